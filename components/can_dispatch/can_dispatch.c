@@ -11,6 +11,8 @@
 
 #include "can_dispatch.h"
 #include "sdkconfig.h"
+#include "esp_timer.h"
+#include <string.h>
 
 #if CONFIG_CAN_BACKEND_MCP2515_MULTI
 #include "mcp25xxx_multi.h"
@@ -29,6 +31,30 @@ const char *can_backend_get_name(void)
 }
 #endif
 
+// ======================================================================================
+// Deadline-aware transmit: shared counters and reporting
+// ======================================================================================
+
+static can_dispatch_tx_stats_t s_tx_stats;
+static can_dispatch_tx_expired_cb_t s_tx_expired_cb = NULL;
+static void *s_tx_expired_cb_arg = NULL;
+
+static void tx_report_expired(uint32_t identifier)
+{
+    s_tx_stats.expired++;
+    if (s_tx_expired_cb) {
+        s_tx_expired_cb(identifier, false, s_tx_expired_cb_arg);
+    }
+}
+
+static void tx_report_aborted(uint32_t identifier)
+{
+    s_tx_stats.aborted++;
+    if (s_tx_expired_cb) {
+        s_tx_expired_cb(identifier, true, s_tx_expired_cb_arg);
+    }
+}
+
 // ======================================================================================
 // Unified TWAI-style API implementation for non-TWAI backends
 // ======================================================================================
@@ -61,12 +87,19 @@ bool can_twai_deinit(void)
 
 bool can_twai_send(const twai_message_t *msg)
 {
-    return mcp2515_single_send(msg);
+    can_frame_t frame;
+    can_frame_from_twai(&frame, msg);
+    return can_dispatch_backend_send_shaped(&frame);
 }
 
 bool can_twai_receive(twai_message_t *msg)
 {
-    return mcp2515_single_receive(msg);
+    can_frame_t frame;
+    if (!can_dispatch_backend_receive(&frame)) {
+        return false;
+    }
+    can_frame_to_twai(&frame, msg);
+    return true;
 }
 
 void can_twai_reset_if_needed(void)
@@ -74,32 +107,115 @@ void can_twai_reset_if_needed(void)
     // MCP25xxx handles reset differently - no-op here
 }
 
+static can_dispatch_tx_result_t backend_send_ex(const can_frame_t *frame, int64_t deadline_us,
+                                                bool replace_pending, bool single_shot)
+{
+    can_dispatch_tx_result_t res = mcp2515_single_send_ex(frame, deadline_us, replace_pending, single_shot);
+    if (res == CAN_DISPATCH_TX_QUEUED || res == CAN_DISPATCH_TX_REPLACED) {
+        CAN_DISPATCH_LOG_TX(frame, 0);
+    }
+    return res;
+}
+
+static uint32_t backend_tx_abort_expired(int64_t now_us)
+{
+    return mcp2515_single_tx_abort_expired(now_us, tx_report_aborted);
+}
+
+static uint32_t backend_tx_not_retransmitted(void)
+{
+    mcp2515_single_tx_stats_t stats;
+    mcp2515_single_get_tx_stats(&stats);
+    return stats.not_retransmitted;
+}
+
+// Single-device backend: every dev_id maps to the one controller
+static size_t backend_dev_count(void)
+{
+    return 1;
+}
+
+static int backend_dev_index(int dev_id)
+{
+    (void)dev_id;
+    return 0;
+}
+
+static int backend_dev_id(size_t index)
+{
+    return (int)index;
+}
+
+static bool backend_dev_send(size_t index, const can_frame_t *frame)
+{
+    (void)index;
+    return can_dispatch_backend_send_shaped(frame);
+}
+
+static bool backend_dev_receive(size_t index, can_frame_t *frame)
+{
+    (void)index;
+    return can_dispatch_backend_receive(frame);
+}
+
 #elif CONFIG_CAN_BACKEND_MCP2515_MULTI
 // --------------------------------------------------------------------------------------
 // MCP25xxx Multi backend: map can_twai_* → canif_multi_*
 // --------------------------------------------------------------------------------------
 
+// Bundle given to can_twai_init(), source of the per-device handles
+static const mcp2515_bundle_config_t *s_multi_bundle = NULL;
+
 bool can_twai_init(const twai_backend_config_t *cfg)
 {
     // Multi backend expects mcp2515_bundle_config_t; in the single-example
     // path, cfg is a twai_backend_config_t-compatible alias pointing to a
     // mcp2515_bundle_config_t instance (see examples/config_twai.h).
-    return canif_multi_init_default((const mcp2515_bundle_config_t *)cfg);
+    const mcp2515_bundle_config_t *bundle = (const mcp2515_bundle_config_t *)cfg;
+#if CONFIG_CAN_DISPATCH_MULTI_SERVICE
+    // The service owns the INT pins; the library polls its controllers
+    if (!canif_multi_init_default(mcp2515_multi_library_bundle(bundle))) {
+        return false;
+    }
+#else
+    if (!canif_multi_init_default(bundle)) {
+        return false;
+    }
+#endif
+    s_multi_bundle = bundle;
+#if CONFIG_CAN_DISPATCH_MULTI_SERVICE
+    if (!mcp2515_multi_service_start(bundle, CONFIG_CAN_DISPATCH_MULTI_SERVICE_PRIORITY)) {
+        canif_multi_deinit_default();
+        return false;
+    }
+#endif
+    return true;
 }
 
 bool can_twai_deinit(void)
 {
+#if CONFIG_CAN_DISPATCH_MULTI_SERVICE
+    mcp2515_multi_service_stop();
+#endif
+    s_multi_bundle = NULL;
     return canif_multi_deinit_default();
 }
 
 bool can_twai_send(const twai_message_t *msg)
 {
-    return canif_multi_send_default(msg);
+    can_frame_t frame;
+    can_frame_from_twai(&frame, msg);
+    return can_dispatch_backend_send_shaped(&frame);
 }
 
 bool can_twai_receive(twai_message_t *msg)
 {
-    return canif_receive_default(msg);
+    can_frame_t frame;
+    if (!can_dispatch_backend_receive(&frame)) {
+        return false;
+    }
+    can_frame_to_twai(&frame, msg);
+    return true;
 }
 
 void can_twai_reset_if_needed(void)
@@ -107,13 +223,415 @@ void can_twai_reset_if_needed(void)
     // MCP25xxx handles reset differently - no-op here
 }
 
+static can_dispatch_tx_result_t backend_send_ex(const can_frame_t *frame, int64_t deadline_us,
+                                                bool replace_pending, bool single_shot)
+{
+    // The multi library owns its TX buffers and retransmission mode:
+    // deadline is checked before queuing only, replace-in-queue and
+    // single-shot are not available.
+    (void)replace_pending;
+    (void)single_shot;
+    if (deadline_us != 0 && esp_timer_get_time() >= deadline_us) {
+        return CAN_DISPATCH_TX_EXPIRED;
+    }
+    return can_dispatch_backend_send(frame) ? CAN_DISPATCH_TX_QUEUED : CAN_DISPATCH_TX_BUSY;
+}
+
+static uint32_t backend_tx_abort_expired(int64_t now_us)
+{
+    (void)now_us;
+    return 0;
+}
+
+static uint32_t backend_tx_not_retransmitted(void)
+{
+    return 0;
+}
+
+static size_t backend_dev_count(void)
+{
+    if (s_multi_bundle == NULL) {
+        return 0;
+    }
+    return s_multi_bundle->device_count < CAN_DISPATCH_MAX_DEVICES ? s_multi_bundle->device_count
+                                                                    : CAN_DISPATCH_MAX_DEVICES;
+}
+
+static int backend_dev_index(int dev_id)
+{
+    for (size_t i = 0; i < backend_dev_count(); i++) {
+        if ((int)s_multi_bundle->devices[i].dev_id == dev_id) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int backend_dev_id(size_t index)
+{
+    return (int)s_multi_bundle->devices[index].dev_id;
+}
+
+static bool backend_dev_send(size_t index, const can_frame_t *frame)
+{
+#if CONFIG_CAN_DISPATCH_SHAPER
+    // The shaper models the default device's bus
+    if (index == 0) {
+        return can_dispatch_backend_send_shaped(frame);
+    }
+#endif
+#if CONFIG_CAN_DISPATCH_MULTI_SERVICE
+    // Bundle index == service device index; locked against the service task
+    if (!mcp2515_multi_send(index, frame)) {
+        return false;
+    }
+#else
+    twai_message_t msg;
+    can_frame_to_twai(frame, &msg);
+    if (!canif_send(s_multi_bundle->devices[index].dev_id, &msg)) {
+        return false;
+    }
+#endif
+    CAN_DISPATCH_LOG_TX(frame, index);
+    return true;
+}
+
+static bool backend_dev_receive(size_t index, can_frame_t *frame)
+{
+#if CONFIG_CAN_DISPATCH_MULTI_SERVICE
+    // Bundle index == service device index
+    if (mcp2515_multi_service_running()) {
+        if (!mcp2515_multi_receive(index, frame)) {
+            return false;
+        }
+        CAN_DISPATCH_LOG_RX(frame, index);
+        return true;
+    }
+#endif
+    twai_message_t msg;
+    while (canif_receive(s_multi_bundle->devices[index].dev_id, &msg)) {
+        can_frame_from_twai(frame, &msg);
+        if (CAN_DISPATCH_RX_ACCEPT(frame)) {
+            CAN_DISPATCH_LOG_RX(frame, index);
+            return true;
+        }
+    }
+    return false;
+}
+
 #elif CONFIG_CAN_BACKEND_TWAI
 // --------------------------------------------------------------------------------------
 // TWAI backend: Native implementation from twai-idf-can component
 // --------------------------------------------------------------------------------------
 // No implementation needed here - functions are provided by twai-idf-can component
-// This block is here for documentation and completeness
+// Only the dispatcher extensions below talk to the ESP-IDF TWAI driver directly.
+
+static can_dispatch_tx_result_t backend_send_ex(const can_frame_t *frame, int64_t deadline_us,
+                                                bool replace_pending, bool single_shot)
+{
+    // The driver TX queue is opaque: replace-in-queue is not possible and
+    // queued frames cannot be aborted selectively. Instead we wait for queue
+    // space at most until the deadline, so a stale frame never enters it.
+    (void)replace_pending;
+    twai_message_t msg;
+    can_frame_to_twai(frame, &msg);
+    if (single_shot || CONFIG_CAN_DISPATCH_TWAI_ONE_SHOT) {
+        msg.ss = 1;
+    }
+    TickType_t ticks = 0;
+    if (deadline_us != 0) {
+        int64_t remaining_us = deadline_us - esp_timer_get_time();
+        if (remaining_us <= 0) {
+            return CAN_DISPATCH_TX_EXPIRED;
+        }
+        ticks = pdMS_TO_TICKS(remaining_us / 1000);
+    }
+    esp_err_t err = twai_transmit(&msg, ticks);
+    if (err == ESP_OK) {
+        CAN_DISPATCH_LOG_TX(frame, 0);
+        return CAN_DISPATCH_TX_QUEUED;
+    }
+    if (err == ESP_ERR_TIMEOUT) {
+        if (deadline_us != 0 && esp_timer_get_time() >= deadline_us) {
+            return CAN_DISPATCH_TX_EXPIRED;
+        }
+        return CAN_DISPATCH_TX_BUSY;
+    }
+    return CAN_DISPATCH_TX_ERROR;
+}
+
+static uint32_t backend_tx_abort_expired(int64_t now_us)
+{
+    (void)now_us;
+    return 0;
+}
+
+static uint32_t backend_tx_not_retransmitted(void)
+{
+    // The driver only counts failed transmissions, without telling which
+    // frame failed. With CONFIG_CAN_DISPATCH_TWAI_ONE_SHOT every dispatcher
+    // frame is single-shot and other frames fail only at bus-off, so the
+    // count is meaningful; per-frame single-shot cannot be told apart.
+    if (!CONFIG_CAN_DISPATCH_TWAI_ONE_SHOT) {
+        return 0;
+    }
+    twai_status_info_t info;
+    if (twai_get_status_info(&info) != ESP_OK) {
+        return 0;
+    }
+    return info.tx_failed_count;
+}
+
+// Single-device backend: every dev_id maps to the one controller
+static size_t backend_dev_count(void)
+{
+    return 1;
+}
+
+static int backend_dev_index(int dev_id)
+{
+    (void)dev_id;
+    return 0;
+}
+
+static int backend_dev_id(size_t index)
+{
+    return (int)index;
+}
+
+static bool backend_dev_send(size_t index, const can_frame_t *frame)
+{
+    (void)index;
+    return can_dispatch_backend_send_shaped(frame);
+}
+
+static bool backend_dev_receive(size_t index, can_frame_t *frame)
+{
+    (void)index;
+    return can_dispatch_backend_receive(frame);
+}
 
 #else
 #error "Unknown CAN backend configuration"
 #endif
+
+// ======================================================================================
+// Native frame API (all backends)
+// ======================================================================================
+
+#if !CONFIG_CAN_DISPATCH_INLINE
+bool can_dispatch_send(const can_frame_t *frame)
+{
+    return can_dispatch_backend_send_shaped(frame);
+}
+
+bool can_dispatch_receive(can_frame_t *frame)
+{
+    return can_dispatch_backend_receive(frame);
+}
+#endif
+
+size_t can_dispatch_send_batch(const can_frame_t *frames, size_t count)
+{
+    size_t sent = 0;
+    while (sent < count && can_dispatch_backend_send_shaped(&frames[sent])) {
+        sent++;
+    }
+    return sent;
+}
+
+size_t can_dispatch_receive_batch(can_frame_t *frames, size_t max_count)
+{
+    size_t received = 0;
+    while (received < max_count && can_dispatch_backend_receive(&frames[received])) {
+        received++;
+    }
+    return received;
+}
+
+// ======================================================================================
+// Per-device handles (all backends)
+// ======================================================================================
+
+struct can_dispatch_dev {
+    size_t index;           // backend device index, fixed at open
+    int dev_id;
+    bool open;              // cleared by can_dispatch_close(), calls are rejected
+    can_dispatch_dev_stats_t stats;
+};
+
+static struct can_dispatch_dev s_dev_handles[CAN_DISPATCH_MAX_DEVICES];
+static size_t s_any_next = 0;   // next device index tried by can_dispatch_receive_any()
+
+can_dispatch_handle_t can_dispatch_open(int dev_id)
+{
+    int index = backend_dev_index(dev_id);
+    if (index < 0 || (size_t)index >= backend_dev_count()) {
+        return NULL;
+    }
+    struct can_dispatch_dev *dev = &s_dev_handles[index];
+    if (!dev->open) {
+        memset(dev, 0, sizeof(*dev));
+        dev->index = (size_t)index;
+        dev->dev_id = backend_dev_id((size_t)index);
+        dev->open = true;
+    }
+    return dev;
+}
+
+void can_dispatch_close(can_dispatch_handle_t handle)
+{
+    if (handle) {
+        handle->open = false;
+    }
+}
+
+static inline bool handle_open(can_dispatch_handle_t handle)
+{
+    return handle && handle->open;
+}
+
+int can_dispatch_dev_id(can_dispatch_handle_t handle)
+{
+    return handle_open(handle) ? handle->dev_id : -1;
+}
+
+bool can_dispatch_dev_send(can_dispatch_handle_t handle, const can_frame_t *frame)
+{
+    if (!handle_open(handle)) {
+        return false;
+    }
+    if (backend_dev_send(handle->index, frame)) {
+        handle->stats.tx_frames++;
+        return true;
+    }
+    handle->stats.tx_failed++;
+    return false;
+}
+
+bool can_dispatch_dev_receive(can_dispatch_handle_t handle, can_frame_t *frame)
+{
+    if (!handle_open(handle) || !backend_dev_receive(handle->index, frame)) {
+        return false;
+    }
+    handle->stats.rx_frames++;
+    return true;
+}
+
+size_t can_dispatch_dev_send_batch(can_dispatch_handle_t handle, const can_frame_t *frames, size_t count)
+{
+    size_t sent = 0;
+    while (sent < count && can_dispatch_dev_send(handle, &frames[sent])) {
+        sent++;
+    }
+    return sent;
+}
+
+size_t can_dispatch_dev_receive_batch(can_dispatch_handle_t handle, can_frame_t *frames, size_t max_count)
+{
+    size_t received = 0;
+    while (received < max_count && can_dispatch_dev_receive(handle, &frames[received])) {
+        received++;
+    }
+    return received;
+}
+
+bool can_dispatch_receive_any(can_frame_t *frame, can_dispatch_handle_t *source)
+{
+    size_t count = backend_dev_count();
+    for (size_t k = 0; k < count; k++) {
+        size_t i = (s_any_next + k) % count;
+        struct can_dispatch_dev *dev = &s_dev_handles[i];
+        if (dev->open && can_dispatch_dev_receive(dev, frame)) {
+            s_any_next = (i + 1) % count;
+            if (source) {
+                *source = dev;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void can_dispatch_dev_get_stats(can_dispatch_handle_t handle, can_dispatch_dev_stats_t *stats)
+{
+    if (stats) {
+        if (handle_open(handle)) {
+            *stats = handle->stats;
+        } else {
+            memset(stats, 0, sizeof(*stats));
+        }
+    }
+}
+
+// ======================================================================================
+// Deadline-aware transmit: public API (all backends)
+// ======================================================================================
+
+can_dispatch_tx_result_t can_dispatch_send_ex(const can_frame_t *frame, const can_dispatch_tx_opts_t *opts)
+{
+    int64_t deadline_us = opts ? opts->deadline_us : 0;
+    bool replace_pending = opts ? opts->replace_pending : false;
+    bool single_shot = opts ? opts->single_shot : false;
+
+    if (deadline_us != 0) {
+        can_dispatch_tx_abort_expired();
+    }
+#if CONFIG_CAN_DISPATCH_SHAPER
+    // Shaped frames are refused rather than queued: the caller owns the
+    // retry policy and the deadline
+    if (!can_shaper_admit(frame)) {
+        return CAN_DISPATCH_TX_BUSY;
+    }
+#endif
+    can_dispatch_tx_result_t res = backend_send_ex(frame, deadline_us, replace_pending, single_shot);
+#if CONFIG_CAN_DISPATCH_SHAPER
+    if (res != CAN_DISPATCH_TX_QUEUED && res != CAN_DISPATCH_TX_REPLACED) {
+        can_shaper_refund(frame);
+    }
+#endif
+    if (res == CAN_DISPATCH_TX_EXPIRED) {
+        tx_report_expired(frame->id);
+    } else if (res == CAN_DISPATCH_TX_REPLACED) {
+        s_tx_stats.replaced++;
+    }
+    return res;
+}
+
+uint32_t can_dispatch_tx_abort_expired(void)
+{
+    return backend_tx_abort_expired(esp_timer_get_time());
+}
+
+void can_dispatch_set_tx_expired_cb(can_dispatch_tx_expired_cb_t cb, void *arg)
+{
+    s_tx_expired_cb = cb;
+    s_tx_expired_cb_arg = arg;
+}
+
+void can_dispatch_get_tx_stats(can_dispatch_tx_stats_t *stats)
+{
+    if (stats) {
+        *stats = s_tx_stats;
+        stats->not_retransmitted = backend_tx_not_retransmitted();
+    }
+}
+
+#if CONFIG_CAN_DISPATCH_FILTER
+// ======================================================================================
+// RX acceptance filter (all backends)
+// ======================================================================================
+
+bool can_dispatch_set_rx_filter(const can_filter_rule_t *rules, size_t count)
+{
+#if CONFIG_CAN_BACKEND_MCP2515_SINGLE
+    // Hardware pre-filter first: it is always a superset of the rules, so no
+    // wanted frame is lost while the software table is swapped afterwards
+    can_filter_hw_plan_t plan;
+    if (!can_filter_plan_hw(rules, count, &plan) || !mcp2515_single_set_hw_filter(&plan)) {
+        return false;
+    }
+#endif
+    return can_filter_set_rules(rules, count);
+}
+#endif
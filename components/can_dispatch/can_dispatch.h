@@ -9,6 +9,8 @@
  * Architecture:
  * - Single examples use can_twai_* API (this file provides declarations)
  * - Multi examples use canif_* API from mcp25xxx_multi.h directly
+ * - Per-device handles (can_dispatch_open) address every device of a
+ *   multi bundle through the dispatcher
  * - Backend selection via Kconfig (CONFIG_CAN_BACKEND_*)
  * - Examples include their own headers (can_twai.h, config_can.h, etc.)
  * 
@@ -22,8 +24,11 @@
 #pragma once
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "driver/twai.h"
 #include "sdkconfig.h"
+#include "can_dispatch_frame.h"
+#include "can_dispatch_inline.h"
 
 // Include can_twai_config.h for type definition
 // (needed for function declarations even in non-TWAI backends)
@@ -87,6 +92,222 @@ void can_twai_reset_if_needed(void);
 
 #endif // !CONFIG_CAN_BACKEND_TWAI
 
+// ======================================================================================
+// Native frame API (all backends)
+// ======================================================================================
+#if CONFIG_CAN_DISPATCH_INLINE
+// Specialised for the selected backend, see can_dispatch_inline.h
+static inline bool can_dispatch_send(const can_frame_t *frame)
+{
+    return can_dispatch_backend_send_shaped(frame);
+}
+
+static inline bool can_dispatch_receive(can_frame_t *frame)
+{
+    return can_dispatch_backend_receive(frame);
+}
+#else
+/**
+ * @brief Send CAN frame (non-blocking)
+ * @param frame Frame to send
+ * @return true if the frame was queued, false otherwise
+ */
+bool can_dispatch_send(const can_frame_t *frame);
+
+/**
+ * @brief Receive CAN frame (non-blocking)
+ * @param frame Frame to fill
+ * @return true if a frame was received, false if none available
+ */
+bool can_dispatch_receive(can_frame_t *frame);
+#endif
+
+/**
+ * @brief Send several frames in order, stopping at the first that cannot be queued
+ * @param frames Array of frames
+ * @param count Number of frames in the array
+ * @return Number of frames queued
+ */
+size_t can_dispatch_send_batch(const can_frame_t *frames, size_t count);
+
+/**
+ * @brief Receive all currently available frames, up to max_count
+ * @param frames Output array
+ * @param max_count Capacity of the output array
+ * @return Number of frames received
+ */
+size_t can_dispatch_receive_batch(can_frame_t *frames, size_t max_count);
+
+// ======================================================================================
+// Per-device handles (all backends)
+// ======================================================================================
+/**
+ * @brief Devices addressable through handles
+ *
+ * The MCP25xxx multi backend exposes every device of the bundle passed to
+ * can_twai_init(). Single-device backends (TWAI, MCP2515 single) expose one
+ * device, opened by any dev_id.
+ */
+#define CAN_DISPATCH_MAX_DEVICES 8
+
+/**
+ * @brief Opaque device handle, resolved once by can_dispatch_open()
+ */
+typedef struct can_dispatch_dev *can_dispatch_handle_t;
+
+/**
+ * @brief Per-device frame counters
+ */
+typedef struct {
+    uint32_t tx_frames;     ///< Frames accepted by the device
+    uint32_t tx_failed;     ///< Send calls the device did not accept
+    uint32_t rx_frames;     ///< Frames received from the device
+} can_dispatch_dev_stats_t;
+
+/**
+ * @brief Open a device by its bundle dev_id
+ * @param dev_id Device identifier (mcp2515_device_config_t.dev_id for the multi backend)
+ * @return Handle, or NULL if the device does not exist or the backend is not initialized
+ */
+can_dispatch_handle_t can_dispatch_open(int dev_id);
+
+/**
+ * @brief Close a handle; its device is no longer polled by can_dispatch_receive_any()
+ *
+ * Later calls with the closed handle are rejected (send/receive return false,
+ * can_dispatch_dev_id() returns -1, counters read as zero) until the device
+ * is opened again, which returns the same handle with fresh counters.
+ *
+ * @param handle Handle from can_dispatch_open()
+ */
+void can_dispatch_close(can_dispatch_handle_t handle);
+
+/**
+ * @brief Device identifier of a handle
+ * @return dev_id, or -1 if the handle is closed
+ */
+int can_dispatch_dev_id(can_dispatch_handle_t handle);
+
+/**
+ * @brief Send CAN frame through one device (non-blocking)
+ * @param handle Device handle
+ * @param frame Frame to send
+ * @return true if the frame was queued, false otherwise
+ */
+bool can_dispatch_dev_send(can_dispatch_handle_t handle, const can_frame_t *frame);
+
+/**
+ * @brief Receive CAN frame from one device (non-blocking)
+ * @param handle Device handle
+ * @param frame Frame to fill
+ * @return true if a frame was received, false if none available
+ */
+bool can_dispatch_dev_receive(can_dispatch_handle_t handle, can_frame_t *frame);
+
+/**
+ * @brief Send several frames through one device, stopping at the first that cannot be queued
+ * @return Number of frames queued
+ */
+size_t can_dispatch_dev_send_batch(can_dispatch_handle_t handle, const can_frame_t *frames, size_t count);
+
+/**
+ * @brief Receive available frames from one device, up to max_count
+ * @return Number of frames received
+ */
+size_t can_dispatch_dev_receive_batch(can_dispatch_handle_t handle, can_frame_t *frames, size_t max_count);
+
+/**
+ * @brief Receive a frame from any open device, round-robin across devices
+ * @param frame Frame to fill
+ * @param source Set to the handle of the device the frame came from (may be NULL)
+ * @return true if a frame was received, false if none available
+ */
+bool can_dispatch_receive_any(can_frame_t *frame, can_dispatch_handle_t *source);
+
+/**
+ * @brief Read per-device counters
+ * @param handle Device handle
+ * @param stats Output structure
+ */
+void can_dispatch_dev_get_stats(can_dispatch_handle_t handle, can_dispatch_dev_stats_t *stats);
+
+// ======================================================================================
+// Deadline-aware transmit (all backends)
+// ======================================================================================
+/**
+ * @brief Counters of frames that were not sent as requested
+ */
+typedef struct {
+    uint32_t expired;       ///< Dropped before reaching the controller (deadline already passed)
+    uint32_t aborted;       ///< Aborted inside the controller after losing arbitration past the deadline
+    uint32_t replaced;      ///< Pending frames overwritten by a newer payload
+    uint32_t not_retransmitted; ///< Single-shot frames that failed and were not retried
+                                ///< (TWAI: only with CONFIG_CAN_DISPATCH_TWAI_ONE_SHOT, 0 otherwise)
+} can_dispatch_tx_stats_t;
+
+/**
+ * @brief Callback reporting a frame that missed its deadline
+ * @param identifier CAN identifier of the stale frame
+ * @param aborted true if aborted inside the controller, false if dropped before queuing
+ * @param arg User argument given to can_dispatch_set_tx_expired_cb()
+ */
+typedef void (*can_dispatch_tx_expired_cb_t)(uint32_t identifier, bool aborted, void *arg);
+
+/**
+ * @brief Send CAN message with optional deadline, replace-in-queue and single-shot
+ *
+ * Frames whose deadline has already passed are dropped. Frames still waiting
+ * for arbitration when their deadline passes are aborted by
+ * can_dispatch_tx_abort_expired() (also run before every send with a deadline).
+ *
+ * Single-shot frames (opts->single_shot or CAN_FRAME_FLAG_SINGLE_SHOT) get one
+ * transmission attempt. On MCP2515 the mode is global (CANCTRL.OSM), so a single-shot
+ * frame returns CAN_DISPATCH_TX_BUSY while frames queued in the other mode
+ * are still pending.
+ *
+ * @param frame Frame to send
+ * @param opts Transmit options, NULL behaves like can_dispatch_send()
+ * @return Result of the request
+ */
+can_dispatch_tx_result_t can_dispatch_send_ex(const can_frame_t *frame, const can_dispatch_tx_opts_t *opts);
+
+/**
+ * @brief Abort pending frames whose deadline has passed
+ * @return Number of frames aborted in this call
+ */
+uint32_t can_dispatch_tx_abort_expired(void);
+
+/**
+ * @brief Register callback invoked for every expired or aborted frame
+ * @param cb Callback, NULL to disable
+ * @param arg User argument passed to callback
+ */
+void can_dispatch_set_tx_expired_cb(can_dispatch_tx_expired_cb_t cb, void *arg);
+
+/**
+ * @brief Read deadline/replace/single-shot counters
+ * @param stats Output structure
+ */
+void can_dispatch_get_tx_stats(can_dispatch_tx_stats_t *stats);
+
+#if CONFIG_CAN_DISPATCH_FILTER
+// ======================================================================================
+// RX acceptance filter
+// ======================================================================================
+/**
+ * @brief Accept only frames matching the rules (see can_dispatch_filter.h)
+ *
+ * Installs the software filter in the backend RX path. On the MCP2515 single
+ * backend the best hardware pre-filter for the rules is programmed as well.
+ * Other backends keep their hardware filter configuration.
+ *
+ * @param rules Rules (NULL / count 0 = accept all)
+ * @param count Number of rules
+ * @return false if the rules exceed the filter limits or the hardware update failed
+ */
+bool can_dispatch_set_rx_filter(const can_filter_rule_t *rules, size_t count);
+#endif
+
 // ======================================================================================
 // Type casting note for MCP backends
 // ======================================================================================
@@ -101,6 +322,9 @@ void can_twai_reset_if_needed(void);
  * because this is a component header and cannot access examples/ directory.
  * 
  * Type conversion happens in can_dispatch.c implementation during init calls.
+ *
+ * Frame data: the can_twai_* functions are the only place where twai_message_t
+ * is converted to/from can_frame_t (inline converters in can_dispatch_frame.h).
  */
 
 #ifdef __cplusplus
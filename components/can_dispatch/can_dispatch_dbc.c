@@ -0,0 +1,110 @@
+/**
+ * @file can_dispatch_dbc.c
+ * @brief Table-driven DBC signal decoder implementation
+ *
+ * Plain C without ESP-IDF dependencies, so the same file is used by the host
+ * benchmark of py/dbc/dbc_codegen.py.
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#include "can_dispatch_dbc.h"
+#include <string.h>
+
+static inline uint64_t load_le64(const uint8_t *d)
+{
+    uint64_t w;
+    memcpy(&w, d, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+void can_dbc_reset(can_dbc_db_t *db)
+{
+    memset(db->value, 0, db->signal_count * sizeof(db->value[0]));
+    memset(db->raw, 0, db->signal_count * sizeof(db->raw[0]));
+    memset(db->changed, 0, ((db->signal_count + 31) / 32) * sizeof(db->changed[0]));
+    memset(db->last_payload, 0, db->message_count * sizeof(db->last_payload[0]));
+    memset(db->seen, 0, ((db->message_count + 31) / 32) * sizeof(db->seen[0]));
+}
+
+void can_dbc_clear_changed(can_dbc_db_t *db)
+{
+    memset(db->changed, 0, ((db->signal_count + 31) / 32) * sizeof(db->changed[0]));
+}
+
+int can_dbc_find(const can_dbc_db_t *db, const can_frame_t *frame)
+{
+    uint32_t key = frame->id | (can_frame_is_extd(frame) ? CAN_DBC_ID_EXTD : 0);
+    size_t lo = 0;
+    size_t hi = db->message_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        uint32_t k = db->messages[mid].key;
+        if (k == key) {
+            return (int)mid;
+        }
+        if (k < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+size_t can_dbc_decode(can_dbc_db_t *db, const can_frame_t *frame)
+{
+    int index = can_dbc_find(db, frame);
+    if (index < 0 || (frame->flags & CAN_FRAME_FLAG_RTR)) {
+        return 0;
+    }
+
+    // Bytes beyond DLC are not part of the payload
+    uint8_t data[CAN_FRAME_MAX_DLC] = {0};
+    memcpy(data, frame->data, frame->dlc <= CAN_FRAME_MAX_DLC ? frame->dlc : CAN_FRAME_MAX_DLC);
+    uint64_t le = load_le64(data);
+
+    uint32_t seen_bit = 1UL << (index & 31);
+    uint64_t diff_le;
+    if (db->seen[index >> 5] & seen_bit) {
+        diff_le = le ^ db->last_payload[index];
+        if (diff_le == 0) {
+            return 0;
+        }
+    } else {
+        db->seen[index >> 5] |= seen_bit;
+        diff_le = ~0ULL;    // first frame: every signal counts as changed
+    }
+    db->last_payload[index] = le;
+
+    uint64_t be = __builtin_bswap64(le);
+    uint64_t diff_be = __builtin_bswap64(diff_le);
+    const can_dbc_message_t *msg = &db->messages[index];
+    size_t changed = 0;
+
+    for (uint16_t s = msg->first_signal; s < msg->first_signal + msg->signal_count; s++) {
+        const can_dbc_signal_t *sig = &db->signals[s];
+        bool big = sig->flags & CAN_DBC_SIG_BIG_ENDIAN;
+        if (((big ? diff_be : diff_le) & sig->mask) == 0) {
+            continue;
+        }
+        uint64_t field = ((big ? be : le) & sig->mask) >> sig->shift;
+        int64_t raw = (int64_t)field;
+        if ((sig->flags & CAN_DBC_SIG_SIGNED) && sig->length < 64 && (field >> (sig->length - 1)) & 1) {
+            raw = (int64_t)(field | (~0ULL << sig->length));
+        }
+        float value = (float)raw * sig->factor + sig->offset;
+        db->raw[s] = raw;
+        db->value[s] = value;
+        db->changed[s >> 5] |= 1UL << (s & 31);
+        changed++;
+        if (db->on_change) {
+            db->on_change(db, s, value, db->on_change_arg);
+        }
+    }
+    return changed;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file can_dispatch_dbc.h
+ * @brief Table-driven DBC signal decoder
+ *
+ * Decode tables are generated on the host from a DBC file by
+ * py/dbc/dbc_codegen.py. Each signal is reduced to a bit-field of a 64-bit
+ * payload word (little-endian word for Intel, big-endian word for Motorola
+ * signals), a pre-shifted mask, sign flag and scale/offset.
+ *
+ * can_dbc_decode() compares the payload with the previous one of the same
+ * message and only decodes signals whose bits changed. Decoded values go to a
+ * struct-of-arrays store (value[], raw[], changed bitmap) indexed by the
+ * generated signal index; an optional callback reports every change.
+ *
+ * Multiplexed signals are not supported by the generator.
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "can_dispatch_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAN_DBC_SIG_BIG_ENDIAN  0x01    ///< Motorola byte order
+#define CAN_DBC_SIG_SIGNED      0x02    ///< Two's complement raw value
+
+#define CAN_DBC_ID_EXTD         0x80000000UL    ///< Set in can_dbc_message_t.key for 29-bit IDs
+
+/**
+ * @brief Decode plan of one signal
+ */
+typedef struct {
+    uint64_t mask;          ///< Field mask within the payload word (already shifted)
+    float factor;           ///< Physical = raw * factor + offset
+    float offset;
+    uint8_t shift;          ///< Position of the field LSB within the payload word
+    uint8_t length;         ///< Field length in bits
+    uint8_t flags;          ///< CAN_DBC_SIG_*
+} can_dbc_signal_t;
+
+/**
+ * @brief Message entry; signals of a message are contiguous in the signal table
+ */
+typedef struct {
+    uint32_t key;           ///< Identifier | CAN_DBC_ID_EXTD for extended frames
+    uint16_t first_signal;  ///< Index of the first signal
+    uint16_t signal_count;  ///< Number of signals
+} can_dbc_message_t;
+
+typedef struct can_dbc_db can_dbc_db_t;
+
+/**
+ * @brief Change notification
+ * @param db Database
+ * @param signal Signal index (generated <MSG>_<SIGNAL> constant)
+ * @param value New physical value
+ * @param arg User argument
+ */
+typedef void (*can_dbc_change_cb_t)(const can_dbc_db_t *db, uint16_t signal, float value, void *arg);
+
+/**
+ * @brief Decoder tables plus signal store (instantiated by generated code)
+ */
+struct can_dbc_db {
+    const can_dbc_message_t *messages;  ///< Sorted by key
+    size_t message_count;
+    const can_dbc_signal_t *signals;
+    size_t signal_count;
+
+    float *value;               ///< [signal_count] physical values
+    int64_t *raw;               ///< [signal_count] raw values (sign extended)
+    uint32_t *changed;          ///< [(signal_count + 31) / 32] changed since last can_dbc_clear_changed()
+    uint64_t *last_payload;     ///< [message_count] last payload, little-endian word
+    uint32_t *seen;             ///< [(message_count + 31) / 32] message received at least once
+
+    can_dbc_change_cb_t on_change;  ///< Optional change callback
+    void *on_change_arg;
+};
+
+/**
+ * @brief Forget previous payloads and clear the store
+ */
+void can_dbc_reset(can_dbc_db_t *db);
+
+/**
+ * @brief Find the message entry of a frame (binary search)
+ * @return Message index, or -1 if the frame is not in the database
+ */
+int can_dbc_find(const can_dbc_db_t *db, const can_frame_t *frame);
+
+/**
+ * @brief Decode signals of a frame that changed since the previous frame
+ * @param db Database
+ * @param frame Received frame
+ * @return Number of changed signals (0 also for unknown frames)
+ */
+size_t can_dbc_decode(can_dbc_db_t *db, const can_frame_t *frame);
+
+/**
+ * @brief Check and clear the changed flag of a signal
+ */
+static inline bool can_dbc_take_changed(can_dbc_db_t *db, uint16_t signal)
+{
+    uint32_t bit = 1UL << (signal & 31);
+    uint32_t *word = &db->changed[signal >> 5];
+    bool changed = (*word & bit) != 0;
+    *word &= ~bit;
+    return changed;
+}
+
+/**
+ * @brief Clear all changed flags
+ */
+void can_dbc_clear_changed(can_dbc_db_t *db);
+
+#ifdef __cplusplus
+}
+#endif
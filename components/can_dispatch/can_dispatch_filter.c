@@ -0,0 +1,410 @@
+/**
+ * @file can_dispatch_filter.c
+ * @brief Software acceptance filter and MCP2515 hardware pre-filter planner
+ *
+ * Plain C without ESP-IDF dependencies, so the same file is used by the host
+ * benchmark in py/host_bench/filter_bench.py.
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#include "can_dispatch_filter.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOOM_BITS      4096
+#define BLOOM_SHIFT     20      // 32 - log2(BLOOM_BITS)
+#define HW_FILTERS      6
+#define HW_RXB0_FILTERS 2
+#define HW_RXB1_FILTERS 4
+#define STD_SHIFT       18      // standard ID position in the 29-bit register layout
+
+// ======================================================================================
+// Compiled rule table
+// ======================================================================================
+typedef struct {
+    uint32_t std_bitmap[2048 / 32];
+    uint32_t ext_bloom[BLOOM_BITS / 32];
+    uint32_t ext_ids[CONFIG_CAN_DISPATCH_FILTER_MAX_IDS];   // sorted
+    can_filter_rule_t masked[CONFIG_CAN_DISPATCH_FILTER_MAX_MASKED];
+    uint16_t ext_count;
+    uint8_t masked_count;
+} filter_table_t;
+
+// Two tables: rules are compiled into the inactive one and then published.
+// A reader may still be matching against the inactive table when the next
+// update starts rewriting it; the update bumps s_generation first and the
+// reader retries if the generation moved during its match (seqlock style,
+// so the writer never waits for readers).
+static filter_table_t s_tables[2];
+static const filter_table_t *volatile s_active = NULL;  // NULL = accept all
+static uint32_t s_generation;
+static can_filter_stats_t s_stats;
+
+static inline uint32_t bloom_hash1(uint32_t id)
+{
+    return (uint32_t)(id * 0x9E3779B1U) >> BLOOM_SHIFT;
+}
+
+static inline uint32_t bloom_hash2(uint32_t id)
+{
+    return (uint32_t)(id * 0x85EBCA77U) >> BLOOM_SHIFT;
+}
+
+static inline bool bit_test(const uint32_t *bits, uint32_t n)
+{
+    return (bits[n >> 5] >> (n & 31)) & 1;
+}
+
+static inline void bit_set(uint32_t *bits, uint32_t n)
+{
+    bits[n >> 5] |= 1UL << (n & 31);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static bool ext_search(const filter_table_t *t, uint32_t id)
+{
+    size_t lo = 0;
+    size_t hi = t->ext_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (t->ext_ids[mid] == id) {
+            return true;
+        }
+        if (t->ext_ids[mid] < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+static bool table_match(const filter_table_t *t, const can_frame_t *frame)
+{
+    bool extd = can_frame_is_extd(frame);
+    uint32_t id;
+    if (extd) {
+        id = frame->id & CAN_FRAME_EXT_ID_MASK;
+        if (bit_test(t->ext_bloom, bloom_hash1(id)) && bit_test(t->ext_bloom, bloom_hash2(id))) {
+            if (ext_search(t, id)) {
+                return true;
+            }
+            s_stats.bloom_false_positives++;
+        }
+    } else {
+        id = frame->id & CAN_FRAME_STD_ID_MASK;
+        if (bit_test(t->std_bitmap, id)) {
+            return true;
+        }
+    }
+    for (uint8_t i = 0; i < t->masked_count; i++) {
+        const can_filter_rule_t *r = &t->masked[i];
+        if (r->extd == extd && (id & r->mask) == r->id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool can_filter_set_rules(const can_filter_rule_t *rules, size_t count)
+{
+    if (rules == NULL || count == 0) {
+        __atomic_store_n(&s_active, NULL, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    filter_table_t *t = (s_active == &s_tables[0]) ? &s_tables[1] : &s_tables[0];
+    __atomic_fetch_add(&s_generation, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    memset(t, 0, sizeof(*t));
+    for (size_t i = 0; i < count; i++) {
+        uint32_t type_mask = rules[i].extd ? CAN_FRAME_EXT_ID_MASK : CAN_FRAME_STD_ID_MASK;
+        uint32_t mask = rules[i].mask & type_mask;
+        uint32_t id = rules[i].id & mask;
+        if (mask != type_mask) {
+            if (t->masked_count == CONFIG_CAN_DISPATCH_FILTER_MAX_MASKED) {
+                return false;
+            }
+            t->masked[t->masked_count++] = (can_filter_rule_t){ .id = id, .mask = mask, .extd = rules[i].extd };
+        } else if (!rules[i].extd) {
+            bit_set(t->std_bitmap, id);
+        } else {
+            if (t->ext_count == CONFIG_CAN_DISPATCH_FILTER_MAX_IDS) {
+                return false;
+            }
+            t->ext_ids[t->ext_count++] = id;
+        }
+    }
+
+    qsort(t->ext_ids, t->ext_count, sizeof(t->ext_ids[0]), cmp_u32);
+    uint16_t unique = 0;
+    for (uint16_t i = 0; i < t->ext_count; i++) {
+        uint32_t id = t->ext_ids[i];
+        if (unique == 0 || t->ext_ids[unique - 1] != id) {
+            t->ext_ids[unique++] = id;
+            bit_set(t->ext_bloom, bloom_hash1(id));
+            bit_set(t->ext_bloom, bloom_hash2(id));
+        }
+    }
+    t->ext_count = unique;
+
+    __atomic_store_n(&s_active, t, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool can_filter_accept(const can_frame_t *frame)
+{
+    bool match;
+    uint32_t generation;
+    do {
+        generation = __atomic_load_n(&s_generation, __ATOMIC_ACQUIRE);
+        const filter_table_t *t = __atomic_load_n(&s_active, __ATOMIC_ACQUIRE);
+        if (t == NULL) {
+            return true;
+        }
+        // Indices stay within the arrays even on a table being rewritten;
+        // such a result is discarded below
+        match = table_match(t, frame);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&s_generation, __ATOMIC_RELAXED) != generation);
+    if (match) {
+        s_stats.accepted++;
+        return true;
+    }
+    s_stats.rejected++;
+    return false;
+}
+
+void can_filter_get_stats(can_filter_stats_t *stats, bool reset)
+{
+    if (stats) {
+        *stats = s_stats;
+    }
+    if (reset) {
+        memset(&s_stats, 0, sizeof(s_stats));
+    }
+}
+
+// ======================================================================================
+// MCP2515 hardware pre-filter planner
+// ======================================================================================
+// A cube is a (value, care) pair in the 29-bit register layout; it accepts
+// 2^(id bits - care bits) identifiers of its frame type. Standard and
+// extended rules are merged separately (a filter matches one frame type), then
+// every mix of k standard + (6 - k) extended cubes is split between the masks.
+typedef struct {
+    uint32_t value;
+    uint32_t care;
+    bool extd;
+} hw_cube_t;
+
+static hw_cube_t s_cubes[CONFIG_CAN_DISPATCH_FILTER_MAX_IDS + CONFIG_CAN_DISPATCH_FILTER_MAX_MASKED];
+static hw_cube_t s_snap[2][HW_FILTERS][HW_FILTERS];    // [extd][k - 1]: greedy result with k cubes
+
+static uint64_t cube_cost(uint32_t care, bool extd)
+{
+    if (extd) {
+        return 1ULL << (29 - __builtin_popcount(care & CAN_FRAME_EXT_ID_MASK));
+    }
+    return 1ULL << (11 - __builtin_popcount((care >> STD_SHIFT) & CAN_FRAME_STD_ID_MASK));
+}
+
+static inline uint32_t merged_care(const hw_cube_t *a, const hw_cube_t *b)
+{
+    return a->care & b->care & ~(a->value ^ b->value);
+}
+
+// Merge the pair of (same-type) cubes that grows the accepted space least
+static void cubes_merge_best(hw_cube_t *cubes, size_t *count)
+{
+    size_t best_i = 0;
+    size_t best_j = 1;
+    int64_t best_growth = INT64_MAX;
+    bool extd = cubes[0].extd;
+    for (size_t i = 0; i < *count; i++) {
+        for (size_t j = i + 1; j < *count; j++) {
+            int64_t growth = (int64_t)cube_cost(merged_care(&cubes[i], &cubes[j]), extd)
+                             - (int64_t)cube_cost(cubes[i].care, extd)
+                             - (int64_t)cube_cost(cubes[j].care, extd);
+            if (growth < best_growth) {
+                best_growth = growth;
+                best_i = i;
+                best_j = j;
+            }
+        }
+    }
+    hw_cube_t *a = &cubes[best_i];
+    a->care = merged_care(a, &cubes[best_j]);
+    a->value &= a->care;
+    cubes[best_j] = cubes[--(*count)];
+}
+
+// Merge cubes of one type down to a single one, keeping every result of
+// HW_FILTERS or fewer cubes; returns the largest kept size
+static size_t cubes_reduce(hw_cube_t *cubes, size_t count, hw_cube_t snap[HW_FILTERS][HW_FILTERS])
+{
+    size_t n = count;
+    while (n > 0) {
+        if (n <= HW_FILTERS) {
+            memcpy(snap[n - 1], cubes, n * sizeof(cubes[0]));
+        }
+        if (n == 1) {
+            break;
+        }
+        cubes_merge_best(cubes, &n);
+    }
+    return count < HW_FILTERS ? count : HW_FILTERS;
+}
+
+// Shared mask of a group of cubes and the space it accepts
+static uint64_t group_cost(const hw_cube_t *set, uint32_t members, size_t count, uint32_t *mask)
+{
+    uint32_t m = CAN_FRAME_EXT_ID_MASK;
+    for (size_t i = 0; i < count; i++) {
+        if (members & (1UL << i)) {
+            m &= set[i].care;
+        }
+    }
+    // Filters that coincide under the shared mask are counted once
+    uint64_t cost = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!(members & (1UL << i))) {
+            continue;
+        }
+        bool duplicate = false;
+        for (size_t k = 0; k < i && !duplicate; k++) {
+            duplicate = (members & (1UL << k)) && set[k].extd == set[i].extd
+                        && ((set[k].value ^ set[i].value) & m) == 0;
+        }
+        if (!duplicate) {
+            cost += cube_cost(m, set[i].extd);
+        }
+    }
+    *mask = m;
+    return cost;
+}
+
+// Best split of up to six cubes into RXB0 (2 filters) and RXB1 (4 filters);
+// an empty RXB1 repeats the RXB0 setup
+static uint64_t best_split(const hw_cube_t *set, size_t count, uint32_t *best_rxb0)
+{
+    uint64_t best_cost = UINT64_MAX;
+    uint32_t all = (1UL << count) - 1;
+    for (uint32_t rxb0 = 1; rxb0 <= all; rxb0++) {
+        uint32_t rxb1 = all & ~rxb0;
+        if (__builtin_popcount(rxb0) > HW_RXB0_FILTERS || __builtin_popcount(rxb1) > HW_RXB1_FILTERS) {
+            continue;
+        }
+        uint32_t mask;
+        uint64_t cost = group_cost(set, rxb0, count, &mask) + (rxb1 ? group_cost(set, rxb1, count, &mask) : 0);
+        if (cost < best_cost) {
+            best_cost = cost;
+            *best_rxb0 = rxb0;
+        }
+    }
+    return best_cost;
+}
+
+static void plan_fill_group(can_filter_hw_plan_t *plan, const hw_cube_t *set, uint32_t members,
+                            size_t count, size_t first, size_t slots)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < count && n < slots; i++) {
+        if (members & (1UL << i)) {
+            plan->filter_extd[first + n] = set[i].extd;
+            plan->filter[first + n] = set[i].extd ? set[i].value : set[i].value >> STD_SHIFT;
+            n++;
+        }
+    }
+    // Unused filters repeat the first one of the group
+    for (; n < slots; n++) {
+        plan->filter[first + n] = plan->filter[first];
+        plan->filter_extd[first + n] = plan->filter_extd[first];
+    }
+}
+
+bool can_filter_plan_hw(const can_filter_rule_t *rules, size_t count, can_filter_hw_plan_t *plan)
+{
+    memset(plan, 0, sizeof(*plan));
+    uint64_t all_ids = cube_cost(0, false) + cube_cost(0, true);
+    if (rules == NULL || count == 0) {
+        // Masks 0: RXF0/RXF2.. standard, RXF1/RXF3.. extended, everything passes
+        for (size_t i = 0; i < HW_FILTERS; i++) {
+            plan->filter_extd[i] = i & 1;
+        }
+        plan->accepted_ids = all_ids;
+        return true;
+    }
+    if (count > sizeof(s_cubes) / sizeof(s_cubes[0])) {
+        return false;
+    }
+
+    // Standard cubes first, extended after them
+    size_t counts[2] = {0, 0};
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < count; i++) {
+            if (rules[i].extd != pass) {
+                continue;
+            }
+            uint32_t type_mask = rules[i].extd ? CAN_FRAME_EXT_ID_MASK : CAN_FRAME_STD_ID_MASK;
+            uint32_t care = rules[i].mask & type_mask;
+            uint32_t value = rules[i].id & care;
+            if (!rules[i].extd) {
+                care <<= STD_SHIFT;
+                value <<= STD_SHIFT;
+            }
+            s_cubes[counts[0] + counts[1]] = (hw_cube_t){ .value = value, .care = care, .extd = rules[i].extd };
+            counts[pass]++;
+        }
+    }
+    size_t max_std = cubes_reduce(s_cubes, counts[0], s_snap[0]);
+    size_t max_ext = cubes_reduce(s_cubes + counts[0], counts[1], s_snap[1]);
+
+    hw_cube_t best_set[HW_FILTERS] = {0};
+    size_t best_n = 0;
+    uint32_t best_rxb0 = 1;
+    uint64_t best_cost = UINT64_MAX;
+    for (size_t k_std = counts[0] ? 1 : 0; k_std <= max_std; k_std++) {
+        size_t k_ext = HW_FILTERS - k_std < max_ext ? HW_FILTERS - k_std : max_ext;
+        if (counts[1] && k_ext == 0) {
+            continue;
+        }
+        hw_cube_t set[HW_FILTERS];
+        if (k_std) {
+            memcpy(set, s_snap[0][k_std - 1], k_std * sizeof(set[0]));
+        }
+        if (k_ext) {
+            memcpy(&set[k_std], s_snap[1][k_ext - 1], k_ext * sizeof(set[0]));
+        }
+        uint32_t rxb0 = 1;
+        uint64_t cost = best_split(set, k_std + k_ext, &rxb0);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_rxb0 = rxb0;
+            best_n = k_std + k_ext;
+            memcpy(best_set, set, sizeof(set));
+        }
+    }
+
+    uint32_t best_rxb1 = ((1UL << best_n) - 1) & ~best_rxb0;
+    group_cost(best_set, best_rxb0, best_n, &plan->mask[0]);
+    plan_fill_group(plan, best_set, best_rxb0, best_n, 0, HW_RXB0_FILTERS);
+    if (best_rxb1) {
+        group_cost(best_set, best_rxb1, best_n, &plan->mask[1]);
+        plan_fill_group(plan, best_set, best_rxb1, best_n, HW_RXB0_FILTERS, HW_RXB1_FILTERS);
+    } else {
+        plan->mask[1] = plan->mask[0];
+        plan_fill_group(plan, best_set, best_rxb0, best_n, HW_RXB0_FILTERS, HW_RXB1_FILTERS);
+    }
+    // The two buffers may overlap; never report more than the whole ID space
+    plan->accepted_ids = best_cost < all_ids ? best_cost : all_ids;
+    return true;
+}
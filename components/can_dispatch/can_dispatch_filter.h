@@ -0,0 +1,112 @@
+/**
+ * @file can_dispatch_filter.h
+ * @brief Software acceptance filter and MCP2515 hardware pre-filter planner
+ *
+ * The hardware filters of the controllers cannot express large ID sets (the
+ * MCP2515 has 6 filters and 2 masks). The software filter takes a rule list
+ * and compiles it into:
+ * - a 2048-bit bitmap of exact standard IDs (one bit test per frame),
+ * - a sorted array of exact extended IDs behind a 4096-bit bloom pre-check,
+ *   so most rejected frames never reach the binary search,
+ * - a short list of masked rules checked last.
+ *
+ * The filter runs where frames leave the controller (MCP2515 RX buffer read,
+ * multi service task, TWAI driver queue read), so rejected frames never reach
+ * the dispatcher or application queues.
+ *
+ * can_filter_plan_hw() reduces the same rule list to the MCP2515 filter set
+ * that lets the fewest unwanted IDs through while accepting every rule; the
+ * software stage removes the rest.
+ *
+ * Rules are swapped in atomically (double-buffered tables); a frame checked
+ * while the rules change is matched against either the old or the new set,
+ * also when updates follow each other quickly. Only one task may call
+ * can_filter_set_rules() at a time.
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "can_dispatch_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CONFIG_CAN_DISPATCH_FILTER_MAX_IDS
+#define CONFIG_CAN_DISPATCH_FILTER_MAX_IDS 256
+#endif
+#ifndef CONFIG_CAN_DISPATCH_FILTER_MAX_MASKED
+#define CONFIG_CAN_DISPATCH_FILTER_MAX_MASKED 8
+#endif
+
+/**
+ * @brief Acceptance rule: frame accepted if (frame.id & mask) == (id & mask)
+ *
+ * Use CAN_FRAME_STD_ID_MASK / CAN_FRAME_EXT_ID_MASK as mask for a single ID.
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t mask;
+    bool extd;          ///< Rule applies to extended (true) or standard frames
+} can_filter_rule_t;
+
+/**
+ * @brief Software filter counters
+ */
+typedef struct {
+    uint32_t accepted;
+    uint32_t rejected;
+    uint32_t bloom_false_positives;    ///< Extended IDs that passed the bloom check but not the search
+} can_filter_stats_t;
+
+/**
+ * @brief MCP2515 filter set (RXM0 + RXF0..1 for RXB0, RXM1 + RXF2..5 for RXB1)
+ *
+ * Masks use the 29-bit register layout (standard ID bits at 28..18) and are
+ * written as extended masks. Standard filters hold the 11-bit ID.
+ */
+typedef struct {
+    uint32_t mask[2];
+    uint32_t filter[6];
+    bool filter_extd[6];
+    uint64_t accepted_ids;  ///< Identifiers the set lets through (standard + extended)
+} can_filter_hw_plan_t;
+
+/**
+ * @brief Compile and activate a rule list
+ * @param rules Rules (NULL / count 0 = accept all frames)
+ * @param count Number of rules
+ * @return false if the rules exceed CONFIG_CAN_DISPATCH_FILTER_MAX_IDS / _MAX_MASKED
+ */
+bool can_filter_set_rules(const can_filter_rule_t *rules, size_t count);
+
+/**
+ * @brief Check a frame against the active rules
+ * @return true if accepted (always true with no rules)
+ */
+bool can_filter_accept(const can_frame_t *frame);
+
+/**
+ * @brief Read and optionally reset counters
+ */
+void can_filter_get_stats(can_filter_stats_t *stats, bool reset);
+
+/**
+ * @brief Compute the MCP2515 filter set for a rule list
+ *
+ * Rules are merged into at most six (value, mask) groups with the smallest
+ * growth of the accepted ID space, then split between the two masks so that
+ * the total accepted space is minimal. With no rules the plan accepts all.
+ *
+ * @return false if the rule list exceeds the filter limits
+ */
+bool can_filter_plan_hw(const can_filter_rule_t *rules, size_t count, can_filter_hw_plan_t *plan);
+
+#ifdef __cplusplus
+}
+#endif
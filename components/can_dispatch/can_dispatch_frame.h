@@ -0,0 +1,110 @@
+/**
+ * @file can_dispatch_frame.h
+ * @brief Backend-neutral CAN frame type used natively by can_dispatch
+ *
+ * can_frame_t is the frame representation shared by all backend adapters and
+ * by the dispatcher's extended APIs (deadline send, batch, ...). Backends work
+ * on it directly, so a frame is copied only where it crosses into the legacy
+ * twai_message_t based can_twai_* API. The transmit result/option types live
+ * here as well, so adapters do not depend on the dispatcher header.
+ *
+ * Layout: 16 bytes, payload 8-byte aligned, two frames per 32-byte cache line.
+ * The low flag bits match twai_message_t.flags (extd, rtr, ss), so the
+ * converters below are a handful of loads and stores.
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "driver/twai.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAN_FRAME_MAX_DLC       8
+
+#define CAN_FRAME_STD_ID_MASK   0x000007FFUL
+#define CAN_FRAME_EXT_ID_MASK   0x1FFFFFFFUL
+
+// Frame flags (bit positions identical to twai_message_t.flags)
+#define CAN_FRAME_FLAG_EXTD         0x01    ///< 29-bit identifier
+#define CAN_FRAME_FLAG_RTR          0x02    ///< Remote transmission request
+#define CAN_FRAME_FLAG_SINGLE_SHOT  0x04    ///< TX: one attempt, no retransmission
+
+#define CAN_FRAME_TWAI_FLAGS_MASK   (CAN_FRAME_FLAG_EXTD | CAN_FRAME_FLAG_RTR | CAN_FRAME_FLAG_SINGLE_SHOT)
+
+/**
+ * @brief CAN 2.0 frame
+ */
+typedef struct __attribute__((packed, aligned(8))) {
+    uint32_t id;                        ///< Identifier without flag bits
+    uint8_t dlc;                        ///< Data length code (0..8)
+    uint8_t flags;                      ///< CAN_FRAME_FLAG_*
+    uint16_t reserved;                  ///< Keeps payload 8-byte aligned, must be 0
+    uint8_t data[CAN_FRAME_MAX_DLC];    ///< Payload
+} can_frame_t;
+
+_Static_assert(sizeof(can_frame_t) == 16, "can_frame_t must stay 16 bytes");
+
+/**
+ * @brief Check for extended (29-bit) identifier
+ */
+static inline bool can_frame_is_extd(const can_frame_t *frame)
+{
+    return (frame->flags & CAN_FRAME_FLAG_EXTD) != 0;
+}
+
+/**
+ * @brief Convert legacy TWAI message to can_frame_t
+ */
+static inline void can_frame_from_twai(can_frame_t *frame, const twai_message_t *msg)
+{
+    frame->id = msg->identifier;
+    frame->dlc = msg->data_length_code;
+    frame->flags = (uint8_t)(msg->flags & CAN_FRAME_TWAI_FLAGS_MASK);
+    frame->reserved = 0;
+    memcpy(frame->data, msg->data, CAN_FRAME_MAX_DLC);
+}
+
+/**
+ * @brief Convert can_frame_t to legacy TWAI message
+ */
+static inline void can_frame_to_twai(const can_frame_t *frame, twai_message_t *msg)
+{
+    msg->flags = frame->flags & CAN_FRAME_TWAI_FLAGS_MASK;
+    msg->identifier = frame->id;
+    msg->data_length_code = frame->dlc;
+    memcpy(msg->data, frame->data, CAN_FRAME_MAX_DLC);
+}
+
+// ======================================================================================
+// Transmit request types shared by the dispatcher and backend adapters
+// ======================================================================================
+/**
+ * @brief Outcome of a deadline-aware transmit request
+ */
+typedef enum {
+    CAN_DISPATCH_TX_QUEUED = 0,   ///< Frame loaded into a free TX buffer / TX queue
+    CAN_DISPATCH_TX_REPLACED,     ///< Payload of a still pending frame with the same ID was overwritten
+    CAN_DISPATCH_TX_EXPIRED,      ///< Deadline already passed, frame was dropped without sending
+    CAN_DISPATCH_TX_BUSY,         ///< No TX buffer free, frame not queued (caller may retry)
+    CAN_DISPATCH_TX_ERROR,        ///< Backend reported an error
+} can_dispatch_tx_result_t;
+
+/**
+ * @brief Per-frame transmit options
+ */
+typedef struct {
+    int64_t deadline_us;    ///< Absolute deadline in esp_timer_get_time() microseconds, 0 = no deadline
+    bool replace_pending;   ///< Overwrite a pending (not yet sent) frame with the same ID
+    bool single_shot;       ///< One transmission attempt only, no automatic retransmission
+} can_dispatch_tx_opts_t;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,431 @@
+/**
+ * @file can_dispatch_gateway.c
+ * @brief TWAI <-> MCP2515 gateway implementation
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#include "can_dispatch_gateway.h"
+#include "can_dispatch_inline.h"
+#include "can_dispatch_trace.h"
+#include "driver/twai.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include <string.h>
+
+static const char *TAG = "CAN_GATEWAY";
+
+#define GW_TWAI_STREAM_DEV      1       // device index of the TWAI port in the frame stream
+
+#ifndef CONFIG_CAN_DISPATCH_GATEWAY_POOL_SIZE
+#define CONFIG_CAN_DISPATCH_GATEWAY_POOL_SIZE 32
+#endif
+#define GW_POOL_SIZE            CONFIG_CAN_DISPATCH_GATEWAY_POOL_SIZE
+#define GW_STD_ID_COUNT         (CAN_FRAME_STD_ID_MASK + 1)
+#define GW_MAX_ROUTE_SETS       256     // std lookup entries are uint8_t
+#define GW_TASK_STACK           3072
+
+_Static_assert(GW_POOL_SIZE <= 255, "pool slots are addressed by uint8_t");
+
+// ======================================================================================
+// Compiled routing table
+// ======================================================================================
+
+static can_gateway_route_t s_routes[CAN_GATEWAY_MAX_ROUTES];
+static size_t s_route_count = 0;
+static can_gateway_route_stats_t s_route_stats[CAN_GATEWAY_MAX_ROUTES];
+static int64_t s_route_last_us[CAN_GATEWAY_MAX_ROUTES];
+
+// Standard IDs: s_std_lut[port][id] selects an entry of s_route_sets, a bit
+// set of all routes matching that ID on that port (entry 0 = no route).
+static uint8_t s_std_lut[CAN_GATEWAY_PORT_COUNT][GW_STD_ID_COUNT];
+static uint32_t s_route_sets[GW_MAX_ROUTE_SETS];
+static size_t s_route_set_count = 0;
+
+// Extended IDs cannot be tabled; keep routes per port for a short linear match
+static uint32_t s_ext_routes[CAN_GATEWAY_PORT_COUNT];
+
+static bool route_matches_std(const can_gateway_route_t *r, uint32_t id)
+{
+    return ((id ^ r->id) & r->mask & CAN_FRAME_STD_ID_MASK) == 0;
+}
+
+static int route_set_index(uint32_t set)
+{
+    for (size_t i = 0; i < s_route_set_count; i++) {
+        if (s_route_sets[i] == set) {
+            return (int)i;
+        }
+    }
+    if (s_route_set_count == GW_MAX_ROUTE_SETS) {
+        return -1;
+    }
+    s_route_sets[s_route_set_count] = set;
+    return (int)s_route_set_count++;
+}
+
+static bool compile_routes(void)
+{
+    memset(s_ext_routes, 0, sizeof(s_ext_routes));
+    s_route_set_count = 0;
+    route_set_index(0);
+
+    for (int port = 0; port < CAN_GATEWAY_PORT_COUNT; port++) {
+        uint32_t std_routes = 0;
+        for (size_t r = 0; r < s_route_count; r++) {
+            if (s_routes[r].src != (can_gateway_port_t)port) {
+                continue;
+            }
+            if (s_routes[r].extd) {
+                s_ext_routes[port] |= 1UL << r;
+            } else {
+                std_routes |= 1UL << r;
+            }
+        }
+        for (uint32_t id = 0; id < GW_STD_ID_COUNT; id++) {
+            uint32_t set = 0;
+            for (uint32_t pending = std_routes; pending; pending &= pending - 1) {
+                int r = __builtin_ctz(pending);
+                if (route_matches_std(&s_routes[r], id)) {
+                    set |= 1UL << r;
+                }
+            }
+            int idx = route_set_index(set);
+            if (idx < 0) {
+                ESP_LOGE(TAG, "Too many distinct route combinations");
+                return false;
+            }
+            s_std_lut[port][id] = (uint8_t)idx;
+        }
+    }
+    ESP_LOGI(TAG, "Compiled %u routes into %u route sets", (unsigned)s_route_count, (unsigned)s_route_set_count);
+    return true;
+}
+
+static uint32_t lookup_routes(can_gateway_port_t port, const can_frame_t *frame)
+{
+    if (!can_frame_is_extd(frame)) {
+        return s_route_sets[s_std_lut[port][frame->id & CAN_FRAME_STD_ID_MASK]];
+    }
+    uint32_t set = 0;
+    for (uint32_t pending = s_ext_routes[port]; pending; pending &= pending - 1) {
+        int r = __builtin_ctz(pending);
+        if (((frame->id ^ s_routes[r].id) & s_routes[r].mask & CAN_FRAME_EXT_ID_MASK) == 0) {
+            set |= 1UL << r;
+        }
+    }
+    return set;
+}
+
+// ======================================================================================
+// Shared frame pool and per-port TX queues
+// ======================================================================================
+
+typedef struct {
+    can_frame_t frame;
+    int64_t rx_time_us;     // esp_timer time the frame was received
+    uint8_t refs;           // TX queue entries referencing this slot
+} gw_slot_t;
+
+typedef struct {
+    uint8_t slot;
+    uint8_t route;
+} gw_tx_entry_t;
+
+typedef struct {
+    gw_tx_entry_t entries[GW_POOL_SIZE];
+    uint8_t head;
+    uint8_t count;
+} gw_tx_queue_t;
+
+static gw_slot_t s_pool[GW_POOL_SIZE];
+static uint8_t s_free[GW_POOL_SIZE];
+static uint8_t s_free_count = 0;
+static gw_tx_queue_t s_txq[CAN_GATEWAY_PORT_COUNT];
+
+static void pool_reset(void)
+{
+    for (int i = 0; i < GW_POOL_SIZE; i++) {
+        s_free[i] = (uint8_t)i;
+        s_pool[i].refs = 0;
+    }
+    s_free_count = GW_POOL_SIZE;
+    memset(s_txq, 0, sizeof(s_txq));
+}
+
+static int pool_alloc(void)
+{
+    return s_free_count ? s_free[--s_free_count] : -1;
+}
+
+static void pool_release(uint8_t slot)
+{
+    if (s_pool[slot].refs == 0 || --s_pool[slot].refs == 0) {
+        s_free[s_free_count++] = slot;
+    }
+}
+
+static bool txq_push(can_gateway_port_t port, uint8_t slot, uint8_t route)
+{
+    gw_tx_queue_t *q = &s_txq[port];
+    if (q->count == GW_POOL_SIZE) {
+        CAN_TRACE(CAN_TRACE_QUEUE_FULL, CAN_TRACE_Q_GATEWAY_TX(port), q->count, CAN_TRACE_FRAME_ID(&s_pool[slot].frame));
+        return false;
+    }
+    q->entries[(q->head + q->count) % GW_POOL_SIZE] = (gw_tx_entry_t){ .slot = slot, .route = route };
+    q->count++;
+    CAN_TRACE(CAN_TRACE_QUEUE_PUSH, CAN_TRACE_Q_GATEWAY_TX(port), q->count, CAN_TRACE_FRAME_ID(&s_pool[slot].frame));
+    s_pool[slot].refs++;
+    return true;
+}
+
+// ======================================================================================
+// Ports
+// ======================================================================================
+
+static bool port_send(can_gateway_port_t port, const can_frame_t *frame)
+{
+    if (port == CAN_GATEWAY_PORT_MCP2515) {
+        // A frame held back by the shaper counts as sent: the shaper owns it now
+        return can_dispatch_backend_send_shaped(frame);
+    }
+    twai_message_t msg;
+    can_frame_to_twai(frame, &msg);
+    if (twai_transmit(&msg, 0) != ESP_OK) {
+        return false;
+    }
+    CAN_DISPATCH_LOG_TX(frame, GW_TWAI_STREAM_DEV);
+    return true;
+}
+
+static bool port_receive(can_gateway_port_t port, can_frame_t *frame)
+{
+    if (port == CAN_GATEWAY_PORT_MCP2515) {
+        return can_dispatch_backend_receive(frame);
+    }
+    twai_message_t msg;
+    if (twai_receive(&msg, 0) != ESP_OK) {
+        return false;
+    }
+    can_frame_from_twai(frame, &msg);
+    CAN_DISPATCH_LOG_RX(frame, GW_TWAI_STREAM_DEV);
+    return true;
+}
+
+// ======================================================================================
+// Forwarding
+// ======================================================================================
+
+static void route_transform(const can_gateway_route_t *r, const can_frame_t *in, can_frame_t *out)
+{
+    if (out != in) {
+        *out = *in;
+    }
+    if (r->rewrite_id) {
+        out->id = r->new_id;
+        if (r->new_extd) {
+            out->flags |= CAN_FRAME_FLAG_EXTD;
+        } else {
+            out->flags &= (uint8_t)~CAN_FRAME_FLAG_EXTD;
+        }
+    }
+    if (r->remap) {
+        uint8_t data[CAN_FRAME_MAX_DLC];
+        for (int i = 0; i < CAN_FRAME_MAX_DLC; i++) {
+            uint8_t src = r->byte_map[i];
+            data[i] = (src < CAN_FRAME_MAX_DLC) ? in->data[src] : 0;
+        }
+        memcpy(out->data, data, sizeof(data));
+    }
+}
+
+// Queue one received frame on every matching route
+static void route_frame(uint8_t slot, uint32_t routes, int64_t now_us)
+{
+    while (routes) {
+        int r = __builtin_ctz(routes);
+        routes &= routes - 1;
+        const can_gateway_route_t *route = &s_routes[r];
+        can_gateway_route_stats_t *stats = &s_route_stats[r];
+
+        if (route->min_interval_us && s_route_last_us[r] != 0
+            && now_us - s_route_last_us[r] < route->min_interval_us) {
+            stats->rate_limited++;
+            continue;
+        }
+
+        uint8_t out = slot;
+        if (route->rewrite_id || route->remap) {
+            // Modify in place only if no other route uses the original
+            if (routes == 0 && s_pool[slot].refs == 0) {
+                route_transform(route, &s_pool[slot].frame, &s_pool[slot].frame);
+            } else {
+                int copy = pool_alloc();
+                if (copy < 0) {
+                    stats->dropped++;
+                    continue;
+                }
+                route_transform(route, &s_pool[slot].frame, &s_pool[copy].frame);
+                s_pool[copy].rx_time_us = s_pool[slot].rx_time_us;
+                s_pool[copy].refs = 0;
+                out = (uint8_t)copy;
+            }
+        }
+        if (!txq_push(route->dst, out, (uint8_t)r)) {
+            stats->dropped++;
+            if (out != slot) {
+                pool_release(out);
+            }
+            continue;
+        }
+        s_route_last_us[r] = now_us;
+    }
+    if (s_pool[slot].refs == 0) {
+        pool_release(slot);
+    }
+}
+
+static uint32_t flush_port(can_gateway_port_t port)
+{
+    gw_tx_queue_t *q = &s_txq[port];
+    uint32_t sent = 0;
+    while (q->count) {
+        gw_tx_entry_t e = q->entries[q->head];
+        gw_slot_t *slot = &s_pool[e.slot];
+        if (!port_send(port, &slot->frame)) {
+            break;  // controller busy, retry on next call
+        }
+        uint32_t latency = (uint32_t)(esp_timer_get_time() - slot->rx_time_us);
+        can_gateway_route_stats_t *stats = &s_route_stats[e.route];
+        if (stats->forwarded == 0 || latency < stats->latency_min_us) {
+            stats->latency_min_us = latency;
+        }
+        if (latency > stats->latency_max_us) {
+            stats->latency_max_us = latency;
+        }
+        stats->latency_sum_us += latency;
+        stats->forwarded++;
+
+        q->head = (q->head + 1) % GW_POOL_SIZE;
+        q->count--;
+        CAN_TRACE(CAN_TRACE_QUEUE_POP, CAN_TRACE_Q_GATEWAY_TX(port), q->count, CAN_TRACE_FRAME_ID(&slot->frame));
+        pool_release(e.slot);
+        sent++;
+    }
+    return sent;
+}
+
+uint32_t can_gateway_process(uint32_t rx_budget)
+{
+    uint32_t moved = 0;
+    for (int port = 0; port < CAN_GATEWAY_PORT_COUNT; port++) {
+        for (uint32_t n = 0; n < rx_budget; n++) {
+            int slot = pool_alloc();
+            if (slot < 0) {
+                break;  // leave frames in the controller until TX drains the pool
+            }
+            if (!port_receive((can_gateway_port_t)port, &s_pool[slot].frame)) {
+                pool_release((uint8_t)slot);
+                break;
+            }
+            int64_t now_us = esp_timer_get_time();
+            s_pool[slot].rx_time_us = now_us;
+            s_pool[slot].refs = 0;
+            route_frame((uint8_t)slot, lookup_routes((can_gateway_port_t)port, &s_pool[slot].frame), now_us);
+            moved++;
+        }
+    }
+    for (int port = 0; port < CAN_GATEWAY_PORT_COUNT; port++) {
+        moved += flush_port((can_gateway_port_t)port);
+    }
+    return moved;
+}
+
+// ======================================================================================
+// Lifecycle
+// ======================================================================================
+
+static TaskHandle_t s_task = NULL;
+static volatile bool s_task_run = false;
+
+static void gateway_task(void *arg)
+{
+    (void)arg;
+    while (s_task_run) {
+        if (can_gateway_process(GW_POOL_SIZE / 2) == 0) {
+            vTaskDelay(1);
+        }
+    }
+    s_task = NULL;
+    vTaskDelete(NULL);
+}
+
+bool can_gateway_init(const can_gateway_config_t *cfg)
+{
+    if (cfg == NULL || (cfg->route_count && cfg->routes == NULL) || cfg->route_count > CAN_GATEWAY_MAX_ROUTES) {
+        ESP_LOGE(TAG, "Invalid gateway configuration");
+        return false;
+    }
+    for (size_t r = 0; r < cfg->route_count; r++) {
+        const can_gateway_route_t *route = &cfg->routes[r];
+        if (route->src >= CAN_GATEWAY_PORT_COUNT || route->dst >= CAN_GATEWAY_PORT_COUNT) {
+            ESP_LOGE(TAG, "Route %u: invalid port", (unsigned)r);
+            return false;
+        }
+        if (route->rewrite_id
+            && route->new_id > (route->new_extd ? CAN_FRAME_EXT_ID_MASK : CAN_FRAME_STD_ID_MASK)) {
+            ESP_LOGE(TAG, "Route %u: new_id 0x%lx does not fit a %s identifier", (unsigned)r,
+                     (unsigned long)route->new_id, route->new_extd ? "29-bit" : "11-bit");
+            return false;
+        }
+    }
+    can_gateway_stop();
+    memcpy(s_routes, cfg->routes, cfg->route_count * sizeof(s_routes[0]));
+    s_route_count = cfg->route_count;
+    memset(s_route_stats, 0, sizeof(s_route_stats));
+    memset(s_route_last_us, 0, sizeof(s_route_last_us));
+    pool_reset();
+    return compile_routes();
+}
+
+void can_gateway_deinit(void)
+{
+    can_gateway_stop();
+    s_route_count = 0;
+    pool_reset();
+}
+
+bool can_gateway_start(UBaseType_t priority)
+{
+    if (s_task) {
+        return true;
+    }
+    s_task_run = true;
+    if (xTaskCreate(gateway_task, "can_gateway", GW_TASK_STACK, NULL, priority, &s_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create gateway task");
+        s_task_run = false;
+        s_task = NULL;
+        return false;
+    }
+    return true;
+}
+
+void can_gateway_stop(void)
+{
+    s_task_run = false;
+    while (s_task) {
+        vTaskDelay(1);
+    }
+}
+
+bool can_gateway_get_route_stats(size_t route, can_gateway_route_stats_t *stats)
+{
+    if (route >= s_route_count || stats == NULL) {
+        return false;
+    }
+    *stats = s_route_stats[route];
+    return true;
+}
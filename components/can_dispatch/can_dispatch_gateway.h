@@ -0,0 +1,135 @@
+/**
+ * @file can_dispatch_gateway.h
+ * @brief TWAI <-> MCP2515 gateway with a compiled routing table
+ *
+ * Forwards frames between the on-chip TWAI controller and the MCP2515 single
+ * controller running in the same image. Each route matches an ID/mask on one
+ * port and forwards to the other, optionally rewriting the ID, remapping
+ * payload bytes and limiting the forwarding rate.
+ *
+ * The route list is compiled by can_gateway_init() into a per-port lookup
+ * table (standard IDs: one byte per ID selecting a set of routes; extended
+ * IDs: short per-port match list). Received frames are stored once in a
+ * shared frame pool and queued to the destination port by slot index, so a
+ * frame is copied only when a route has to modify it while another route
+ * still uses the original.
+ *
+ * Both controllers must be started by the application before forwarding:
+ * MCP2515 through can_twai_init(), TWAI through twai_driver_install() and
+ * twai_start() of ESP-IDF.
+ *
+ * The MCP2515 port is the dispatcher backend: frames go through
+ * can_dispatch_backend_send_shaped()/can_dispatch_backend_receive(), so the
+ * TX shaper, the binary stream and the trace see them. The TWAI port is
+ * another bus, driven here directly; its frames appear in the stream as
+ * device 1 and are not shaped (the shaper models the backend's bus).
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "can_dispatch_frame.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAN_GATEWAY_MAX_ROUTES  32      ///< Routes are tracked in a 32-bit set
+#define CAN_GATEWAY_BYTE_ZERO   0xFF    ///< byte_map entry: output byte is 0
+
+/**
+ * @brief Gateway ports
+ */
+typedef enum {
+    CAN_GATEWAY_PORT_TWAI = 0,      ///< On-chip TWAI controller (ESP-IDF driver)
+    CAN_GATEWAY_PORT_MCP2515,       ///< MCP2515 single adapter
+    CAN_GATEWAY_PORT_COUNT,
+} can_gateway_port_t;
+
+/**
+ * @brief One forwarding rule
+ */
+typedef struct {
+    can_gateway_port_t src;         ///< Port the frame is received on
+    can_gateway_port_t dst;         ///< Port the frame is sent to
+    uint32_t id;                    ///< Identifier to match
+    uint32_t mask;                  ///< Identifier bits that must match (1 = compare)
+    bool extd;                      ///< Match extended (29-bit) instead of standard frames
+    bool rewrite_id;                ///< Replace identifier with new_id
+    uint32_t new_id;                ///< Identifier used when rewrite_id is set
+    bool new_extd;                  ///< Format of new_id: true = extended, false = standard (at most 0x7FF)
+    bool remap;                     ///< Rearrange payload through byte_map
+    uint8_t byte_map[CAN_FRAME_MAX_DLC]; ///< Output byte i = input byte byte_map[i], or CAN_GATEWAY_BYTE_ZERO
+    uint32_t min_interval_us;       ///< Minimum time between forwarded frames, 0 = no limit
+} can_gateway_route_t;
+
+/**
+ * @brief Gateway configuration
+ */
+typedef struct {
+    const can_gateway_route_t *routes;  ///< Route table (copied during init)
+    size_t route_count;                 ///< Number of routes, at most CAN_GATEWAY_MAX_ROUTES
+} can_gateway_config_t;
+
+/**
+ * @brief Per-route counters and forwarding latency (receive to transmit queued)
+ */
+typedef struct {
+    uint32_t forwarded;         ///< Frames handed to the destination controller
+    uint32_t rate_limited;      ///< Frames dropped by min_interval_us
+    uint32_t dropped;           ///< Frames dropped because pool or TX queue was full
+    uint32_t latency_min_us;    ///< Shortest forwarding latency
+    uint32_t latency_max_us;    ///< Longest forwarding latency
+    uint64_t latency_sum_us;    ///< Sum of latencies (average = sum / forwarded)
+} can_gateway_route_stats_t;
+
+/**
+ * @brief Compile the routing table and reset the frame pool
+ * @param cfg Gateway configuration
+ * @return true on success, false if the route table is invalid
+ */
+bool can_gateway_init(const can_gateway_config_t *cfg);
+
+/**
+ * @brief Stop the gateway task (if running) and drop queued frames
+ */
+void can_gateway_deinit(void);
+
+/**
+ * @brief Receive, route and transmit pending frames once
+ *
+ * Not thread-safe: call from one task only, or use can_gateway_start().
+ *
+ * @param rx_budget Maximum number of frames read from each port
+ * @return Number of frames received plus transmitted in this call
+ */
+uint32_t can_gateway_process(uint32_t rx_budget);
+
+/**
+ * @brief Run can_gateway_process() in a dedicated task
+ * @param priority FreeRTOS priority of the gateway task
+ * @return true if the task was created
+ */
+bool can_gateway_start(UBaseType_t priority);
+
+/**
+ * @brief Stop the gateway task
+ */
+void can_gateway_stop(void);
+
+/**
+ * @brief Read counters of one route
+ * @param route Index into the route table given to can_gateway_init()
+ * @param stats Output structure
+ * @return false if route is out of range
+ */
+bool can_gateway_get_route_stats(size_t route, can_gateway_route_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
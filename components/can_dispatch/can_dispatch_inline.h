@@ -0,0 +1,183 @@
+/**
+ * @file can_dispatch_inline.h
+ * @brief Per-backend frame send/receive, specialised at compile time
+ *
+ * Only one backend is compiled into an image, so the send/receive path is
+ * selected here by CONFIG_CAN_BACKEND_* and reduced to a direct call into the
+ * adapter or driver. can_dispatch.c always uses these helpers. With
+ * CONFIG_CAN_DISPATCH_INLINE, can_dispatch.h also exposes can_dispatch_send()
+ * and can_dispatch_receive() as static inline wrappers around them, removing
+ * the dispatcher call from every frame.
+ *
+ * The can_twai_* functions stay out of line: examples declare them through
+ * their own can_twai.h. With CONFIG_CAN_DISPATCH_LTO and an LTO application
+ * link (CONFIG_CAN_DISPATCH_LTO_LINK) the remaining hop is removed at link
+ * time instead.
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#pragma once
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "can_dispatch_frame.h"
+
+#if CONFIG_CAN_BACKEND_MCP2515_SINGLE
+#include "can_dispatch_mcp2515_single.h"
+#elif CONFIG_CAN_BACKEND_MCP2515_MULTI
+#include "mcp25xxx_multi.h"
+#if CONFIG_CAN_DISPATCH_MULTI_SERVICE
+#include "can_dispatch_mcp2515_multi.h"
+#endif
+#elif CONFIG_CAN_BACKEND_TWAI
+#include "freertos/FreeRTOS.h"
+#endif
+#if CONFIG_CAN_DISPATCH_FILTER
+#include "can_dispatch_filter.h"
+#endif
+#if CONFIG_CAN_DISPATCH_SHAPER
+#include "can_dispatch_shaper.h"
+#endif
+#include "can_dispatch_trace.h"
+#if CONFIG_CAN_DISPATCH_STREAM
+#include "can_dispatch_stream.h"
+#endif
+
+#ifndef CONFIG_CAN_DISPATCH_TWAI_ONE_SHOT
+#define CONFIG_CAN_DISPATCH_TWAI_ONE_SHOT 0
+#endif
+
+// Software acceptance filter for backends whose driver queue is read here
+// (the MCP2515 adapters filter before their own queues)
+#if CONFIG_CAN_DISPATCH_FILTER
+#define CAN_DISPATCH_RX_ACCEPT(frame) can_filter_accept(frame)
+#else
+#define CAN_DISPATCH_RX_ACCEPT(frame) true
+#endif
+
+// Logging hook: frames passing the dispatcher go to the binary host stream
+#if CONFIG_CAN_DISPATCH_STREAM
+#define CAN_DISPATCH_LOG_RX(frame, dev) can_stream_log((frame), false, (dev))
+#define CAN_DISPATCH_LOG_TX(frame, dev) can_stream_log((frame), true, (dev))
+#else
+#define CAN_DISPATCH_LOG_RX(frame, dev) ((void)0)
+#define CAN_DISPATCH_LOG_TX(frame, dev) ((void)0)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if CONFIG_CAN_BACKEND_MCP2515_SINGLE
+
+static inline bool can_dispatch_backend_send(const can_frame_t *frame)
+{
+    if (!mcp2515_single_send(frame)) {
+        return false;
+    }
+    CAN_DISPATCH_LOG_TX(frame, 0);
+    return true;
+}
+
+static inline bool can_dispatch_backend_receive(can_frame_t *frame)
+{
+    if (!mcp2515_single_receive(frame)) {
+        return false;
+    }
+    CAN_DISPATCH_LOG_RX(frame, 0);
+    return true;
+}
+
+#elif CONFIG_CAN_BACKEND_MCP2515_MULTI
+
+// The multi library API is twai_message_t based; frames are converted at
+// this boundary only.
+static inline bool can_dispatch_backend_send(const can_frame_t *frame)
+{
+#if CONFIG_CAN_DISPATCH_MULTI_SERVICE
+    // Locked against the service task reading the same controller
+    if (!mcp2515_multi_send_default(frame)) {
+        return false;
+    }
+#else
+    twai_message_t msg;
+    can_frame_to_twai(frame, &msg);
+    if (!canif_multi_send_default(&msg)) {
+        return false;
+    }
+#endif
+    CAN_DISPATCH_LOG_TX(frame, 0);
+    return true;
+}
+
+static inline bool can_dispatch_backend_receive(can_frame_t *frame)
+{
+#if CONFIG_CAN_DISPATCH_MULTI_SERVICE
+    // The service task owns the controllers; read the first device's queue
+    if (mcp2515_multi_service_running()) {
+        if (!mcp2515_multi_receive(0, frame)) {
+            return false;
+        }
+        CAN_DISPATCH_LOG_RX(frame, 0);
+        return true;
+    }
+#endif
+    twai_message_t msg;
+    while (canif_receive_default(&msg)) {
+        can_frame_from_twai(frame, &msg);
+        if (CAN_DISPATCH_RX_ACCEPT(frame)) {
+            CAN_DISPATCH_LOG_RX(frame, 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+#elif CONFIG_CAN_BACKEND_TWAI
+
+// The ESP-IDF driver API is twai_message_t based; frames are converted at
+// this boundary only.
+static inline bool can_dispatch_backend_send(const can_frame_t *frame)
+{
+    twai_message_t msg;
+    can_frame_to_twai(frame, &msg);
+    msg.ss |= CONFIG_CAN_DISPATCH_TWAI_ONE_SHOT;
+    if (twai_transmit(&msg, 0) != ESP_OK) {
+        return false;
+    }
+    CAN_TRACE(CAN_TRACE_TX_LOAD, 0, frame->dlc, CAN_TRACE_FRAME_ID(frame));
+    CAN_DISPATCH_LOG_TX(frame, 0);
+    return true;
+}
+
+static inline bool can_dispatch_backend_receive(can_frame_t *frame)
+{
+    twai_message_t msg;
+    while (twai_receive(&msg, 0) == ESP_OK) {
+        can_frame_from_twai(frame, &msg);
+        CAN_TRACE(CAN_TRACE_RX_READ, 0, frame->dlc, CAN_TRACE_FRAME_ID(frame));
+        if (CAN_DISPATCH_RX_ACCEPT(frame)) {
+            CAN_DISPATCH_LOG_RX(frame, 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
+
+// Transmit entry of the dispatcher send paths: through the token-bucket
+// shaper when enabled (the shaper itself calls can_dispatch_backend_send)
+static inline bool can_dispatch_backend_send_shaped(const can_frame_t *frame)
+{
+#if CONFIG_CAN_DISPATCH_SHAPER
+    return can_shaper_send(frame);
+#else
+    return can_dispatch_backend_send(frame);
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
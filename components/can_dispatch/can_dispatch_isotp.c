@@ -0,0 +1,455 @@
+/**
+ * @file can_dispatch_isotp.c
+ * @brief ISO-TP (ISO 15765-2) transport implementation
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#include "can_dispatch_isotp.h"
+#include "can_dispatch.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "CAN_ISOTP";
+
+// Protocol control information (high nibble of byte 0)
+#define PCI_SF      0x00
+#define PCI_FF      0x10
+#define PCI_CF      0x20
+#define PCI_FC      0x30
+
+#define FC_CTS      0
+#define FC_WAIT     1
+#define FC_OVFLW    2
+
+#define SF_MAX_DATA     7
+#define FF_MAX_SHORT    0x0FFF      // larger lengths use the 32-bit escape
+#define STMIN_RETRY_US  100         // re-arm delay when the timed send finds TX full
+
+// ======================================================================================
+// Frame helpers
+// ======================================================================================
+
+static void frame_init(const can_isotp_link_t *link, can_frame_t *frame)
+{
+    frame->id = link->cfg.tx_id;
+    frame->dlc = CAN_FRAME_MAX_DLC;
+    frame->flags = link->cfg.extd ? CAN_FRAME_FLAG_EXTD : 0;
+    frame->reserved = 0;
+    memset(frame->data, link->cfg.padding, CAN_FRAME_MAX_DLC);
+}
+
+static uint32_t stmin_to_us(uint8_t stmin)
+{
+    if (stmin <= 0x7F) {
+        return (uint32_t)stmin * 1000;
+    }
+    if (stmin >= 0xF1 && stmin <= 0xF9) {
+        return (uint32_t)(stmin - 0xF0) * 100;
+    }
+    return 127000;  // reserved values: use the longest valid STmin
+}
+
+static bool send_flow_control(can_isotp_link_t *link, uint8_t status)
+{
+    can_frame_t frame;
+    frame_init(link, &frame);
+    frame.data[0] = PCI_FC | status;
+    frame.data[1] = link->cfg.block_size;
+    frame.data[2] = link->cfg.stmin;
+    return can_dispatch_send(&frame);
+}
+
+// ======================================================================================
+// Transmit
+// ======================================================================================
+
+static void tx_finish(can_isotp_link_t *link, can_isotp_result_t result)
+{
+    link->tx_phase = CAN_ISOTP_TX_IDLE;
+    link->tx_result = result;
+    if (result == CAN_ISOTP_DONE) {
+        link->stats.tx_bytes = (uint32_t)link->tx_len;
+        link->stats.tx_us = (uint32_t)(esp_timer_get_time() - link->tx_start_us);
+    }
+}
+
+// Send the next consecutive frame; false if the backend did not accept it.
+// The first refusal starts the N_As timeout, checked by tx_send_timed_out().
+static bool tx_send_cf(can_isotp_link_t *link)
+{
+    can_frame_t frame;
+    frame_init(link, &frame);
+    size_t chunk = link->tx_len - link->tx_off;
+    if (chunk > CAN_FRAME_MAX_DLC - 1) {
+        chunk = CAN_FRAME_MAX_DLC - 1;
+    }
+    frame.data[0] = PCI_CF | link->tx_sn;
+    memcpy(&frame.data[1], link->tx_buf + link->tx_off, chunk);
+    if (!can_dispatch_send(&frame)) {
+        link->stats.tx_busy++;
+        if (!link->tx_blocked) {
+            link->tx_blocked = true;
+            link->tx_deadline_us = esp_timer_get_time() + CAN_ISOTP_TIMEOUT_US;
+        }
+        return false;
+    }
+    link->tx_blocked = false;
+    link->tx_off += chunk;
+    link->tx_sn = (link->tx_sn + 1) & 0x0F;
+    return true;
+}
+
+// After a consecutive frame: finish, wait for the next flow control, or continue
+static bool tx_after_cf(can_isotp_link_t *link)
+{
+    if (link->tx_off >= link->tx_len) {
+        tx_finish(link, CAN_ISOTP_DONE);
+        return false;
+    }
+    if (link->tx_bs && --link->tx_bs_left == 0) {
+        link->tx_phase = CAN_ISOTP_TX_WAIT_FC;
+        link->tx_deadline_us = esp_timer_get_time() + CAN_ISOTP_TIMEOUT_US;
+        return false;
+    }
+    return true;
+}
+
+static bool tx_send_timed_out(const can_isotp_link_t *link, int64_t now_us)
+{
+    return link->tx_blocked && now_us > link->tx_deadline_us;
+}
+
+// STmin 0: push frames until the backend TX path is full
+static void tx_stream(can_isotp_link_t *link)
+{
+    while (link->tx_phase == CAN_ISOTP_TX_STREAM && tx_send_cf(link)) {
+        if (!tx_after_cf(link)) {
+            break;
+        }
+    }
+}
+
+static void stmin_timer_cb(void *arg)
+{
+    can_isotp_link_t *link = (can_isotp_link_t *)arg;
+    if (link->tx_phase != CAN_ISOTP_TX_TIMED) {
+        return;
+    }
+    if (!tx_send_cf(link)) {
+        if (tx_send_timed_out(link, esp_timer_get_time())) {
+            tx_finish(link, CAN_ISOTP_ERR_SEND);
+            return;
+        }
+        esp_timer_start_once(link->stmin_timer, STMIN_RETRY_US);
+        return;
+    }
+    if (tx_after_cf(link)) {
+        esp_timer_start_once(link->stmin_timer, link->tx_stmin_us);
+    }
+}
+
+static void tx_on_flow_control(can_isotp_link_t *link, const can_frame_t *frame)
+{
+    if (link->tx_phase != CAN_ISOTP_TX_WAIT_FC) {
+        return;
+    }
+    uint8_t status = frame->data[0] & 0x0F;
+    if (status == FC_WAIT) {
+        link->tx_deadline_us = esp_timer_get_time() + CAN_ISOTP_TIMEOUT_US;
+        return;
+    }
+    if (status != FC_CTS) {
+        tx_finish(link, CAN_ISOTP_ERR_OVERFLOW);
+        return;
+    }
+    link->tx_bs = frame->data[1];
+    link->tx_bs_left = link->tx_bs;
+    link->tx_blocked = false;
+    link->tx_stmin_us = stmin_to_us(frame->data[2]);
+    if (link->tx_stmin_us == 0) {
+        link->tx_phase = CAN_ISOTP_TX_STREAM;
+        tx_stream(link);
+    } else {
+        link->tx_phase = CAN_ISOTP_TX_TIMED;
+        esp_timer_start_once(link->stmin_timer, 1);
+    }
+}
+
+bool can_isotp_send(can_isotp_link_t *link, const uint8_t *data, size_t len)
+{
+    if (link->tx_phase != CAN_ISOTP_TX_IDLE || (len > 0 && data == NULL) || len > UINT32_MAX) {
+        return false;
+    }
+    link->tx_buf = data;
+    link->tx_len = len;
+    link->tx_start_us = esp_timer_get_time();
+
+    can_frame_t frame;
+    frame_init(link, &frame);
+    if (len <= SF_MAX_DATA) {
+        frame.data[0] = PCI_SF | (uint8_t)len;
+        memcpy(&frame.data[1], data, len);
+        if (!can_dispatch_send(&frame)) {
+            return false;
+        }
+        link->tx_off = len;
+        tx_finish(link, CAN_ISOTP_DONE);
+        return true;
+    }
+
+    size_t first;
+    if (len <= FF_MAX_SHORT) {
+        frame.data[0] = PCI_FF | (uint8_t)(len >> 8);
+        frame.data[1] = (uint8_t)len;
+        first = 6;
+        memcpy(&frame.data[2], data, first);
+    } else {
+        frame.data[0] = PCI_FF;
+        frame.data[1] = 0;
+        frame.data[2] = (uint8_t)(len >> 24);
+        frame.data[3] = (uint8_t)(len >> 16);
+        frame.data[4] = (uint8_t)(len >> 8);
+        frame.data[5] = (uint8_t)len;
+        first = 2;
+        memcpy(&frame.data[6], data, first);
+    }
+    if (!can_dispatch_send(&frame)) {
+        return false;
+    }
+    link->tx_off = first;
+    link->tx_sn = 1;
+    link->tx_result = CAN_ISOTP_IN_PROGRESS;
+    link->tx_deadline_us = link->tx_start_us + CAN_ISOTP_TIMEOUT_US;
+    link->tx_phase = CAN_ISOTP_TX_WAIT_FC;
+    return true;
+}
+
+// ======================================================================================
+// Receive
+// ======================================================================================
+
+static void rx_fail(can_isotp_link_t *link, can_isotp_result_t result)
+{
+    link->rx_result = result;
+    ESP_LOGW(TAG, "Receive failed: %d at %u/%u bytes", result, (unsigned)link->rx_off, (unsigned)link->rx_len);
+}
+
+static void rx_finish(can_isotp_link_t *link)
+{
+    link->rx_result = CAN_ISOTP_DONE;
+    link->stats.rx_bytes = (uint32_t)link->rx_len;
+    link->stats.rx_us = (uint32_t)(esp_timer_get_time() - link->rx_start_us);
+}
+
+static void rx_request_fc(can_isotp_link_t *link, uint8_t status)
+{
+    link->rx_fc_status = status;
+    link->rx_fc_pending = !send_flow_control(link, status);
+}
+
+static void rx_on_single(can_isotp_link_t *link, const can_frame_t *frame)
+{
+    size_t len = frame->data[0] & 0x0F;
+    if (len == 0 || len > SF_MAX_DATA || len > (size_t)(frame->dlc - 1)) {
+        return;
+    }
+    if (link->rx_result == CAN_ISOTP_DONE) {
+        // Completed payload not collected yet: a single frame has no flow control to refuse with
+        link->stats.rx_dropped++;
+        return;
+    }
+    if (link->rx_buf == NULL || len > link->rx_cap) {
+        rx_fail(link, CAN_ISOTP_ERR_OVERFLOW);
+        return;
+    }
+    link->rx_start_us = esp_timer_get_time();
+    memcpy(link->rx_buf, &frame->data[1], len);
+    link->rx_len = len;
+    link->rx_off = len;
+    rx_finish(link);
+}
+
+static void rx_on_first(can_isotp_link_t *link, const can_frame_t *frame)
+{
+    size_t len = ((size_t)(frame->data[0] & 0x0F) << 8) | frame->data[1];
+    size_t first = 6;
+    const uint8_t *payload = &frame->data[2];
+    if (len == 0) {
+        len = ((size_t)frame->data[2] << 24) | ((size_t)frame->data[3] << 16)
+            | ((size_t)frame->data[4] << 8) | frame->data[5];
+        first = 2;
+        payload = &frame->data[6];
+    }
+    if (frame->dlc < CAN_FRAME_MAX_DLC || len <= first) {
+        return;
+    }
+    if (link->rx_result == CAN_ISOTP_DONE) {
+        // Completed payload not collected yet: refuse, keep the buffer
+        link->stats.rx_dropped++;
+        rx_request_fc(link, FC_OVFLW);
+        return;
+    }
+    link->rx_len = len;
+    link->rx_off = 0;
+    if (link->rx_buf == NULL || len > link->rx_cap) {
+        rx_request_fc(link, FC_OVFLW);
+        rx_fail(link, CAN_ISOTP_ERR_OVERFLOW);
+        return;
+    }
+    link->rx_start_us = esp_timer_get_time();
+    memcpy(link->rx_buf, payload, first);
+    link->rx_off = first;
+    link->rx_sn = 1;
+    link->rx_bs_count = 0;
+    link->rx_result = CAN_ISOTP_IN_PROGRESS;
+    link->rx_deadline_us = link->rx_start_us + CAN_ISOTP_TIMEOUT_US;
+    rx_request_fc(link, FC_CTS);
+}
+
+static void rx_on_consecutive(can_isotp_link_t *link, const can_frame_t *frame)
+{
+    if (link->rx_result != CAN_ISOTP_IN_PROGRESS) {
+        return;
+    }
+    if ((frame->data[0] & 0x0F) != link->rx_sn) {
+        rx_fail(link, CAN_ISOTP_ERR_SEQUENCE);
+        return;
+    }
+    size_t chunk = link->rx_len - link->rx_off;
+    if (chunk > CAN_FRAME_MAX_DLC - 1) {
+        chunk = CAN_FRAME_MAX_DLC - 1;
+    }
+    if (chunk > (size_t)(frame->dlc - 1)) {
+        rx_fail(link, CAN_ISOTP_ERR_SEQUENCE);
+        return;
+    }
+    memcpy(link->rx_buf + link->rx_off, &frame->data[1], chunk);
+    link->rx_off += chunk;
+    link->rx_sn = (link->rx_sn + 1) & 0x0F;
+    link->rx_deadline_us = esp_timer_get_time() + CAN_ISOTP_TIMEOUT_US;
+
+    if (link->rx_off >= link->rx_len) {
+        rx_finish(link);
+    } else if (link->cfg.block_size && ++link->rx_bs_count == link->cfg.block_size) {
+        link->rx_bs_count = 0;
+        rx_request_fc(link, FC_CTS);
+    }
+}
+
+void can_isotp_receive_start(can_isotp_link_t *link, uint8_t *buf, size_t capacity)
+{
+    link->rx_buf = buf;
+    link->rx_cap = capacity;
+    link->rx_len = 0;
+    link->rx_off = 0;
+    link->rx_result = CAN_ISOTP_IDLE;
+}
+
+bool can_isotp_on_frame(can_isotp_link_t *link, const can_frame_t *frame)
+{
+    if (frame->id != link->cfg.rx_id || can_frame_is_extd(frame) != link->cfg.extd || frame->dlc == 0) {
+        return false;
+    }
+    switch (frame->data[0] & 0xF0) {
+    case PCI_SF:
+        rx_on_single(link, frame);
+        break;
+    case PCI_FF:
+        rx_on_first(link, frame);
+        break;
+    case PCI_CF:
+        rx_on_consecutive(link, frame);
+        break;
+    case PCI_FC:
+        if (frame->dlc >= 3) {
+            tx_on_flow_control(link, frame);
+        }
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+// ======================================================================================
+// Polling, lifecycle, status
+// ======================================================================================
+
+void can_isotp_poll(can_isotp_link_t *link)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    if (link->rx_fc_pending) {
+        link->rx_fc_pending = !send_flow_control(link, link->rx_fc_status);
+    }
+    if (link->rx_result == CAN_ISOTP_IN_PROGRESS && now_us > link->rx_deadline_us) {
+        rx_fail(link, CAN_ISOTP_ERR_TIMEOUT);
+    }
+
+    switch (link->tx_phase) {
+    case CAN_ISOTP_TX_STREAM:
+        tx_stream(link);
+        if (link->tx_phase == CAN_ISOTP_TX_STREAM && tx_send_timed_out(link, now_us)) {
+            tx_finish(link, CAN_ISOTP_ERR_SEND);
+        }
+        break;
+    case CAN_ISOTP_TX_WAIT_FC:
+        if (now_us > link->tx_deadline_us) {
+            tx_finish(link, CAN_ISOTP_ERR_TIMEOUT);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+bool can_isotp_link_init(can_isotp_link_t *link, const can_isotp_config_t *cfg)
+{
+    memset(link, 0, sizeof(*link));
+    link->cfg = *cfg;
+    esp_timer_create_args_t args = {
+        .callback = stmin_timer_cb,
+        .arg = link,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "isotp_stmin",
+        .skip_unhandled_events = true,
+    };
+    esp_err_t err = esp_timer_create(&args, &link->stmin_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create STmin timer: %s", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+void can_isotp_link_deinit(can_isotp_link_t *link)
+{
+    link->tx_phase = CAN_ISOTP_TX_IDLE;
+    if (link->stmin_timer) {
+        esp_timer_stop(link->stmin_timer);
+        esp_timer_delete(link->stmin_timer);
+        link->stmin_timer = NULL;
+    }
+}
+
+can_isotp_result_t can_isotp_tx_result(const can_isotp_link_t *link)
+{
+    return link->tx_result;
+}
+
+can_isotp_result_t can_isotp_rx_result(const can_isotp_link_t *link, size_t *len)
+{
+    if (len && link->rx_result == CAN_ISOTP_DONE) {
+        *len = link->rx_len;
+    }
+    return link->rx_result;
+}
+
+void can_isotp_get_stats(const can_isotp_link_t *link, can_isotp_stats_t *stats)
+{
+    if (stats) {
+        *stats = link->stats;
+    }
+}
@@ -0,0 +1,199 @@
+/**
+ * @file can_dispatch_isotp.h
+ * @brief ISO-TP (ISO 15765-2) transport on top of the native frame API
+ *
+ * One link is a pair of identifiers (tx_id/rx_id) with normal addressing and
+ * classic 8-byte frames. Payloads longer than 4095 bytes use the 32-bit
+ * First Frame length escape, so whole firmware images fit one transfer.
+ *
+ * Transmit: consecutive frames go straight to can_dispatch_send() until the
+ * backend refuses one (all three MCP2515 TX buffers or the TWAI TX queue
+ * full), then continue on the next can_isotp_poll(). When the receiver asks
+ * for STmin > 0, frames are paced by an esp_timer one-shot instead; the
+ * timer callback sends them, so other senders must not use the controller
+ * from another task during such a transfer.
+ *
+ * Receive: the application arms a caller-owned buffer with
+ * can_isotp_receive_start() and passes received frames to
+ * can_isotp_on_frame(). Payload bytes are written straight into that buffer.
+ * The flow control we send advertises the configured block size (0 = the
+ * sender never waits for another flow control). A completed payload stays in
+ * the buffer until can_isotp_receive_start() arms it again; until then new
+ * First Frames are refused with flow control overflow and Single Frames are
+ * dropped (both counted in rx_dropped).
+ *
+ * A transmit fails with CAN_ISOTP_ERR_SEND when the backend keeps refusing
+ * frames for longer than CAN_ISOTP_TIMEOUT_US (N_As).
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_timer.h"
+#include "can_dispatch_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAN_ISOTP_TIMEOUT_US    1000000     ///< N_As / N_Bs / N_Cr timeout (1 s)
+
+/**
+ * @brief Link configuration
+ */
+typedef struct {
+    uint32_t tx_id;         ///< Identifier of frames we send
+    uint32_t rx_id;         ///< Identifier of frames we receive
+    bool extd;              ///< 29-bit identifiers
+    uint8_t block_size;     ///< Block size advertised in our flow control, 0 = no further flow control
+    uint8_t stmin;          ///< STmin advertised in our flow control (ISO-TP encoding)
+    uint8_t padding;        ///< Fill byte for unused frame bytes
+} can_isotp_config_t;
+
+/**
+ * @brief Transfer state / result
+ */
+typedef enum {
+    CAN_ISOTP_IDLE = 0,     ///< No transfer started
+    CAN_ISOTP_IN_PROGRESS,  ///< Transfer running
+    CAN_ISOTP_DONE,         ///< Transfer completed
+    CAN_ISOTP_ERR_TIMEOUT,  ///< Flow control or consecutive frame did not arrive in time
+    CAN_ISOTP_ERR_OVERFLOW, ///< Payload does not fit (our buffer, or peer reported overflow)
+    CAN_ISOTP_ERR_SEQUENCE, ///< Wrong consecutive frame sequence number
+    CAN_ISOTP_ERR_SEND,     ///< Backend refused frames for longer than the N_As timeout
+} can_isotp_result_t;
+
+/**
+ * @brief Throughput counters of the last completed transfers
+ */
+typedef struct {
+    uint32_t tx_bytes;      ///< Payload bytes of the last completed transmit
+    uint32_t tx_us;         ///< Duration of the last completed transmit
+    uint32_t rx_bytes;      ///< Payload bytes of the last completed receive
+    uint32_t rx_us;         ///< Duration of the last completed receive
+    uint32_t tx_busy;       ///< Consecutive frames deferred because the backend TX path was full
+    uint32_t rx_dropped;    ///< Single/First Frames refused while a completed payload was not collected
+} can_isotp_stats_t;
+
+typedef enum {
+    CAN_ISOTP_TX_IDLE = 0,
+    CAN_ISOTP_TX_WAIT_FC,   // waiting for flow control
+    CAN_ISOTP_TX_STREAM,    // STmin 0: stream from can_isotp_poll()/on_frame()
+    CAN_ISOTP_TX_TIMED,     // STmin > 0: esp_timer callback sends
+} can_isotp_tx_phase_t;
+
+/**
+ * @brief ISO-TP link (caller allocated, fields are private)
+ */
+typedef struct {
+    can_isotp_config_t cfg;
+
+    const uint8_t *tx_buf;
+    size_t tx_len;
+    size_t tx_off;
+    uint8_t tx_sn;
+    uint8_t tx_bs;              // peer block size, 0 = unlimited
+    uint8_t tx_bs_left;
+    uint32_t tx_stmin_us;
+    int64_t tx_start_us;
+    int64_t tx_deadline_us;     // flow control, or N_As once tx_blocked
+    bool tx_blocked;            // backend refused the last consecutive frame
+    volatile can_isotp_tx_phase_t tx_phase;
+    volatile can_isotp_result_t tx_result;
+    esp_timer_handle_t stmin_timer;
+
+    uint8_t *rx_buf;
+    size_t rx_cap;
+    size_t rx_len;
+    size_t rx_off;
+    uint8_t rx_sn;
+    uint8_t rx_bs_count;
+    bool rx_fc_pending;         // flow control still to be sent
+    uint8_t rx_fc_status;
+    int64_t rx_start_us;
+    int64_t rx_deadline_us;
+    can_isotp_result_t rx_result;
+
+    can_isotp_stats_t stats;
+} can_isotp_link_t;
+
+/**
+ * @brief Initialize a link
+ * @param link Link storage
+ * @param cfg Link configuration
+ * @return true on success, false if the STmin timer cannot be created
+ */
+bool can_isotp_link_init(can_isotp_link_t *link, const can_isotp_config_t *cfg);
+
+/**
+ * @brief Release link resources
+ */
+void can_isotp_link_deinit(can_isotp_link_t *link);
+
+/**
+ * @brief Start transmitting a payload
+ * @param link Link
+ * @param data Payload, must stay valid until the transfer ends
+ * @param len Payload length
+ * @return false if a transmit is already running or the first frame was rejected
+ */
+bool can_isotp_send(can_isotp_link_t *link, const uint8_t *data, size_t len);
+
+/**
+ * @brief Arm a caller-owned buffer for the next received payload
+ *
+ * Must be called again after each completed receive before the link accepts
+ * the next payload.
+ *
+ * @param link Link
+ * @param buf Destination buffer
+ * @param capacity Buffer size; longer payloads are refused with flow control overflow
+ */
+void can_isotp_receive_start(can_isotp_link_t *link, uint8_t *buf, size_t capacity);
+
+/**
+ * @brief Feed a received frame into the link
+ * @param link Link
+ * @param frame Received frame
+ * @return true if the frame belonged to the link (identifier match)
+ */
+bool can_isotp_on_frame(can_isotp_link_t *link, const can_frame_t *frame);
+
+/**
+ * @brief Continue streaming, retry deferred flow control and check timeouts
+ * @param link Link
+ */
+void can_isotp_poll(can_isotp_link_t *link);
+
+/**
+ * @brief State of the current/last transmit
+ */
+can_isotp_result_t can_isotp_tx_result(const can_isotp_link_t *link);
+
+/**
+ * @brief State of the current/last receive
+ * @param link Link
+ * @param len Set to the payload length once the receive is done (may be NULL)
+ */
+can_isotp_result_t can_isotp_rx_result(const can_isotp_link_t *link, size_t *len);
+
+/**
+ * @brief Read throughput counters
+ */
+void can_isotp_get_stats(const can_isotp_link_t *link, can_isotp_stats_t *stats);
+
+/**
+ * @brief Sustained rate of the last completed transfer in kB/s (1 kB = 1000 bytes)
+ */
+static inline uint32_t can_isotp_kBps(uint32_t bytes, uint32_t us)
+{
+    return us ? (uint32_t)(((uint64_t)bytes * 1000u) / us) : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,699 @@
+/**
+ * @file can_dispatch_j1939.c
+ * @brief SAE J1939 layer implementation
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#include "can_dispatch_j1939.h"
+#include "can_dispatch.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include <string.h>
+
+static const char *TAG = "J1939";
+
+#ifndef CONFIG_CAN_DISPATCH_J1939_HANDLERS
+#define CONFIG_CAN_DISPATCH_J1939_HANDLERS 64
+#endif
+#ifndef CONFIG_CAN_DISPATCH_J1939_RX_SESSIONS
+#define CONFIG_CAN_DISPATCH_J1939_RX_SESSIONS 8
+#endif
+#ifndef CONFIG_CAN_DISPATCH_J1939_TX_SESSIONS
+#define CONFIG_CAN_DISPATCH_J1939_TX_SESSIONS 4
+#endif
+
+#define HANDLER_SLOTS       CONFIG_CAN_DISPATCH_J1939_HANDLERS
+#define RX_SESSIONS         CONFIG_CAN_DISPATCH_J1939_RX_SESSIONS
+#define TX_SESSIONS         CONFIG_CAN_DISPATCH_J1939_TX_SESSIONS
+#define NO_SESSION          0xFF
+
+_Static_assert((HANDLER_SLOTS & (HANDLER_SLOTS - 1)) == 0, "handler table size must be a power of two");
+_Static_assert(RX_SESSIONS < NO_SESSION && TX_SESSIONS < NO_SESSION, "session index is uint8_t");
+
+// TP.CM control bytes
+#define TP_RTS              16
+#define TP_CTS              17
+#define TP_EOMA             19
+#define TP_BAM              32
+#define TP_ABORT            255
+
+#define TP_ABORT_TIMEOUT    3
+#define TP_DT_PAYLOAD       7
+#define TP_MAX_PACKETS      255
+#define TP_CTS_WINDOW       16          // packets requested per CTS
+
+// Timeouts (J1939-21)
+#define T1_US               750000      // between BAM/DT packets
+#define T2_US               1250000     // after CTS, waiting for data
+#define T3_US               1250000     // after RTS/last DT, waiting for CTS/EOMA
+#define BAM_INTERVAL_US     50000       // minimum time between BAM packets
+#define CLAIM_WAIT_US       250000      // address claim contention period
+
+#define CLAIM_PRIORITY      6
+#define ARBITRARY_FIRST     128
+#define ARBITRARY_LAST      247
+#define NAME_ARBITRARY      (1ULL << 63)
+
+// ======================================================================================
+// PGN handler table (open addressing, multiplicative hash)
+// ======================================================================================
+
+typedef struct {
+    uint32_t pgn;               // HANDLER_EMPTY if unused
+    j1939_handler_t handler;
+    void *arg;
+} handler_slot_t;
+
+#define HANDLER_EMPTY 0xFFFFFFFFUL
+
+static handler_slot_t s_handlers[HANDLER_SLOTS];
+
+static inline uint32_t handler_hash(uint32_t pgn)
+{
+    return ((pgn * 2654435761UL) >> 16) & (HANDLER_SLOTS - 1);
+}
+
+static const handler_slot_t *handler_find(uint32_t pgn)
+{
+    uint32_t i = handler_hash(pgn);
+    for (int n = 0; n < HANDLER_SLOTS; n++) {
+        const handler_slot_t *slot = &s_handlers[i];
+        if (slot->pgn == pgn) {
+            return slot;
+        }
+        if (slot->pgn == HANDLER_EMPTY) {
+            return NULL;
+        }
+        i = (i + 1) & (HANDLER_SLOTS - 1);
+    }
+    return NULL;
+}
+
+bool j1939_register_handler(uint32_t pgn, j1939_handler_t handler, void *arg)
+{
+    uint32_t i = handler_hash(pgn);
+    for (int n = 0; n < HANDLER_SLOTS; n++) {
+        handler_slot_t *slot = &s_handlers[i];
+        if (slot->pgn == HANDLER_EMPTY || slot->pgn == pgn) {
+            slot->pgn = pgn;
+            slot->handler = handler;
+            slot->arg = arg;
+            return true;
+        }
+        i = (i + 1) & (HANDLER_SLOTS - 1);
+    }
+    ESP_LOGE(TAG, "Handler table full, PGN %lu not registered", (unsigned long)pgn);
+    return false;
+}
+
+static j1939_stats_t s_stats;
+
+static void deliver(const j1939_id_t *id, const uint8_t *data, size_t len)
+{
+    const handler_slot_t *slot = handler_find(id->pgn);
+    if (slot == NULL) {
+        s_stats.unhandled++;
+        return;
+    }
+    slot->handler(id, data, len, slot->arg);
+}
+
+// ======================================================================================
+// Frame output
+// ======================================================================================
+
+static uint8_t s_addr = J1939_ADDR_NULL;
+static j1939_addr_state_t s_addr_state = J1939_ADDR_NONE;
+
+static bool send_frame(uint8_t priority, uint32_t pgn, uint8_t sa, uint8_t da, const uint8_t *data, size_t len)
+{
+    can_frame_t frame = {
+        .id = j1939_make_id(priority, pgn, sa, da),
+        .dlc = CAN_FRAME_MAX_DLC,
+        .flags = CAN_FRAME_FLAG_EXTD,
+    };
+    memset(frame.data, 0xFF, sizeof(frame.data));
+    memcpy(frame.data, data, len);
+    if (len < CAN_FRAME_MAX_DLC && pgn != J1939_PGN_TP_DT && pgn != J1939_PGN_TP_CM) {
+        frame.dlc = (uint8_t)len;
+    }
+    return can_dispatch_send(&frame);
+}
+
+// Transport frames go out at the priority of the message they carry
+static bool send_tp_cm(uint8_t priority, uint8_t da, uint8_t control, uint8_t b1, uint8_t b2, uint8_t b3,
+                       uint8_t b4, uint32_t pgn)
+{
+    uint8_t d[8] = { control, b1, b2, b3, b4, (uint8_t)pgn, (uint8_t)(pgn >> 8), (uint8_t)(pgn >> 16) };
+    return send_frame(priority, J1939_PGN_TP_CM, s_addr, da, d, sizeof(d));
+}
+
+static void send_abort(uint8_t priority, uint8_t da, uint8_t reason, uint32_t pgn)
+{
+    send_tp_cm(priority, da, TP_ABORT, reason, 0xFF, 0xFF, 0xFF, pgn);
+}
+
+// ======================================================================================
+// Receive sessions
+// ======================================================================================
+
+typedef struct {
+    bool active;
+    bool bam;
+    j1939_id_t id;          // reassembled message: pgn, priority, sa, da
+    uint16_t size;
+    uint8_t packets;
+    uint8_t next_seq;       // expected sequence number (1-based)
+    uint8_t window_end;     // RTS/CTS: last sequence number of the current CTS
+    uint8_t max_per_cts;    // RTS/CTS: sender limit, 0xFF = none
+    int64_t deadline_us;
+    uint8_t data[J1939_TP_MAX_SIZE];
+} rx_session_t;
+
+static rx_session_t s_rx[RX_SESSIONS];
+// Session lookup by source address: one BAM and one RTS/CTS per sender
+static uint8_t s_rx_bam_by_sa[256];
+static uint8_t s_rx_cmdt_by_sa[256];
+
+static void rx_release(uint8_t index)
+{
+    rx_session_t *s = &s_rx[index];
+    uint8_t *map = s->bam ? s_rx_bam_by_sa : s_rx_cmdt_by_sa;
+    map[s->id.sa] = NO_SESSION;
+    s->active = false;
+}
+
+static uint8_t rx_alloc(bool bam, uint8_t sa)
+{
+    uint8_t *map = bam ? s_rx_bam_by_sa : s_rx_cmdt_by_sa;
+    if (map[sa] != NO_SESSION) {
+        // New announcement from the same sender replaces the old session
+        rx_release(map[sa]);
+    }
+    for (uint8_t i = 0; i < RX_SESSIONS; i++) {
+        if (!s_rx[i].active) {
+            s_rx[i].active = true;
+            s_rx[i].bam = bam;
+            map[sa] = i;
+            return i;
+        }
+    }
+    s_stats.rx_no_session++;
+    return NO_SESSION;
+}
+
+static void rx_send_cts(rx_session_t *s)
+{
+    uint8_t remaining = s->packets - s->next_seq + 1;
+    uint8_t count = remaining < TP_CTS_WINDOW ? remaining : TP_CTS_WINDOW;
+    if (count > s->max_per_cts) {
+        count = s->max_per_cts;
+    }
+    s->window_end = s->next_seq + count - 1;
+    s->deadline_us = esp_timer_get_time() + T2_US;
+    send_tp_cm(s->id.priority, s->id.sa, TP_CTS, count, s->next_seq, 0xFF, 0xFF, s->id.pgn);
+}
+
+static void rx_on_announce(const j1939_id_t *cm, const uint8_t *d, bool bam)
+{
+    uint16_t size = (uint16_t)(d[1] | (d[2] << 8));
+    uint8_t packets = d[3];
+    uint32_t pgn = d[5] | ((uint32_t)d[6] << 8) | ((uint32_t)d[7] << 16);
+    if (size <= 8 || size > J1939_TP_MAX_SIZE || packets != (size + TP_DT_PAYLOAD - 1) / TP_DT_PAYLOAD) {
+        if (!bam) {
+            send_abort(cm->priority, cm->sa, 1, pgn);
+        }
+        return;
+    }
+    uint8_t index = rx_alloc(bam, cm->sa);
+    if (index == NO_SESSION) {
+        if (!bam) {
+            send_abort(cm->priority, cm->sa, 1, pgn);  // reason 1: already in a session / no resources
+        }
+        return;
+    }
+    rx_session_t *s = &s_rx[index];
+    s->id.pgn = pgn;
+    s->id.priority = cm->priority;
+    s->id.sa = cm->sa;
+    s->id.da = bam ? J1939_ADDR_GLOBAL : cm->da;
+    s->size = size;
+    s->packets = packets;
+    s->next_seq = 1;
+    s->max_per_cts = bam ? TP_MAX_PACKETS : (d[4] ? d[4] : TP_MAX_PACKETS);
+    s->deadline_us = esp_timer_get_time() + T1_US;
+    if (!bam) {
+        rx_send_cts(s);
+    }
+}
+
+static void rx_on_data(const j1939_id_t *dt, const uint8_t *d)
+{
+    bool bam = dt->da == J1939_ADDR_GLOBAL;
+    uint8_t index = bam ? s_rx_bam_by_sa[dt->sa] : s_rx_cmdt_by_sa[dt->sa];
+    if (index == NO_SESSION) {
+        return;
+    }
+    rx_session_t *s = &s_rx[index];
+    if (d[0] != s->next_seq) {
+        if (!bam) {
+            send_abort(s->id.priority, s->id.sa, 2, s->id.pgn);  // reason 2: bad sequence
+        }
+        s_stats.aborts++;
+        rx_release(index);
+        return;
+    }
+    size_t offset = (size_t)(d[0] - 1) * TP_DT_PAYLOAD;
+    size_t chunk = s->size - offset < TP_DT_PAYLOAD ? s->size - offset : TP_DT_PAYLOAD;
+    memcpy(&s->data[offset], &d[1], chunk);
+    s->next_seq++;
+    s->deadline_us = esp_timer_get_time() + T1_US;
+
+    if (offset + chunk >= s->size) {
+        if (!bam) {
+            send_tp_cm(s->id.priority, s->id.sa, TP_EOMA, (uint8_t)s->size, (uint8_t)(s->size >> 8), s->packets, 0xFF, s->id.pgn);
+        }
+        s_stats.rx_messages++;
+        j1939_id_t id = s->id;
+        rx_release(index);
+        // Session memory stays intact until the next announcement reuses it
+        deliver(&id, s->data, s->size);
+    } else if (!bam && d[0] == s->window_end) {
+        rx_send_cts(s);
+    }
+}
+
+// ======================================================================================
+// Transmit sessions
+// ======================================================================================
+
+typedef enum {
+    TX_IDLE = 0,
+    TX_BAM,             // paced by the BAM timer
+    TX_WAIT_CTS,
+    TX_SENDING,         // streaming packets of the current CTS window
+    TX_WAIT_EOMA,
+} tx_state_t;
+
+typedef struct {
+    volatile tx_state_t state;
+    uint8_t da;
+    uint8_t priority;
+    uint32_t pgn;
+    const uint8_t *data;
+    uint16_t size;
+    uint8_t packets;
+    uint8_t next_seq;
+    uint8_t window_end;
+    int64_t deadline_us;
+} tx_session_t;
+
+static tx_session_t s_tx[TX_SESSIONS];
+static esp_timer_handle_t s_bam_timer = NULL;
+
+static bool tx_send_dt(tx_session_t *s)
+{
+    uint8_t d[8];
+    memset(d, 0xFF, sizeof(d));
+    d[0] = s->next_seq;
+    size_t offset = (size_t)(s->next_seq - 1) * TP_DT_PAYLOAD;
+    size_t chunk = s->size - offset < TP_DT_PAYLOAD ? s->size - offset : TP_DT_PAYLOAD;
+    memcpy(&d[1], s->data + offset, chunk);
+    if (!send_frame(s->priority, J1939_PGN_TP_DT, s_addr, s->state == TX_BAM ? J1939_ADDR_GLOBAL : s->da, d, sizeof(d))) {
+        return false;
+    }
+    s->next_seq++;
+    return true;
+}
+
+static void tx_stream(tx_session_t *s)
+{
+    while (s->state == TX_SENDING && tx_send_dt(s)) {
+        if (s->next_seq > s->packets) {
+            s->state = TX_WAIT_EOMA;
+            s->deadline_us = esp_timer_get_time() + T3_US;
+        } else if (s->next_seq > s->window_end) {
+            s->state = TX_WAIT_CTS;
+            s->deadline_us = esp_timer_get_time() + T3_US;
+        }
+    }
+}
+
+// One BAM packet per tick; J1939 allows only one BAM per sender at a time
+static void bam_timer_cb(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < TX_SESSIONS; i++) {
+        tx_session_t *s = &s_tx[i];
+        if (s->state != TX_BAM) {
+            continue;
+        }
+        if (tx_send_dt(s) && s->next_seq > s->packets) {
+            s->state = TX_IDLE;
+            s_stats.tx_messages++;
+            esp_timer_stop(s_bam_timer);
+        }
+        return;
+    }
+    esp_timer_stop(s_bam_timer);
+}
+
+static tx_session_t *tx_find(uint8_t da, uint32_t pgn)
+{
+    for (int i = 0; i < TX_SESSIONS; i++) {
+        tx_session_t *s = &s_tx[i];
+        if (s->state != TX_IDLE && s->state != TX_BAM && s->da == da && s->pgn == pgn) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static void tx_on_control(const j1939_id_t *cm, const uint8_t *d)
+{
+    uint32_t pgn = d[5] | ((uint32_t)d[6] << 8) | ((uint32_t)d[7] << 16);
+    tx_session_t *s = tx_find(cm->sa, pgn);
+    if (s == NULL) {
+        return;
+    }
+    switch (d[0]) {
+    case TP_CTS:
+        if (d[1] == 0) {
+            // Receiver asks to hold the connection open
+            s->state = TX_WAIT_CTS;
+            s->deadline_us = esp_timer_get_time() + T3_US;
+            break;
+        }
+        s->next_seq = d[2];
+        s->window_end = d[2] + d[1] - 1;
+        if (s->next_seq == 0 || s->window_end > s->packets) {
+            send_abort(s->priority, s->da, 3, s->pgn);
+            s_stats.aborts++;
+            s->state = TX_IDLE;
+            break;
+        }
+        s->state = TX_SENDING;
+        tx_stream(s);
+        break;
+    case TP_EOMA:
+        s->state = TX_IDLE;
+        s_stats.tx_messages++;
+        break;
+    case TP_ABORT:
+        s->state = TX_IDLE;
+        s_stats.aborts++;
+        break;
+    default:
+        break;
+    }
+}
+
+bool j1939_send(uint32_t pgn, uint8_t priority, uint8_t da, const uint8_t *data, size_t len)
+{
+    // No traffic from an address that may still be lost to contention
+    if (s_addr_state != J1939_ADDR_CLAIMED) {
+        return false;
+    }
+    if (len <= CAN_FRAME_MAX_DLC) {
+        return send_frame(priority, pgn, s_addr, da, data, len);
+    }
+    if (len > J1939_TP_MAX_SIZE) {
+        return false;
+    }
+
+    bool bam = da == J1939_ADDR_GLOBAL;
+    tx_session_t *s = NULL;
+    for (int i = 0; i < TX_SESSIONS; i++) {
+        tx_state_t state = s_tx[i].state;
+        if (state != TX_IDLE && (bam ? state == TX_BAM : s_tx[i].da == da)) {
+            return false;  // one BAM per sender, one RTS/CTS per destination
+        }
+        if (state == TX_IDLE && s == NULL) {
+            s = &s_tx[i];
+        }
+    }
+    if (s == NULL) {
+        return false;
+    }
+
+    s->da = da;
+    s->priority = priority;
+    s->pgn = pgn;
+    s->data = data;
+    s->size = (uint16_t)len;
+    s->packets = (uint8_t)((len + TP_DT_PAYLOAD - 1) / TP_DT_PAYLOAD);
+    s->next_seq = 1;
+    if (bam) {
+        if (!send_tp_cm(priority, J1939_ADDR_GLOBAL, TP_BAM, (uint8_t)len, (uint8_t)(len >> 8), s->packets, 0xFF, pgn)) {
+            return false;
+        }
+        s->state = TX_BAM;
+        esp_timer_start_periodic(s_bam_timer, BAM_INTERVAL_US);
+    } else {
+        if (!send_tp_cm(priority, da, TP_RTS, (uint8_t)len, (uint8_t)(len >> 8), s->packets, 0xFF, pgn)) {
+            return false;
+        }
+        s->deadline_us = esp_timer_get_time() + T3_US;
+        s->state = TX_WAIT_CTS;
+    }
+    return true;
+}
+
+// ======================================================================================
+// Address claim
+// ======================================================================================
+
+static uint64_t s_name = 0;
+static int64_t s_claim_deadline_us = 0;
+static uint32_t s_addr_used[256 / 32];  // addresses claimed by other nodes
+
+static bool send_claim(uint8_t sa)
+{
+    uint8_t d[8];
+    for (int i = 0; i < 8; i++) {
+        d[i] = (uint8_t)(s_name >> (8 * i));
+    }
+    return send_frame(CLAIM_PRIORITY, J1939_PGN_ADDRESS_CLAIM, sa, J1939_ADDR_GLOBAL, d, sizeof(d));
+}
+
+static bool addr_used(uint8_t a)
+{
+    return (s_addr_used[a / 32] >> (a % 32)) & 1;
+}
+
+static void claim_lost(void)
+{
+    if (s_name & NAME_ARBITRARY) {
+        for (int a = ARBITRARY_FIRST; a <= ARBITRARY_LAST; a++) {
+            if (a != s_addr && !addr_used((uint8_t)a)) {
+                s_addr = (uint8_t)a;
+                s_addr_state = J1939_ADDR_CLAIMING;
+                s_claim_deadline_us = esp_timer_get_time() + CLAIM_WAIT_US;
+                send_claim(s_addr);
+                return;
+            }
+        }
+    }
+    ESP_LOGW(TAG, "Address lost, no free address");
+    s_addr = J1939_ADDR_NULL;
+    s_addr_state = J1939_ADDR_LOST;
+    send_claim(J1939_ADDR_NULL);
+}
+
+static void on_address_claim(const j1939_id_t *id, const uint8_t *d)
+{
+    uint64_t name = 0;
+    for (int i = 0; i < 8; i++) {
+        name |= (uint64_t)d[i] << (8 * i);
+    }
+    if (id->sa < J1939_ADDR_NULL) {
+        s_addr_used[id->sa / 32] |= 1UL << (id->sa % 32);
+    }
+    if ((s_addr_state != J1939_ADDR_CLAIMING && s_addr_state != J1939_ADDR_CLAIMED) || id->sa != s_addr) {
+        return;
+    }
+    if (s_name < name) {
+        send_claim(s_addr);     // lower NAME has priority: defend the address
+    } else {
+        claim_lost();
+    }
+}
+
+static void on_request(const j1939_id_t *id, const uint8_t *d, size_t len)
+{
+    if (len < 3) {
+        return;
+    }
+    uint32_t pgn = d[0] | ((uint32_t)d[1] << 8) | ((uint32_t)d[2] << 16);
+    if (pgn == J1939_PGN_ADDRESS_CLAIM && s_addr_state != J1939_ADDR_NONE) {
+        send_claim(s_addr);
+        return;
+    }
+    deliver(id, d, len);
+}
+
+bool j1939_claim_address(uint8_t preferred, uint64_t name)
+{
+    s_name = name;
+    s_addr = preferred;
+    s_addr_state = J1939_ADDR_CLAIMING;
+    s_claim_deadline_us = esp_timer_get_time() + CLAIM_WAIT_US;
+    return send_claim(preferred);
+}
+
+j1939_addr_state_t j1939_get_address(uint8_t *address)
+{
+    if (address) {
+        *address = s_addr;
+    }
+    return s_addr_state;
+}
+
+// ======================================================================================
+// Receive path, timeouts, lifecycle
+// ======================================================================================
+
+bool j1939_on_frame(const can_frame_t *frame)
+{
+    if (!can_frame_is_extd(frame) || (frame->flags & CAN_FRAME_FLAG_RTR)) {
+        return false;
+    }
+    j1939_id_t id;
+    j1939_parse_id(frame->id, &id);
+    if (id.da != J1939_ADDR_GLOBAL && (s_addr_state == J1939_ADDR_NONE || id.da != s_addr)) {
+        return true;    // addressed to another node
+    }
+    const uint8_t *d = frame->data;
+
+    switch (id.pgn) {
+    case J1939_PGN_ADDRESS_CLAIM:
+        if (frame->dlc == 8) {
+            on_address_claim(&id, d);
+        }
+        break;
+    case J1939_PGN_REQUEST:
+        on_request(&id, d, frame->dlc);
+        break;
+    case J1939_PGN_TP_CM:
+        if (frame->dlc < 8) {
+            break;
+        }
+        if (d[0] == TP_BAM || (d[0] == TP_RTS && id.da != J1939_ADDR_GLOBAL)) {
+            rx_on_announce(&id, d, d[0] == TP_BAM);
+        } else if (d[0] == TP_ABORT && s_rx_cmdt_by_sa[id.sa] != NO_SESSION) {
+            s_stats.aborts++;
+            rx_release(s_rx_cmdt_by_sa[id.sa]);
+            tx_on_control(&id, d);
+        } else {
+            tx_on_control(&id, d);
+        }
+        break;
+    case J1939_PGN_TP_DT:
+        if (frame->dlc == 8) {
+            rx_on_data(&id, d);
+        }
+        break;
+    default:
+        deliver(&id, d, frame->dlc);
+        break;
+    }
+    return true;
+}
+
+static void run_timeouts(int64_t now_us)
+{
+    for (uint8_t i = 0; i < RX_SESSIONS; i++) {
+        rx_session_t *s = &s_rx[i];
+        if (s->active && now_us > s->deadline_us) {
+            if (!s->bam) {
+                send_abort(s->id.priority, s->id.sa, TP_ABORT_TIMEOUT, s->id.pgn);
+            }
+            s_stats.aborts++;
+            rx_release(i);
+        }
+    }
+    for (int i = 0; i < TX_SESSIONS; i++) {
+        tx_session_t *s = &s_tx[i];
+        if (s->state == TX_SENDING) {
+            tx_stream(s);
+        } else if ((s->state == TX_WAIT_CTS || s->state == TX_WAIT_EOMA) && now_us > s->deadline_us) {
+            send_abort(s->priority, s->da, TP_ABORT_TIMEOUT, s->pgn);
+            s_stats.aborts++;
+            s->state = TX_IDLE;
+        }
+    }
+    if (s_addr_state == J1939_ADDR_CLAIMING && now_us > s_claim_deadline_us) {
+        s_addr_state = J1939_ADDR_CLAIMED;
+        ESP_LOGI(TAG, "Claimed address %u", s_addr);
+    }
+}
+
+size_t j1939_poll(size_t max_frames)
+{
+    can_frame_t frames[8];
+    size_t done = 0;
+    while (done < max_frames) {
+        size_t want = max_frames - done < 8 ? max_frames - done : 8;
+        size_t n = can_dispatch_receive_batch(frames, want);
+        for (size_t i = 0; i < n; i++) {
+            j1939_on_frame(&frames[i]);
+        }
+        done += n;
+        if (n < want) {
+            break;
+        }
+    }
+    run_timeouts(esp_timer_get_time());
+    return done;
+}
+
+bool j1939_init(void)
+{
+    for (int i = 0; i < HANDLER_SLOTS; i++) {
+        s_handlers[i].pgn = HANDLER_EMPTY;
+    }
+    memset(s_rx, 0, sizeof(s_rx));
+    memset(s_tx, 0, sizeof(s_tx));
+    memset(s_rx_bam_by_sa, NO_SESSION, sizeof(s_rx_bam_by_sa));
+    memset(s_rx_cmdt_by_sa, NO_SESSION, sizeof(s_rx_cmdt_by_sa));
+    memset(s_addr_used, 0, sizeof(s_addr_used));
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_addr = J1939_ADDR_NULL;
+    s_addr_state = J1939_ADDR_NONE;
+
+    if (s_bam_timer == NULL) {
+        esp_timer_create_args_t args = {
+            .callback = bam_timer_cb,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "j1939_bam",
+        };
+        esp_err_t err = esp_timer_create(&args, &s_bam_timer);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create BAM timer: %s", esp_err_to_name(err));
+            return false;
+        }
+    }
+    return true;
+}
+
+void j1939_deinit(void)
+{
+    if (s_bam_timer) {
+        esp_timer_stop(s_bam_timer);
+        esp_timer_delete(s_bam_timer);
+        s_bam_timer = NULL;
+    }
+    memset(s_tx, 0, sizeof(s_tx));
+    memset(s_rx, 0, sizeof(s_rx));
+    s_addr_state = J1939_ADDR_NONE;
+}
+
+void j1939_get_stats(j1939_stats_t *stats)
+{
+    if (stats) {
+        *stats = s_stats;
+    }
+}
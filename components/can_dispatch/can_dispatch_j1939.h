@@ -0,0 +1,174 @@
+/**
+ * @file can_dispatch_j1939.h
+ * @brief SAE J1939 layer on top of the native frame API
+ *
+ * - PGN extraction from 29-bit identifiers and dispatch through a PGN-indexed
+ *   handler table (open addressing, constant time per frame).
+ * - Address claim (PGN 60928) with NAME arbitration and, for arbitrary
+ *   address capable NAMEs, automatic selection of a free address.
+ * - Transport protocol (PGN 60416 TP.CM / 60160 TP.DT): concurrent BAM and
+ *   RTS/CTS sessions in fixed, statically allocated memory. Receive sessions
+ *   are found by source address in constant time. Reassembled messages are
+ *   delivered through the same handler table as single frames.
+ * - BAM transmit packets are paced by an esp_timer at the minimum interval
+ *   of 50 ms. The timer callback sends the packets, so other senders must not
+ *   use the controller from another task while a BAM transmit is running.
+ *
+ * Frames are fed with j1939_on_frame() or drained from can_dispatch_receive()
+ * by j1939_poll(), which also runs the protocol timeouts.
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "can_dispatch_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define J1939_ADDR_GLOBAL       0xFF    ///< Destination: all nodes
+#define J1939_ADDR_NULL         0xFE    ///< Source of "cannot claim address"
+#define J1939_TP_MAX_SIZE       1785    ///< Largest transport protocol message
+
+#define J1939_PGN_REQUEST       0xEA00  ///< 59904
+#define J1939_PGN_ADDRESS_CLAIM 0xEE00  ///< 60928
+#define J1939_PGN_TP_CM         0xEC00  ///< 60416
+#define J1939_PGN_TP_DT         0xEB00  ///< 60160
+
+/**
+ * @brief Decoded 29-bit identifier
+ */
+typedef struct {
+    uint32_t pgn;       ///< Parameter group number (PS cleared for PDU1)
+    uint8_t priority;   ///< 0 (highest) .. 7
+    uint8_t sa;         ///< Source address
+    uint8_t da;         ///< Destination address (J1939_ADDR_GLOBAL for PDU2)
+} j1939_id_t;
+
+/**
+ * @brief Handler for a received parameter group (single frame or reassembled)
+ */
+typedef void (*j1939_handler_t)(const j1939_id_t *id, const uint8_t *data, size_t len, void *arg);
+
+/**
+ * @brief Address claim state
+ */
+typedef enum {
+    J1939_ADDR_NONE = 0,    ///< j1939_claim_address() not called
+    J1939_ADDR_CLAIMING,    ///< Claim sent, waiting 250 ms for contention
+    J1939_ADDR_CLAIMED,     ///< Address owned
+    J1939_ADDR_LOST,        ///< No address available ("cannot claim" sent)
+} j1939_addr_state_t;
+
+/**
+ * @brief Transport protocol counters
+ */
+typedef struct {
+    uint32_t rx_messages;       ///< Multi-packet messages reassembled
+    uint32_t tx_messages;       ///< Multi-packet messages sent
+    uint32_t rx_no_session;     ///< Announcements dropped, all receive sessions busy
+    uint32_t aborts;            ///< Sessions aborted (timeout, abort message, bad sequence)
+    uint32_t unhandled;         ///< Frames with no registered handler
+} j1939_stats_t;
+
+/**
+ * @brief Split a 29-bit identifier into PGN, priority and addresses
+ */
+static inline void j1939_parse_id(uint32_t can_id, j1939_id_t *id)
+{
+    uint8_t pf = (uint8_t)(can_id >> 16);
+    uint8_t ps = (uint8_t)(can_id >> 8);
+    id->priority = (uint8_t)((can_id >> 26) & 0x07);
+    id->sa = (uint8_t)can_id;
+    id->pgn = (can_id >> 8) & 0x3FF00;
+    if (pf >= 240) {
+        id->pgn |= ps;
+        id->da = J1939_ADDR_GLOBAL;
+    } else {
+        id->da = ps;
+    }
+}
+
+/**
+ * @brief Build a 29-bit identifier
+ */
+static inline uint32_t j1939_make_id(uint8_t priority, uint32_t pgn, uint8_t sa, uint8_t da)
+{
+    uint32_t id = ((uint32_t)(priority & 0x07) << 26) | ((pgn & 0x3FF00) << 8) | sa;
+    if (((pgn >> 8) & 0xFF) < 240) {
+        id |= (uint32_t)da << 8;
+    } else {
+        id |= (pgn & 0xFF) << 8;
+    }
+    return id;
+}
+
+/**
+ * @brief Reset the layer (handlers, sessions, address)
+ * @return true on success, false if the pacing timer cannot be created
+ */
+bool j1939_init(void);
+
+/**
+ * @brief Stop timers and drop all sessions
+ */
+void j1939_deinit(void);
+
+/**
+ * @brief Register a handler for a PGN (replaces an existing one)
+ * @return false if the handler table is full
+ */
+bool j1939_register_handler(uint32_t pgn, j1939_handler_t handler, void *arg);
+
+/**
+ * @brief Start claiming an address
+ * @param preferred Preferred source address
+ * @param name 64-bit NAME; bit 63 (arbitrary address capable) allows other addresses
+ * @return false if the claim frame could not be sent
+ */
+bool j1939_claim_address(uint8_t preferred, uint64_t name);
+
+/**
+ * @brief Current address claim state
+ * @param address Set to the claimed/claiming address (may be NULL)
+ */
+j1939_addr_state_t j1939_get_address(uint8_t *address);
+
+/**
+ * @brief Send a parameter group from the claimed address
+ *
+ * Up to 8 bytes go out as one frame. Longer payloads start a BAM session
+ * (da == J1939_ADDR_GLOBAL) or an RTS/CTS session whose TP.CM and TP.DT
+ * frames all use the given priority; data must stay valid until the session
+ * ends. Sending is refused until the address claim has completed
+ * (J1939_ADDR_CLAIMED).
+ *
+ * @return false if the address is not claimed (yet), the payload is too long or no TX session is free
+ */
+bool j1939_send(uint32_t pgn, uint8_t priority, uint8_t da, const uint8_t *data, size_t len);
+
+/**
+ * @brief Process one received frame
+ * @return true if the frame was a J1939 (extended) frame
+ */
+bool j1939_on_frame(const can_frame_t *frame);
+
+/**
+ * @brief Drain up to max_frames from can_dispatch_receive() and run protocol timeouts
+ * @return Number of frames processed
+ */
+size_t j1939_poll(size_t max_frames);
+
+/**
+ * @brief Read transport protocol counters
+ */
+void j1939_get_stats(j1939_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
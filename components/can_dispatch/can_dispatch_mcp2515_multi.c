@@ -0,0 +1,417 @@
+#include "can_dispatch_mcp2515_multi.h"
+#include "can_dispatch_trace.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include <string.h>
+#if CONFIG_CAN_DISPATCH_FILTER
+#include "can_dispatch_filter.h"
+#endif
+
+static const char *TAG = "MCP25XXX_MULTI_SERVICE";
+
+#ifndef CONFIG_CAN_DISPATCH_MULTI_RX_QUANTUM
+#define CONFIG_CAN_DISPATCH_MULTI_RX_QUANTUM 2
+#endif
+#ifndef CONFIG_CAN_DISPATCH_MULTI_ROUND_BUDGET
+#define CONFIG_CAN_DISPATCH_MULTI_ROUND_BUDGET 8
+#endif
+#ifndef CONFIG_CAN_DISPATCH_MULTI_RX_QUEUE_LEN
+#define CONFIG_CAN_DISPATCH_MULTI_RX_QUEUE_LEN 16
+#endif
+
+#define RX_QUEUE_LEN        CONFIG_CAN_DISPATCH_MULTI_RX_QUEUE_LEN
+#define SERVICE_STACK       3072
+// Polls devices without INT pin and re-arms INT lines held low by a source
+// other than RX (e.g. error flags) at least this often
+#define SERVICE_IDLE_TICKS  pdMS_TO_TICKS(10)
+
+// Single-producer (service task) / single-consumer (application) queue
+typedef struct {
+    can_frame_t frames[RX_QUEUE_LEN];
+    volatile uint16_t head;     // consumer index
+    volatile uint16_t tail;     // producer index
+} dev_rx_queue_t;
+
+typedef struct {
+    can_dev_id_t dev_id;
+    gpio_num_t int_gpio;
+    int64_t pending_since_us;   // time of the INT edge still waiting for service, 0 = none (s_pending_mux)
+    dev_rx_queue_t rxq;
+    mcp2515_multi_dev_stats_t stats;
+} dev_state_t;
+
+static dev_state_t s_devs[MCP2515_MULTI_MAX_DEVICES];
+static mcp2515_device_config_t s_lib_devices[MCP2515_MULTI_MAX_DEVICES];
+static mcp2515_bundle_config_t s_lib_bundle;
+static size_t s_dev_count = 0;
+static size_t s_rr_next = 0;            // first device of the next service round
+static size_t s_any_next = 0;           // next device for receive_any()
+static volatile uint32_t s_pending = 0; // INT edge seen, bit = device index
+static portMUX_TYPE s_pending_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t s_task = NULL;
+static volatile bool s_run = false;
+// Serialize SPI access to each controller between the service task's reads
+// and application sends; kept across stop so a racing sender never sees a
+// deleted mutex
+static StaticSemaphore_t s_dev_lock_buf[MCP2515_MULTI_MAX_DEVICES];
+static SemaphoreHandle_t s_dev_lock[MCP2515_MULTI_MAX_DEVICES];
+
+static void dev_lock(size_t index) {
+    if (s_dev_lock[index]) {
+        xSemaphoreTake(s_dev_lock[index], portMAX_DELAY);
+    }
+}
+
+static void dev_unlock(size_t index) {
+    if (s_dev_lock[index]) {
+        xSemaphoreGive(s_dev_lock[index]);
+    }
+}
+
+// INT is level triggered (active low): the line stays low while the
+// controller holds frames. The ISR masks it until the service task has
+// drained the device, so a device with frames left wakes the task again
+// right after re-arming and an idle one lets it block.
+static void IRAM_ATTR int_isr_handler(void *arg) {
+    dev_state_t *dev = &s_devs[(uintptr_t)arg];
+    uint32_t bit = 1UL << (uint32_t)(uintptr_t)arg;
+    BaseType_t woken = pdFALSE;
+    int64_t now_us = esp_timer_get_time();
+    gpio_intr_disable(dev->int_gpio);
+    CAN_TRACE(CAN_TRACE_ISR, (uintptr_t)arg, 0, 0);
+    portENTER_CRITICAL_ISR(&s_pending_mux);
+    s_pending |= bit;
+    if (dev->pending_since_us == 0) {
+        dev->pending_since_us = now_us;
+    }
+    portEXIT_CRITICAL_ISR(&s_pending_mux);
+    if (s_task) {
+        vTaskNotifyGiveFromISR(s_task, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+static bool rxq_push(dev_rx_queue_t *q, const can_frame_t *frame) {
+    uint16_t next = (q->tail + 1) % RX_QUEUE_LEN;
+    if (next == q->head) {
+        return false;
+    }
+    q->frames[q->tail] = *frame;
+    q->tail = next;
+    return true;
+}
+
+static inline uint16_t rxq_fill(const dev_rx_queue_t *q) {
+    return (uint16_t)((q->tail + RX_QUEUE_LEN - q->head) % RX_QUEUE_LEN);
+}
+
+static bool rxq_pop(dev_rx_queue_t *q, can_frame_t *frame) {
+    if (q->head == q->tail) {
+        return false;
+    }
+    *frame = q->frames[q->head];
+    q->head = (q->head + 1) % RX_QUEUE_LEN;
+    return true;
+}
+
+// Collect edge bits and devices whose INT line is still asserted (active low).
+// Devices without an INT pin are polled on every wake-up.
+static uint32_t take_pending(void) {
+    portENTER_CRITICAL(&s_pending_mux);
+    uint32_t pending = s_pending;
+    s_pending = 0;
+    portEXIT_CRITICAL(&s_pending_mux);
+    for (size_t i = 0; i < s_dev_count; i++) {
+        if (s_devs[i].int_gpio < 0 || gpio_get_level(s_devs[i].int_gpio) == 0) {
+            pending |= 1UL << i;
+        }
+    }
+    return pending;
+}
+
+// Drain up to quantum frames from one controller; returns the number read
+static int service_device(dev_state_t *dev, int64_t now_us) {
+    portENTER_CRITICAL(&s_pending_mux);
+    int64_t since_us = dev->pending_since_us;
+    dev->pending_since_us = 0;
+    portEXIT_CRITICAL(&s_pending_mux);
+    if (since_us) {
+        uint32_t wait_us = (uint32_t)(now_us - since_us);
+        if (wait_us > dev->stats.max_wait_us) {
+            dev->stats.max_wait_us = wait_us;
+        }
+    }
+    for (int n = 0; n < CONFIG_CAN_DISPATCH_MULTI_RX_QUANTUM; n++) {
+        twai_message_t msg;
+        dev_lock(dev - s_devs);
+        bool got = canif_receive(dev->dev_id, &msg);
+        dev_unlock(dev - s_devs);
+        if (!got) {
+            return n;
+        }
+        can_frame_t frame;
+        can_frame_from_twai(&frame, &msg);
+        CAN_TRACE(CAN_TRACE_RX_READ, dev - s_devs, frame.dlc, CAN_TRACE_FRAME_ID(&frame));
+#if CONFIG_CAN_DISPATCH_FILTER
+        if (!can_filter_accept(&frame)) {
+            dev->stats.filtered++;
+            continue;
+        }
+#endif
+        if (rxq_push(&dev->rxq, &frame)) {
+            dev->stats.frames++;
+            CAN_TRACE(CAN_TRACE_QUEUE_PUSH, CAN_TRACE_Q_MULTI_RX(dev - s_devs), rxq_fill(&dev->rxq),
+                      CAN_TRACE_FRAME_ID(&frame));
+        } else {
+            dev->stats.queue_overflows++;
+            CAN_TRACE(CAN_TRACE_QUEUE_FULL, CAN_TRACE_Q_MULTI_RX(dev - s_devs), RX_QUEUE_LEN - 1,
+                      CAN_TRACE_FRAME_ID(&frame));
+        }
+    }
+    dev->stats.quantum_exhausted++;
+    return CONFIG_CAN_DISPATCH_MULTI_RX_QUANTUM;
+}
+
+static void service_task(void *arg) {
+    while (s_run) {
+        bool idle = ulTaskNotifyTake(pdTRUE, SERVICE_IDLE_TICKS) == 0;
+        uint32_t pending = take_pending();
+        if (idle) {
+            // Re-arm lines left masked because they stayed low without frames
+            for (size_t i = 0; i < s_dev_count; i++) {
+                if (s_devs[i].int_gpio >= 0) {
+                    gpio_intr_enable(s_devs[i].int_gpio);
+                }
+            }
+        }
+        if (pending == 0) {
+            continue;
+        }
+
+        // Edges are timed by the ISR; polled devices and lines found low
+        // without an edge start waiting now
+        int64_t now_us = esp_timer_get_time();
+        portENTER_CRITICAL(&s_pending_mux);
+        for (size_t i = 0; i < s_dev_count; i++) {
+            if ((pending & (1UL << i)) && s_devs[i].pending_since_us == 0) {
+                s_devs[i].pending_since_us = now_us;
+            }
+        }
+        portEXIT_CRITICAL(&s_pending_mux);
+
+        // One round: visit devices starting at s_rr_next until the budget is
+        // spent. Devices left with frames (quantum spent or not reached) wake
+        // the task again through their re-armed INT line; devices without INT
+        // line have no such wake-up and notify the task directly.
+        int budget = CONFIG_CAN_DISPATCH_MULTI_ROUND_BUDGET;
+        size_t first_unserved = s_dev_count;
+        bool again = false;
+        for (size_t k = 0; k < s_dev_count; k++) {
+            size_t i = (s_rr_next + k) % s_dev_count;
+            dev_state_t *dev = &s_devs[i];
+            if (!(pending & (1UL << i))) {
+                continue;
+            }
+            int read = 0;
+            if (budget <= 0) {
+                dev->stats.deferred++;
+                if (first_unserved == s_dev_count) {
+                    first_unserved = i;
+                }
+                read = -1;
+            } else {
+                budget -= CONFIG_CAN_DISPATCH_MULTI_RX_QUANTUM;
+                read = service_device(dev, esp_timer_get_time());
+            }
+            if (dev->int_gpio < 0) {
+                again |= read == CONFIG_CAN_DISPATCH_MULTI_RX_QUANTUM || read < 0;
+            } else if (read != 0 || gpio_get_level(dev->int_gpio) != 0) {
+                // A line held low with nothing to read stays masked until the idle re-arm
+                gpio_intr_enable(dev->int_gpio);
+            }
+        }
+        if (again) {
+            xTaskNotifyGive(s_task);
+        }
+        // Start the next round with the first device that was skipped, otherwise rotate
+        s_rr_next = (first_unserved != s_dev_count) ? first_unserved : (s_rr_next + 1) % s_dev_count;
+    }
+    s_task = NULL;
+    vTaskDelete(NULL);
+}
+
+bool mcp2515_multi_service_start(const mcp2515_bundle_config_t *bundle, UBaseType_t priority) {
+    if (bundle == NULL || bundle->devices == NULL || bundle->device_count == 0) {
+        ESP_LOGE(TAG, "Invalid bundle configuration");
+        return false;
+    }
+    if (bundle->device_count > MCP2515_MULTI_MAX_DEVICES) {
+        ESP_LOGE(TAG, "Too many devices: %u (max %d)", (unsigned)bundle->device_count, MCP2515_MULTI_MAX_DEVICES);
+        return false;
+    }
+    if (s_task) {
+        return true;
+    }
+
+    memset(s_devs, 0, sizeof(s_devs));
+    for (size_t i = 0; i < bundle->device_count; i++) {
+        if (s_dev_lock[i] == NULL) {
+            s_dev_lock[i] = xSemaphoreCreateMutexStatic(&s_dev_lock_buf[i]);
+        }
+    }
+    s_dev_count = bundle->device_count;
+    s_rr_next = 0;
+    s_any_next = 0;
+    s_pending = 0;
+
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to install ISR service: %s", esp_err_to_name(err));
+        return false;
+    }
+    for (size_t i = 0; i < s_dev_count; i++) {
+        dev_state_t *dev = &s_devs[i];
+        dev->dev_id = bundle->devices[i].dev_id;
+        dev->int_gpio = bundle->devices[i].wiring.int_gpio;
+        if (dev->int_gpio < 0) {
+            ESP_LOGW(TAG, "Device %d has no INT pin, polled by the service task", (int)dev->dev_id);
+            continue;
+        }
+        gpio_config_t io_conf = {
+            .pin_bit_mask = 1ULL << dev->int_gpio,
+            .mode = GPIO_MODE_INPUT,
+            .pull_up_en = GPIO_PULLUP_ENABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_LOW_LEVEL
+        };
+        err = gpio_config(&io_conf);
+        if (err == ESP_OK) {
+            err = gpio_isr_handler_add(dev->int_gpio, int_isr_handler, (void *)(uintptr_t)i);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to set up INT GPIO %d: %s", dev->int_gpio, esp_err_to_name(err));
+            mcp2515_multi_service_stop();
+            return false;
+        }
+    }
+
+    s_run = true;
+    if (xTaskCreate(service_task, "mcp_multi_svc", SERVICE_STACK, NULL, priority, &s_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create service task");
+        s_run = false;
+        s_task = NULL;
+        mcp2515_multi_service_stop();
+        return false;
+    }
+    ESP_LOGI(TAG, "Servicing %u devices", (unsigned)s_dev_count);
+    return true;
+}
+
+void mcp2515_multi_service_stop(void) {
+    s_run = false;
+    if (s_task) {
+        xTaskNotifyGive(s_task);
+    }
+    while (s_task) {
+        vTaskDelay(1);
+    }
+    for (size_t i = 0; i < s_dev_count; i++) {
+        if (s_devs[i].int_gpio >= 0) {
+            // A level interrupt left enabled without handler would fire forever
+            gpio_intr_disable(s_devs[i].int_gpio);
+            gpio_isr_handler_remove(s_devs[i].int_gpio);
+        }
+    }
+}
+
+const mcp2515_bundle_config_t *mcp2515_multi_library_bundle(const mcp2515_bundle_config_t *bundle) {
+    if (bundle == NULL || bundle->devices == NULL || bundle->device_count > MCP2515_MULTI_MAX_DEVICES) {
+        return bundle;
+    }
+    s_lib_bundle = *bundle;
+    for (size_t i = 0; i < bundle->device_count; i++) {
+        s_lib_devices[i] = bundle->devices[i];
+        s_lib_devices[i].wiring.int_gpio = GPIO_NUM_NC;
+    }
+    s_lib_bundle.devices = s_lib_devices;
+    return &s_lib_bundle;
+}
+
+bool mcp2515_multi_service_running(void) {
+    return s_task != NULL;
+}
+
+size_t mcp2515_multi_device_count(void) {
+    return s_dev_count;
+}
+
+int mcp2515_multi_device_index(can_dev_id_t dev_id) {
+    for (size_t i = 0; i < s_dev_count; i++) {
+        if (s_devs[i].dev_id == dev_id) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+bool mcp2515_multi_send(size_t dev_index, const can_frame_t *frame) {
+    if (dev_index >= s_dev_count) {
+        return false;
+    }
+    twai_message_t msg;
+    can_frame_to_twai(frame, &msg);
+    dev_lock(dev_index);
+    bool sent = canif_send(s_devs[dev_index].dev_id, &msg);
+    dev_unlock(dev_index);
+    return sent;
+}
+
+bool mcp2515_multi_send_default(const can_frame_t *frame) {
+    twai_message_t msg;
+    can_frame_to_twai(frame, &msg);
+    // The library's default device is the first one of the bundle
+    dev_lock(0);
+    bool sent = canif_multi_send_default(&msg);
+    dev_unlock(0);
+    return sent;
+}
+
+bool mcp2515_multi_receive(size_t dev_index, can_frame_t *frame) {
+    if (dev_index >= s_dev_count) {
+        return false;
+    }
+    if (!rxq_pop(&s_devs[dev_index].rxq, frame)) {
+        return false;
+    }
+    CAN_TRACE(CAN_TRACE_QUEUE_POP, CAN_TRACE_Q_MULTI_RX(dev_index), rxq_fill(&s_devs[dev_index].rxq),
+              CAN_TRACE_FRAME_ID(frame));
+    return true;
+}
+
+bool mcp2515_multi_receive_any(can_frame_t *frame, size_t *dev_index) {
+    for (size_t k = 0; k < s_dev_count; k++) {
+        size_t i = (s_any_next + k) % s_dev_count;
+        if (rxq_pop(&s_devs[i].rxq, frame)) {
+            CAN_TRACE(CAN_TRACE_QUEUE_POP, CAN_TRACE_Q_MULTI_RX(i), rxq_fill(&s_devs[i].rxq),
+                      CAN_TRACE_FRAME_ID(frame));
+            s_any_next = (i + 1) % s_dev_count;
+            if (dev_index) {
+                *dev_index = i;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool mcp2515_multi_get_dev_stats(size_t dev_index, mcp2515_multi_dev_stats_t *stats) {
+    if (dev_index >= s_dev_count || stats == NULL) {
+        return false;
+    }
+    *stats = s_devs[dev_index].stats;
+    return true;
+}
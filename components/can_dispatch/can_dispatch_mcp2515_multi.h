@@ -0,0 +1,86 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "mcp25xxx_multi.h"
+#include "can_dispatch_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Aggregated RX service for all controllers of a mcp25xxx-multi bundle.
+//
+// One task services every device: INT edges from all devices set bits in a
+// shared pending mask and wake the task, which drains pending controllers
+// round-robin into per-device software queues. Each device gets at most
+// CONFIG_CAN_DISPATCH_MULTI_RX_QUANTUM frames per turn and a round reads at
+// most CONFIG_CAN_DISPATCH_MULTI_ROUND_BUDGET frames; the next round starts
+// with the first device that was not reached, so every pending device is
+// served within a bounded number of rounds.
+//
+// Devices are addressed by their index in mcp2515_bundle_config_t.devices.
+//
+// The service task reads a controller under a per-device lock; application
+// sends to the same controller must go through mcp2515_multi_send() or
+// mcp2515_multi_send_default(), which take the same lock, instead of calling
+// canif_send() / canif_multi_send_default() directly.
+//
+// The service owns the INT GPIOs: it configures them as level interrupts
+// and installs its own handlers. The mcp25xxx multi library must therefore
+// run without them. Initialize it with mcp2515_multi_library_bundle(bundle)
+// instead of the bundle, as can_twai_init() of the dispatcher does; the
+// library then reads its controllers on request and leaves the pins alone.
+
+#define MCP2515_MULTI_MAX_DEVICES 8
+
+// Per-device service counters
+typedef struct {
+    uint32_t frames;            // frames moved from the controller to the software queue
+    uint32_t queue_overflows;   // frames dropped because the software queue was full
+    uint32_t deferred;          // rounds the device was pending but not reached (budget spent)
+    uint32_t quantum_exhausted; // turns that ended with frames still pending in the controller
+    uint32_t max_wait_us;       // longest time from INT edge (taken in the ISR) to the start of its service turn
+    uint32_t filtered;          // frames dropped by the software acceptance filter
+} mcp2515_multi_dev_stats_t;
+
+// Copy of the bundle with every INT pin removed (GPIO_NUM_NC), for
+// canif_multi_init_default(). Points to static storage reused by the next call.
+const mcp2515_bundle_config_t *mcp2515_multi_library_bundle(const mcp2515_bundle_config_t *bundle);
+
+// Start the service for the bundle (with its INT pins); the library must have
+// been initialized with mcp2515_multi_library_bundle(bundle)
+bool mcp2515_multi_service_start(const mcp2515_bundle_config_t *bundle, UBaseType_t priority);
+
+// Stop the service task and remove the INT handlers
+void mcp2515_multi_service_stop(void);
+
+// True while the service task is running
+bool mcp2515_multi_service_running(void);
+
+// Number of devices handled by the service
+size_t mcp2515_multi_device_count(void);
+
+// Index of a device in the bundle, -1 if unknown
+int mcp2515_multi_device_index(can_dev_id_t dev_id);
+
+// Send frame through device dev_index, serialized with the service task
+bool mcp2515_multi_send(size_t dev_index, const can_frame_t *frame);
+
+// Send frame through the library's default device (the first of the bundle),
+// serialized with the service task
+bool mcp2515_multi_send_default(const can_frame_t *frame);
+
+// Receive frame queued for device dev_index (non-blocking)
+bool mcp2515_multi_receive(size_t dev_index, can_frame_t *frame);
+
+// Receive frame from any device, round-robin across devices; stores the source index
+bool mcp2515_multi_receive_any(can_frame_t *frame, size_t *dev_index);
+
+// Read service counters of device dev_index
+bool mcp2515_multi_get_dev_stats(size_t dev_index, mcp2515_multi_dev_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,8 +1,17 @@
 #include "can_dispatch_mcp2515_single.h"
+#include "can_dispatch_trace.h"
+#if CONFIG_CAN_DISPATCH_SPI_PROF
+#include "can_dispatch_spi_prof.h"
+#include "esp_cpu.h"
+#include "esp_private/esp_clk.h"
+#endif
 #include "mcp2515.h"
 #include "driver/spi_master.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -10,6 +19,52 @@ static const char *TAG = "MCP25XXX_SINGLE_ADAPTER";
 // Keep pointer to bundle (provided by example config, typically static const)
 static const mcp2515_bundle_config_t *s_bundle = NULL;
 static volatile bool interrupt_pending = false;
+// SPI handle cached after spi_bus_add_device(); used by the frame hot path
+static spi_device_handle_t s_spi = NULL;
+
+// Every public entry point runs under this lock: a send or receive is a
+// sequence of SPI commands over shared TX/RX bookkeeping, and callers include
+// application tasks, the shaper drain timer (esp_timer task) and the gateway
+// task. Recursive, so the TX abort callback may send again.
+static StaticSemaphore_t s_lock_buf;
+static SemaphoreHandle_t s_lock = NULL;
+
+static void adapter_lock(void) {
+    if (s_lock) {
+        xSemaphoreTakeRecursive(s_lock, portMAX_DELAY);
+    }
+}
+
+static void adapter_unlock(void) {
+    if (s_lock) {
+        xSemaphoreGiveRecursive(s_lock);
+    }
+}
+
+// TX buffer bookkeeping for deadline-aware and one-shot transmit (index = TXBn)
+typedef struct {
+    uint32_t identifier;    // identifier loaded into the buffer
+    int64_t deadline_us;    // 0 = no deadline
+    bool single_shot;       // loaded while CANCTRL.OSM was set
+    bool in_use;            // frame loaded by this adapter, TXREQ may still be set
+} mcp_tx_slot_t;
+
+static const REGISTER_t tx_ctrl_regs[3] = {MCP_TXB0CTRL, MCP_TXB1CTRL, MCP_TXB2CTRL};
+static mcp_tx_slot_t tx_slots[3];
+static mcp2515_single_tx_stats_t tx_stats;
+static bool osm_enabled = false;    // current CANCTRL.OSM state
+
+#ifndef CONFIG_CAN_DISPATCH_MCP2515_ONE_SHOT
+#define CONFIG_CAN_DISPATCH_MCP2515_ONE_SHOT 0
+#endif
+
+// Software FIFO between the two hardware RX buffers and the caller. A drain
+// round may read both RXB0 and RXB1; the second frame waits here.
+#define RX_FIFO_LEN 4
+static can_frame_t rx_fifo[RX_FIFO_LEN];
+static uint8_t rx_fifo_head = 0;
+static uint8_t rx_fifo_count = 0;
+static mcp2515_single_rx_stats_t rx_stats;
 
 // Compile-time switch for SPI/link diagnostics in MCP25xxx adapter
 #ifndef MCP25XXX_ADAPTER_DEBUG
@@ -75,8 +130,36 @@ static void mcp2515_diagnostics(void) {
 }
 #endif
 
+#if CONFIG_CAN_DISPATCH_SPI_PROF
+// SPI driver hooks around every transaction on the device, including the
+// ones issued by the mcp2515 library
+static uint32_t prof_start_cycles;
+static uint32_t prof_cycles_per_us;
+static uint8_t prof_prefix_bytes;   // command + address phase bytes, if the device uses them
+static bool prof_cmd_phase;
+
+static void IRAM_ATTR spi_prof_pre_cb(spi_transaction_t *t) {
+    prof_start_cycles = esp_cpu_get_cycle_count();
+}
+
+static void IRAM_ATTR spi_prof_post_cb(spi_transaction_t *t) {
+    uint32_t cycles = esp_cpu_get_cycle_count() - prof_start_cycles;
+    uint8_t instr;
+    if (prof_cmd_phase) {
+        instr = (uint8_t)t->cmd;
+    } else if (t->flags & SPI_TRANS_USE_TXDATA) {
+        instr = t->tx_data[0];
+    } else {
+        instr = t->tx_buffer ? *(const uint8_t *)t->tx_buffer : 0;
+    }
+    can_spi_prof_record(instr, (uint32_t)(t->length / 8) + prof_prefix_bytes,
+                        (uint32_t)((uint64_t)cycles * 1000 / prof_cycles_per_us));
+}
+#endif
+
 // Interrupt handler
 static void IRAM_ATTR isr_handler(void* arg) {
+    CAN_TRACE(CAN_TRACE_ISR, 0, 0, 0);
     interrupt_pending = true;
 }
 
@@ -104,6 +187,70 @@ static void test_gpio_cs(gpio_num_t cs_gpio) {
 #endif
 
 
+// --------------------------------------------------------------------------------------
+// Frame <-> register image
+// --------------------------------------------------------------------------------------
+// TX/RX buffers share the layout SIDH, SIDL, EIDH, EIDL, DLC, D0..D7. Frames are
+// encoded straight from can_frame_t into the SPI transfer buffer (and decoded
+// back), so the hot path never goes through the library's CAN_FRAME_t.
+
+#define MCP_INSTR_LOAD_TX       0x40    // + 0x00/0x02/0x04 -> TXB0/1/2 starting at SIDH
+#define MCP_INSTR_RTS           0x80    // + 0x01/0x02/0x04 -> TXB0/1/2
+#define MCP_INSTR_READ_RX       0x90    // + 0x00/0x04 -> RXB0/1 starting at SIDH, clears RXnIF
+#define MCP_SIDL_EXIDE          0x08
+#define MCP_SIDL_SRR            0x10
+#define MCP_DLC_RTR             0x40
+#define MCP_DLC_MASK            0x0F
+#define MCP_BUF_IMAGE_LEN       13      // SIDH..D7
+
+static void frame_to_regs(const can_frame_t *frame, uint8_t *regs) {
+    uint32_t id = frame->id;
+    if (can_frame_is_extd(frame)) {
+        regs[0] = (uint8_t)(id >> 21);
+        regs[1] = (uint8_t)(((id >> 13) & 0xE0) | MCP_SIDL_EXIDE | ((id >> 16) & 0x03));
+        regs[2] = (uint8_t)(id >> 8);
+        regs[3] = (uint8_t)id;
+    } else {
+        regs[0] = (uint8_t)(id >> 3);
+        regs[1] = (uint8_t)((id & 0x07) << 5);
+        regs[2] = 0;
+        regs[3] = 0;
+    }
+    regs[4] = frame->dlc | ((frame->flags & CAN_FRAME_FLAG_RTR) ? MCP_DLC_RTR : 0);
+    memcpy(&regs[5], frame->data, CAN_FRAME_MAX_DLC);
+}
+
+static void regs_to_frame(const uint8_t *regs, can_frame_t *frame) {
+    uint32_t id = ((uint32_t)regs[0] << 3) | (regs[1] >> 5);
+    frame->flags = 0;
+    frame->reserved = 0;
+    if (regs[1] & MCP_SIDL_EXIDE) {
+        id = (id << 18) | ((uint32_t)(regs[1] & 0x03) << 16) | ((uint32_t)regs[2] << 8) | regs[3];
+        frame->flags |= CAN_FRAME_FLAG_EXTD;
+        if (regs[4] & MCP_DLC_RTR) {
+            frame->flags |= CAN_FRAME_FLAG_RTR;
+        }
+    } else if (regs[1] & MCP_SIDL_SRR) {
+        frame->flags |= CAN_FRAME_FLAG_RTR;
+    }
+    frame->id = id;
+    frame->dlc = regs[4] & MCP_DLC_MASK;
+    memcpy(frame->data, &regs[5], CAN_FRAME_MAX_DLC);
+}
+
+// Single full-duplex SPI transaction on the adapter's device handle
+static bool mcp_spi_xfer(const uint8_t *tx, uint8_t *rx, size_t len) {
+    spi_transaction_t t = {
+        .length = len * 8,
+        .tx_buffer = tx,
+        .rx_buffer = rx,
+    };
+    CAN_TRACE(CAN_TRACE_SPI_BEGIN, tx[0], len, 0);
+    bool ok = spi_device_polling_transmit(s_spi, &t) == ESP_OK;
+    CAN_TRACE(CAN_TRACE_SPI_END, tx[0], len, ok);
+    return ok;
+}
+
 // Initialize MCP25xxx adapter
 bool mcp2515_single_init(const mcp2515_bundle_config_t *cfg) {
     ESP_LOGI(TAG, "Initializing MCP25xxx adapter");
@@ -113,7 +260,11 @@ bool mcp2515_single_init(const mcp2515_bundle_config_t *cfg) {
         return false;
     }
 
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateRecursiveMutexStatic(&s_lock_buf);
+    }
     s_bundle = cfg;
+    memset(tx_slots, 0, sizeof(tx_slots));
     const mcp2515_device_config_t *dev0 = &s_bundle->devices[0];
 
     #if MCP25XXX_ADAPTER_DEBUG
@@ -156,11 +307,20 @@ if (err != ESP_OK) {
     // Step 3: Add MCP2515 device to SPI bus
     spi_device_interface_config_t idf_dev_cfg = {0};
     mcp_spi_dev_to_idf(&dev0->wiring, &dev0->spi_params, &idf_dev_cfg);
+    #if CONFIG_CAN_DISPATCH_SPI_PROF
+    prof_cycles_per_us = (uint32_t)esp_clk_cpu_freq() / 1000000;
+    prof_cmd_phase = idf_dev_cfg.command_bits != 0;
+    prof_prefix_bytes = (uint8_t)((idf_dev_cfg.command_bits + idf_dev_cfg.address_bits) / 8);
+    idf_dev_cfg.pre_cb = spi_prof_pre_cb;
+    idf_dev_cfg.post_cb = spi_prof_post_cb;
+    can_spi_prof_reset();
+    #endif
     err = spi_bus_add_device(host, &idf_dev_cfg, &MCP2515_Object->spi);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to add MCP2515 device to SPI bus: %s", esp_err_to_name(err));
         return false;
     }
+    s_spi = MCP2515_Object->spi;
     
     // Step 4: Reset and configure MCP2515
     ret = MCP2515_reset();
@@ -308,6 +468,23 @@ if (err != ESP_OK) {
         }
     }
 
+    // Configure RXB0 -> RXB1 rollover (BUKT) explicitly in both directions,
+    // so the result does not depend on what the library's reset left behind
+    #if CONFIG_CAN_DISPATCH_MCP2515_RX_ROLLOVER
+    MCP2515_modifyRegister(MCP_RXB0CTRL, RXB0CTRL_BUKT, RXB0CTRL_BUKT);
+    #else
+    MCP2515_modifyRegister(MCP_RXB0CTRL, RXB0CTRL_BUKT, 0);
+    #endif
+    // One-shot mode (CANCTRL.OSM): no automatic retransmission after lost
+    // arbitration or error. Per-frame requests may enable it temporarily.
+    osm_enabled = CONFIG_CAN_DISPATCH_MCP2515_ONE_SHOT;
+    MCP2515_modifyRegister(MCP_CANCTRL, CANCTRL_OSM, osm_enabled ? CANCTRL_OSM : 0);
+    memset(&tx_stats, 0, sizeof(tx_stats));
+
+    rx_fifo_head = 0;
+    rx_fifo_count = 0;
+    memset(&rx_stats, 0, sizeof(rx_stats));
+
     // Re-apply requested mode after filter/mask configuration (they force config mode)
     #if MCP25XXX_ADAPTER_DEBUG
     ESP_LOGI(TAG, "Re-applying %s mode after filter/mask configuration", mode_name);
@@ -399,6 +576,7 @@ bool mcp2515_single_deinit() {
             ESP_LOGE(TAG, "Failed to remove SPI device: %s", esp_err_to_name(err));
             return false;
         }
+        s_spi = NULL;
     }
     
     // Step 4: Free SPI bus (if managed here)
@@ -412,101 +590,390 @@ bool mcp2515_single_deinit() {
     return true;
 }
 
-// Send message
-bool mcp2515_single_send(const twai_message_t *msg) {
-    if (msg->data_length_code > CAN_MAX_DLEN) {
-        ESP_LOGE(TAG, "Message too long: %d bytes", msg->data_length_code);
+// Update bookkeeping of TX buffer i from a fresh TXBnCTRL read
+static void tx_slot_refresh(int i, uint8_t ctrl) {
+    mcp_tx_slot_t *slot = &tx_slots[i];
+    if (!slot->in_use || (ctrl & TXB_TXREQ)) {
+        return;
+    }
+    // TXREQ cleared by the controller: sent, or given up after a single
+    // attempt in one-shot mode (ABTF set, no retransmission)
+    if (slot->single_shot && (ctrl & TXB_ABTF)) {
+        tx_stats.not_retransmitted++;
+    }
+    CAN_TRACE(CAN_TRACE_TX_DONE, i, 0, slot->identifier);
+    slot->in_use = false;
+}
+
+// Load frame into TX buffer i (LOAD TX BUFFER + RTS) and track it
+static bool tx_load(int i, const can_frame_t *frame, int64_t deadline_us, bool single_shot) {
+    uint8_t tx[1 + MCP_BUF_IMAGE_LEN];
+    tx[0] = MCP_INSTR_LOAD_TX | (uint8_t)(i << 1);
+    frame_to_regs(frame, &tx[1]);
+    const uint8_t rts = MCP_INSTR_RTS | (uint8_t)(1 << i);
+    if (!mcp_spi_xfer(tx, NULL, 1 + 5 + frame->dlc) || !mcp_spi_xfer(&rts, NULL, 1)) {
+        tx_slots[i].in_use = false;
         return false;
     }
+    tx_slots[i].identifier = frame->id;
+    tx_slots[i].deadline_us = deadline_us;
+    tx_slots[i].single_shot = single_shot;
+    tx_slots[i].in_use = true;
+    #if CONFIG_CAN_DISPATCH_SPI_PROF
+    can_spi_prof_frame(false, frame->dlc);
+    #endif
+    CAN_TRACE(CAN_TRACE_TX_LOAD, i, frame->dlc, CAN_TRACE_FRAME_ID(frame));
+    return true;
+}
 
-    // Check TX buffer status BEFORE sending
-    uint8_t ctrl0 = MCP2515_readRegister(MCP_TXB0CTRL);
-    uint8_t ctrl1 = MCP2515_readRegister(MCP_TXB1CTRL);
-    uint8_t ctrl2 = MCP2515_readRegister(MCP_TXB2CTRL);
-    ESP_LOGD(TAG, "TX buffer status: TXB0=0x%02X, TXB1=0x%02X, TXB2=0x%02X", ctrl0, ctrl1, ctrl2);
- 
-    // Convert twai_message_t to CAN_FRAME_t
-    CAN_FRAME_t frame;  // Array of size 1 containing can_frame structure
-    frame[0].can_id = msg->identifier;
-    frame[0].can_dlc = msg->data_length_code;
-    memcpy(frame[0].data, msg->data, msg->data_length_code);
-    
-    ERROR_t ret = MCP2515_sendMessageAfterCtrlCheck(frame);
-    
-    if (ret != ERROR_OK) {
-        // Read error flags
-        uint8_t eflg = MCP2515_readRegister(MCP_EFLG);
-        uint8_t canintf = MCP2515_readRegister(MCP_CANINTF);
-        // Read TX buffer CTRL registers to diagnose reason
-        uint8_t t0 = MCP2515_readRegister(MCP_TXB0CTRL);
-        uint8_t t1 = MCP2515_readRegister(MCP_TXB1CTRL);
-        uint8_t t2 = MCP2515_readRegister(MCP_TXB2CTRL);
-        ESP_LOGE(TAG, "Failed to send message: %d, EFLG=0x%02X, CANINTF=0x%02X", ret, eflg, canintf);
-        ESP_LOGE(TAG, "TXBCTRL: TXB0=0x%02X TXB1=0x%02X TXB2=0x%02X", t0, t1, t2);
-        ESP_LOGE(TAG, "TXB0 flags: ABTF=%d MLOA=%d TXERR=%d", (t0 & TXB_ABTF)?1:0, (t0 & TXB_MLOA)?1:0, (t0 & TXB_TXERR)?1:0);
-        // Clear message error flag if set
-        if (canintf & CANINTF_MERRF) {
-            MCP2515_clearMERR();
+// CANCTRL.OSM can only change while no buffer other than `except` (-1 = none)
+// is pending, since the bit applies to every frame that starts transmission
+// while it is set
+static bool tx_one_shot_allowed(bool enable, const uint8_t ctrl[3], int except) {
+    if (enable == osm_enabled) {
+        return true;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (i != except && (ctrl[i] & TXB_TXREQ)) {
+            return false;
         }
+    }
+    return true;
+}
+
+// Switch CANCTRL.OSM (see tx_one_shot_allowed)
+static bool tx_set_one_shot(bool enable, const uint8_t ctrl[3]) {
+    if (enable == osm_enabled) {
+        return true;
+    }
+    if (!tx_one_shot_allowed(enable, ctrl, -1)) {
         return false;
     }
-    
+    MCP2515_modifyRegister(MCP_CANCTRL, CANCTRL_OSM, enable ? CANCTRL_OSM : 0);
+    osm_enabled = enable;
     return true;
 }
 
-// Receive message
-bool mcp2515_single_receive(twai_message_t *msg) {
-    if (!interrupt_pending && !MCP2515_checkReceive()) {
+// Abort TX buffers still waiting for arbitration past their deadline
+uint32_t mcp2515_single_tx_abort_expired(int64_t now_us, void (*on_abort)(uint32_t identifier)) {
+    uint32_t aborted = 0;
+    uint32_t identifiers[3];
+    adapter_lock();
+    for (int i = 0; i < 3; i++) {
+        mcp_tx_slot_t *slot = &tx_slots[i];
+        if (!slot->in_use) {
+            continue;
+        }
+        tx_slot_refresh(i, MCP2515_readRegister(tx_ctrl_regs[i]));
+        if (!slot->in_use) {
+            continue;
+        }
+        if (slot->deadline_us == 0 || now_us < slot->deadline_us) {
+            continue;
+        }
+        // Clearing TXREQ aborts only this buffer; a frame already on the wire
+        // completes normally. CANCTRL.ABAT is not used since it would abort
+        // fresh frames in the other buffers as well.
+        MCP2515_modifyRegister(tx_ctrl_regs[i], TXB_TXREQ, 0);
+        slot->in_use = false;
+        identifiers[aborted++] = slot->identifier;
+        ESP_LOGD(TAG, "TXB%d aborted: ID=0x%lX missed deadline", i, (unsigned long)slot->identifier);
+    }
+    adapter_unlock();
+    // Reported outside the lock: the callback may block on other locks
+    for (uint32_t i = 0; on_abort && i < aborted; i++) {
+        on_abort(identifiers[i]);
+    }
+    return aborted;
+}
+
+// Send message with optional deadline, replace-in-queue and one-shot (lock held)
+static can_dispatch_tx_result_t tx_send(const can_frame_t *frame, int64_t deadline_us,
+                                        bool replace_pending, bool single_shot) {
+    if (frame->dlc > CAN_FRAME_MAX_DLC) {
+        ESP_LOGE(TAG, "Message too long: %d bytes", frame->dlc);
+        return CAN_DISPATCH_TX_ERROR;
+    }
+    if (deadline_us != 0 && esp_timer_get_time() >= deadline_us) {
+        return CAN_DISPATCH_TX_EXPIRED;
+    }
+    single_shot = single_shot || (frame->flags & CAN_FRAME_FLAG_SINGLE_SHOT) || CONFIG_CAN_DISPATCH_MCP2515_ONE_SHOT;
+
+    // Read all three TXBnCTRL once; reused by replace and free-buffer search
+    uint8_t ctrl[3];
+    for (int i = 0; i < 3; i++) {
+        ctrl[i] = MCP2515_readRegister(tx_ctrl_regs[i]);
+        tx_slot_refresh(i, ctrl[i]);
+    }
+    ESP_LOGD(TAG, "TX buffer status: TXB0=0x%02X, TXB1=0x%02X, TXB2=0x%02X", ctrl[0], ctrl[1], ctrl[2]);
+
+    if (replace_pending) {
+        for (int i = 0; i < 3; i++) {
+            mcp_tx_slot_t *slot = &tx_slots[i];
+            if (!slot->in_use || slot->identifier != frame->id || !(ctrl[i] & TXB_TXREQ)) {
+                continue;
+            }
+            // Check the retransmission mode first: the pending frame must not
+            // be aborted if the new one cannot take its place
+            if (!tx_one_shot_allowed(single_shot, ctrl, i)) {
+                return CAN_DISPATCH_TX_BUSY;
+            }
+            // Request abort and check it took effect: if the frame is currently
+            // being transmitted TXREQ stays set until it completes.
+            MCP2515_modifyRegister(tx_ctrl_regs[i], TXB_TXREQ, 0);
+            ctrl[i] = MCP2515_readRegister(tx_ctrl_regs[i]);
+            if (ctrl[i] & TXB_TXREQ) {
+                break;
+            }
+            // Cannot fail: the other buffers were idle above and only this
+            // adapter (under its lock) sets TXREQ
+            tx_set_one_shot(single_shot, ctrl);
+            if (!tx_load(i, frame, deadline_us, single_shot)) {
+                return CAN_DISPATCH_TX_ERROR;
+            }
+            return CAN_DISPATCH_TX_REPLACED;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (ctrl[i] & TXB_TXREQ) {
+            continue;
+        }
+        if (!tx_set_one_shot(single_shot, ctrl)) {
+            // Pending frames were queued with the other retransmission mode
+            return CAN_DISPATCH_TX_BUSY;
+        }
+        if (!tx_load(i, frame, deadline_us, single_shot)) {
+            ESP_LOGE(TAG, "Failed to load TXB%d", i);
+            return CAN_DISPATCH_TX_ERROR;
+        }
+        return CAN_DISPATCH_TX_QUEUED;
+    }
+    return CAN_DISPATCH_TX_BUSY;
+}
+
+can_dispatch_tx_result_t mcp2515_single_send_ex(const can_frame_t *frame, int64_t deadline_us,
+                                                bool replace_pending, bool single_shot) {
+    adapter_lock();
+    can_dispatch_tx_result_t res = tx_send(frame, deadline_us, replace_pending, single_shot);
+    adapter_unlock();
+    return res;
+}
+
+// Send message
+bool mcp2515_single_send(const can_frame_t *frame) {
+    adapter_lock();
+    can_dispatch_tx_result_t res = tx_send(frame, 0, false, false);
+    // All TX buffers pending is the normal back-pressure of streaming senders:
+    // no SPI diagnostics and no logging for it
+    if (res != CAN_DISPATCH_TX_ERROR || frame->dlc > CAN_FRAME_MAX_DLC) {
+        adapter_unlock();
+        return res == CAN_DISPATCH_TX_QUEUED;
+    }
+
+    // Read error flags
+    uint8_t eflg = MCP2515_readRegister(MCP_EFLG);
+    uint8_t canintf = MCP2515_readRegister(MCP_CANINTF);
+    // Read TX buffer CTRL registers to diagnose reason
+    uint8_t t0 = MCP2515_readRegister(MCP_TXB0CTRL);
+    uint8_t t1 = MCP2515_readRegister(MCP_TXB1CTRL);
+    uint8_t t2 = MCP2515_readRegister(MCP_TXB2CTRL);
+    ESP_LOGE(TAG, "Failed to send message: %d, EFLG=0x%02X, CANINTF=0x%02X", res, eflg, canintf);
+    ESP_LOGE(TAG, "TXBCTRL: TXB0=0x%02X TXB1=0x%02X TXB2=0x%02X", t0, t1, t2);
+    ESP_LOGE(TAG, "TXB0 flags: ABTF=%d MLOA=%d TXERR=%d", (t0 & TXB_ABTF)?1:0, (t0 & TXB_MLOA)?1:0, (t0 & TXB_TXERR)?1:0);
+    // Clear message error flag if set
+    if (canintf & CANINTF_MERRF) {
+        MCP2515_clearMERR();
+    }
+    adapter_unlock();
+    return false;
+}
+
+// Read TX counters
+void mcp2515_single_get_tx_stats(mcp2515_single_tx_stats_t *stats) {
+    if (stats) {
+        *stats = tx_stats;
+    }
+}
+
+static bool rx_fifo_pop(can_frame_t *frame) {
+    if (rx_fifo_count == 0) {
+        return false;
+    }
+    *frame = rx_fifo[rx_fifo_head];
+    rx_fifo_head = (rx_fifo_head + 1) % RX_FIFO_LEN;
+    rx_fifo_count--;
+    CAN_TRACE(CAN_TRACE_QUEUE_POP, CAN_TRACE_Q_SINGLE_RX, rx_fifo_count, CAN_TRACE_FRAME_ID(frame));
+    return true;
+}
+
+// Read one hardware buffer (READ RX BUFFER, clears RXnIF) into the FIFO tail
+static bool rx_read_buffer(RXBn_t rxb) {
+    if (rx_fifo_count == RX_FIFO_LEN) {
+        CAN_TRACE(CAN_TRACE_QUEUE_FULL, CAN_TRACE_Q_SINGLE_RX, rx_fifo_count, 0);
+        return false;
+    }
+    uint8_t tx[1 + MCP_BUF_IMAGE_LEN] = {0};
+    uint8_t rx[1 + MCP_BUF_IMAGE_LEN];
+    tx[0] = MCP_INSTR_READ_RX | (rxb == RXB1 ? 0x04 : 0x00);
+    if (!mcp_spi_xfer(tx, rx, sizeof(tx))) {
+        ESP_LOGE(TAG, "Failed to read RXB%d", (int)rxb);
+        return false;
+    }
+    can_frame_t *slot = &rx_fifo[(rx_fifo_head + rx_fifo_count) % RX_FIFO_LEN];
+    regs_to_frame(&rx[1], slot);
+    CAN_TRACE(CAN_TRACE_RX_READ, rxb, slot->dlc, CAN_TRACE_FRAME_ID(slot));
+    if (slot->dlc > CAN_FRAME_MAX_DLC) {
+        ESP_LOGE(TAG, "Received message too long: %d bytes", slot->dlc);
+        return false;
+    }
+    rx_stats.frames++;
+    #if CONFIG_CAN_DISPATCH_SPI_PROF
+    can_spi_prof_frame(true, slot->dlc);
+    #endif
+    #if CONFIG_CAN_DISPATCH_FILTER
+    // Buffer is consumed either way; a rejected frame just never enters the FIFO
+    if (!can_filter_accept(slot)) {
+        rx_stats.filtered++;
+        return true;
+    }
+    #endif
+    rx_fifo_count++;
+    CAN_TRACE(CAN_TRACE_QUEUE_PUSH, CAN_TRACE_Q_SINGLE_RX, rx_fifo_count, CAN_TRACE_FRAME_ID(slot));
+    return true;
+}
+
+// Move pending hardware frames into the FIFO in arrival order.
+//
+// With rollover a frame is stored in RXB1 only while RXB0 is full, so RXB0
+// is older when both are pending. Once RXB0 is read, new frames land in
+// RXB0 again, so a frame sitting in RXB1 at that point is older than
+// anything arriving later: read it right away, before RXB0 is revisited.
+// Each decision uses a single READ STATUS transaction.
+static void rx_drain(uint8_t status) {
+    if (status & STAT_RX0IF) {
+        if (!rx_read_buffer(RXB0)) {
+            return;
+        }
+        status = MCP2515_getStatus();
+        if (status & STAT_RX1IF) {
+            rx_read_buffer(RXB1);
+        }
+    } else if (status & STAT_RX1IF) {
+        rx_read_buffer(RXB1);
+    }
+}
+
+// Receive message (lock held)
+static bool rx_receive(can_frame_t *frame) {
+    if (rx_fifo_pop(frame)) {
+        return true;
+    }
+
+    uint8_t status = MCP2515_getStatus();
+    if (!interrupt_pending && !(status & (STAT_RX0IF | STAT_RX1IF))) {
         return false;
     }
     
     // Check for errors
     if (MCP2515_checkError()) {
         uint8_t eflg = MCP2515_getErrorFlags();
-        ESP_LOGE(TAG, "MCP25xxx error flags: 0x%02x", eflg);
         // Handle RX buffer overrun explicitly: clear EFLG RXnOVR and related interrupts
         if (eflg & (EFLG_RX0OVR | EFLG_RX1OVR)) {
+            ESP_LOGW(TAG, "RX overrun: EFLG=0x%02x", eflg);
+            if (eflg & EFLG_RX0OVR) {
+                rx_stats.rx0_overruns++;
+            }
+            if (eflg & EFLG_RX1OVR) {
+                rx_stats.rx1_overruns++;
+            }
             MCP2515_clearRXnOVR();
         } else {
+            ESP_LOGE(TAG, "MCP25xxx error flags: 0x%02x", eflg);
             // Clear generic error interrupt flag
             MCP2515_clearERRIF();
         }
-        // Ensure we don't remain stuck thinking an interrupt is pending
-        interrupt_pending = false;
-        return false;
+        // Frames still sitting in RXB0/RXB1 are valid - keep draining them
     }
-    
-    // Read CAN frame from MCP25xxx
-    CAN_FRAME_t frame;  // Array of size 1 containing can_frame structure
-    ERROR_t ret = MCP2515_readMessageAfterStatCheck(frame);
-    if (ret != ERROR_OK) {
-        ESP_LOGE(TAG, "Failed to read message: %d", ret);
-        // Clear spurious interrupt flags to avoid IRQ storm
-        MCP2515_clearInterrupts();
-        interrupt_pending = false;
-        return false;
-    }
-    
-    if (frame[0].can_dlc > CAN_MAX_DLEN) {
-        ESP_LOGE(TAG, "Received message too long: %d bytes", frame[0].can_dlc);
-        return false;
+
+    interrupt_pending = false;
+    rx_drain(status);
+    return rx_fifo_pop(frame);
+}
+
+bool mcp2515_single_receive(can_frame_t *frame) {
+    adapter_lock();
+    bool ok = rx_receive(frame);
+    adapter_unlock();
+    return ok;
+}
+
+// Read RX counters
+void mcp2515_single_get_rx_stats(mcp2515_single_rx_stats_t *stats) {
+    if (stats) {
+        *stats = rx_stats;
     }
-    
-    // Convert CAN_FRAME_t to twai_message_t
-    msg->identifier = frame[0].can_id;
-    msg->data_length_code = frame[0].can_dlc;
-    msg->flags = 0;  // Standard frame by default
-    memcpy(msg->data, frame[0].data, frame[0].can_dlc);
-    
-    // Drain any remaining RX frames to prevent RXnOVR under burst logging or delays
-    while (MCP2515_checkReceive()) {
-        CAN_FRAME_t drain;
-        if (MCP2515_readMessageAfterStatCheck(drain) != ERROR_OK) {
-            break;
+}
+
+#if CONFIG_CAN_DISPATCH_FILTER
+// Request normal/loopback mode (as configured in the bundle) and wait for CANSTAT
+static bool request_run_mode(void) {
+    CANCTRL_REQOP_MODE_t target_mode = s_bundle->devices[0].can.use_loopback ? CANCTRL_REQOP_LOOPBACK
+                                                                             : CANCTRL_REQOP_NORMAL;
+    MCP2515_modifyRegister(MCP_CANCTRL, CANCTRL_REQOP, target_mode);
+    for (int attempt = 0; attempt < 10; attempt++) {
+        vTaskDelay(pdMS_TO_TICKS(20));
+        if (((MCP2515_readRegister(MCP_CANSTAT) >> 5) & 0x07) == ((target_mode >> 5) & 0x07)) {
+            return true;
         }
     }
+    return false;
+}
 
-    interrupt_pending = false;  // Reset interrupt flag after successful read and drain
+// Program masks and filters, back to run mode (lock held)
+static bool hw_filter_write(const can_filter_hw_plan_t *plan) {
+    // Filter/mask writes switch the controller to configuration mode
+    const MASK_t masks[] = {MASK0, MASK1};
+    for (int i = 0; i < 2; i++) {
+        ERROR_t ret = MCP2515_setFilterMask(masks[i], true, plan->mask[i]);
+        if (ret != ERROR_OK) {
+            ESP_LOGE(TAG, "Failed to set mask %d: %d", i, ret);
+            return false;
+        }
+    }
+    const RXF_t filters[] = {RXF0, RXF1, RXF2, RXF3, RXF4, RXF5};
+    for (int i = 0; i < 6; i++) {
+        ERROR_t ret = MCP2515_setFilter(filters[i], plan->filter_extd[i], plan->filter[i]);
+        if (ret != ERROR_OK) {
+            ESP_LOGE(TAG, "Failed to set filter %d: %d", i, ret);
+            return false;
+        }
+    }
+    if (!request_run_mode()) {
+        ESP_LOGE(TAG, "Failed to leave configuration mode after filter update");
+        return false;
+    }
+    ESP_LOGI(TAG, "Hardware filter: RXM0=0x%08lX RXM1=0x%08lX, %llu IDs pass",
+             (unsigned long)plan->mask[0], (unsigned long)plan->mask[1],
+             (unsigned long long)plan->accepted_ids);
     return true;
 }
 
+// Program hardware acceptance masks and filters
+bool mcp2515_single_set_hw_filter(const can_filter_hw_plan_t *plan) {
+    if (s_bundle == NULL) {
+        ESP_LOGE(TAG, "Adapter not initialized");
+        return false;
+    }
+    can_filter_hw_plan_t accept_all;
+    if (plan == NULL) {
+        can_filter_plan_hw(NULL, 0, &accept_all);
+        plan = &accept_all;
+    }
+    // Senders and receivers wait while the controller is in configuration mode
+    adapter_lock();
+    bool ok = hw_filter_write(plan);
+    adapter_unlock();
+    return ok;
+}
+#endif
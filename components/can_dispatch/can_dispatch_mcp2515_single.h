@@ -3,11 +3,30 @@
 #include "driver/spi_master.h"
 #include "driver/gpio.h"
 #include "mcp25xxx_multi.h"
+#include "sdkconfig.h"
+#include "can_dispatch_frame.h"
+#include "can_dispatch_filter.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// RX path counters
+typedef struct {
+    uint32_t frames;        // frames read from RXB0/RXB1
+    uint32_t rx0_overruns;  // EFLG.RX0OVR occurrences
+    uint32_t rx1_overruns;  // EFLG.RX1OVR occurrences
+    uint32_t filtered;      // frames dropped by the software acceptance filter
+} mcp2515_single_rx_stats_t;
+
+// TX path counters
+typedef struct {
+    uint32_t not_retransmitted; // one-shot frames given up after a failed attempt (ABTF)
+} mcp2515_single_tx_stats_t;
+
+// Send, receive and abort calls may come from several tasks (application,
+// shaper drain timer, gateway); the adapter serializes them with an internal
+// lock created by mcp2515_single_init().
 
 // Initialize MCP25xxx adapter
 bool mcp2515_single_init(const mcp2515_bundle_config_t *cfg);
@@ -15,11 +34,32 @@ bool mcp2515_single_init(const mcp2515_bundle_config_t *cfg);
 // Deinitialize MCP25xxx adapter
 bool mcp2515_single_deinit();
 
-// Send message
-bool mcp2515_single_send(const twai_message_t *msg);
+// Send frame
+bool mcp2515_single_send(const can_frame_t *frame);
+
+// Receive frame
+bool mcp2515_single_receive(can_frame_t *frame);
+
+// Read RX counters
+void mcp2515_single_get_rx_stats(mcp2515_single_rx_stats_t *stats);
 
-// Receive message
-bool mcp2515_single_receive(twai_message_t *msg);
+// Send message with optional deadline (esp_timer us, 0 = none), replace-in-queue
+// and one-shot (no automatic retransmission) for this frame
+can_dispatch_tx_result_t mcp2515_single_send_ex(const can_frame_t *frame, int64_t deadline_us,
+                                                bool replace_pending, bool single_shot);
+
+// Read TX counters
+void mcp2515_single_get_tx_stats(mcp2515_single_tx_stats_t *stats);
+
+// Abort TX buffers still waiting for arbitration past their deadline.
+// on_abort (may be NULL) is called with the identifier of every aborted frame.
+uint32_t mcp2515_single_tx_abort_expired(int64_t now_us, void (*on_abort)(uint32_t identifier));
+
+#if CONFIG_CAN_DISPATCH_FILTER
+// Program RXM0/1 and RXF0..5 from a plan (NULL = accept all). The controller
+// passes through configuration mode and returns to normal/loopback mode.
+bool mcp2515_single_set_hw_filter(const can_filter_hw_plan_t *plan);
+#endif
 
 #ifdef __cplusplus
 }
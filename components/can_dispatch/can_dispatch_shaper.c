@@ -0,0 +1,603 @@
+/**
+ * @file can_dispatch_shaper.c
+ * @brief Token-bucket transmit shaper implementation
+ *
+ * Token units are bit-microseconds per second (bits * 1e6), so refilling a
+ * bucket is one multiplication of its rate by the elapsed microseconds.
+ * Per-ID buckets count frames the same way (frames * 1e6).
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#include "can_dispatch_shaper.h"
+#include "can_dispatch_inline.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "CAN_SHAPER";
+
+#define CLASSES         CONFIG_CAN_DISPATCH_SHAPER_CLASSES
+#define ID_RULES        CONFIG_CAN_DISPATCH_SHAPER_ID_RULES
+#define QUEUE_LEN       CONFIG_CAN_DISPATCH_SHAPER_QUEUE_LEN
+#define UNIT            1000000LL       // tokens per bit (or per frame) and second
+#define DEFAULT_BURST_US 10000          // default bucket depth: 10 ms of the bucket's rate
+#define MIN_DEPTH_BITS  160             // longest frame, a bucket must hold at least one
+#define DRAIN_PERIOD_US 1000
+#define WINDOW_US       1000000         // bandwidth measurement window
+#define EXTD_KEY        0x80000000UL
+
+typedef struct {
+    int64_t tokens;
+    int64_t depth;
+    uint32_t rate;          // per second; 0 = bucket never refills
+    int64_t last_us;
+} bucket_t;
+
+typedef struct {
+    can_shaper_class_config_t cfg;
+    bucket_t reserved;
+    bucket_t ceil;
+    can_frame_t queue[QUEUE_LEN];
+    uint16_t q_head;
+    uint16_t q_count;
+    can_shaper_class_stats_t stats;
+    uint64_t window_bits;
+    int64_t window_start_us;
+} shaper_class_t;
+
+typedef struct {
+    uint32_t key;           // id | EXTD_KEY for extended frames
+    uint8_t class_id;
+    bucket_t bucket;        // unused if rate == 0
+} id_rule_t;
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool s_active = false;
+static uint32_t s_link_bps;
+static bucket_t s_shared;                   // link budget not reserved by any class
+static shaper_class_t s_classes[CLASSES];
+static id_rule_t s_rules[ID_RULES];         // sorted by key
+static size_t s_rule_count;
+static uint8_t s_default_class;
+static uint32_t s_backlog;                  // bit n: class n has queued frames
+static esp_timer_handle_t s_drain_timer = NULL;
+static bool s_drain_armed = false;
+// Serializes backend sends of application tasks and the drain timer; kept
+// across deinit so a sender racing with it never sees a deleted mutex
+static StaticSemaphore_t s_tx_mutex_buf;
+static SemaphoreHandle_t s_tx_mutex = NULL;
+
+// ======================================================================================
+// Buckets
+// ======================================================================================
+
+static void bucket_setup(bucket_t *b, uint32_t rate, uint32_t depth, int64_t now_us)
+{
+    b->rate = rate;
+    b->depth = (int64_t)depth * UNIT;
+    b->tokens = b->depth;
+    b->last_us = now_us;
+}
+
+static void bucket_refill(bucket_t *b, int64_t now_us)
+{
+    int64_t dt = now_us - b->last_us;
+    if (dt <= 0) {
+        return;     // never move last_us backwards
+    }
+    b->last_us = now_us;
+    if (b->tokens < b->depth) {
+        b->tokens += (int64_t)b->rate * dt;
+        if (b->tokens > b->depth) {
+            b->tokens = b->depth;
+        }
+    }
+}
+
+static void bucket_put(bucket_t *b, int64_t amount)
+{
+    b->tokens += amount;
+    if (b->tokens > b->depth) {
+        b->tokens = b->depth;
+    }
+}
+
+static uint32_t depth_bits(uint32_t burst_bits, uint32_t rate)
+{
+    uint32_t depth = burst_bits ? burst_bits : (uint32_t)((uint64_t)rate * DEFAULT_BURST_US / 1000000);
+    return depth < MIN_DEPTH_BITS ? MIN_DEPTH_BITS : depth;
+}
+
+// Shared bucket rate follows the reservations (caller holds the lock)
+static bool shared_update(int64_t now_us)
+{
+    uint64_t reserved = 0;
+    for (int i = 0; i < CLASSES; i++) {
+        reserved += s_classes[i].cfg.reserved_bps;
+    }
+    if (reserved > s_link_bps) {
+        return false;
+    }
+    uint32_t rate = s_link_bps - (uint32_t)reserved;
+    bucket_setup(&s_shared, rate, depth_bits(0, rate), now_us);
+    return true;
+}
+
+static void class_setup(shaper_class_t *c, const can_shaper_class_config_t *cfg, int64_t now_us)
+{
+    c->cfg = *cfg;
+    uint32_t ceil = cfg->ceil_bps ? cfg->ceil_bps : s_link_bps;
+    c->cfg.ceil_bps = ceil;
+    bucket_setup(&c->reserved, cfg->reserved_bps, depth_bits(cfg->burst_bits, cfg->reserved_bps), now_us);
+    bucket_setup(&c->ceil, ceil, depth_bits(cfg->burst_bits, ceil), now_us);
+}
+
+// ======================================================================================
+// Classification and charging (caller holds the lock)
+// ======================================================================================
+
+static id_rule_t *rule_find(uint32_t key)
+{
+    size_t lo = 0;
+    size_t hi = s_rule_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (s_rules[mid].key == key) {
+            return &s_rules[mid];
+        }
+        if (s_rules[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+static inline uint32_t frame_key(const can_frame_t *frame)
+{
+    return frame->id | (can_frame_is_extd(frame) ? EXTD_KEY : 0);
+}
+
+// A backlogged class whose ceiling lets its head frame out now; only such
+// classes hold shared tokens back from higher-numbered ones
+static bool class_wants_shared(shaper_class_t *c, int64_t now_us)
+{
+    bucket_refill(&c->ceil, now_us);
+    return c->ceil.tokens >= (int64_t)can_shaper_frame_bits(&c->queue[c->q_head]) * UNIT;
+}
+
+static bool lower_class_waiting(const shaper_class_t *c, int64_t now_us)
+{
+    uint32_t waiting = s_backlog & ((1UL << (c - s_classes)) - 1);
+    while (waiting) {
+        int i = __builtin_ctz(waiting);
+        waiting &= waiting - 1;
+        if (class_wants_shared(&s_classes[i], now_us)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef enum {
+    CHARGE_OK,
+    CHARGE_BORROWED,
+    CHARGE_ID_LIMITED,
+    CHARGE_CLASS_LIMITED,
+} charge_t;
+
+static charge_t charge(const can_frame_t *frame, id_rule_t *rule, shaper_class_t *c, int64_t now_us)
+{
+    if (rule && rule->bucket.rate) {
+        bucket_refill(&rule->bucket, now_us);
+        if (rule->bucket.tokens < UNIT) {
+            return CHARGE_ID_LIMITED;
+        }
+    }
+    int64_t cost = (int64_t)can_shaper_frame_bits(frame) * UNIT;
+    bucket_refill(&c->ceil, now_us);
+    if (c->ceil.tokens < cost) {
+        return CHARGE_CLASS_LIMITED;
+    }
+    charge_t res = CHARGE_OK;
+    bucket_refill(&c->reserved, now_us);
+    if (c->reserved.rate && c->reserved.tokens >= cost) {
+        c->reserved.tokens -= cost;
+    } else {
+        // Shared tokens go to the queued frames of lower-numbered classes
+        // first, unless their own ceiling holds them back
+        bucket_refill(&s_shared, now_us);
+        if (s_shared.tokens < cost || lower_class_waiting(c, now_us)) {
+            return CHARGE_CLASS_LIMITED;
+        }
+        s_shared.tokens -= cost;
+        res = CHARGE_BORROWED;
+    }
+    c->ceil.tokens -= cost;
+    if (rule && rule->bucket.rate) {
+        rule->bucket.tokens -= UNIT;
+    }
+    return res;
+}
+
+static void uncharge(const can_frame_t *frame, id_rule_t *rule, shaper_class_t *c, charge_t how)
+{
+    int64_t cost = (int64_t)can_shaper_frame_bits(frame) * UNIT;
+    bucket_put(&c->ceil, cost);
+    bucket_put(how == CHARGE_BORROWED ? &s_shared : &c->reserved, cost);
+    if (rule && rule->bucket.rate) {
+        bucket_put(&rule->bucket, UNIT);
+    }
+}
+
+static void window_roll(shaper_class_t *c, int64_t now_us)
+{
+    int64_t elapsed = now_us - c->window_start_us;
+    if (elapsed >= WINDOW_US) {
+        c->stats.bandwidth_bps = (uint32_t)(c->window_bits * 1000000ULL / (uint64_t)elapsed);
+        c->window_bits = 0;
+        c->window_start_us = now_us;
+    }
+}
+
+static void account_sent(shaper_class_t *c, const can_frame_t *frame, charge_t how, int64_t now_us)
+{
+    c->stats.sent++;
+    if (how == CHARGE_BORROWED) {
+        c->stats.borrowed++;
+    }
+    c->window_bits += can_shaper_frame_bits(frame);
+    window_roll(c, now_us);
+}
+
+// ======================================================================================
+// Queue and drain timer
+// ======================================================================================
+
+static bool tx_lock(TickType_t wait)
+{
+    return s_tx_mutex == NULL || xSemaphoreTake(s_tx_mutex, wait) == pdTRUE;
+}
+
+static void tx_unlock(void)
+{
+    if (s_tx_mutex) {
+        xSemaphoreGive(s_tx_mutex);
+    }
+}
+
+static bool locked_send(const can_frame_t *frame)
+{
+    tx_lock(portMAX_DELAY);
+    bool sent = can_dispatch_backend_send(frame);
+    tx_unlock();
+    return sent;
+}
+
+static bool queue_push(shaper_class_t *c, const can_frame_t *frame)
+{
+    if (c->q_count == QUEUE_LEN) {
+        return false;
+    }
+    c->queue[(c->q_head + c->q_count) % QUEUE_LEN] = *frame;
+    c->q_count++;
+    s_backlog |= 1UL << (c - s_classes);
+    return true;
+}
+
+static size_t drain(TickType_t wait);
+
+static void drain_timer_cb(void *arg)
+{
+    (void)arg;
+    // Never block the esp_timer task: a sender holding the mutex has the
+    // controller anyway, the next tick retries
+    drain(0);
+}
+
+static bool any_queued(void)
+{
+    return s_backlog != 0;
+}
+
+// ======================================================================================
+// Public API
+// ======================================================================================
+
+bool can_shaper_init(uint32_t link_bps)
+{
+    if (s_tx_mutex == NULL) {
+        s_tx_mutex = xSemaphoreCreateMutexStatic(&s_tx_mutex_buf);
+    }
+    if (s_drain_timer == NULL) {
+        esp_timer_create_args_t args = {
+            .callback = drain_timer_cb,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "can_shaper",
+        };
+        esp_err_t err = esp_timer_create(&args, &s_drain_timer);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create drain timer: %s", esp_err_to_name(err));
+            return false;
+        }
+    }
+    esp_timer_stop(s_drain_timer);
+
+    portENTER_CRITICAL(&s_lock);
+    int64_t now = esp_timer_get_time();
+    s_link_bps = link_bps;
+    memset(s_classes, 0, sizeof(s_classes));
+    const can_shaper_class_config_t unlimited = { .queue = false };
+    for (int i = 0; i < CLASSES; i++) {
+        class_setup(&s_classes[i], &unlimited, now);
+        s_classes[i].window_start_us = now;
+    }
+    shared_update(now);
+    s_rule_count = 0;
+    s_default_class = 0;
+    s_backlog = 0;
+    s_drain_armed = false;
+    s_active = true;
+    portEXIT_CRITICAL(&s_lock);
+    return true;
+}
+
+void can_shaper_deinit(void)
+{
+    s_active = false;
+    if (s_drain_timer) {
+        esp_timer_stop(s_drain_timer);
+        esp_timer_delete(s_drain_timer);
+        s_drain_timer = NULL;
+    }
+    s_drain_armed = false;
+}
+
+bool can_shaper_set_class(uint8_t class_id, const can_shaper_class_config_t *cfg)
+{
+    if (class_id >= CLASSES || cfg == NULL) {
+        return false;
+    }
+    portENTER_CRITICAL(&s_lock);
+    int64_t now = esp_timer_get_time();
+    shaper_class_t *c = &s_classes[class_id];
+    can_shaper_class_config_t old = c->cfg;
+    class_setup(c, cfg, now);
+    bool ok = shared_update(now);
+    if (!ok) {
+        class_setup(c, &old, now);
+        shared_update(now);
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (!ok) {
+        ESP_LOGE(TAG, "Class %u: reservations exceed the link budget of %lu bit/s",
+                 class_id, (unsigned long)s_link_bps);
+    }
+    return ok;
+}
+
+bool can_shaper_set_id_rule(const can_shaper_id_rule_t *rule)
+{
+    if (rule == NULL || rule->class_id >= CLASSES) {
+        return false;
+    }
+    uint32_t key = rule->id | (rule->extd ? EXTD_KEY : 0);
+    bool ok = true;
+    portENTER_CRITICAL(&s_lock);
+    int64_t now = esp_timer_get_time();
+    id_rule_t *r = rule_find(key);
+    if (r == NULL) {
+        if (s_rule_count == ID_RULES) {
+            ok = false;
+        } else {
+            // Insert keeping the table sorted
+            size_t pos = s_rule_count;
+            while (pos > 0 && s_rules[pos - 1].key > key) {
+                s_rules[pos] = s_rules[pos - 1];
+                pos--;
+            }
+            r = &s_rules[pos];
+            s_rule_count++;
+        }
+    }
+    if (ok) {
+        r->key = key;
+        r->class_id = rule->class_id;
+        bucket_setup(&r->bucket, rule->rate_fps, rule->burst ? rule->burst : 1, now);
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return ok;
+}
+
+bool can_shaper_set_default_class(uint8_t class_id)
+{
+    if (class_id >= CLASSES) {
+        return false;
+    }
+    s_default_class = class_id;
+    return true;
+}
+
+bool can_shaper_send(const can_frame_t *frame)
+{
+    if (!s_active) {
+        return locked_send(frame);
+    }
+
+    // Time is read under the lock so buckets only ever see it move forward
+    portENTER_CRITICAL(&s_lock);
+    int64_t now = esp_timer_get_time();
+    id_rule_t *rule = rule_find(frame_key(frame));
+    shaper_class_t *c = &s_classes[rule ? rule->class_id : s_default_class];
+    // Frames of a class leave in order: never overtake queued ones
+    charge_t how = c->q_count ? CHARGE_CLASS_LIMITED : charge(frame, rule, c, now);
+    if (how == CHARGE_OK || how == CHARGE_BORROWED) {
+        portEXIT_CRITICAL(&s_lock);
+        bool sent = locked_send(frame);
+        portENTER_CRITICAL(&s_lock);
+        if (sent) {
+            account_sent(c, frame, how, now);
+        } else {
+            uncharge(frame, rule, c, how);
+        }
+        portEXIT_CRITICAL(&s_lock);
+        return sent;
+    }
+
+    if (how == CHARGE_ID_LIMITED) {
+        c->stats.id_limited++;
+    }
+    bool queued = c->cfg.queue && queue_push(c, frame);
+    bool arm = false;
+    if (queued) {
+        c->stats.queued++;
+        arm = !s_drain_armed;
+        s_drain_armed = true;
+    } else {
+        c->stats.rejected++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (arm) {
+        esp_timer_start_periodic(s_drain_timer, DRAIN_PERIOD_US);
+    }
+    return queued;
+}
+
+bool can_shaper_admit(const can_frame_t *frame)
+{
+    if (!s_active) {
+        return true;
+    }
+    portENTER_CRITICAL(&s_lock);
+    int64_t now = esp_timer_get_time();
+    id_rule_t *rule = rule_find(frame_key(frame));
+    shaper_class_t *c = &s_classes[rule ? rule->class_id : s_default_class];
+    charge_t how = charge(frame, rule, c, now);
+    bool ok = how == CHARGE_OK || how == CHARGE_BORROWED;
+    if (ok) {
+        account_sent(c, frame, how, now);
+    } else {
+        if (how == CHARGE_ID_LIMITED) {
+            c->stats.id_limited++;
+        }
+        c->stats.rejected++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return ok;
+}
+
+void can_shaper_refund(const can_frame_t *frame)
+{
+    if (!s_active) {
+        return;
+    }
+    portENTER_CRITICAL(&s_lock);
+    id_rule_t *rule = rule_find(frame_key(frame));
+    shaper_class_t *c = &s_classes[rule ? rule->class_id : s_default_class];
+    // The bucket it came from is not tracked; shared tokens are returned
+    // only if the class has no reservation
+    uncharge(frame, rule, c, c->reserved.rate ? CHARGE_OK : CHARGE_BORROWED);
+    if (c->stats.sent) {
+        c->stats.sent--;
+    }
+    uint32_t bits = can_shaper_frame_bits(frame);
+    c->window_bits = c->window_bits > bits ? c->window_bits - bits : 0;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+size_t can_shaper_poll(void)
+{
+    return drain(portMAX_DELAY);
+}
+
+static size_t drain(TickType_t wait)
+{
+    size_t sent = 0;
+    if (!s_active || !tx_lock(wait)) {
+        return 0;
+    }
+    for (int i = 0; i < CLASSES; i++) {
+        shaper_class_t *c = &s_classes[i];
+        for (;;) {
+            portENTER_CRITICAL(&s_lock);
+            int64_t now = esp_timer_get_time();
+            if (c->q_count == 0) {
+                portEXIT_CRITICAL(&s_lock);
+                break;
+            }
+            can_frame_t frame = c->queue[c->q_head];
+            id_rule_t *rule = rule_find(frame_key(&frame));
+            charge_t how = charge(&frame, rule, c, now);
+            if (how != CHARGE_OK && how != CHARGE_BORROWED) {
+                portEXIT_CRITICAL(&s_lock);
+                break;
+            }
+            c->q_head = (c->q_head + 1) % QUEUE_LEN;
+            if (--c->q_count == 0) {
+                s_backlog &= ~(1UL << i);
+            }
+            portEXIT_CRITICAL(&s_lock);
+
+            bool ok = can_dispatch_backend_send(&frame);
+            portENTER_CRITICAL(&s_lock);
+            if (ok) {
+                account_sent(c, &frame, how, now);
+            } else {
+                // Controller full: put the frame back at the head and retry next tick
+                uncharge(&frame, rule, c, how);
+                c->q_head = (c->q_head + QUEUE_LEN - 1) % QUEUE_LEN;
+                c->queue[c->q_head] = frame;
+                c->q_count++;
+                s_backlog |= 1UL << i;
+            }
+            portEXIT_CRITICAL(&s_lock);
+            if (!ok) {
+                tx_unlock();
+                return sent;
+            }
+            sent++;
+        }
+    }
+
+    // Stop the drain timer once everything left; restart it if a sender
+    // queued a frame in between (its start failed while the timer still ran,
+    // or succeeded just before the stop)
+    portENTER_CRITICAL(&s_lock);
+    bool idle = !any_queued();
+    if (idle) {
+        s_drain_armed = false;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (idle && s_drain_timer) {
+        esp_timer_stop(s_drain_timer);
+        portENTER_CRITICAL(&s_lock);
+        bool rearm = any_queued();
+        if (rearm) {
+            s_drain_armed = true;
+        }
+        portEXIT_CRITICAL(&s_lock);
+        if (rearm) {
+            esp_timer_start_periodic(s_drain_timer, DRAIN_PERIOD_US);
+        }
+    }
+    tx_unlock();
+    return sent;
+}
+
+bool can_shaper_get_class_stats(uint8_t class_id, can_shaper_class_stats_t *stats)
+{
+    if (class_id >= CLASSES || stats == NULL) {
+        return false;
+    }
+    portENTER_CRITICAL(&s_lock);
+    int64_t now = esp_timer_get_time();
+    window_roll(&s_classes[class_id], now);
+    *stats = s_classes[class_id].stats;
+    portEXIT_CRITICAL(&s_lock);
+    return true;
+}
@@ -0,0 +1,164 @@
+/**
+ * @file can_dispatch_shaper.h
+ * @brief Token-bucket transmit shaper for the dispatcher TX path
+ *
+ * Every frame sent through the dispatcher (can_dispatch_send, batch, handles,
+ * can_dispatch_send_ex and, on the MCP25xxx backends, can_twai_send) is
+ * charged its worst-case wire length in bits against:
+ * - an optional per-ID bucket (frames per second and burst),
+ * - its class: a reserved bucket (guaranteed rate), a ceiling bucket (upper
+ *   limit), and a shared bucket holding the link budget nobody reserved.
+ *
+ * A class sends on its reserved tokens first and borrows from the shared
+ * bucket up to its ceiling, so bursts of one class cannot eat the bandwidth
+ * reserved for another. While a class has queued frames that its ceiling
+ * would let out, higher-numbered classes cannot borrow, so the shared budget
+ * goes to classes in order (use ceilings to keep a busy class from taking all
+ * of it: a class held back by its ceiling does not block the others). Excess frames are
+ * either rejected (send returns false) or held in a per-class queue that a
+ * periodic esp_timer drains in class order as tokens become available. The timer callback
+ * sends the queued frames from the esp_timer task while application tasks
+ * keep sending; backend sends of the shaper are serialized by its TX mutex
+ * (the drain timer skips a tick rather than wait for it), and the MCP2515
+ * single adapter additionally locks each of its calls against unshaped users
+ * such as can_dispatch_send_ex().
+ *
+ * Frames of unlisted IDs belong to the default class (class 0 unless set).
+ * Before can_shaper_init() every frame passes unshaped. Not shaped: per-device
+ * handles of the MCP25xxx multi backend other than the first device, the
+ * native can_twai_send() of twai-idf-can on the TWAI backend (use
+ * can_dispatch_send() for shaped traffic there) and the TWAI port of the
+ * gateway (its MCP2515 port is shaped).
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "can_dispatch_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CONFIG_CAN_DISPATCH_SHAPER_CLASSES
+#define CONFIG_CAN_DISPATCH_SHAPER_CLASSES 4
+#endif
+#ifndef CONFIG_CAN_DISPATCH_SHAPER_ID_RULES
+#define CONFIG_CAN_DISPATCH_SHAPER_ID_RULES 32
+#endif
+#ifndef CONFIG_CAN_DISPATCH_SHAPER_QUEUE_LEN
+#define CONFIG_CAN_DISPATCH_SHAPER_QUEUE_LEN 16
+#endif
+
+/**
+ * @brief Traffic class configuration
+ */
+typedef struct {
+    uint32_t reserved_bps;  ///< Guaranteed bandwidth, never used by other classes
+    uint32_t ceil_bps;      ///< Upper limit including borrowed bandwidth (0 = link budget)
+    uint32_t burst_bits;    ///< Bucket depth (0 = 10 ms at the ceiling rate, at least one frame)
+    bool queue;             ///< true: hold excess frames, false: reject them
+} can_shaper_class_config_t;
+
+/**
+ * @brief Per-ID limit; the frame is also charged to its class
+ */
+typedef struct {
+    uint32_t id;
+    bool extd;
+    uint8_t class_id;       ///< Class of this ID
+    uint32_t rate_fps;      ///< Frames per second (0 = no per-ID limit, class only)
+    uint16_t burst;         ///< Frames allowed back to back (0 = 1)
+} can_shaper_id_rule_t;
+
+/**
+ * @brief Per-class counters
+ */
+typedef struct {
+    uint32_t sent;          ///< Frames passed to the backend
+    uint32_t borrowed;      ///< ... of which sent on shared (unreserved) bandwidth
+    uint32_t queued;        ///< Frames held back by the shaper
+    uint32_t rejected;      ///< Frames refused (reject mode, full queue or send_ex)
+    uint32_t id_limited;    ///< Frames shaped by their per-ID bucket
+    uint32_t bandwidth_bps; ///< Measured bandwidth of the last full second
+} can_shaper_class_stats_t;
+
+/**
+ * @brief Enable shaping
+ * @param link_bps Link budget shared by all classes (e.g. 80 % of the bitrate)
+ * @return false if the drain timer cannot be created
+ */
+bool can_shaper_init(uint32_t link_bps);
+
+/**
+ * @brief Disable shaping; queued frames are dropped
+ */
+void can_shaper_deinit(void);
+
+/**
+ * @brief Configure a class (all classes start as unlimited reject-mode classes)
+ * @return false for an invalid class or if the reservations exceed the link budget
+ */
+bool can_shaper_set_class(uint8_t class_id, const can_shaper_class_config_t *cfg);
+
+/**
+ * @brief Add or replace a per-ID rule
+ * @return false if the rule table is full or the class is invalid
+ */
+bool can_shaper_set_id_rule(const can_shaper_id_rule_t *rule);
+
+/**
+ * @brief Class of frames without an ID rule
+ */
+bool can_shaper_set_default_class(uint8_t class_id);
+
+/**
+ * @brief Send a frame through the shaper
+ * @return true if sent or queued, false if rejected or the backend refused it
+ */
+bool can_shaper_send(const can_frame_t *frame);
+
+/**
+ * @brief Charge a frame without queuing (for callers with their own retry policy)
+ *
+ * Call can_shaper_refund() if the frame is then not handed to the controller.
+ *
+ * @return true if the frame may be sent now
+ */
+bool can_shaper_admit(const can_frame_t *frame);
+
+/**
+ * @brief Return the tokens of an admitted frame that was not sent
+ */
+void can_shaper_refund(const can_frame_t *frame);
+
+/**
+ * @brief Send queued frames that have tokens now (also run by the drain timer)
+ * @return Number of frames sent
+ */
+size_t can_shaper_poll(void);
+
+/**
+ * @brief Read counters of a class
+ */
+bool can_shaper_get_class_stats(uint8_t class_id, can_shaper_class_stats_t *stats);
+
+/**
+ * @brief Worst-case wire length of a frame in bits (including bit stuffing and IFS)
+ */
+static inline uint32_t can_shaper_frame_bits(const can_frame_t *frame)
+{
+    uint32_t dlc = frame->dlc <= CAN_FRAME_MAX_DLC ? frame->dlc : CAN_FRAME_MAX_DLC;
+    if (frame->flags & CAN_FRAME_FLAG_RTR) {
+        dlc = 0;
+    }
+    return (can_frame_is_extd(frame) ? 80 : 55) + 10 * dlc;
+}
+
+#ifdef __cplusplus
+}
+#endif
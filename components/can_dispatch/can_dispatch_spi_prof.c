@@ -0,0 +1,171 @@
+/**
+ * @file can_dispatch_spi_prof.c
+ * @brief SPI transaction profiler implementation
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#include "can_dispatch_spi_prof.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include <string.h>
+
+// Only used by ESP_LOGI, which host builds may define without the tag
+static const char *TAG __attribute__((unused)) = "CAN_SPI_PROF";
+
+static can_spi_prof_stats_t s_stats;
+static int64_t s_since_us;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *const s_op_names[CAN_SPI_PROF_OP_COUNT] = {
+    "RESET", "READ", "READ_RX", "WRITE", "LOAD_TX", "RTS", "READ_STATUS", "RX_STATUS", "BIT_MODIFY", "OTHER",
+};
+
+// Polling and configuration traffic as opposed to RX/TX buffer transfers
+static inline bool op_is_overhead(can_spi_prof_op_t op)
+{
+    return op != CAN_SPI_PROF_READ_RX && op != CAN_SPI_PROF_LOAD_TX && op != CAN_SPI_PROF_RTS;
+}
+
+static inline uint32_t dur_bucket(uint32_t ns)
+{
+    uint32_t us = ns / 1000;
+    uint32_t b = us ? 32 - (uint32_t)__builtin_clz(us) : 0;
+    return b < CAN_SPI_PROF_DUR_BUCKETS ? b : CAN_SPI_PROF_DUR_BUCKETS - 1;
+}
+
+// ======================================================================================
+// Recording
+// ======================================================================================
+
+void can_spi_prof_reset(void)
+{
+    portENTER_CRITICAL_SAFE(&s_lock);
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_since_us = esp_timer_get_time();
+    portEXIT_CRITICAL_SAFE(&s_lock);
+}
+
+void IRAM_ATTR can_spi_prof_record(uint8_t instr, uint32_t bytes, uint32_t duration_ns)
+{
+    can_spi_prof_op_stats_t *op = &s_stats.op[can_spi_prof_classify(instr)];
+    uint32_t len = bytes ? bytes : 1;
+    portENTER_CRITICAL_SAFE(&s_lock);
+    op->count++;
+    op->bytes += bytes;
+    op->busy_ns += duration_ns;
+    if (duration_ns > op->max_ns) {
+        op->max_ns = duration_ns;
+    }
+    op->dur_hist[dur_bucket(duration_ns)]++;
+    op->len_hist[(len < CAN_SPI_PROF_LEN_BUCKETS ? len : CAN_SPI_PROF_LEN_BUCKETS) - 1]++;
+    portEXIT_CRITICAL_SAFE(&s_lock);
+}
+
+void can_spi_prof_frame(bool rx, uint8_t dlc)
+{
+    portENTER_CRITICAL_SAFE(&s_lock);
+    if (rx) {
+        s_stats.rx_frames++;
+    } else {
+        s_stats.tx_frames++;
+    }
+    s_stats.payload_bytes += dlc;
+    portEXIT_CRITICAL_SAFE(&s_lock);
+}
+
+void can_spi_prof_get(can_spi_prof_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    portENTER_CRITICAL_SAFE(&s_lock);
+    *stats = s_stats;
+    portEXIT_CRITICAL_SAFE(&s_lock);
+    stats->elapsed_us = esp_timer_get_time() - s_since_us;
+}
+
+const char *can_spi_prof_op_name(can_spi_prof_op_t op)
+{
+    return op < CAN_SPI_PROF_OP_COUNT ? s_op_names[op] : "?";
+}
+
+// ======================================================================================
+// Report
+// ======================================================================================
+
+void can_spi_prof_report(void)
+{
+    static can_spi_prof_stats_t st;     // too large for small task stacks
+    can_spi_prof_get(&st);
+
+    uint64_t busy_ns = 0;
+    uint64_t overhead_ns = 0;
+    uint32_t bytes = 0;
+    uint32_t overhead_bytes = 0;
+    for (int i = 0; i < CAN_SPI_PROF_OP_COUNT; i++) {
+        busy_ns += st.op[i].busy_ns;
+        bytes += st.op[i].bytes;
+        if (op_is_overhead((can_spi_prof_op_t)i)) {
+            overhead_ns += st.op[i].busy_ns;
+            overhead_bytes += st.op[i].bytes;
+        }
+    }
+    uint32_t frames = st.rx_frames + st.tx_frames;
+
+    ESP_LOGI(TAG, "=== SPI profile over %lld ms ===", (long long)(st.elapsed_us / 1000));
+    ESP_LOGI(TAG, "%-12s %8s %8s %9s %8s %6s", "instruction", "count", "bytes", "avg [us]", "max [us]", "time");
+    for (int i = 0; i < CAN_SPI_PROF_OP_COUNT; i++) {
+        const can_spi_prof_op_stats_t *op = &st.op[i];
+        if (op->count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%-12s %8lu %8lu %9.1f %8.1f %5.1f%%", s_op_names[i], (unsigned long)op->count,
+                 (unsigned long)op->bytes, op->busy_ns / 1000.0 / op->count, op->max_ns / 1000.0,
+                 busy_ns ? 100.0 * op->busy_ns / busy_ns : 0.0);
+    }
+
+    ESP_LOGI(TAG, "duration histogram (all instructions):");
+    for (int b = 0; b < CAN_SPI_PROF_DUR_BUCKETS; b++) {
+        uint32_t n = 0;
+        for (int i = 0; i < CAN_SPI_PROF_OP_COUNT; i++) {
+            n += st.op[i].dur_hist[b];
+        }
+        if (n == 0) {
+            continue;
+        }
+        if (b == 0) {
+            ESP_LOGI(TAG, "  < 1 us      %8lu", (unsigned long)n);
+        } else if (b == CAN_SPI_PROF_DUR_BUCKETS - 1) {
+            ESP_LOGI(TAG, "  >= %4u us  %8lu", 1u << (b - 1), (unsigned long)n);
+        } else {
+            ESP_LOGI(TAG, "  %4u-%4u us %8lu", 1u << (b - 1), (1u << b) - 1, (unsigned long)n);
+        }
+    }
+    ESP_LOGI(TAG, "length histogram (all instructions):");
+    for (int b = 0; b < CAN_SPI_PROF_LEN_BUCKETS; b++) {
+        uint32_t n = 0;
+        for (int i = 0; i < CAN_SPI_PROF_OP_COUNT; i++) {
+            n += st.op[i].len_hist[b];
+        }
+        if (n) {
+            ESP_LOGI(TAG, "  %2d%s bytes   %8lu", b + 1, b == CAN_SPI_PROF_LEN_BUCKETS - 1 ? "+" : " ", (unsigned long)n);
+        }
+    }
+
+    double elapsed_ns = st.elapsed_us > 0 ? st.elapsed_us * 1000.0 : 1.0;
+    ESP_LOGI(TAG, "bus utilisation %.2f %% (polling/config %.2f %%)",
+             100.0 * busy_ns / elapsed_ns, 100.0 * overhead_ns / elapsed_ns);
+    ESP_LOGI(TAG, "frames rx %lu tx %lu, %lu payload bytes", (unsigned long)st.rx_frames,
+             (unsigned long)st.tx_frames, (unsigned long)st.payload_bytes);
+    if (frames) {
+        ESP_LOGI(TAG, "SPI bytes per frame %.1f (%.1f polling/config), %.1f us bus time per frame",
+                 (double)bytes / frames, (double)overhead_bytes / frames, busy_ns / 1000.0 / frames);
+    }
+    if (bytes) {
+        ESP_LOGI(TAG, "payload share %.1f %% of SPI bytes", 100.0 * st.payload_bytes / bytes);
+    }
+}
@@ -0,0 +1,140 @@
+/**
+ * @file can_dispatch_spi_prof.h
+ * @brief SPI transaction profiler for the MCP25xxx adapters
+ *
+ * Every SPI transaction is classified by its MCP2515 instruction byte and
+ * recorded with its length and duration: per instruction counts, bytes, busy
+ * time and two histograms (duration, transaction length). Adapters also
+ * report the frames they move, which gives bus utilisation and the
+ * efficiency figures "SPI bytes per frame" and "payload share" (CAN data
+ * bytes over SPI bytes), so register polling overhead shows up next to the
+ * useful RX/TX buffer traffic.
+ *
+ * The MCP2515 single adapter feeds the profiler from the SPI driver's
+ * pre_cb/post_cb hooks, so transactions issued by the mcp2515 library itself
+ * (register reads, CANSTAT polling during init) are included. The module has
+ * no driver dependency and also builds on the host
+ * (py/host_bench/spi_prof_bench.py).
+ *
+ * can_spi_prof_record() may be called from ISR context.
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Instruction classes (MCP2515 SPI instruction set)
+ */
+typedef enum {
+    CAN_SPI_PROF_RESET = 0,
+    CAN_SPI_PROF_READ,              ///< READ register(s)
+    CAN_SPI_PROF_READ_RX,           ///< READ RX BUFFER
+    CAN_SPI_PROF_WRITE,             ///< WRITE register(s)
+    CAN_SPI_PROF_LOAD_TX,           ///< LOAD TX BUFFER
+    CAN_SPI_PROF_RTS,               ///< REQUEST TO SEND
+    CAN_SPI_PROF_READ_STATUS,
+    CAN_SPI_PROF_RX_STATUS,
+    CAN_SPI_PROF_BIT_MODIFY,
+    CAN_SPI_PROF_OTHER,
+    CAN_SPI_PROF_OP_COUNT
+} can_spi_prof_op_t;
+
+// Duration histogram: bucket 0 < 1 us, bucket n in [2^(n-1), 2^n) us, last bucket open ended
+#define CAN_SPI_PROF_DUR_BUCKETS    12
+// Length histogram: bucket n = n + 1 bytes, last bucket = 16 bytes or more
+#define CAN_SPI_PROF_LEN_BUCKETS    16
+
+/**
+ * @brief Counters of one instruction class
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t bytes;
+    uint64_t busy_ns;
+    uint32_t max_ns;
+    uint32_t dur_hist[CAN_SPI_PROF_DUR_BUCKETS];
+    uint32_t len_hist[CAN_SPI_PROF_LEN_BUCKETS];
+} can_spi_prof_op_stats_t;
+
+/**
+ * @brief Profiler snapshot
+ */
+typedef struct {
+    can_spi_prof_op_stats_t op[CAN_SPI_PROF_OP_COUNT];
+    uint32_t rx_frames;         ///< Frames read from the controller
+    uint32_t tx_frames;         ///< Frames loaded for transmission
+    uint32_t payload_bytes;     ///< CAN data bytes of those frames
+    int64_t elapsed_us;         ///< Time since the last reset
+} can_spi_prof_stats_t;
+
+/**
+ * @brief Instruction class of an MCP2515 instruction byte
+ */
+static inline can_spi_prof_op_t can_spi_prof_classify(uint8_t instr)
+{
+    switch (instr) {
+    case 0xC0: return CAN_SPI_PROF_RESET;
+    case 0x03: return CAN_SPI_PROF_READ;
+    case 0x02: return CAN_SPI_PROF_WRITE;
+    case 0xA0: return CAN_SPI_PROF_READ_STATUS;
+    case 0xB0: return CAN_SPI_PROF_RX_STATUS;
+    case 0x05: return CAN_SPI_PROF_BIT_MODIFY;
+    default: break;
+    }
+    if ((instr & 0xF9) == 0x90) {
+        return CAN_SPI_PROF_READ_RX;
+    }
+    if ((instr & 0xF8) == 0x40) {
+        return CAN_SPI_PROF_LOAD_TX;
+    }
+    if ((instr & 0xF8) == 0x80) {
+        return CAN_SPI_PROF_RTS;
+    }
+    return CAN_SPI_PROF_OTHER;
+}
+
+/**
+ * @brief Clear all counters and restart the utilisation window
+ */
+void can_spi_prof_reset(void);
+
+/**
+ * @brief Record one transaction
+ * @param instr First byte sent (instruction)
+ * @param bytes Transaction length including the instruction byte
+ * @param duration_ns Time the transaction occupied the bus
+ */
+void can_spi_prof_record(uint8_t instr, uint32_t bytes, uint32_t duration_ns);
+
+/**
+ * @brief Count a frame moved over SPI (for the efficiency figures)
+ */
+void can_spi_prof_frame(bool rx, uint8_t dlc);
+
+/**
+ * @brief Copy the counters
+ */
+void can_spi_prof_get(can_spi_prof_stats_t *stats);
+
+/**
+ * @brief Log a summary table: per instruction share of bus time, histograms,
+ *        utilisation and bytes per frame
+ */
+void can_spi_prof_report(void);
+
+/**
+ * @brief Short name of an instruction class
+ */
+const char *can_spi_prof_op_name(can_spi_prof_op_t op);
+
+#ifdef __cplusplus
+}
+#endif
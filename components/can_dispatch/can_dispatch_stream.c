@@ -0,0 +1,265 @@
+/**
+ * @file can_dispatch_stream.c
+ * @brief Binary frame stream implementation
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#include "can_dispatch_stream.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include <stdio.h>
+#include <string.h>
+
+// Packets are binary and may contain 0x0A: a console translating LF to CR
+// destroys them, LF to CRLF is undone by the host decoder but costs bandwidth
+#if CONFIG_NEWLIB_STDOUT_LINE_ENDING_CR || CONFIG_LIBC_STDOUT_LINE_ENDING_CR
+#error "CAN_DISPATCH_STREAM needs CONFIG_NEWLIB_STDOUT_LINE_ENDING_LF (recommended) or _CRLF"
+#endif
+
+static const char *TAG = "CAN_STREAM";
+
+#define DEPTH               CONFIG_CAN_DISPATCH_STREAM_DEPTH
+#define WRITE_PERIOD_TICKS  pdMS_TO_TICKS(10)
+#define STREAM_TASK_STACK   3072
+#define MAX_PACKET          (1 + 1 + 1 + 4 + 4 + CAN_FRAME_MAX_DLC + 2)
+#define MAX_ENCODED         (MAX_PACKET + MAX_PACKET / 254 + 1 + 2)     // COBS + both delimiters
+#define OUT_BUF_SIZE        512
+
+typedef struct {
+    uint32_t time_us;
+    uint32_t id;
+    uint8_t flags;
+    uint8_t dev;
+    uint8_t data[CAN_FRAME_MAX_DLC];
+} stream_record_t;
+
+static stream_record_t s_ring[DEPTH];
+static uint16_t s_head;                 // next record to write out
+static uint16_t s_count;
+static uint32_t s_dropped_pending;      // not yet reported in a DROPPED packet
+static can_stream_stats_t s_stats;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t s_task = NULL;
+static volatile bool s_task_run = false;
+static volatile bool s_logging = false;
+
+// ======================================================================================
+// Encoding
+// ======================================================================================
+
+static uint16_t crc16_ccitt(const uint8_t *p, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    while (len--) {
+        crc ^= (uint16_t)(*p++) << 8;
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Frame a raw packet: 0x00, COBS(packet + crc), 0x00. Returns the encoded length.
+static size_t encode_packet(uint8_t *pkt, size_t len, uint8_t *out)
+{
+    uint16_t crc = crc16_ccitt(pkt, len);
+    pkt[len++] = (uint8_t)crc;
+    pkt[len++] = (uint8_t)(crc >> 8);
+
+    size_t o = 0;
+    out[o++] = 0;
+    size_t code_pos = o++;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (pkt[i] == 0) {
+            out[code_pos] = code;
+            code_pos = o++;
+            code = 1;
+        } else {
+            out[o++] = pkt[i];
+            if (++code == 0xFF) {
+                out[code_pos] = code;
+                code_pos = o++;
+                code = 1;
+            }
+        }
+    }
+    out[code_pos] = code;
+    out[o++] = 0;
+    return o;
+}
+
+static size_t encode_record(const stream_record_t *r, uint8_t *out)
+{
+    uint8_t pkt[MAX_PACKET];
+    size_t n = 0;
+    pkt[n++] = CAN_STREAM_PKT_FRAME;
+    pkt[n++] = r->flags;
+    pkt[n++] = r->dev;
+    memcpy(&pkt[n], &r->time_us, 4);
+    n += 4;
+    if (r->flags & CAN_STREAM_FLAG_EXTD) {
+        memcpy(&pkt[n], &r->id, 4);
+        n += 4;
+    } else {
+        pkt[n++] = (uint8_t)r->id;
+        pkt[n++] = (uint8_t)(r->id >> 8);
+    }
+    if (!(r->flags & CAN_STREAM_FLAG_RTR)) {
+        uint8_t dlc = r->flags & 0x0F;
+        memcpy(&pkt[n], r->data, dlc);
+        n += dlc;
+    }
+    return encode_packet(pkt, n, out);
+}
+
+static size_t encode_dropped(uint32_t count, uint8_t *out)
+{
+    uint8_t pkt[1 + 4 + 2];
+    pkt[0] = CAN_STREAM_PKT_DROPPED;
+    memcpy(&pkt[1], &count, 4);
+    return encode_packet(pkt, 5, out);
+}
+
+// ======================================================================================
+// Writer
+// ======================================================================================
+
+// Encode and write everything queued so far; one fwrite per buffer so the
+// packets are not split by log text from other tasks
+static void flush_ring(void)
+{
+    static uint8_t out[OUT_BUF_SIZE];
+    size_t fill = 0;
+    for (;;) {
+        stream_record_t rec;
+        uint32_t dropped;
+        bool have;
+        portENTER_CRITICAL(&s_lock);
+        dropped = s_dropped_pending;
+        s_dropped_pending = 0;
+        have = s_count != 0;
+        if (have) {
+            rec = s_ring[s_head];
+            s_head = (s_head + 1) % DEPTH;
+            s_count--;
+        }
+        portEXIT_CRITICAL(&s_lock);
+
+        if (fill + 2 * MAX_ENCODED > sizeof(out) || (!have && fill)) {
+            fwrite(out, 1, fill, stdout);
+            s_stats.bytes += fill;
+            fill = 0;
+        }
+        if (dropped) {
+            fill += encode_dropped(dropped, &out[fill]);
+        }
+        if (!have) {
+            break;
+        }
+        fill += encode_record(&rec, &out[fill]);
+    }
+    if (fill) {
+        fwrite(out, 1, fill, stdout);
+        s_stats.bytes += fill;
+    }
+    fflush(stdout);
+}
+
+static void stream_task(void *arg)
+{
+    (void)arg;
+    while (s_task_run) {
+        ulTaskNotifyTake(pdTRUE, WRITE_PERIOD_TICKS);
+        flush_ring();
+    }
+    flush_ring();
+    s_task = NULL;
+    vTaskDelete(NULL);
+}
+
+// ======================================================================================
+// Public API
+// ======================================================================================
+
+void can_stream_log(const can_frame_t *frame, bool tx, uint8_t dev)
+{
+    if (!s_logging) {
+        return;
+    }
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    uint8_t dlc = frame->dlc <= CAN_FRAME_MAX_DLC ? frame->dlc : CAN_FRAME_MAX_DLC;
+    uint8_t flags = dlc;
+    if (can_frame_is_extd(frame)) {
+        flags |= CAN_STREAM_FLAG_EXTD;
+    }
+    if (frame->flags & CAN_FRAME_FLAG_RTR) {
+        flags |= CAN_STREAM_FLAG_RTR;
+    }
+    if (tx) {
+        flags |= CAN_STREAM_FLAG_TX;
+    }
+
+    bool wake = false;
+    portENTER_CRITICAL(&s_lock);
+    if (s_count == DEPTH) {
+        s_dropped_pending++;
+        s_stats.dropped++;
+    } else {
+        stream_record_t *r = &s_ring[(s_head + s_count) % DEPTH];
+        r->time_us = now;
+        r->id = frame->id;
+        r->flags = flags;
+        r->dev = dev;
+        memcpy(r->data, frame->data, CAN_FRAME_MAX_DLC);
+        s_count++;
+        s_stats.logged++;
+        wake = s_count == DEPTH / 2;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    // Write early when the ring fills faster than the period drains it
+    if (wake && s_task) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+bool can_stream_start(UBaseType_t priority)
+{
+    if (s_task) {
+        return true;
+    }
+    s_task_run = true;
+    if (xTaskCreate(stream_task, "can_stream", STREAM_TASK_STACK, NULL, priority, &s_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create stream task");
+        s_task_run = false;
+        s_task = NULL;
+        return false;
+    }
+    s_logging = true;
+    return true;
+}
+
+void can_stream_stop(void)
+{
+    s_logging = false;
+    s_task_run = false;
+    if (s_task) {
+        xTaskNotifyGive(s_task);
+    }
+    while (s_task) {
+        vTaskDelay(1);
+    }
+}
+
+void can_stream_get_stats(can_stream_stats_t *stats)
+{
+    if (stats) {
+        portENTER_CRITICAL(&s_lock);
+        *stats = s_stats;
+        portEXIT_CRITICAL(&s_lock);
+    }
+}
@@ -0,0 +1,92 @@
+/**
+ * @file can_dispatch_stream.h
+ * @brief Compact binary frame stream to the host monitor
+ *
+ * With CONFIG_CAN_DISPATCH_STREAM the dispatcher logs every frame it sends
+ * or receives through can_stream_log(), which copies a fixed-size record
+ * into a ring (no formatting in the CAN path). A writer task encodes the
+ * records and writes them to stdout in batches, so the stream shares the
+ * console (UART or USB-CDC) with the normal log text.
+ *
+ * Wire format: every packet is COBS encoded and framed by a zero byte on
+ * both sides, so text between packets stays readable and the host decoder
+ * (py/monitor/frame_stream.py) resynchronises on the next zero after a
+ * corrupted byte. Decoded packet, little endian:
+ *
+ *   type    u8    CAN_STREAM_PKT_FRAME or CAN_STREAM_PKT_DROPPED
+ *   FRAME:  flags u8  bits 0-3 DLC, bit 4 extended, bit 5 RTR, bit 6 TX
+ *           dev   u8  device index (multi backend), 0 otherwise
+ *           time  u32 esp_timer time in us (low 32 bits)
+ *           id    u16 standard or u32 extended
+ *           data  DLC bytes (none for RTR)
+ *   DROPPED: count u32 records lost to a full ring since the last report
+ *   crc     u16   CRC-16/CCITT-FALSE of all preceding packet bytes
+ *
+ * The console must pass 0x0A unchanged: set CONFIG_NEWLIB_STDOUT_LINE_ENDING_LF
+ * (sdkconfig.defaults does). With the ESP-IDF default LF -> CRLF translation
+ * the host decoder undoes the inserted 0x0D bytes, LF -> CR is rejected at
+ * build time.
+ *
+ * A standard 8-byte frame takes 21 bytes on the wire, so a fully loaded
+ * 1 Mbit/s bus (about 8000 frames/s) needs roughly 170 kB/s: USB-CDC or
+ * USB-Serial-JTAG (the baud rate does not apply), or a UART console at
+ * 2 Mbaud (CONFIG_ESP_CONSOLE_UART_BAUDRATE, flash_manager.py --baud).
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "can_dispatch_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CONFIG_CAN_DISPATCH_STREAM_DEPTH
+#define CONFIG_CAN_DISPATCH_STREAM_DEPTH 256
+#endif
+
+#define CAN_STREAM_PKT_FRAME        0x01
+#define CAN_STREAM_PKT_DROPPED      0x02
+
+#define CAN_STREAM_FLAG_EXTD        0x10
+#define CAN_STREAM_FLAG_RTR         0x20
+#define CAN_STREAM_FLAG_TX          0x40
+
+/**
+ * @brief Stream counters
+ */
+typedef struct {
+    uint32_t logged;        ///< Records accepted into the ring
+    uint32_t dropped;       ///< Records lost because the ring was full
+    uint32_t bytes;         ///< Bytes written to the console
+} can_stream_stats_t;
+
+/**
+ * @brief Start the writer task; frames are logged from then on
+ * @return false if the task cannot be created
+ */
+bool can_stream_start(UBaseType_t priority);
+
+/**
+ * @brief Stop logging and the writer task (pending records are written first)
+ */
+void can_stream_stop(void);
+
+/**
+ * @brief Log one frame (called by the dispatcher; task context)
+ */
+void can_stream_log(const can_frame_t *frame, bool tx, uint8_t dev);
+
+/**
+ * @brief Read counters
+ */
+void can_stream_get_stats(can_stream_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
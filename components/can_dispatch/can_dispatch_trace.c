@@ -0,0 +1,148 @@
+/**
+ * @file can_dispatch_trace.c
+ * @brief Trace ring storage and serial dump
+ *
+ * Dump layout (little endian), base64 encoded in lines of 64 characters:
+ * a can_trace_dump_header_t followed, per core, by the ring head and the
+ * whole event array. The decoder keeps the last min(head, depth) events.
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#include "can_dispatch_trace.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_private/esp_clk.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t cores;
+    uint16_t event_size;
+    uint32_t depth;
+    uint32_t cpu_hz;
+} can_trace_dump_header_t;
+
+_Static_assert(sizeof(can_trace_event_t) == 12, "trace record layout is part of the dump format");
+
+can_trace_ring_t can_trace_rings[CAN_TRACE_MAX_CORES];
+// Recording starts at boot so the first events after a fault are not lost
+volatile bool can_trace_enabled = true;
+
+// ======================================================================================
+// Base64 line writer
+// ======================================================================================
+
+#define LINE_BYTES 48       // 64 characters per line
+
+static const char s_b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+typedef struct {
+    uint8_t buf[LINE_BYTES];
+    size_t fill;
+    uint32_t total;
+} b64_writer_t;
+
+static void b64_flush(b64_writer_t *w)
+{
+    if (w->fill == 0) {
+        return;
+    }
+    char line[LINE_BYTES / 3 * 4 + 1];
+    size_t o = 0;
+    for (size_t i = 0; i < w->fill; i += 3) {
+        uint32_t v = (uint32_t)w->buf[i] << 16;
+        if (i + 1 < w->fill) {
+            v |= (uint32_t)w->buf[i + 1] << 8;
+        }
+        if (i + 2 < w->fill) {
+            v |= w->buf[i + 2];
+        }
+        line[o++] = s_b64[(v >> 18) & 0x3F];
+        line[o++] = s_b64[(v >> 12) & 0x3F];
+        line[o++] = i + 1 < w->fill ? s_b64[(v >> 6) & 0x3F] : '=';
+        line[o++] = i + 2 < w->fill ? s_b64[v & 0x3F] : '=';
+    }
+    line[o] = '\0';
+    printf("CANTRACE %s\n", line);
+    w->fill = 0;
+}
+
+static void b64_write(b64_writer_t *w, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    w->total += len;
+    while (len) {
+        size_t n = LINE_BYTES - w->fill;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&w->buf[w->fill], p, n);
+        w->fill += n;
+        p += n;
+        len -= n;
+        if (w->fill == LINE_BYTES) {
+            b64_flush(w);
+        }
+    }
+}
+
+// ======================================================================================
+// Public API
+// ======================================================================================
+
+void can_trace_start(void)
+{
+    can_trace_enabled = false;
+    for (int c = 0; c < CAN_TRACE_MAX_CORES; c++) {
+        __atomic_store_n(&can_trace_rings[c].head, 0, __ATOMIC_RELAXED);
+    }
+    can_trace_enabled = true;
+    can_trace_sync();
+}
+
+void can_trace_stop(void)
+{
+    can_trace_enabled = false;
+}
+
+void can_trace_sync(void)
+{
+    can_trace_record(CAN_TRACE_SYNC, 0, 0, (uint32_t)esp_timer_get_time());
+}
+
+void can_trace_dump(void)
+{
+    bool was_enabled = can_trace_enabled;
+    // End anchor for the decoder (idle gaps longer than a counter wrap)
+    can_trace_sync();
+    can_trace_enabled = false;
+    // Let writers that passed the enabled check finish their record
+    vTaskDelay(1);
+
+    const can_trace_dump_header_t hdr = {
+        .magic = CAN_TRACE_MAGIC,
+        .version = CAN_TRACE_VERSION,
+        .cores = portNUM_PROCESSORS,
+        .event_size = sizeof(can_trace_event_t),
+        .depth = CONFIG_CAN_DISPATCH_TRACE_DEPTH,
+        .cpu_hz = (uint32_t)esp_clk_cpu_freq(),
+    };
+    b64_writer_t w = {0};
+    printf("CANTRACE BEGIN\n");
+    b64_write(&w, &hdr, sizeof(hdr));
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        const can_trace_ring_t *ring = &can_trace_rings[c];
+        b64_write(&w, &ring->head, sizeof(ring->head));
+        b64_write(&w, ring->events, sizeof(ring->events));
+    }
+    b64_flush(&w);
+    printf("CANTRACE END %lu\n", (unsigned long)w.total);
+    fflush(stdout);
+
+    can_trace_enabled = was_enabled;
+}
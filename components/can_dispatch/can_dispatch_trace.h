@@ -0,0 +1,152 @@
+/**
+ * @file can_dispatch_trace.h
+ * @brief Binary event trace of the CAN hot paths
+ *
+ * Each CPU core owns a ring of fixed-size binary events stamped with its
+ * cycle counter. Recording an event is one atomic increment of the core's
+ * write index plus four stores, with no locks and no formatting, so the trace
+ * can stay enabled in production builds. An ISR that interrupts a task on the
+ * same core reserves its own slot through the same atomic index.
+ *
+ * Traced points: MCP2515 INT edges, SPI transactions of the single adapter
+ * (start and end), RX buffer reads, adapter/service/gateway queue push and pop,
+ * TX buffer loads and TX completion. New events overwrite the oldest ones.
+ *
+ * can_trace_dump() pauses recording and prints the rings to stdout as
+ * base64 lines between "CANTRACE BEGIN" and "CANTRACE END" markers, so the
+ * dump passes through the normal serial console. py/trace/trace_decode.py
+ * turns a captured log into Chrome trace JSON for Perfetto.
+ *
+ * Cycle counters of the two cores are not synchronised: can_trace_sync()
+ * records an anchor (esp_timer time) on the calling core; call it once per
+ * core, e.g. from a task pinned to each core, to align them in the decoder.
+ * Anchors also let the decoder count cycle counter wraps (every 2^32 cycles)
+ * during idle periods, so repeat them if a trace spans long idle gaps.
+ *
+ * @author Ivo Marvan
+ * @date 2025
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "can_dispatch_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CONFIG_CAN_DISPATCH_TRACE_DEPTH
+#define CONFIG_CAN_DISPATCH_TRACE_DEPTH 1024
+#endif
+
+#define CAN_TRACE_MAGIC         0x43525443UL    // "CTRC" little endian
+#define CAN_TRACE_VERSION       1
+#define CAN_TRACE_MAX_CORES     2
+
+/**
+ * @brief Event types (the decoder in py/trace mirrors this list)
+ */
+typedef enum {
+    CAN_TRACE_SYNC = 0,         ///< arg = esp_timer time in us (low 32 bits)
+    CAN_TRACE_ISR,              ///< aux = device index
+    CAN_TRACE_SPI_BEGIN,        ///< aux = instruction byte, len = transaction bytes
+    CAN_TRACE_SPI_END,          ///< aux = instruction byte, arg = 1 on success
+    CAN_TRACE_RX_READ,          ///< aux = RX buffer or device, len = DLC, arg = ID | 0x80000000 for extended
+    CAN_TRACE_QUEUE_PUSH,       ///< aux = queue (CAN_TRACE_Q_*), len = fill level after push, arg = ID
+    CAN_TRACE_QUEUE_POP,        ///< aux = queue, len = fill level after pop, arg = ID
+    CAN_TRACE_QUEUE_FULL,       ///< aux = queue, arg = ID of the dropped frame
+    CAN_TRACE_TX_LOAD,          ///< aux = TX buffer, len = DLC, arg = ID
+    CAN_TRACE_TX_DONE,          ///< aux = TX buffer, arg = ID (when the adapter sees TXREQ cleared)
+    CAN_TRACE_USER,             ///< free for application markers
+} can_trace_type_t;
+
+// Queue identifiers of CAN_TRACE_QUEUE_* events
+#define CAN_TRACE_Q_SINGLE_RX       0x00                    ///< MCP2515 single adapter RX FIFO
+#define CAN_TRACE_Q_MULTI_RX(dev)   (0x10 + (dev))          ///< Multi service RX queue of a device
+#define CAN_TRACE_Q_GATEWAY_TX(p)   (0x20 + (p))            ///< Gateway TX queue of a port
+
+// ID argument of frame events: bit 31 marks an extended ID
+#define CAN_TRACE_FRAME_ID(frame) \
+    ((frame)->id | (can_frame_is_extd(frame) ? 0x80000000UL : 0))
+
+/**
+ * @brief One trace record (12 bytes, little endian in the dump)
+ */
+typedef struct {
+    uint32_t cycles;        ///< CPU cycle counter of the recording core
+    uint8_t type;           ///< can_trace_type_t
+    uint8_t aux;
+    uint16_t len;
+    uint32_t arg;
+} can_trace_event_t;
+
+/**
+ * @brief Per-core ring; head counts every event ever reserved
+ */
+typedef struct {
+    uint32_t head;
+    can_trace_event_t events[CONFIG_CAN_DISPATCH_TRACE_DEPTH];
+} can_trace_ring_t;
+
+#if CONFIG_CAN_DISPATCH_TRACE
+
+#include "esp_cpu.h"
+
+_Static_assert((CONFIG_CAN_DISPATCH_TRACE_DEPTH & (CONFIG_CAN_DISPATCH_TRACE_DEPTH - 1)) == 0,
+               "CONFIG_CAN_DISPATCH_TRACE_DEPTH must be a power of two");
+
+extern can_trace_ring_t can_trace_rings[CAN_TRACE_MAX_CORES];
+extern volatile bool can_trace_enabled;
+
+/**
+ * @brief Record an event on the calling core (task or ISR context)
+ */
+static inline void can_trace_record(uint8_t type, uint8_t aux, uint16_t len, uint32_t arg)
+{
+    if (!can_trace_enabled) {
+        return;
+    }
+    can_trace_ring_t *ring = &can_trace_rings[esp_cpu_get_core_id()];
+    uint32_t idx = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    can_trace_event_t *ev = &ring->events[idx & (CONFIG_CAN_DISPATCH_TRACE_DEPTH - 1)];
+    ev->cycles = esp_cpu_get_cycle_count();
+    ev->type = type;
+    ev->aux = aux;
+    ev->len = len;
+    ev->arg = arg;
+}
+
+#define CAN_TRACE(type, aux, len, arg) \
+    can_trace_record((type), (uint8_t)(aux), (uint16_t)(len), (uint32_t)(arg))
+
+/**
+ * @brief Clear the rings and start recording
+ */
+void can_trace_start(void);
+
+/**
+ * @brief Stop recording (the rings keep their content)
+ */
+void can_trace_stop(void);
+
+/**
+ * @brief Record a SYNC anchor for the calling core
+ */
+void can_trace_sync(void);
+
+/**
+ * @brief Print the rings to stdout (base64 lines); recording is paused meanwhile
+ */
+void can_trace_dump(void);
+
+#else
+
+#define CAN_TRACE(type, aux, len, arg) ((void)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
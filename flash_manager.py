@@ -26,6 +26,9 @@ import logging
 
 # Import our modules
 from py.gui.app_gui import AppGui
+from py.monitor.frame_capture import CAPTURE_FORMATS
+from py.monitor.frame_store import STORE_FORMAT
+from py.monitor.shell_monitor_logic import ShellMonitorLogic
 
 
 def main(logging_level):
@@ -50,6 +53,24 @@ def main(logging_level):
                         action='store_true',
                         help="Enable debug mode")
 
+    parser.add_argument('-c', '--capture-dir',
+                        default=None,
+                        help="Capture CAN frames of monitored ports to files in this directory (default: off)")
+    parser.add_argument('--capture-format',
+                        choices=[*CAPTURE_FORMATS, STORE_FORMAT], default="candump",
+                        help="Capture file format; 'store' is the indexed frame store (default: candump)")
+    parser.add_argument('--capture-rotate-mb',
+                        type=float, default=0,
+                        help="Start a new capture file every N MB (default: 0 = off)")
+    parser.add_argument('--capture-compress',
+                        action='store_true',
+                        help="Compress capture files (zstd, needs the zstandard package; BLF uses zlib)")
+    parser.add_argument('-b', '--baud',
+                        type=int, default=ShellMonitorLogic.BAUD_RATE,
+                        help="Monitor line speed of UART consoles (ttyUSB*), e.g. 2000000 for the binary frame "
+                             "stream of a full 1 Mbit/s bus; must match CONFIG_ESP_CONSOLE_UART_BAUDRATE "
+                             "(default: 115200; USB ports ignore it)")
+
     args = parser.parse_args()
 
     # Adjust logging level based on verbose flag
@@ -63,6 +84,11 @@ def main(logging_level):
         sdkconfig_path=args.sdkconfig, 
         idf_setup_path=args.idf_setup,
         debug=args.debug,
+        capture_dir=args.capture_dir,
+        capture_format=args.capture_format,
+        capture_rotate_mb=args.capture_rotate_mb,
+        capture_compress=args.capture_compress,
+        baud_rate=args.baud,
     )
 
     app.run()
@@ -8,9 +8,13 @@ Handles configuration updates, code compilation with ESP-IDF, and firmware uploa
 Manages the complete workflow from Kconfig parsing to ESP32 flashing.
 '''
 
+import asyncio
 import glob
+import hashlib
+import json
 import re
-from typing import List, Optional, Type, Any, Tuple
+import subprocess
+from typing import Dict, List, Optional, Type, Any, Tuple
 import traceback
 import os
 import shutil
@@ -36,6 +40,9 @@ class FlashApp:
     """
 
     WORKSPACES_DIR = ".workspaces"
+    CCACHE_DIR = os.path.join(WORKSPACES_DIR, ".ccache")   # one compiler cache for all workspaces
+    CCACHE_MAX_SIZE = "5G"
+    BUILD_INPUTS_FILE = ".build_inputs.json"                # in the build directory, see should_fullclean()
 
     def __init__(
             self,
@@ -44,6 +51,7 @@ class FlashApp:
             sdkconfig_path: str = "./sdkconfig",
             gui_app=None,
             menu_name: str = "*** CAN bus examples  ***",
+            use_ccache: bool = True,
             *args, **kwargs
     ):
         """
@@ -55,12 +63,14 @@ class FlashApp:
             sdkconfig_path: Path to sdkconfig file
             gui_app: Optional reference to GUI application instance
             menu_name: Menu name in Kconfig to parse
+            use_ccache: Build through the compiler cache shared by all workspaces
         """
         super().__init__(*args, **kwargs)
         self.idf_setup_path = idf_setup_path
         self.kconfig_path = kconfig_path
         self.sdkconfig_path = sdkconfig_path
         self.menu_name = menu_name
+        self.use_ccache = use_ccache
         self.gui_app = gui_app
         self.kconfig_dict = None
         self.sdkconfig = None
@@ -302,21 +312,14 @@ class FlashApp:
         if not success1:
             return False
         jobs = self.get_optimal_jobs()
-        should_fullclean = self.should_fullclean(None, None)
+        # Tree walk and git run off the event loop
+        inputs = self.build_inputs(await asyncio.to_thread(self.project_build_inputs))
+        should_fullclean, reason = self.should_fullclean(self._workspace_path, inputs)
         if should_fullclean:
-            command = (
-                f"bash -c 'export MAKEFLAGS=-j{jobs} && "
-                f"source {self.idf_setup_path} && "
-                f"cd {self._workspace_path} && "
-                f"idf.py fullclean && idf.py build'"
-            )
+            build_logger.warning(f"Full clean build: {reason}")
         else:
-            command = (
-                f"bash -c 'export MAKEFLAGS=-j{jobs} && "
-                f"source {self.idf_setup_path} && "
-                f"cd {self._workspace_path} && "
-                f"idf.py build'"
-            )
+            build_logger.info(f"Incremental build: {reason}")
+        command = self.build_command(self._workspace_path, jobs, should_fullclean)
         success2 = await self.call_with_results(
             name="Compile ESP32 firmware",
             target=ShellCommandConfig(
@@ -327,6 +330,7 @@ class FlashApp:
         )
         if not success2:
             return False
+        self.save_build_inputs(self._workspace_path, inputs)
 
         time.sleep(0.5)
         command = f"bash -c 'source {self.idf_setup_path} && cd {self._workspace_path} && idf.py -p /dev/{port} flash'"
@@ -395,13 +399,16 @@ class FlashApp:
         return lib_options, example_options 
 
     @staticmethod
-    def get_optimal_jobs() -> int:
+    def get_optimal_jobs(max_jobs: int = 16) -> int:
         """
         Calculate optimal number of parallel compilation jobs.
         Based on CPU count and available memory.
         
+        Args:
+            max_jobs: Upper limit (one build gains little above 16; a build matrix uses the whole machine)
+            
         Returns:
-            Number of parallel jobs (1-16)
+            Number of parallel jobs (1-max_jobs)
         """
         cpu_count = multiprocessing.cpu_count()
         available_memory = psutil.virtual_memory().available / (1024**3)
@@ -412,20 +419,271 @@ class FlashApp:
         else:
             jobs = cpu_count
         
-        jobs = max(1, min(jobs, 16))
+        jobs = max(1, min(jobs, max_jobs))
         
         return jobs
 
-    def should_fullclean(self, old_config: dict = None, new_config: dict = None) -> bool:
+    def ccache_exports(self) -> str:
+        """
+        Shell exports of the compiler cache shared by all workspaces.
+        Paths under the project root are hashed relative to it and the working
+        directory is left out of the hash, so an object compiled in one workspace
+        is a hit in every other one. sdkconfig.h differs between combinations,
+        which defeats the direct mode; the preprocessed mode still hits for the
+        ESP-IDF components that do not use the changed options.
+
+        Returns:
+            "export ... && " prefix, empty with the cache disabled
+        """
+        if not self.use_ccache:
+            return ""
+        return (
+            f"export CCACHE_DIR={os.path.realpath(self.CCACHE_DIR)} "
+            f"CCACHE_BASEDIR={os.path.realpath('.')} "
+            f"CCACHE_NOHASHDIR=1 CCACHE_MAXSIZE={self.CCACHE_MAX_SIZE} && "
+        )
+
+    def build_command(self, workspace_path: str, jobs: int, fullclean: bool = False) -> str:
+        """
+        Shell command building one workspace.
+
+        Args:
+            workspace_path: Workspace directory
+            jobs: Parallel compile jobs
+            fullclean: Run fullclean before the build (the compiler cache survives it)
+
+        Returns:
+            Command for ShellCommandConfig
+        """
+        idf = "idf.py --ccache" if self.use_ccache else "idf.py"
+        clean = "idf.py fullclean && " if fullclean else ""
+        return (
+            f"bash -c 'export MAKEFLAGS=-j{jobs} && "
+            f"{self.ccache_exports()}"
+            f"source {self.idf_setup_path} && "
+            f"cd {workspace_path} && "
+            f"{clean}{idf} build'"
+        )
+
+    async def _run_ccache(self, arguments: str) -> Optional[str]:
+        """
+        Run ccache from the ESP-IDF environment on the shared cache.
+
+        Returns:
+            Standard output, None if ccache is not available or fails
+        """
+        if not self.use_ccache:
+            return None
+        command = (
+            f"bash -c '{self.ccache_exports()}"
+            f"source {self.idf_setup_path} >/dev/null 2>&1 && "
+            f"ccache {arguments}'"
+        )
+        try:
+            process = await asyncio.create_subprocess_shell(
+                command, stdout=asyncio.subprocess.PIPE, stderr=asyncio.subprocess.DEVNULL)
+            stdout, _ = await asyncio.wait_for(process.communicate(), timeout=60)
+        except (OSError, asyncio.TimeoutError) as e:
+            build_logger.debug(f"ccache {arguments} failed: {e}")
+            return None
+        if process.returncode != 0:
+            return None
+        return stdout.decode(errors='replace')
+
+    async def ccache_zero_stats(self) -> bool:
+        """Reset the statistics of the shared compiler cache."""
+        return await self._run_ccache("--zero-stats") is not None
+
+    async def ccache_stats(self) -> Optional[Dict[str, int]]:
+        """
+        Counters of the shared compiler cache (ccache 4 --print-stats).
+
+        Returns:
+            Dict such as {'direct_cache_hit': .., 'preprocessed_cache_hit': .., 'cache_miss': ..},
+            None if not available
+        """
+        output = await self._run_ccache("--print-stats")
+        if output is None:
+            return None
+        stats = {}
+        for line in output.splitlines():
+            key, _, value = line.partition('\t')
+            if value.strip().isdigit():
+                stats[key] = int(value)
+        return stats or None
+
+    @staticmethod
+    def cmake_config_keys(project_dir: str = ".") -> List[str]:
+        """
+        sdkconfig keys the CMake files of the project branch on.
+        They change source lists and component requirements, so a stale CMake
+        cache built with other values is not safe. CONFIG_IDF_TARGET is always included.
+
+        Args:
+            project_dir: Project root
+
+        Returns:
+            Sorted list of CONFIG_ keys
+        """
+        keys = {"CONFIG_IDF_TARGET"}
+        for root, dirs, files in os.walk(project_dir):
+            dirs[:] = [d for d in dirs if not d.startswith('.') and d not in ('build', 'managed_components')]
+            for name in files:
+                if name == "CMakeLists.txt" or name.endswith(".cmake"):
+                    try:
+                        with open(os.path.join(root, name), 'r', errors='replace') as f:
+                            keys.update(re.findall(r'\bCONFIG_[A-Z0-9_]+', f.read()))
+                    except OSError:
+                        pass
+        return sorted(keys)
+
+    @staticmethod
+    def _hash_files(paths: List[str]) -> str:
+        """Digest of the names and contents of existing files."""
+        digest = hashlib.sha256()
+        for path in sorted(paths):
+            if os.path.isfile(path):
+                digest.update(path.encode())
+                with open(path, 'rb') as f:
+                    digest.update(f.read())
+        return digest.hexdigest()[:16]
+
+    @staticmethod
+    def submodule_commits(project_dir: str = ".") -> Dict[str, str]:
+        """
+        Checked out commit of each git submodule.
+
+        Returns:
+            Dict path -> commit, empty outside a git checkout
+        """
+        try:
+            output = subprocess.run(["git", "submodule", "status"], cwd=project_dir,
+                                    capture_output=True, text=True, timeout=30).stdout
+        except (OSError, subprocess.TimeoutExpired):
+            return {}
+        commits = {}
+        for line in output.splitlines():
+            fields = line[1:].split()
+            if len(fields) >= 2:
+                commits[fields[1]] = fields[0]
+        return commits
+
+    def toolchain_version(self) -> str:
+        """
+        ESP-IDF installation and version the build uses; the version also fixes the
+        compiler release (tools/tools.json).
+
+        Returns:
+            "<IDF_PATH> v<major>.<minor>.<patch> tools:<digest>"
+        """
+        idf_path = os.path.dirname(os.path.realpath(os.path.expanduser(self.idf_setup_path)))
+        version = "v?"
+        try:
+            with open(os.path.join(idf_path, "tools", "cmake", "version.cmake"), 'r') as f:
+                parts = dict(re.findall(r'set\(IDF_VERSION_(MAJOR|MINOR|PATCH)\s+(\d+)\)', f.read()))
+            version = f"v{parts.get('MAJOR', '?')}.{parts.get('MINOR', '?')}.{parts.get('PATCH', '?')}"
+        except OSError:
+            pass
+        tools = self._hash_files([os.path.join(idf_path, "tools", "tools.json")])
+        return f"{idf_path} {version} tools:{tools}"
+
+    def project_build_inputs(self) -> Dict[str, Any]:
+        """
+        Workspace independent part of build_inputs(): walks the project tree and
+        runs git, so compute it once per run and share it between builds.
+
+        Returns:
+            Dict with 'config_keys', 'components', 'submodules' and 'toolchain' entries
+        """
+        manifests = ["dependencies.lock"] + glob.glob("main/idf_component.yml") + glob.glob("components/*/idf_component.yml")
+        return {
+            "config_keys": self.cmake_config_keys(),
+            "components": self._hash_files(manifests),
+            "submodules": self.submodule_commits(),
+            "toolchain": self.toolchain_version(),
+        }
+
+    def build_inputs(self, project: Optional[Dict[str, Any]] = None) -> Dict[str, Any]:
+        """
+        Inputs of the current workspace that invalidate the CMake cache.
+        Uses self.sdkconfig, so call it after _update_sdkconfig().
+
+        Args:
+            project: project_build_inputs() of this run (computed now if None)
+
+        Returns:
+            Dict with 'sdkconfig', 'components', 'submodules' and 'toolchain' entries
+        """
+        if project is None:
+            project = self.project_build_inputs()
+        sdkconfig = {}
+        for key in project["config_keys"]:
+            line = self.sdkconfig.get_line_by_key(key) if self.sdkconfig else None
+            sdkconfig[key] = line.value if line else None
+        return {
+            "sdkconfig": sdkconfig,
+            "components": project["components"],
+            "submodules": project["submodules"],
+            "toolchain": project["toolchain"],
+        }
+
+    def should_fullclean(self, workspace_path: str, inputs: Dict[str, Any]) -> Tuple[bool, str]:
         """
         Determine if full clean build is needed.
-        Currently always returns False - incremental builds only.
-        
+        Compares the inputs with those recorded by the last build of the workspace;
+        any other change is left to the incremental build.
+
         Args:
-            old_config: Previous configuration (unused)
-            new_config: New configuration (unused)
-            
+            workspace_path: Workspace directory
+            inputs: Current build_inputs()
+
         Returns:
-            False (incremental builds only)
+            Tuple (fullclean needed, reason for the build log)
         """
-        return False
+        build_dir = os.path.join(workspace_path, "build")
+        if not os.path.exists(os.path.join(build_dir, "CMakeCache.txt")):
+            return False, "no CMake cache yet"
+        try:
+            with open(os.path.join(build_dir, self.BUILD_INPUTS_FILE), 'r') as f:
+                recorded = json.load(f)
+        except (OSError, ValueError):
+            return True, "build inputs of the existing build directory are not recorded"
+
+        def shown(value) -> str:
+            return "unset" if value is None else str(value)
+
+        reasons = []
+        old_config, new_config = recorded.get("sdkconfig", {}), inputs["sdkconfig"]
+        for key in sorted(set(old_config) | set(new_config)):
+            if old_config.get(key) != new_config.get(key):
+                reasons.append(f"{key} {shown(old_config.get(key))} -> {shown(new_config.get(key))}")
+        if recorded.get("components") != inputs["components"]:
+            reasons.append("component manifest (dependencies.lock, idf_component.yml) changed")
+        old_modules, new_modules = recorded.get("submodules", {}), inputs["submodules"]
+        for path in sorted(set(old_modules) | set(new_modules)):
+            if old_modules.get(path) != new_modules.get(path):
+                reasons.append(f"submodule {path} {shown(old_modules.get(path))[:8]} -> {shown(new_modules.get(path))[:8]}")
+        if recorded.get("toolchain") != inputs["toolchain"]:
+            reasons.append(f"toolchain {shown(recorded.get('toolchain'))} -> {inputs['toolchain']}")
+        if reasons:
+            return True, "; ".join(reasons)
+        return False, "build inputs unchanged"
+
+    def save_build_inputs(self, workspace_path: str, inputs: Dict[str, Any]) -> None:
+        """
+        Record the inputs the build directory was configured with.
+        Call it after a successful build only: a failed one keeps the old record,
+        so the next build still sees the change.
+
+        Args:
+            workspace_path: Workspace directory
+            inputs: build_inputs() taken before the build
+        """
+        build_dir = os.path.join(workspace_path, "build")
+        if not os.path.isdir(build_dir):
+            return
+        try:
+            with open(os.path.join(build_dir, self.BUILD_INPUTS_FILE), 'w') as f:
+                json.dump(inputs, f, indent=2, sort_keys=True)
+        except OSError as e:
+            build_logger.warning(f"Cannot record build inputs: {e}")
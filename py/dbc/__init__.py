@@ -0,0 +1,6 @@
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+DBC tooling: generation of decode tables for components/can_dispatch/can_dispatch_dbc.h.
+'''
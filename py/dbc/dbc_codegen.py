@@ -0,0 +1,268 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+DBC to C decode table generator for can_dispatch_dbc.
+
+Reads a DBC file and writes <name>_dbc.h / <name>_dbc.c with:
+- signal index constants <MESSAGE>_<SIGNAL>,
+- message table sorted by identifier and per-signal shift/mask/scale plans,
+- the struct-of-arrays signal store and a can_dbc_db_t instance <name>_db.
+
+With --bench the generated code is compiled for the host together with
+components/can_dispatch/can_dispatch_dbc.c and the decode time per frame is
+measured on random traffic (a fraction of frames repeats the previous payload,
+as periodic messages do on a real bus).
+
+Multiplexed signals (M / mN) are skipped.
+'''
+import argparse
+import os
+import re
+import sys
+from dataclasses import dataclass, field
+from typing import List
+
+from py.host_bench.host_cc import build_and_run
+
+_BO_RE = re.compile(r'^BO_\s+(\d+)\s+(\w+)\s*:\s*(\d+)\s+(\w+)')
+_SG_RE = re.compile(r'^SG_\s+(\w+)\s*(\w*)\s*:\s*(\d+)\|(\d+)@([01])([+-])\s*'
+                    r'\(\s*([-+0-9.eE]+)\s*,\s*([-+0-9.eE]+)\s*\)')
+
+CAN_EFF_FLAG = 0x80000000
+CAN_DBC_ID_EXTD = 0x80000000
+SIG_BIG_ENDIAN = 0x01
+SIG_SIGNED = 0x02
+
+
+@dataclass
+class DbcSignal:
+    name: str
+    start: int
+    length: int
+    big_endian: bool
+    signed: bool
+    factor: float
+    offset: float
+
+    def plan(self):
+        """
+        Returns (shift, mask) of the field within the 64-bit payload word.
+        Intel signals use the little-endian word, Motorola signals the
+        big-endian word, so both are a single shift and mask.
+        """
+        if self.big_endian:
+            # DBC start bit is the MSB in byte*8 + bit numbering
+            byte, bit = divmod(self.start, 8)
+            msb = (7 - byte) * 8 + bit
+            shift = msb - self.length + 1
+        else:
+            shift = self.start
+        if shift < 0 or shift + self.length > 64:
+            raise ValueError(f"signal {self.name} does not fit into 8 bytes")
+        mask = ((1 << self.length) - 1) << shift
+        return shift, mask
+
+
+@dataclass
+class DbcMessage:
+    can_id: int
+    extd: bool
+    name: str
+    dlc: int
+    signals: List[DbcSignal] = field(default_factory=list)
+
+    @property
+    def key(self):
+        return self.can_id | (CAN_DBC_ID_EXTD if self.extd else 0)
+
+
+def parse_dbc(path):
+    """
+    Parses BO_ and SG_ lines of a DBC file.
+
+    Returns:
+        (messages sorted by key, number of skipped multiplexed signals)
+    """
+    messages = []
+    skipped = 0
+    current = None
+    with open(path, encoding='utf-8', errors='replace') as f:
+        for line in f:
+            line = line.strip()
+            m = _BO_RE.match(line)
+            if m:
+                raw_id = int(m.group(1))
+                current = DbcMessage(can_id=raw_id & 0x1FFFFFFF,
+                                     extd=bool(raw_id & CAN_EFF_FLAG),
+                                     name=m.group(2), dlc=int(m.group(3)))
+                messages.append(current)
+                continue
+            m = _SG_RE.match(line)
+            if m and current is not None:
+                if m.group(2):
+                    skipped += 1
+                    continue
+                current.signals.append(DbcSignal(name=m.group(1),
+                                                 start=int(m.group(3)),
+                                                 length=int(m.group(4)),
+                                                 big_endian=m.group(5) == '0',
+                                                 signed=m.group(6) == '-',
+                                                 factor=float(m.group(7)),
+                                                 offset=float(m.group(8))))
+                continue
+            if line and not line.startswith('SG_'):
+                current = None
+    messages = [msg for msg in messages if msg.signals]
+    messages.sort(key=lambda msg: msg.key)
+    return messages, skipped
+
+
+def _c_ident(text):
+    return re.sub(r'\W', '_', text).upper()
+
+
+def generate(messages, name):
+    """
+    Returns (header, source) text of the generated decode tables.
+    """
+    signal_count = sum(len(msg.signals) for msg in messages)
+    h = [f"// Generated by py/dbc/dbc_codegen.py, do not edit",
+         f"#pragma once",
+         f'#include "can_dispatch_dbc.h"',
+         f"",
+         f"#define {_c_ident(name)}_MESSAGE_COUNT {len(messages)}",
+         f"#define {_c_ident(name)}_SIGNAL_COUNT {signal_count}",
+         f""]
+    c = [f"// Generated by py/dbc/dbc_codegen.py, do not edit",
+         f'#include "{name}_dbc.h"',
+         f"",
+         f"static const can_dbc_message_t s_messages[{max(len(messages), 1)}] = {{"]
+    sig_lines = []
+    index = 0
+    for msg in messages:
+        c.append(f"    {{ 0x{msg.key:08X}UL, {index}, {len(msg.signals)} }},  // {msg.name}")
+        for sig in msg.signals:
+            shift, mask = sig.plan()
+            flags = []
+            if sig.big_endian:
+                flags.append("CAN_DBC_SIG_BIG_ENDIAN")
+            if sig.signed:
+                flags.append("CAN_DBC_SIG_SIGNED")
+            h.append(f"#define {_c_ident(msg.name)}_{_c_ident(sig.name)} {index}")
+            sig_lines.append(f"    {{ 0x{mask:016X}ULL, {sig.factor!r}f, {sig.offset!r}f, {shift}, {sig.length}, "
+                             f"{' | '.join(flags) or '0'} }},  // {msg.name}.{sig.name}")
+            index += 1
+    c.append("};")
+    c.append("")
+    c.append(f"static const can_dbc_signal_t s_signals[{max(signal_count, 1)}] = {{")
+    c.extend(sig_lines)
+    c.append("};")
+    c.append("")
+    c.append(f"static float s_value[{max(signal_count, 1)}];")
+    c.append(f"static int64_t s_raw[{max(signal_count, 1)}];")
+    c.append(f"static uint32_t s_changed[{(signal_count + 31) // 32 or 1}];")
+    c.append(f"static uint64_t s_last_payload[{max(len(messages), 1)}];")
+    c.append(f"static uint32_t s_seen[{(len(messages) + 31) // 32 or 1}];")
+    c.append("")
+    c.append(f"can_dbc_db_t {name}_db = {{")
+    c.append(f"    .messages = s_messages,")
+    c.append(f"    .message_count = {len(messages)},")
+    c.append(f"    .signals = s_signals,")
+    c.append(f"    .signal_count = {signal_count},")
+    c.append(f"    .value = s_value,")
+    c.append(f"    .raw = s_raw,")
+    c.append(f"    .changed = s_changed,")
+    c.append(f"    .last_payload = s_last_payload,")
+    c.append(f"    .seen = s_seen,")
+    c.append("};")
+    h.append("")
+    h.append(f"extern can_dbc_db_t {name}_db;")
+    h.append("")
+    return "\n".join(h), "\n".join(c) + "\n"
+
+
+_BENCH_MAIN = '''#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "%(name)s_dbc.h"
+
+#define FRAMES 200000
+
+int main(int argc, char **argv)
+{
+    double repeat = argc > 1 ? atof(argv[1]) : 0.5;
+    can_frame_t *frames = calloc(FRAMES, sizeof(can_frame_t));
+    srand(1);
+    for (int i = 0; i < FRAMES; i++) {
+        size_t m = (size_t)rand() %% %(name)s_db.message_count;
+        uint32_t key = %(name)s_db.messages[m].key;
+        frames[i].id = key & ~CAN_DBC_ID_EXTD;
+        frames[i].flags = (key & CAN_DBC_ID_EXTD) ? CAN_FRAME_FLAG_EXTD : 0;
+        frames[i].dlc = 8;
+        if ((double)rand() / RAND_MAX >= repeat) {
+            for (int b = 0; b < 8; b++) {
+                frames[i].data[b] = (uint8_t)rand();
+            }
+        }
+    }
+    size_t changed = 0;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < FRAMES; i++) {
+        changed += can_dbc_decode(&%(name)s_db, &frames[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("%%d frames, %%zu signal updates, %%.1f ns/frame\\n", FRAMES, changed, ns / FRAMES);
+    free(frames);
+    return 0;
+}
+'''
+
+
+def run_bench(header, source, name, repeat, cc):
+    """
+    Compiles the generated tables with the decoder for the host and runs the benchmark.
+    """
+    build_and_run({f'{name}_dbc.h': header, f'{name}_dbc.c': source, 'bench.c': _BENCH_MAIN % {'name': name}},
+                  ['can_dispatch_dbc.c'], args=[repeat], cc=cc)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__description__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('dbc', help="Input DBC file")
+    parser.add_argument('-n', '--name', default=None,
+                        help="Base name of the generated files and database (default: DBC file name)")
+    parser.add_argument('-o', '--output', default='.', help="Output directory (default: .)")
+    parser.add_argument('--bench', action='store_true', help="Build and run the host decode benchmark")
+    parser.add_argument('--repeat', type=float, default=0.5,
+                        help="Benchmark: fraction of frames repeating the previous payload (default: 0.5)")
+    parser.add_argument('--cc', default='cc', help="Benchmark: host C compiler (default: cc)")
+    args = parser.parse_args()
+
+    name = args.name or re.sub(r'\W', '_', os.path.splitext(os.path.basename(args.dbc))[0]).lower()
+    messages, skipped = parse_dbc(args.dbc)
+    if not messages:
+        print(f"No messages with signals in {args.dbc}", file=sys.stderr)
+        return 1
+    header, source = generate(messages, name)
+
+    os.makedirs(args.output, exist_ok=True)
+    with open(os.path.join(args.output, f'{name}_dbc.h'), 'w') as f:
+        f.write(header)
+    with open(os.path.join(args.output, f'{name}_dbc.c'), 'w') as f:
+        f.write(source)
+    signal_count = sum(len(msg.signals) for msg in messages)
+    print(f"{name}: {len(messages)} messages, {signal_count} signals"
+          + (f", {skipped} multiplexed signals skipped" if skipped else ""))
+
+    if args.bench:
+        run_bench(header, source, name, args.repeat, args.cc)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -43,7 +43,12 @@ class AppGui(App):
             kconfig_path: str = "./main/Kconfig.projbuild",
             sdkconfig_path: str = "./sdkconfig",
             idf_setup_path: str = "~/esp/v5.4.1/esp-idf/export.sh",
-            debug: bool = False
+            debug: bool = False,
+            capture_dir: str = None,
+            capture_format: str = "candump",
+            capture_rotate_mb: float = 0,
+            capture_compress: bool = False,
+            baud_rate: int = ShellMonitorLogic.BAUD_RATE
     ):
         """
         Initialize ESP32 Flash Tool GUI application.
@@ -53,6 +58,11 @@ class AppGui(App):
             sdkconfig_path: Path to sdkconfig file
             idf_setup_path: Path to ESP-IDF setup script
             debug: Enable debug features in GUI
+            capture_dir: Directory for CAN frame captures of monitored ports (None = no capture)
+            capture_format: Capture file format (candump, asc, blf, pcapng, store)
+            capture_rotate_mb: Roll over to a new capture file every N MB (0 = off)
+            capture_compress: Compressed capture files
+            baud_rate: Line speed of monitored UART consoles
         """
         self._debug = debug
         super().__init__()
@@ -81,9 +91,13 @@ class AppGui(App):
         )
         self.monitor_logic = ShellMonitorLogic(
             idf_setup_path=idf_setup_path,
-            read_timeout=0.001,
             chunk_size=4096,
-            flush_interval=0.05
+            flush_interval=0.05,
+            capture_dir=capture_dir,
+            capture_format=capture_format,
+            capture_rotate_mb=capture_rotate_mb,
+            capture_compress=capture_compress,
+            baud_rate=baud_rate
         )
         self.ports, self.real_ports_found = self.logic.find_flash_ports()
 
@@ -9,7 +9,7 @@ Includes real-time build output logging and dependency validation.
 from typing import List
 from textual.app import App, ComposeResult
 from textual.containers import Grid, Container
-from textual.widgets import Static, Button, Select
+from textual.widgets import Static, Button, Select, Input
 from py.log.rich_log_extended import RichLogExtended
 from py.app_logic import FlashApp
 from py.log.rich_log_handler import RichLogHandler
@@ -73,6 +73,7 @@ class BuildFlashTab(Container):
             markup=True,
         )
         with Container(id="build-flash-actions"):
+            yield Input(placeholder="🔍 Search log (Enter = next)", id="log-search")
             yield Button("🧹 Clear Log", id="clear-log", classes="toolbar-button")
             if self._debug:
                 yield Button("📊 Log Statistics", id="richlog-statistics", classes="toolbar-button")
@@ -142,6 +143,13 @@ class BuildFlashTab(Container):
         elif event.button.id == "richlog-statistics":
             self._on_show_stats_pressed(event)
 
+    def on_input_submitted(self, event: Input.Submitted) -> None:
+        """Jump to the next log line containing the search text."""
+        if event.input.id == "log-search" and event.value:
+            rich_log = self.query_one("#status", RichLogExtended)
+            if not rich_log.find(event.value):
+                self.notify(f"'{event.value}' not found in the last {rich_log.max_lines} lines", severity="warning")
+
     def _on_flash_pressed(self, event: Button.Pressed) -> None:
         """Handle flash button press - start async build and flash process."""
         port = event.button.id.replace("flash-", "")
@@ -0,0 +1,6 @@
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Host builds and benchmarks of the platform independent parts of components/can_dispatch.
+'''
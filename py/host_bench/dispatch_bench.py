@@ -0,0 +1,206 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Host instruction count of the per-frame send path of the MCP2515 single
+backend (can_dispatch.c + can_dispatch_inline.h) for each dispatch option.
+
+can_dispatch.c is compiled for the host with the adapter replaced by an
+out-of-line stub, so only the dispatcher layers are counted. A traced child
+sends the frames while the parent single-steps it with ptrace; the count per
+frame is the difference between two runs divided by the difference of their
+frame counts, so the setup cancels out; the stub and the bench loop are the
+same few instructions in every variant.
+
+The numbers are host (x86-64) instructions, not Xtensa/RISC-V ones, but the
+difference between the options is the dispatcher code removed by each of
+them. Needs Linux on x86-64 (ptrace single-step).
+
+    python -m py.host_bench.dispatch_bench
+'''
+import argparse
+import sys
+
+from py.host_bench.host_cc import build_and_run
+
+_STUBS = {
+    'sdkconfig.h': '''#pragma once
+/* options come from -D flags of each variant */
+''',
+    'driver/twai.h': '''#pragma once
+#include <stdint.h>
+typedef struct {
+    union {
+        struct {
+            uint32_t extd: 1;
+            uint32_t rtr: 1;
+            uint32_t ss: 1;
+            uint32_t self: 1;
+            uint32_t dlc_non_comp: 1;
+            uint32_t reserved: 27;
+        };
+        uint32_t flags;
+    };
+    uint32_t identifier;
+    uint8_t data_length_code;
+    uint8_t data[8];
+} twai_message_t;
+''',
+    'driver/spi_master.h': '#pragma once\n',
+    'driver/gpio.h': '#pragma once\n',
+    'mcp25xxx_multi.h': '''#pragma once
+typedef struct mcp2515_bundle_config mcp2515_bundle_config_t;
+''',
+    'can_twai_config.h': '''#pragma once
+typedef struct twai_backend_config { int unused; } twai_backend_config_t;
+''',
+    'esp_timer.h': '''#pragma once
+#include <stdint.h>
+int64_t esp_timer_get_time(void);
+''',
+    # Adapter stub in its own unit: counted once per frame in every variant
+    'adapter_stub.c': '''#include "can_dispatch_mcp2515_single.h"
+
+// noipa also keeps LTO from specialising the stub for the bench frame
+#if defined(__GNUC__) && !defined(__clang__)
+#define ADAPTER_OPAQUE __attribute__((noipa))
+#else
+#define ADAPTER_OPAQUE __attribute__((noinline))
+#endif
+
+static volatile uint32_t s_sent;
+
+int64_t esp_timer_get_time(void) { return 0; }
+bool mcp2515_single_init(const mcp2515_bundle_config_t *cfg) { (void)cfg; return true; }
+bool mcp2515_single_deinit(void) { return true; }
+ADAPTER_OPAQUE bool mcp2515_single_send(const can_frame_t *frame) { s_sent += frame->dlc; return true; }
+bool mcp2515_single_receive(can_frame_t *frame) { (void)frame; return false; }
+void mcp2515_single_get_rx_stats(mcp2515_single_rx_stats_t *stats) { (void)stats; }
+can_dispatch_tx_result_t mcp2515_single_send_ex(const can_frame_t *frame, int64_t deadline_us,
+                                                bool replace_pending, bool single_shot)
+{ (void)frame; (void)deadline_us; (void)replace_pending; (void)single_shot; return CAN_DISPATCH_TX_QUEUED; }
+void mcp2515_single_get_tx_stats(mcp2515_single_tx_stats_t *stats) { (void)stats; }
+uint32_t mcp2515_single_tx_abort_expired(int64_t now_us, void (*on_abort)(uint32_t identifier))
+{ (void)now_us; (void)on_abort; return 0; }
+''',
+}
+
+# The child sends n frames between SIGSTOP and bench_end(); the parent counts
+# single steps until the child reaches bench_end. fork() keeps the addresses.
+_BENCH_MAIN = '''#include "can_dispatch.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if !defined(__linux__) || !defined(__x86_64__)
+#error "dispatch_bench needs Linux on x86-64"
+#endif
+
+bool can_twai_send(const twai_message_t *msg);
+
+__attribute__((noinline)) void bench_end(void) { __asm__ volatile(""); }
+
+static __attribute__((noinline)) void send_frames(long n)
+{
+    for (long i = 0; i < n; i++) {
+#if BENCH_TWAI_API
+        twai_message_t msg = {.identifier = 0x123, .data_length_code = 8};
+        can_twai_send(&msg);
+#else
+        can_frame_t frame = {.id = 0x123, .dlc = 8};
+        can_dispatch_send(&frame);
+#endif
+    }
+}
+
+static long count_steps(long n)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        send_frames(n);
+        bench_end();
+        _exit(0);
+    }
+    int status;
+    long steps = 0;
+    waitpid(pid, &status, 0);
+    for (;;) {
+        struct user_regs_struct regs;
+        ptrace(PTRACE_GETREGS, pid, NULL, &regs);
+        if (regs.rip == (unsigned long long)(uintptr_t)bench_end) {
+            break;
+        }
+        if (ptrace(PTRACE_SINGLESTEP, pid, NULL, NULL) != 0) {
+            return -1;
+        }
+        waitpid(pid, &status, 0);
+        if (WIFEXITED(status)) {
+            return -1;
+        }
+        steps++;
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return steps;
+}
+
+int main(int argc, char **argv)
+{
+    long n1 = atol(argv[1]);
+    long n2 = atol(argv[2]);
+    long s1 = count_steps(n1);
+    long s2 = count_steps(n2);
+    if (s1 < 0 || s2 < 0) {
+        return 1;
+    }
+    printf("%.2f\\n", (double)(s2 - s1) / (double)(n2 - n1));
+    return 0;
+}
+'''
+
+_BACKEND = ('-DCONFIG_CAN_BACKEND_MCP2515_SINGLE=1',)
+
+# name, extra compiler flags
+_VARIANTS = (
+    ('can_twai_send()', ('-DBENCH_TWAI_API=1',)),
+    ('can_twai_send(), LTO', ('-DBENCH_TWAI_API=1', '-flto')),
+    ('can_dispatch_send()', ()),
+    ('can_dispatch_send(), LTO', ('-flto',)),
+    ('can_dispatch_send(), INLINE', ('-DCONFIG_CAN_DISPATCH_INLINE=1',)),
+)
+
+
+def instructions_per_frame(cc, opt, extra, frames):
+    sources = dict(_STUBS)
+    sources['bench.c'] = _BENCH_MAIN
+    out = build_and_run(sources, ['can_dispatch.c'], args=(frames, 2 * frames), cc=cc,
+                        cflags=(opt, *_BACKEND, *extra), capture=True)
+    return float(out.decode().strip())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__description__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--cc', default='cc', help="Host C compiler (default: cc)")
+    parser.add_argument('--opt', default='-O2', help="Optimisation flag (default: -O2)")
+    parser.add_argument('--frames', type=int, default=200, help="Frames of the shorter run (default: 200)")
+    args = parser.parse_args()
+
+    base = None
+    print(f"host instructions per frame, MCP2515 single backend, {args.opt}")
+    for name, extra in _VARIANTS:
+        count = instructions_per_frame(args.cc, args.opt, extra, args.frames)
+        base = count if base is None else base
+        print(f"  {name:30s} {count:7.2f}  ({count - base:+.2f})")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,110 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Host benchmark of the software acceptance filter (can_dispatch_filter.c).
+
+Builds a rule set of random extended IDs (plus a few standard IDs and masked
+rules), runs mixed traffic through can_filter_accept() and prints ns/frame,
+the bloom false positive count and the MCP2515 hardware pre-filter plan
+computed for the same rules.
+'''
+import argparse
+import sys
+
+from py.host_bench.host_cc import build_and_run
+
+_BENCH_MAIN = '''#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "can_dispatch_filter.h"
+
+#define FRAMES 1000000
+
+static uint32_t rnd(void)
+{
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+int main(int argc, char **argv)
+{
+    int ext_ids = argc > 1 ? atoi(argv[1]) : 200;
+    int std_ids = argc > 2 ? atoi(argv[2]) : 20;
+    double match = argc > 3 ? atof(argv[3]) : 0.2;
+    static can_filter_rule_t rules[CONFIG_CAN_DISPATCH_FILTER_MAX_IDS + 2048 + 2];
+    size_t n = 0;
+    srand(7);
+    for (int i = 0; i < ext_ids; i++) {
+        rules[n++] = (can_filter_rule_t){ rnd() & CAN_FRAME_EXT_ID_MASK, CAN_FRAME_EXT_ID_MASK, true };
+    }
+    for (int i = 0; i < std_ids; i++) {
+        rules[n++] = (can_filter_rule_t){ rnd() & CAN_FRAME_STD_ID_MASK, CAN_FRAME_STD_ID_MASK, false };
+    }
+    rules[n++] = (can_filter_rule_t){ 0x18FEF000, 0x1FFFFF00, true };   // one J1939 PGN range
+    rules[n++] = (can_filter_rule_t){ 0x700, 0x7F0, false };
+    if (!can_filter_set_rules(rules, n)) {
+        printf("rule set too large\\n");
+        return 1;
+    }
+
+    can_frame_t *frames = calloc(FRAMES, sizeof(can_frame_t));
+    for (int i = 0; i < FRAMES; i++) {
+        if ((double)rand() / RAND_MAX < match) {
+            const can_filter_rule_t *r = &rules[(size_t)rand() % n];
+            frames[i].id = r->id;
+            frames[i].flags = r->extd ? CAN_FRAME_FLAG_EXTD : 0;
+        } else if (rand() & 1) {
+            frames[i].id = rnd() & CAN_FRAME_EXT_ID_MASK;
+            frames[i].flags = CAN_FRAME_FLAG_EXTD;
+        } else {
+            frames[i].id = rnd() & CAN_FRAME_STD_ID_MASK;
+        }
+        frames[i].dlc = 8;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < FRAMES; i++) {
+        can_filter_accept(&frames[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    can_filter_stats_t stats;
+    can_filter_get_stats(&stats, true);
+    printf("%zu rules, %d frames: %.1f ns/frame, accepted %u, rejected %u, bloom false positives %u\\n",
+           n, FRAMES, ns / FRAMES, (unsigned)stats.accepted, (unsigned)stats.rejected,
+           (unsigned)stats.bloom_false_positives);
+
+    can_filter_hw_plan_t plan;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    can_filter_plan_hw(rules, n, &plan);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("hardware plan (%.1f ms): RXM0=0x%08X RXM1=0x%08X, %llu IDs pass\\n",
+           ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e6,
+           (unsigned)plan.mask[0], (unsigned)plan.mask[1], (unsigned long long)plan.accepted_ids);
+    for (int i = 0; i < 6; i++) {
+        printf("  RXF%d %s 0x%08X\\n", i, plan.filter_extd[i] ? "ext" : "std", (unsigned)plan.filter[i]);
+    }
+    free(frames);
+    return 0;
+}
+'''
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__description__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--ext-ids', type=int, default=200, help="Exact extended IDs (default: 200)")
+    parser.add_argument('--std-ids', type=int, default=20, help="Exact standard IDs (default: 20)")
+    parser.add_argument('--match', type=float, default=0.2,
+                        help="Fraction of frames matching a rule (default: 0.2)")
+    parser.add_argument('--cc', default='cc', help="Host C compiler (default: cc)")
+    args = parser.parse_args()
+    build_and_run({'bench.c': _BENCH_MAIN}, ['can_dispatch_filter.c'],
+                  args=[args.ext_ids, args.std_ids, args.match], cc=args.cc)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,66 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Compiles plain C modules of components/can_dispatch for the host.
+
+Only can_dispatch_frame.h reaches into ESP-IDF (driver/twai.h for the legacy
+converters); a minimal twai_message_t stub is provided for it.
+'''
+import os
+import shutil
+import subprocess
+import tempfile
+
+REPO_ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), '..', '..'))
+DISPATCH_DIR = os.path.join(REPO_ROOT, 'components', 'can_dispatch')
+
+_TWAI_STUB = '''#pragma once
+#include <stdint.h>
+typedef struct {
+    uint32_t flags;
+    uint32_t identifier;
+    uint8_t data_length_code;
+    uint8_t data[8];
+} twai_message_t;
+'''
+
+
+def build_and_run(sources, dispatch_sources, args=(), cc='cc', cflags=('-O2',), capture=False):
+    """
+    Builds a host executable and runs it.
+
+    Args:
+        sources: dict file name -> C source text written to a temporary directory
+            (names may contain subdirectories, e.g. stub headers like 'freertos/FreeRTOS.h')
+        dispatch_sources: file names in components/can_dispatch to compile along
+        args: command line arguments of the executable
+        cc: host C compiler
+        cflags: compiler flags
+        capture: return the standard output instead of passing it through
+
+    Returns:
+        Standard output bytes when capture is set, else None
+    """
+    work = tempfile.mkdtemp(prefix='can_dispatch_host_')
+    try:
+        os.makedirs(os.path.join(work, 'driver'))
+        with open(os.path.join(work, 'driver', 'twai.h'), 'w') as f:
+            f.write(_TWAI_STUB)
+        c_files = []
+        for name, text in sources.items():
+            path = os.path.join(work, name)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, 'w') as f:
+                f.write(text)
+            if name.endswith('.c'):
+                c_files.append(path)
+        c_files += [os.path.join(DISPATCH_DIR, name) for name in dispatch_sources]
+        exe = os.path.join(work, 'host_bench')
+        subprocess.run([cc, *cflags, '-I', work, '-I', DISPATCH_DIR, '-o', exe, *c_files], check=True)
+        run = subprocess.run([exe, *[str(a) for a in args]], check=True,
+                             stdout=subprocess.PIPE if capture else None)
+        return run.stdout
+    finally:
+        shutil.rmtree(work, ignore_errors=True)
@@ -0,0 +1,130 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Host model of the SPI traffic of the MCP25xxx single adapter, reported by
+the SPI profiler (can_dispatch_spi_prof.c).
+
+Replays the transaction sequence the adapter issues per received frame
+(READ STATUS, EFLG read, READ RX BUFFER, second READ STATUS), per sent frame
+(TXBnCTRL reads, LOAD TX BUFFER, RTS) and per idle receive poll, with
+durations from the SPI clock plus a fixed per-transaction overhead. The
+simulated time is the CAN bus time of the frames, so the report shows the
+SPI load an SPI change would leave at a given bus load. Compare the options
+(e.g. --tx-ctrl-reads 1) against the default before touching the adapter;
+check the figures against can_spi_prof_report() on the target.
+'''
+import argparse
+import sys
+
+from py.host_bench.host_cc import build_and_run
+
+_STUBS = {
+    'freertos/FreeRTOS.h': '''#pragma once
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL_SAFE(m) (void)(m)
+#define portEXIT_CRITICAL_SAFE(m) (void)(m)
+''',
+    'esp_attr.h': '''#pragma once
+#define IRAM_ATTR
+''',
+    'esp_timer.h': '''#pragma once
+#include <stdint.h>
+extern int64_t sim_now_us;
+static inline int64_t esp_timer_get_time(void) { return sim_now_us; }
+''',
+    'esp_log.h': '''#pragma once
+#include <stdio.h>
+#define ESP_LOGI(tag, fmt, ...) printf(fmt "\\n", ##__VA_ARGS__)
+''',
+}
+
+_BENCH_MAIN = '''#include <stdio.h>
+#include <stdlib.h>
+#include "can_dispatch_spi_prof.h"
+
+int64_t sim_now_us;
+static double s_spi_hz;
+static double s_overhead_ns;
+static double s_busy_ns;
+
+static void xfer(uint8_t instr, uint32_t bytes)
+{
+    double ns = s_overhead_ns + bytes * 8 * 1e9 / s_spi_hz;
+    can_spi_prof_record(instr, bytes, (uint32_t)ns);
+    s_busy_ns += ns;
+}
+
+int main(int argc, char **argv)
+{
+    int rx = atoi(argv[1]);
+    int tx = atoi(argv[2]);
+    double idle_polls = atof(argv[3]);
+    int tx_ctrl_reads = atoi(argv[4]);
+    int dlc = atoi(argv[5]);
+    s_spi_hz = atof(argv[6]);
+    s_overhead_ns = atof(argv[7]) * 1000.0;
+    double can_bps = atof(argv[8]);
+
+    can_spi_prof_reset();
+    double polls = 0;
+    for (int i = 0; i < rx + tx; i++) {
+        if (i < rx) {
+            xfer(0xA0, 2);              // READ STATUS
+            xfer(0x03, 3);              // EFLG via MCP2515_checkError()
+            xfer(0x90, 14);             // READ RX BUFFER RXB0
+            xfer(0xA0, 2);              // READ STATUS for RXB1
+            can_spi_prof_frame(true, (uint8_t)dlc);
+        } else {
+            for (int k = 0; k < tx_ctrl_reads; k++) {
+                xfer(0x03, 3);          // READ TXBnCTRL
+            }
+            xfer(0x40, 6 + dlc);        // LOAD TX BUFFER
+            xfer(0x81, 1);              // RTS
+            can_spi_prof_frame(false, (uint8_t)dlc);
+        }
+        for (polls += idle_polls; polls >= 1; polls -= 1) {
+            xfer(0xA0, 2);              // receive() poll with nothing pending
+        }
+    }
+    // Worst case standard frame with stuffing and IFS
+    double frame_us = (55 + 10 * dlc) * 1e6 / can_bps;
+    sim_now_us = (int64_t)((rx + tx) * frame_us);
+    if (sim_now_us * 1000.0 < s_busy_ns) {
+        sim_now_us = (int64_t)(s_busy_ns / 1000.0);
+        printf("SPI is the bottleneck: frames cannot be moved at the CAN bit rate\\n");
+    }
+    can_spi_prof_report();
+    return 0;
+}
+'''
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__description__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--rx', type=int, default=1000, help="Received frames (default: 1000)")
+    parser.add_argument('--tx', type=int, default=1000, help="Sent frames (default: 1000)")
+    parser.add_argument('--idle-polls', type=float, default=1.0,
+                        help="Empty receive polls per frame (default: 1)")
+    parser.add_argument('--tx-ctrl-reads', type=int, default=3,
+                        help="TXBnCTRL register reads per send (default: 3, as mcp2515_single_send_ex)")
+    parser.add_argument('--dlc', type=int, default=8, help="Data length of every frame (default: 8)")
+    parser.add_argument('--spi-hz', type=float, default=10e6, help="SPI clock (default: 10 MHz)")
+    parser.add_argument('--overhead-us', type=float, default=3.0,
+                        help="Driver and CS overhead per transaction (default: 3 us, polling transmit)")
+    parser.add_argument('--can-bps', type=float, default=500e3, help="CAN bit rate (default: 500 kbit/s)")
+    parser.add_argument('--cc', default='cc', help="Host C compiler (default: cc)")
+    args = parser.parse_args()
+    sources = dict(_STUBS)
+    sources['bench.c'] = _BENCH_MAIN
+    build_and_run(sources, ['can_dispatch_spi_prof.c'],
+                  args=[args.rx, args.tx, args.idle_polls, args.tx_ctrl_reads, args.dlc,
+                        args.spi_hz, args.overhead_us, args.can_bps], cc=args.cc)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
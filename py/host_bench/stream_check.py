@@ -0,0 +1,135 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Host check of the binary frame stream (can_dispatch_stream.c) against the
+host decoder (py/monitor/frame_stream.py).
+
+The firmware encoder runs on the host and logs frames whose timestamp, ID,
+data and CRC contain 0x0A. Its output goes through each console line-ending
+translation ESP-IDF offers (CONFIG_NEWLIB_STDOUT_LINE_ENDING_LF/CRLF) with log
+text between the batches, then through the decoder in small chunks. Every
+frame has to come back unchanged and the text has to stay text.
+
+    python -m py.host_bench.stream_check
+'''
+import argparse
+import struct
+import sys
+
+from py.host_bench.host_cc import build_and_run
+from py.monitor.frame_stream import CanFrame, FrameStreamDecoder
+
+_STUBS = {
+    'freertos/FreeRTOS.h': '''#pragma once
+#include <stdint.h>
+typedef int portMUX_TYPE;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void *TaskHandle_t;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(m) (void)(m)
+#define portEXIT_CRITICAL(m) (void)(m)
+#define pdMS_TO_TICKS(ms) (ms)
+#define pdPASS 1
+#define pdTRUE 1
+''',
+    'freertos/task.h': '''#pragma once
+#include "freertos/FreeRTOS.h"
+static inline int xTaskCreate(void (*fn)(void *), const char *name, unsigned stack, void *arg,
+                              UBaseType_t prio, TaskHandle_t *handle)
+{ (void)fn; (void)name; (void)stack; (void)arg; (void)prio; *handle = (TaskHandle_t)1; return pdPASS; }
+static inline uint32_t ulTaskNotifyTake(int clear, TickType_t ticks) { (void)clear; (void)ticks; return 0; }
+static inline void xTaskNotifyGive(TaskHandle_t t) { (void)t; }
+static inline void vTaskDelete(TaskHandle_t t) { (void)t; }
+static inline void vTaskDelay(TickType_t t) { (void)t; }
+''',
+    'esp_timer.h': '''#pragma once
+#include <stdint.h>
+extern int64_t sim_now_us;
+static inline int64_t esp_timer_get_time(void) { return sim_now_us; }
+''',
+    'esp_log.h': '''#pragma once
+#define ESP_LOGE(tag, fmt, ...) (void)(tag)
+''',
+}
+
+# The writer is static: the check includes the source to call flush_ring()
+_CHECK_MAIN = '''#include "can_dispatch_stream.c"
+
+int64_t sim_now_us;
+
+int main(void)
+{
+    can_stream_start(1);
+    for (int i = 0; i < 64; i++) {
+        can_frame_t f = {0};
+        sim_now_us = 0x0A0A0A00 + i * 0x0A;
+        f.id = (i & 1) ? 0x0A0A0A0Au + i : 0x10A + i;
+        f.flags = (i & 1) ? CAN_FRAME_FLAG_EXTD : 0;
+        f.dlc = i % 9;
+        for (int k = 0; k < 8; k++) {
+            f.data[k] = (k + i) % 3 ? 0x0A : (uint8_t)(i + k);
+        }
+        can_stream_log(&f, i % 3 == 0, (uint8_t)(i % 2 ? 0x0A : 0));
+        if (i % 16 == 15) {
+            flush_ring();
+            printf("I (%d) can_stream: batch done\\n", i);
+        }
+    }
+    fflush(stdout);
+    return 0;
+}
+'''
+
+
+def expected_frames():
+    """ Frames the check program logs, as the decoder should return them. """
+    frames = []
+    for i in range(64):
+        extd = bool(i & 1)
+        dlc = i % 9
+        data = bytes(0x0A if (k + i) % 3 else (i + k) & 0xFF for k in range(8))
+        frames.append(CanFrame(timestamp_us=0x0A0A0A00 + i * 0x0A,
+                               can_id=(0x0A0A0A0A + i) if extd else 0x10A + i,
+                               is_extended=extd, is_remote=False, dlc=dlc, data=data[:min(dlc, 8)],
+                               is_tx=i % 3 == 0, dev=0x0A if i % 2 else 0))
+    return frames
+
+
+def decode(stream: bytes, chunk: int):
+    decoder = FrameStreamDecoder()
+    items = []
+    for pos in range(0, len(stream), chunk):
+        items += decoder.feed(stream[pos:pos + chunk])
+    items += decoder.flush()
+    return decoder, [i for i in items if isinstance(i, CanFrame)], ''.join(i for i in items if isinstance(i, str))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__description__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--cc', default='cc', help="Host C compiler (default: cc)")
+    args = parser.parse_args()
+    sources = dict(_STUBS)
+    sources['check.c'] = _CHECK_MAIN
+    raw = build_and_run(sources, [], cc=args.cc, capture=True)
+    expected = expected_frames()
+    lf_bytes = sum(struct.pack('<I', f.timestamp_us).count(0x0A) for f in expected)
+    print(f"{len(raw)} stream bytes, {raw.count(0x0A)} of them 0x0A ({lf_bytes} in timestamps alone)")
+
+    failed = False
+    for name, stream in (('LF', raw), ('CRLF', raw.replace(b'\n', b'\r\n'))):
+        for chunk in (1, 7, 4096):
+            decoder, frames, text = decode(stream, chunk)
+            ok = frames == expected and text.count('batch done') == 4
+            failed |= not ok
+            print(f"{name:4s} chunk {chunk:4d}: {len(frames)}/{len(expected)} frames, "
+                  f"{decoder.crlf_packets} after undoing CRLF, {decoder.bad_packets} bad packets "
+                  f"{'OK' if ok else 'FAILED'}")
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,108 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Fixed-capacity ring buffer of log lines, the model behind RichLogExtended.
+Lines are addressed by a sequence number that keeps growing, so a position
+(search match, scroll anchor) stays valid while old lines drop off the front.
+'''
+from typing import Any, Callable, Iterator, List, Optional, Tuple
+
+
+class LogLineRing:
+    """
+    Ring of the last `capacity` lines with O(1) append and indexed access.
+    Memory is bounded by the capacity; the oldest line is overwritten when full.
+    """
+
+    def __init__(self, capacity: int):
+        """
+        Initialize ring.
+
+        Args:
+            capacity: Maximum number of retained lines
+        """
+        if capacity < 1:
+            raise ValueError("capacity must be positive")
+        self.capacity = capacity
+        self._items: List[Any] = [None] * capacity
+        self._first = 0             # sequence number of the oldest retained line
+        self._next = 0              # sequence number of the next appended line
+        self.dropped = 0            # lines overwritten since the last clear()
+
+    def __len__(self) -> int:
+        return self._next - self._first
+
+    @property
+    def first(self) -> int:
+        """ Sequence number of the oldest retained line. """
+        return self._first
+
+    @property
+    def end(self) -> int:
+        """ Sequence number the next line will get. """
+        return self._next
+
+    def append(self, item: Any) -> None:
+        """
+        Add a line, dropping the oldest one when full.
+
+        Args:
+            item: Line content (string or pre-rendered line)
+        """
+        self._items[self._next % self.capacity] = item
+        self._next += 1
+        if self._next - self._first > self.capacity:
+            self._first += 1
+            self.dropped += 1
+
+    def get(self, seq: int) -> Any:
+        """
+        Line by sequence number.
+
+        Raises:
+            IndexError: The line is not retained
+        """
+        if not self._first <= seq < self._next:
+            raise IndexError(seq)
+        return self._items[seq % self.capacity]
+
+    def items(self, start: Optional[int] = None, stop: Optional[int] = None) -> Iterator[Tuple[int, Any]]:
+        """ (sequence number, line) pairs of the retained lines in [start, stop). """
+        start = self._first if start is None else max(start, self._first)
+        stop = self._next if stop is None else min(stop, self._next)
+        for seq in range(start, stop):
+            yield seq, self._items[seq % self.capacity]
+
+    def find_if(self, predicate: Callable[[Any], bool], start: Optional[int] = None,
+                backwards: bool = False) -> Optional[int]:
+        """
+        First line the predicate accepts, wrapping around the retained history.
+
+        Args:
+            predicate: Called with the line content
+            start: First sequence number to test (default: oldest, or newest when backwards)
+            backwards: Search towards older lines
+
+        Returns:
+            Sequence number of the matching line, or None
+        """
+        count = len(self)
+        if count == 0:
+            return None
+        if start is None or not self._first <= start < self._next:
+            start = self._next - 1 if backwards else self._first
+        step = -1 if backwards else 1
+        offset = start - self._first
+        for i in range(count):
+            seq = self._first + (offset + i * step) % count
+            if predicate(self._items[seq % self.capacity]):
+                return seq
+        return None
+
+    def clear(self) -> None:
+        """ Drop all lines; sequence numbers keep growing. """
+        self._items = [None] * self.capacity
+        self._first = self._next
+        self.dropped = 0
@@ -3,52 +3,131 @@
 __author__ = "Ivo Marvan"
 __email__ = "ivo@marvan.cz"
 __description__ = '''
-Buffered RichLog widget with timer-based flushing for performance.
+Buffered log widget with periodic flushing for performance.
 Prevents GUI freezing during high-frequency log output by batching writes.
-Includes emergency flush on errors and async-safe operations.
+Lines are kept in a fixed-capacity ring (LogLineRing) and rendered only when
+visible, so memory and frame time stay constant however much is logged.
+Includes emergency flush on errors, search and jump over the history.
 '''
-from textual.widgets import RichLog
+from textual.cache import LRUCache
+from textual.geometry import Size
+from textual.scroll_view import ScrollView
+from textual.strip import Strip
+from rich.highlighter import Highlighter, ReprHighlighter
+from rich.markup import MarkupError
+from rich.pretty import Pretty
+from rich.protocol import is_renderable
+from rich.segment import Segment
+from rich.style import Style
+from rich.text import Text
+import logging
 import time
-import asyncio
-from typing import Any, Optional
-from rich.markup import escape
+from typing import Any, List, Optional
+from py.log.log_line_ring import LogLineRing
 
 
-class RichLogExtended(RichLog):
+class RichLogExtended(ScrollView, can_focus=True):
     """
-    Buffered RichLog with timer-based flushing and performance tracking.
-    Accumulates log messages and flushes on buffer full, timer expiry, or emergency conditions.
-    Thread-safe with async lock support.
+    Buffered log with periodic flushing and performance tracking; drop-in for RichLog.
+    Accumulates log messages and flushes on buffer full, error lines, or by
+    one interval timer per widget (paused while nothing is buffered).
+    Flushing only appends to the line ring; markup and highlighting are applied
+    when a line scrolls into view. The view follows new lines while it is at
+    the end; scrolled up, it stays on the same lines while old ones drop off.
+    Every write gets a severity once: the logging level when given (RichLogHandler),
+    otherwise per line from its ESP-IDF level prefix, or error words when it has none.
     """
+    DEFAULT_CSS = """
+    RichLogExtended {
+        background: $surface;
+        color: $foreground;
+        overflow-y: scroll;
+    }
+    """
+    BINDINGS = [
+        ("e", "next_error", "Next error"),
+        ("E", "previous_error", "Previous error"),
+    ]
+    DEFAULT_MAX_LINES = 10000
+    MATCH_STYLE = Style(reverse=True)
+    ERROR_WORDS = ('error', 'failed', 'exception', '❌')
+    WARNING_WORDS = ('warning',)
+    # ESP-IDF log line prefix "L (<time>) <tag>: ..." -> severity, no word scan needed
+    PREFIX_SEVERITY = {
+        'E (': logging.ERROR,
+        'W (': logging.WARNING,
+        'I (': logging.INFO,
+        'D (': logging.INFO,
+        'V (': logging.INFO,
+    }
+
     def __init__(
             self,
             buffer_size: int = 10,
             flush_interval: float = 0.1,
-            *args,
-            **kwargs
+            *,
+            max_lines: Optional[int] = None,
+            min_width: int = 78,
+            highlight: bool = False,
+            markup: bool = False,
+            auto_scroll: bool = True,
+            name: Optional[str] = None,
+            id: Optional[str] = None,
+            classes: Optional[str] = None,
+            disabled: bool = False
     ):
         """
-        Initialize buffered RichLog.
-        
+        Initialize buffered log.
+
         Args:
             buffer_size: Number of messages to buffer before auto-flush
             flush_interval: Time in seconds between timer-based flushes
-            *args, **kwargs: Passed to parent RichLog
+            max_lines: Lines retained in the ring (default DEFAULT_MAX_LINES)
+            min_width: Width used to render non-text renderables
+            highlight: Highlight text with ReprHighlighter (see `highlighter`)
+            markup: Apply Rich console markup to text
+            auto_scroll: Follow new lines while the view is at the end
+            name, id, classes, disabled: Passed to the widget
         """
-        super().__init__(*args, **kwargs)
-        
+        super().__init__(name=name, id=id, classes=classes, disabled=disabled)
+
         self.buffer_size = buffer_size
         self.flush_interval = flush_interval
+        self.max_lines = max_lines or self.DEFAULT_MAX_LINES
+        self.min_width = min_width
+        self.highlight = highlight
+        self.markup = markup
+        self.auto_scroll = auto_scroll
+        self.highlighter: Highlighter = ReprHighlighter()
         self.buffer = []
         self.total_lines = 0
+        self._lines = LogLineRing(self.max_lines)
+        self._line_cache: LRUCache = LRUCache(1024)
+        self._widest_line_width = 0
+        self._dropped_seen = 0
+        self._match: Optional[int] = None
         self._last_flush = time.time()
-        self._async_lock = asyncio.Lock()
         self.flush_count = 0
         self.total_flush_time = 0.0
         self.avg_flush_time = 0.0
         self.emergency_flush_count = 0
+        self.error_lines = 0
         self._flush_timer = None
-    
+        self._flush_timer_running = False
+
+    def on_mount(self) -> None:
+        self._flush_timer = self.set_interval(self.flush_interval, self._on_flush_timer, name="log-flush",
+                                              pause=not self.buffer)
+        self._flush_timer_running = bool(self.buffer)
+
+    def _on_flush_timer(self) -> None:
+        """Periodic flush; the timer pauses itself once nothing is buffered."""
+        if self.buffer:
+            self._flush_buffer()
+        else:
+            self._flush_timer.pause()
+            self._flush_timer_running = False
+
     def write(
             self,
             content: Any,
@@ -56,145 +135,298 @@ class RichLogExtended(RichLog):
             expand: bool = False,
             shrink: bool = True,
             scroll_end: Optional[bool] = None,
-            animate: bool = False
+            animate: bool = False,
+            severity: Optional[int] = None
     ) -> 'RichLogExtended':
         """
-        Buffer write with timer-based flushing.
+        Buffer write with periodic flushing.
         Flushes immediately on error messages or buffer full.
-        
+
         Args:
-            content: Content to write
-            width: Optional width constraint
-            expand: Whether to expand
-            shrink: Whether to shrink
-            scroll_end: Whether to scroll to end
-            animate: Whether to animate
-            
+            content: Content to write (text, one line per '\\n', or a Rich renderable)
+            width: Render width of a renderable (default: min_width)
+            expand: Kept for RichLog compatibility
+            shrink: Kept for RichLog compatibility
+            scroll_end: Whether to scroll to end (None: auto_scroll)
+            animate: Kept for RichLog compatibility
+            severity: logging level of the content (None: classify the text)
+
         Returns:
             Self for chaining
         """
-        write_params = {
-            'content': content,
-            'width': width,
-            'expand': expand,
-            'shrink': shrink,
-            'scroll_end': scroll_end,
-            'animate': animate
-        }
-        
-        self.buffer.append(write_params)
-        
-        content_str = str(content)
-        if any(error_word in content_str.lower() for error_word in ['error', 'failed', 'exception', '❌']):
-            self._flush_buffer()
-            return self
-        
-        if len(self.buffer) > self.buffer_size * 2:
+        # Unstructured text is classified once per line here; _append reuses the result
+        per_line = None
+        if severity is None:
+            severity = logging.INFO
+            if isinstance(content, str):
+                per_line = [self.classify(line) for line in self._split_lines(content)]
+                severity = max(per_line, default=logging.INFO)
+                if severity == logging.INFO or len(per_line) == 1:
+                    per_line = None
+
+        self.buffer.append((content, width, scroll_end, severity, per_line))
+
+        if severity >= logging.ERROR:
             self.emergency_flush_count += 1
             self._flush_buffer()
             return self
-        
+
         if len(self.buffer) >= self.buffer_size:
             self._flush_buffer()
             return self
-        
-        self._start_flush_timer()
-        
+
+        if not self._flush_timer_running and self._flush_timer is not None:
+            self._flush_timer.resume()
+            self._flush_timer_running = True
+
         return self
-    
-    def _start_flush_timer(self):
-        """Start or restart flush timer."""
-        if self._flush_timer and not self._flush_timer.done():
-            self._flush_timer.cancel()
-        
-        self._flush_timer = asyncio.create_task(self._timer_flush())
-    
-    async def _timer_flush(self):
-        """Flush after interval expires."""
-        await asyncio.sleep(self.flush_interval)
-        
-        if self.buffer:
-            self._flush_buffer()
-    
+
+    @classmethod
+    def classify(cls, text: str) -> int:
+        """
+        Severity of one line of unstructured text.
+        An ESP-IDF level prefix ("E (", "W (", "I (", ...) decides on its own;
+        only lines without one are lowercased and scanned for error words.
+
+        Args:
+            text: One log line
+
+        Returns:
+            logging.ERROR, logging.WARNING or logging.INFO
+        """
+        severity = cls.PREFIX_SEVERITY.get(text[:3])
+        if severity is not None:
+            return severity
+        lowered = text.lower()
+        if any(word in lowered for word in cls.ERROR_WORDS):
+            return logging.ERROR
+        if any(word in lowered for word in cls.WARNING_WORDS):
+            return logging.WARNING
+        return logging.INFO
+
+    @staticmethod
+    def _split_lines(text: str) -> List[str]:
+        """ Text lines of a write; a trailing '\\n' does not start an empty line. """
+        lines = text.split('\n')
+        if len(lines) > 1 and not lines[-1]:
+            lines.pop()
+        return lines
+
     def _flush_buffer(self) -> None:
         """
-        Flush all buffered writes to parent RichLog.
-        Updates statistics and respects max_lines limit.
-        Handles MarkupError by escaping problematic characters.
+        Move all buffered writes into the line ring and update the view.
+        Updates statistics; the ring drops the oldest lines beyond max_lines.
         """
         if not self.buffer:
             return
-        
-        if self._flush_timer and not self._flush_timer.done():
-            self._flush_timer.cancel()
-        
+
         flush_start = time.time()
-        
-        for write_params in self.buffer:
-            try:
-                super().write(**write_params)
-            except Exception as e:
-                # If markup parsing fails, escape the content and try again
-                if 'MarkupError' in str(type(e).__name__):
-                    content = write_params.get('content', '')
-                    if isinstance(content, str):
-                        # Escape markup characters and retry
-                        write_params['content'] = escape(str(content))
-                        try:
-                            super().write(**write_params)
-                        except Exception:
-                            # If still failing, write without any formatting
-                            write_params['content'] = str(content).replace('[', '(').replace(']', ')')
-                            super().write(**write_params)
-                else:
-                    # Re-raise non-markup errors
-                    raise
-            
+        follow = self.scroll_y >= self.max_scroll_y
+        scroll_end = None
+
+        for content, width, write_scroll_end, severity, per_line in self.buffer:
+            self._append(content, width, severity, per_line)
+            if write_scroll_end is not None:
+                scroll_end = write_scroll_end
             self.total_lines += 1
-            
-            if self.max_lines and self.total_lines > self.max_lines:
-                super().clear()
-                self.total_lines = 0
-        
+
+        self._update_view(follow and (self.auto_scroll if scroll_end is None else scroll_end))
+
         flush_time = time.time() - flush_start
         self.flush_count += 1
         self.total_flush_time += flush_time
         self.avg_flush_time = self.total_flush_time / self.flush_count
-        
+
         self.buffer.clear()
         self._last_flush = time.time()
-    
+
+    def _append(self, content: Any, width: Optional[int], severity: int,
+                per_line: Optional[List[int]] = None) -> None:
+        """
+        Add content to the ring: text as one entry per line, rendered when
+        visible; other renderables are rendered now into line strips.
+        Every entry is a (line, severity) pair; per_line holds the severity of
+        each text line when they differ (None: all lines have severity).
+        """
+        if isinstance(content, str):
+            lines = self._split_lines(content)
+            for i, line in enumerate(lines):
+                line_severity = per_line[i] if per_line else severity
+                if line_severity >= logging.ERROR:
+                    self.error_lines += 1
+                self._lines.append((line, line_severity))
+                # Upper bound (markup tags count too); only sizes the scrollbar
+                self._widest_line_width = max(self._widest_line_width, len(line))
+            return
+        renderable = content if is_renderable(content) else Pretty(content)
+        console = self.app.console
+        options = console.options.update_width(width or self.min_width)
+        for segments in Segment.split_lines(console.render(renderable, options)):
+            strip = Strip(segments)
+            self._lines.append((strip, severity))
+            self._widest_line_width = max(self._widest_line_width, strip.cell_length)
+        if severity >= logging.ERROR:
+            self.error_lines += 1
+
+    def _update_view(self, follow: bool) -> None:
+        """ New virtual size; follow the end, or keep the viewed lines in place. """
+        dropped = self._lines.dropped - self._dropped_seen
+        self._dropped_seen = self._lines.dropped
+        self.virtual_size = Size(self._widest_line_width, len(self._lines))
+        if follow:
+            self.scroll_end(animate=False, immediate=True, x_axis=False)
+        elif dropped:
+            self.scroll_to(y=max(0, self.scroll_y - dropped), animate=False, immediate=True)
+        self.refresh()
+
+    def render_line(self, y: int) -> Strip:
+        """ Render one visible line (Line API); only lines in view are ever rendered. """
+        scroll_x, scroll_y = self.scroll_offset
+        width = self.scrollable_content_region.width
+        style = self.rich_style
+        seq = self._lines.first + scroll_y + y
+        if seq >= self._lines.end:
+            return Strip.blank(width, style)
+        key = (seq, scroll_x, width, seq == self._match)
+        strip = self._line_cache.get(key)
+        if strip is None:
+            strip = self._render_entry(seq).crop_extend(scroll_x, scroll_x + width, style)
+            if seq == self._match:
+                strip = Strip(Segment.apply_style(strip, post_style=self.MATCH_STYLE), strip.cell_length)
+            self._line_cache[key] = strip
+        return strip.apply_style(style)
+
+    def _render_entry(self, seq: int) -> Strip:
+        """ Strip of one ring entry with markup and highlighting applied. """
+        entry = self._lines.get(seq)[0]
+        if isinstance(entry, Strip):
+            return entry
+        text = None
+        if self.markup:
+            try:
+                text = Text.from_markup(entry)
+            except MarkupError:
+                pass
+        if text is None:
+            text = Text(entry)
+        if self.highlight:
+            text = self.highlighter(text)
+        text.expand_tabs()
+        return Strip(list(text.render(self.app.console)))
+
+    def notify_style_update(self) -> None:
+        super().notify_style_update()
+        self._line_cache.clear()
+
+    def find(self, term: str, backwards: bool = False) -> bool:
+        """
+        Jump to the next line containing term (case-insensitive) and mark it.
+        Repeated calls continue from the last match, wrapping around.
+
+        Args:
+            term: Text to look for
+            backwards: Search towards older lines
+
+        Returns:
+            True if a line was found
+        """
+        if not term:
+            return False
+        term = term.lower()
+        return self._find_and_mark(lambda entry: isinstance(entry[0], str) and term in entry[0].lower(), backwards)
+
+    def find_severity(self, level: int = logging.ERROR, backwards: bool = False) -> bool:
+        """
+        Jump to the next line of at least the given severity and mark it.
+
+        Args:
+            level: Minimum logging level
+            backwards: Search towards older lines
+
+        Returns:
+            True if a line was found
+        """
+        return self._find_and_mark(lambda entry: entry[1] >= level, backwards)
+
+    def action_next_error(self) -> None:
+        self.find_severity(logging.ERROR)
+
+    def action_previous_error(self) -> None:
+        self.find_severity(logging.ERROR, backwards=True)
+
+    def _find_and_mark(self, predicate, backwards: bool) -> bool:
+        self._flush_buffer()
+        if self._match is not None:
+            start = self._match + (-1 if backwards else 1)
+        else:
+            start = self._lines.first + int(self.scroll_y) + (self.scrollable_content_region.height if backwards else 0)
+        seq = self._lines.find_if(predicate, start, backwards)
+        if seq is None:
+            return False
+        self._match = seq
+        self.jump_to(seq)
+        return True
+
+    def jump_to(self, seq: int) -> None:
+        """
+        Scroll a line into the middle of the view; the view stops following new lines.
+
+        Args:
+            seq: Line sequence number (see LogLineRing)
+        """
+        y = seq - self._lines.first - self.scrollable_content_region.height // 2
+        self.scroll_to(y=max(0, y), animate=False, immediate=True)
+        self.refresh()
+
+    def clear_match(self) -> None:
+        """ Remove the search mark. """
+        self._match = None
+        self.refresh()
+
     def clear(self) -> 'RichLogExtended':
         """Clear both display and buffer."""
-        super().clear()
         self.buffer.clear()
+        self._lines.clear()
+        self._line_cache.clear()
+        self._dropped_seen = 0
+        self._widest_line_width = 0
+        self._match = None
         self.total_lines = 0
+        self.error_lines = 0
+        self.virtual_size = Size(0, 0)
+        self.refresh()
         return self
-    
+
     def get_stats(self) -> dict:
         """
         Get buffering performance statistics.
-        
+
         Returns:
             Dictionary with flush counts, times, and buffer state
         """
         return {
             'total_lines': self.total_lines,
+            'retained_lines': len(self._lines),
+            'dropped_lines': self._lines.dropped,
             'buffer_size': len(self.buffer),
             'flush_count': self.flush_count,
             'avg_flush_time': self.avg_flush_time,
             'emergency_flush_count': self.emergency_flush_count,
+            'error_lines': self.error_lines,
             'buffer_efficiency': self.flush_count / max(1, self.total_lines) if self.total_lines > 0 else 0
         }
-    
+
     def print_stats(self) -> 'RichLogExtended':
         """Print statistics to the log"""
         stats = self.get_stats()
         self.write(f"📊 RichLogExtended Stats:")
         self.write(f"   Total lines: {stats['total_lines']}")
+        self.write(f"   Retained lines: {stats['retained_lines']} of {self.max_lines} "
+                   f"({stats['dropped_lines']} dropped)")
         self.write(f"   Flush count: {stats['flush_count']}")
         self.write(f"   Avg flush time: {stats['avg_flush_time']:.3f}s")
         self.write(f"   Emergency flushes: {stats['emergency_flush_count']}")
+        self.write(f"   Error lines: {stats['error_lines']}", severity=logging.INFO)
         self.write(f"   Buffer efficiency: {stats['buffer_efficiency']:.2f}")
         self._flush_buffer()
         return self
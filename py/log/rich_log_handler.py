@@ -128,8 +128,12 @@ class RichLogHandler(logging.Handler):
         if self._rich_log:
             record = self._modify_record(record)
             msg = self.format(record)
-            self._rich_log.write(msg)
-            self._rich_log.refresh()
+            if isinstance(self._rich_log, RichLogExtended):
+                # Level is known here; the widget flushes and refreshes on its own
+                self._rich_log.write(msg, severity=record.levelno)
+            else:
+                self._rich_log.write(msg)
+                self._rich_log.refresh()
 
     def _modify_record(self, record: logging.LogRecord) -> logging.LogRecord:
         """
@@ -0,0 +1,118 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Soak test of the log widget: a headless Textual app receives a steady stream
+of log lines (default 10k lines/s) and once per second reports
+
+  retained   lines held by the widget
+  memory     resident set size of the process
+  frame      time to render the visible window (all lines re-rendered)
+  write      average cost of one write() call
+  cpu        process CPU time per second of wall time
+  lag        worst event loop delay of a 10 ms tick (GUI responsiveness)
+
+Memory and frame time of RichLogExtended should stay flat once the ring is
+full. --widget richlog runs the same load against Textual's RichLog.
+
+    python -m py.log.rich_log_soak
+    python -m py.log.rich_log_soak --rate 10000 --seconds 30 --max-lines 2000
+    python -m py.log.rich_log_soak --rate 500
+'''
+import argparse
+import asyncio
+import sys
+import time
+
+import psutil
+
+from textual.app import App, ComposeResult
+from textual.widgets import RichLog
+
+from py.log.rich_log_extended import RichLogExtended
+
+
+class SoakApp(App):
+    """ App with just the log widget. """
+
+    def __init__(self, widget):
+        super().__init__()
+        self.widget = widget
+
+    def compose(self) -> ComposeResult:
+        yield self.widget
+
+
+def make_line(n: int) -> str:
+    level = 'E' if n % 97 == 0 else 'W' if n % 13 == 0 else 'I'
+    return f"{level} ({n}) can_dispatch: [bold]rx[/bold] id=0x{n % 0x7FF:03X} dlc=8 queue={n % 64}"
+
+
+async def soak(args) -> int:
+    if args.widget == 'richlog':
+        widget = RichLog(max_lines=args.max_lines, highlight=True, markup=True)
+    else:
+        widget = RichLogExtended(max_lines=args.max_lines, buffer_size=20, flush_interval=0.05,
+                                 highlight=True, markup=True)
+    app = SoakApp(widget)
+    process = psutil.Process()
+    tick = 0.01
+    per_tick = max(1, int(args.rate * tick))
+    print(f"{args.widget}: {per_tick / tick:.0f} lines/s for {args.seconds} s, max_lines {args.max_lines}")
+    print(f"{'t [s]':>5} {'lines':>9} {'retained':>9} {'RSS [kB]':>12} {'frame [ms]':>11} {'write [us]':>11} {'cpu [%]':>8} {'lag [ms]':>9}")
+    async with app.run_test(size=(120, 40)) as pilot:
+        await pilot.pause()
+        n = 0
+        started = time.perf_counter()
+        next_tick = started
+        next_report = started + 1.0
+        max_lag = 0.0
+        write_time = 0.0
+        writes = 0
+        cpu = time.process_time()
+        while time.perf_counter() - started < args.seconds:
+            write_start = time.perf_counter()
+            for _ in range(per_tick):
+                widget.write(make_line(n))
+                n += 1
+            write_time += time.perf_counter() - write_start
+            writes += per_tick
+            next_tick += tick
+            delay = next_tick - time.perf_counter()
+            await asyncio.sleep(max(0.0, delay))
+            max_lag = max(max_lag, time.perf_counter() - next_tick)
+            if time.perf_counter() >= next_report:
+                next_report += 1.0
+                frame_start = time.perf_counter()
+                if hasattr(widget, '_line_cache'):
+                    widget._line_cache.clear()
+                for y in range(widget.size.height):
+                    widget.render_line(y)
+                frame = time.perf_counter() - frame_start
+                retained = len(widget._lines) if hasattr(widget, '_lines') else len(widget.lines)
+                memory = process.memory_info().rss
+                cpu_used = time.process_time() - cpu
+                cpu = time.process_time()
+                print(f"{time.perf_counter() - started:5.0f} {n:9d} {retained:9d} {memory / 1024:12.0f} "
+                      f"{frame * 1000:11.2f} {write_time / writes * 1e6:11.1f} {cpu_used * 100:8.0f} {max_lag * 1000:9.1f}")
+                max_lag = 0.0
+                write_time = 0.0
+                writes = 0
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__description__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--rate', type=int, default=10000, help="Lines per second (default: 10000)")
+    parser.add_argument('--seconds', type=int, default=10, help="Duration (default: 10)")
+    parser.add_argument('--max-lines', type=int, default=2000, help="Widget max_lines (default: 2000, as the GUI)")
+    parser.add_argument('--widget', choices=['extended', 'richlog'], default='extended',
+                        help="Widget under test (default: extended)")
+    args = parser.parse_args()
+    return asyncio.run(soak(args))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
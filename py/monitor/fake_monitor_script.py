@@ -6,6 +6,8 @@ __description__ = '''
 Fake monitor script for testing serial port monitoring.
 Generates simulated ESP32 boot sequence and CAN messages.
 This script runs as external process and outputs to stdout.
+With --binary the CAN messages are sent as binary frame stream packets
+(see frame_stream.py) between the text lines.
 '''
 
 import sys
@@ -25,6 +27,10 @@ def main():
     
     # Get port from command line argument
     port = sys.argv[1] if len(sys.argv) > 1 else "unknown"
+    binary = '--binary' in sys.argv[2:]
+    if binary:
+        # Run as a script: frame_stream.py sits next to it
+        from frame_stream import CanFrame, encode_frame
     
     try:
         # Generate initial connection message
@@ -81,8 +87,14 @@ def main():
             data = [random.randint(0, 255) for _ in range(dlc)]
             data_hex = ' '.join([f"{b:02X}" for b in data])
             
-            message = f"can: CAN message received: ID=0x{can_id:03X}, DLC={dlc}, Data=[{data_hex}]"
-            print(f"[FAKE] ({message_counter}) {message}", flush=True)
+            if binary:
+                frame = CanFrame(timestamp_us=int(time.monotonic() * 1e6), can_id=can_id, is_extended=False,
+                                 is_remote=False, dlc=dlc, data=bytes(data), is_tx=False)
+                sys.stdout.buffer.write(encode_frame(frame))
+                sys.stdout.buffer.flush()
+            else:
+                message = f"can: CAN message received: ID=0x{can_id:03X}, DLC={dlc}, Data=[{data_hex}]"
+                print(f"[FAKE] ({message_counter}) {message}", flush=True)
             
             message_counter += 1
             time.sleep(0.1)  # Generate message every 2 seconds
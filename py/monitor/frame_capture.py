@@ -0,0 +1,476 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Streaming capture of decoded CAN frames to standard log files.
+
+Formats (chosen by name or by file extension):
+  candump   Linux can-utils log (.log), "(time) can0 123#1122"
+  asc       Vector ASCII log (.asc)
+  blf       Vector binary log (.blf), zlib compressed containers with --compress
+  pcapng    pcapng with the SocketCAN link type (.pcapng), opens in Wireshark
+
+FrameCaptureWriter is a frame sink for the monitors (frame_sink argument of
+PortMonitorProcess, SerialPortMonitor and MonitorOutput). Frames are encoded
+into a batch and written once batch_bytes are collected or flush_interval
+has passed, so a full-rate stream costs one write() per batch. Capture runs
+on the reader side of the monitor and does not depend on the log widget.
+
+Device timestamps are anchored to the wall clock at the first frame.
+With rotate_mb the capture rolls over to a new numbered file, every file
+complete with its own header; --compress wraps text and pcapng files in
+zstd (.zst, needs the zstandard package).
+
+Standalone use converts a raw stream (capture file or serial device):
+    python -m py.monitor.frame_capture capture.bin frames.blf
+    python -m py.monitor.frame_capture /dev/ttyACM0 frames.pcapng --rotate-mb 100 --compress
+'''
+import argparse
+import asyncio
+import os
+import struct
+import sys
+import time
+import zlib
+from typing import Dict, Optional
+
+from py.monitor.frame_stream import CanFrame, FrameStreamDecoder
+
+
+class CaptureFormat:
+    """
+    Encoder of one capture file format.
+    header() starts a file, frame() encodes one frame, flush() and footer()
+    return bytes the format still holds back (BLF containers).
+    """
+    name = ""
+    extension = ""
+    binary = False
+
+    def header(self, start: float) -> bytes:
+        """
+        File header.
+
+        Args:
+            start: Wall clock time the file starts at (seconds since epoch)
+        """
+        return b""
+
+    def frame(self, frame: CanFrame, t: float) -> bytes:
+        """
+        Encode one frame.
+
+        Args:
+            frame: Decoded frame
+            t: Wall clock time of the frame (seconds since epoch)
+        """
+        raise NotImplementedError
+
+    def flush(self) -> bytes:
+        return b""
+
+    def footer(self) -> bytes:
+        return b""
+
+    def final_header(self, file_size: int) -> Optional[bytes]:
+        """ Header rewritten over the first one on close (seekable files only). """
+        return None
+
+
+class CandumpFormat(CaptureFormat):
+    """ can-utils log format as written by candump -l and read by canplayer. """
+    name = "candump"
+    extension = ".log"
+
+    def frame(self, frame: CanFrame, t: float) -> bytes:
+        can_id = f"{frame.can_id:08X}" if frame.is_extended else f"{frame.can_id:03X}"
+        payload = "R" if frame.is_remote else frame.data.hex().upper()
+        return f"({t:.6f}) can{frame.dev} {can_id}#{payload}\n".encode()
+
+
+class AscFormat(CaptureFormat):
+    """ Vector ASCII log, timestamps relative to the start of the file; channels count from 1. """
+    name = "asc"
+    extension = ".asc"
+
+    def __init__(self):
+        self._start = 0.0
+
+    def header(self, start: float) -> bytes:
+        self._start = start
+        date = time.strftime("%a %b %d %I:%M:%S", time.localtime(start)) + \
+            f".{int(start * 1000) % 1000:03d} " + time.strftime("%p %Y", time.localtime(start)).lower()
+        return (f"date {date}\n"
+                "base hex  timestamps absolute\n"
+                "internal events logged\n"
+                "// version 9.0.0\n"
+                f"Begin Triggerblock {date}\n"
+                "   0.000000 Start of measurement\n").encode()
+
+    def frame(self, frame: CanFrame, t: float) -> bytes:
+        can_id = f"{frame.can_id:X}x" if frame.is_extended else f"{frame.can_id:X}"
+        if frame.is_remote:
+            payload = f"r {frame.dlc:x}"
+        else:
+            payload = f"d {frame.dlc:x} {frame.data.hex(' ').upper()}".rstrip()
+        return (f"{max(t - self._start, 0.0):11.6f} {frame.dev + 1}  {can_id:<15} "
+                f"{'Tx' if frame.is_tx else 'Rx'}   {payload}\n").encode()
+
+    def footer(self) -> bytes:
+        return b"End TriggerBlock\n"
+
+
+class BlfFormat(CaptureFormat):
+    """
+    Vector binary log: a file header (object count and size, patched on
+    close) followed by LOG_CONTAINER objects holding CAN_MESSAGE objects.
+    """
+    name = "blf"
+    extension = ".blf"
+    binary = True
+
+    FILE_HEADER = struct.Struct("<4sLBBBBBBBBQQLL8H8H")
+    FILE_HEADER_SIZE = 144
+    OBJ_HEADER_BASE = struct.Struct("<4sHHLL")
+    OBJ_HEADER_V1 = struct.Struct("<LHHQ")
+    LOG_CONTAINER = struct.Struct("<H6xL4x")
+    CAN_MSG = struct.Struct("<HBBL8s")
+    CAN_MESSAGE = 1
+    LOG_CONTAINER_TYPE = 10
+    TIME_ONE_NANS = 0x00000002
+    CAN_MSG_EXT = 0x80000000
+    DIR_TX = 0x01
+    REMOTE_FLAG = 0x80
+    CONTAINER_SIZE = 128 * 1024
+
+    def __init__(self, compress: bool = False):
+        """
+        Args:
+            compress: zlib compressed containers (the format's own compression)
+        """
+        self.compress = compress
+        self._container = bytearray()
+        self._start = 0.0
+        self._stop = 0.0
+        self._objects = 0
+        self._uncompressed = self.FILE_HEADER_SIZE
+        header_size = self.OBJ_HEADER_BASE.size + self.OBJ_HEADER_V1.size
+        self._can_object = self.OBJ_HEADER_BASE.pack(b"LOBJ", header_size, 1, header_size + self.CAN_MSG.size,
+                                                     self.CAN_MESSAGE)
+
+    @staticmethod
+    def _systemtime(t: float):
+        tm = time.localtime(t)
+        return tm.tm_year, tm.tm_mon, (tm.tm_wday + 1) % 7, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, \
+            int(t * 1000) % 1000
+
+    def _file_header(self, file_size: int) -> bytes:
+        header = self.FILE_HEADER.pack(b"LOGG", self.FILE_HEADER_SIZE, 5, 0, 0, 0, 2, 6, 8, 1,
+                                       file_size, self._uncompressed, self._objects, self._objects,
+                                       *self._systemtime(self._start), *self._systemtime(self._stop))
+        return header + bytes(self.FILE_HEADER_SIZE - len(header))
+
+    def header(self, start: float) -> bytes:
+        self._start = self._stop = int(start * 1000) / 1000.0     # SYSTEMTIME has ms resolution
+        return self._file_header(0)
+
+    def frame(self, frame: CanFrame, t: float) -> bytes:
+        flags = self.REMOTE_FLAG if frame.is_remote else 0
+        if frame.is_tx:
+            flags |= self.DIR_TX
+        can_id = frame.can_id | self.CAN_MSG_EXT if frame.is_extended else frame.can_id
+        self._container += self._can_object
+        self._container += self.OBJ_HEADER_V1.pack(self.TIME_ONE_NANS, 0, 0, max(int((t - self._start) * 1e9), 0))
+        self._container += self.CAN_MSG.pack(frame.dev + 1, flags, frame.dlc, can_id, frame.data)
+        self._objects += 1
+        self._stop = max(self._stop, t)
+        if len(self._container) >= self.CONTAINER_SIZE:
+            return self.flush()
+        return b""
+
+    def flush(self) -> bytes:
+        if not self._container:
+            return b""
+        data = bytes(self._container)
+        self._container.clear()
+        self._uncompressed += self.OBJ_HEADER_BASE.size + self.LOG_CONTAINER.size + len(data)
+        method = 0
+        if self.compress:
+            data_out = zlib.compress(data)
+            method = 2
+        else:
+            data_out = data
+        obj_size = self.OBJ_HEADER_BASE.size + self.LOG_CONTAINER.size + len(data_out)
+        return (self.OBJ_HEADER_BASE.pack(b"LOBJ", self.OBJ_HEADER_BASE.size, 1, obj_size, self.LOG_CONTAINER_TYPE) +
+                self.LOG_CONTAINER.pack(method, len(data)) + data_out + bytes(obj_size % 4))
+
+    def footer(self) -> bytes:
+        return self.flush()
+
+    def final_header(self, file_size: int) -> Optional[bytes]:
+        return self._file_header(file_size)
+
+
+class PcapngFormat(CaptureFormat):
+    """
+    pcapng, link type LINKTYPE_CAN_SOCKETCAN (227), one interface per
+    device channel (can0, can1, ...), microsecond timestamps and the
+    packet direction in the epb_flags option.
+    """
+    name = "pcapng"
+    extension = ".pcapng"
+    binary = True
+
+    LINKTYPE_CAN_SOCKETCAN = 227
+    CAN_EFF_FLAG = 0x80000000
+    CAN_RTR_FLAG = 0x40000000
+    EPB_INBOUND = 0x1
+    EPB_OUTBOUND = 0x2
+
+    def __init__(self):
+        self._interfaces: Dict[int, int] = {}
+
+    @staticmethod
+    def _block(block_type: int, body: bytes) -> bytes:
+        body += bytes(-len(body) % 4)
+        length = len(body) + 12
+        return struct.pack("<II", block_type, length) + body + struct.pack("<I", length)
+
+    @staticmethod
+    def _option(code: int, value: bytes) -> bytes:
+        return struct.pack("<HH", code, len(value)) + value + bytes(-len(value) % 4)
+
+    def header(self, start: float) -> bytes:
+        self._interfaces.clear()
+        shb = struct.pack("<IHHq", 0x1A2B3C4D, 1, 0, -1) + \
+            self._option(4, b"esp32-can-examples monitor") + self._option(0, b"")
+        return self._block(0x0A0D0D0A, shb)
+
+    def _interface(self, dev: int) -> bytes:
+        self._interfaces[dev] = len(self._interfaces)
+        idb = struct.pack("<HHI", self.LINKTYPE_CAN_SOCKETCAN, 0, 16) + \
+            self._option(2, f"can{dev}".encode()) + self._option(0, b"")
+        return self._block(0x00000001, idb)
+
+    def frame(self, frame: CanFrame, t: float) -> bytes:
+        out = b""
+        interface = self._interfaces.get(frame.dev)
+        if interface is None:
+            out = self._interface(frame.dev)
+            interface = self._interfaces[frame.dev]
+        can_id = frame.can_id
+        if frame.is_extended:
+            can_id |= self.CAN_EFF_FLAG
+        if frame.is_remote:
+            can_id |= self.CAN_RTR_FLAG
+        data = b"" if frame.is_remote else frame.data
+        packet = struct.pack(">IBBBB", can_id, len(data), 0, 0, 0) + data
+        ts = int(t * 1e6)
+        direction = self.EPB_OUTBOUND if frame.is_tx else self.EPB_INBOUND
+        epb = struct.pack("<IIIII", interface, ts >> 32, ts & 0xFFFFFFFF, len(packet), len(packet)) + \
+            packet + bytes(-len(packet) % 4) + self._option(2, struct.pack("<I", direction)) + self._option(0, b"")
+        return out + self._block(0x00000006, epb)
+
+
+CAPTURE_FORMATS = {
+    "candump": CandumpFormat,
+    "asc": AscFormat,
+    "blf": BlfFormat,
+    "pcapng": PcapngFormat,
+}
+
+
+def format_for_path(path: str) -> str:
+    """
+    Capture format name from a file name (".zst" suffix ignored).
+
+    Raises:
+        ValueError: Unknown extension
+    """
+    base = path[:-4] if path.endswith(".zst") else path
+    ext = os.path.splitext(base)[1].lower()
+    for name, cls in CAPTURE_FORMATS.items():
+        if cls.extension == ext:
+            return name
+    raise ValueError(f"unknown capture file extension '{ext}' (use one of "
+                     f"{', '.join(cls.extension for cls in CAPTURE_FORMATS.values())})")
+
+
+class FrameCaptureWriter:
+    """
+    Batched writer of frames to a capture file; callable as a frame sink.
+    Frames go into an in-memory batch that is written when batch_bytes are
+    collected, on an event loop timer (flush_interval) or on close().
+    """
+
+    def __init__(
+            self,
+            path: str,
+            capture_format: Optional[str] = None,
+            batch_bytes: int = 64 * 1024,
+            flush_interval: float = 1.0,
+            rotate_mb: float = 0,
+            compress: bool = False
+    ):
+        """
+        Initialize capture writer; the first file is opened at once.
+
+        Args:
+            path: Capture file name; with rotate_mb files are numbered (name.0001.log, ...)
+            capture_format: Format name (CAPTURE_FORMATS), default from the file extension
+            batch_bytes: Encoded bytes collected before a disk write
+            flush_interval: Longest time frames wait in memory (seconds, needs a running event loop)
+            rotate_mb: Start a new file after this many MB of capture data (0 = one file)
+            compress: zstd for candump/asc/pcapng (".zst" appended), zlib containers for blf
+
+        Raises:
+            ValueError: Unknown format
+            ImportError: compress without the zstandard package
+            OSError: The file cannot be created
+        """
+        self.capture_format = capture_format or format_for_path(path)
+        if self.capture_format not in CAPTURE_FORMATS:
+            raise ValueError(f"unknown capture format '{self.capture_format}'")
+        self.path = path[:-4] if path.endswith(".zst") else path
+        self.batch_bytes = batch_bytes
+        self.flush_interval = flush_interval
+        self.rotate_bytes = int(rotate_mb * 1e6)
+        self.compress = compress
+        self._zstd = None
+        if compress and self.capture_format != "blf":
+            import zstandard
+            self._zstd = zstandard.ZstdCompressor(level=3)
+        self.frames = 0
+        self.files = []
+        self._format: Optional[CaptureFormat] = None
+        self._raw = None
+        self._file = None
+        self._batch = bytearray()
+        self._file_bytes = 0
+        self._time_offset = None
+        self._timer = None
+        self._open(time.time())
+
+    def __call__(self, frame: CanFrame) -> None:
+        self.write(frame)
+
+    def write(self, frame: CanFrame) -> None:
+        """
+        Add a frame to the batch.
+
+        Args:
+            frame: Decoded frame
+        """
+        if self._file is None:
+            return
+        if self._time_offset is None:
+            self._time_offset = time.time() - frame.timestamp_us / 1e6
+        t = self._time_offset + frame.timestamp_us / 1e6
+        self._batch += self._format.frame(frame, t)
+        self.frames += 1
+        if len(self._batch) >= self.batch_bytes:
+            self.flush()
+            if self.rotate_bytes and self._file_bytes >= self.rotate_bytes:
+                self._close_file()
+                self._open(t)
+        elif self._timer is None:
+            try:
+                self._timer = asyncio.get_running_loop().call_later(self.flush_interval, self._on_timer)
+            except RuntimeError:
+                pass
+
+    def flush(self) -> None:
+        """ Write the batch (and data the format holds back) to the file. """
+        if self._file is None:
+            return
+        self._batch += self._format.flush()
+        if self._batch:
+            self._file.write(self._batch)
+            self._file_bytes += len(self._batch)
+            self._batch.clear()
+
+    def close(self) -> None:
+        """ Write everything still buffered and close the file. """
+        if self._timer is not None:
+            self._timer.cancel()
+            self._timer = None
+        self._close_file()
+
+    def _on_timer(self) -> None:
+        self._timer = None
+        try:
+            self.flush()
+        except OSError as e:
+            print(f"Capture write to {self.files[-1]} failed: {e}")
+            self._raw.close()
+            self._file = self._raw = None
+
+    def _file_name(self) -> str:
+        name = self.path
+        if self.rotate_bytes:
+            stem, ext = os.path.splitext(self.path)
+            name = f"{stem}.{len(self.files) + 1:04d}{ext}"
+        return name + ".zst" if self._zstd else name
+
+    def _open(self, start: float) -> None:
+        name = self._file_name()
+        cls = CAPTURE_FORMATS[self.capture_format]
+        self._format = cls(compress=self.compress) if cls is BlfFormat else cls()
+        self._raw = open(name, "wb")
+        self._file = self._zstd.stream_writer(self._raw, closefd=False) if self._zstd else self._raw
+        self.files.append(name)
+        self._file_bytes = 0
+        self._batch += self._format.header(start)
+
+    def _close_file(self) -> None:
+        if self._file is None:
+            return
+        self._batch += self._format.footer()
+        self.flush()
+        if self._file is not self._raw:
+            self._file.close()
+        else:
+            final = self._format.final_header(self._raw.tell())
+            if final is not None:
+                self._raw.seek(0)
+                self._raw.write(final)
+        self._raw.close()
+        self._file = self._raw = None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__description__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('source', help="Raw stream: capture file or serial device (already configured)")
+    parser.add_argument('output', help="Capture file; the format follows the extension")
+    parser.add_argument('--format', choices=list(CAPTURE_FORMATS), help="Format (default: from the extension)")
+    parser.add_argument('--rotate-mb', type=float, default=0, help="Roll over to a new file every N MB (default: off)")
+    parser.add_argument('--compress', action='store_true', help="zstd compressed files (blf: zlib containers)")
+    args = parser.parse_args()
+
+    try:
+        writer = FrameCaptureWriter(args.output, args.format, rotate_mb=args.rotate_mb, compress=args.compress)
+    except (ValueError, ImportError, OSError) as e:
+        print(f"Cannot start capture: {e}", file=sys.stderr)
+        return 1
+    decoder = FrameStreamDecoder()
+    try:
+        with open(args.source, 'rb', buffering=0) as f:
+            while True:
+                data = f.read(65536)
+                if not data:
+                    break
+                for item in decoder.feed(data):
+                    if isinstance(item, CanFrame):
+                        writer.write(item)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        writer.close()
+    print(f"{writer.frames} frames written to {', '.join(writer.files)}", file=sys.stderr)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,487 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Indexed, columnar store of captured CAN frames (.cfs) with fast ID and
+time-range queries over long captures.
+
+Frames are written in chunks of up to chunk_frames frames. Every chunk keeps
+its columns as separate arrays (timestamp, ID, flags with DLC, channel,
+payload), and its header holds the time range and a bitmap of the IDs in
+it. A query memory-maps the file, skips every chunk whose time range or ID
+bitmap cannot match, bisects the timestamp column and finds the ID with a
+byte search of the ID column, so only matching frames are decoded.
+
+File layout (little endian):
+  header   "CANSTORE", version, chunk_frames, created [us]
+  chunk    "CHNK", count, t_min, t_max, flags, ID bitmap (8192 bits),
+           then columns ts u64[n], id u32[n], flags u8[n], dev u8[n], data u8[8n]
+  index    "INDX", count, chunk offsets u64[count]       (written on close)
+  trailer  index offset u64, "CANSTEND"
+A file without the trailer (capture still running, or killed) is read by
+walking the chunks from the start.
+
+FrameStoreWriter is a frame sink like FrameCaptureWriter, so monitored ports
+are stored with flash_manager.py --capture-dir DIR --capture-format store.
+
+    python -m py.monitor.frame_store import capture.bin frames.cfs
+    python -m py.monitor.frame_store info frames.cfs
+    python -m py.monitor.frame_store query frames.cfs --id 0x18FEF100 --from 120 --to 180
+'''
+import argparse
+import asyncio
+import bisect
+import mmap
+import os
+import re
+import struct
+import sys
+import time
+from array import array
+from typing import Iterator, List, Optional
+
+from py.monitor.frame_stream import CanFrame, FrameStreamDecoder
+
+STORE_FORMAT = "store"
+STORE_EXTENSION = ".cfs"
+
+FILE_HEADER = struct.Struct("<8sIIQ")
+FILE_MAGIC = b"CANSTORE"
+FILE_VERSION = 1
+CHUNK_HEADER = struct.Struct("<4sIQQII")
+CHUNK_MAGIC = b"CHNK"
+CHUNK_SORTED = 0x01             # timestamps ascending, the time range can be bisected
+INDEX_HEADER = struct.Struct("<4sI")
+INDEX_MAGIC = b"INDX"
+TRAILER = struct.Struct("<Q8s")
+TRAILER_MAGIC = b"CANSTEND"
+
+FLAG_DLC_MASK = 0x0F
+FLAG_EXTD = 0x10
+FLAG_RTR = 0x20
+FLAG_TX = 0x40
+
+BITMAP_BITS = 8192
+BITMAP_BYTES = BITMAP_BITS // 8
+BITMAP_STD = 2048               # standard IDs have one exact bit each, extended IDs are hashed above
+CHUNK_HEADER_SIZE = CHUNK_HEADER.size + BITMAP_BYTES
+FRAME_BYTES = 8 + 4 + 1 + 1 + 8
+
+
+def id_bit(can_id: int, is_extended: bool) -> int:
+    """ Bit of an ID in the chunk bitmap. """
+    if not is_extended:
+        return can_id & 0x7FF
+    return BITMAP_STD + (can_id * 2654435761 >> 7) % (BITMAP_BITS - BITMAP_STD)
+
+
+def _pad8(size: int) -> int:
+    return -size % 8
+
+
+class FrameStoreWriter:
+    """
+    Writer of a .cfs store; callable as a frame sink.
+    Frames are collected column by column and written one chunk per write();
+    a chunk is also cut by flush_interval (event loop timer), so a crash
+    loses at most that much of a slow capture.
+    """
+
+    def __init__(self, path: str, chunk_frames: int = 65536, flush_interval: float = 10.0):
+        """
+        Create the store file.
+
+        Args:
+            path: Store file name (.cfs)
+            chunk_frames: Frames per chunk
+            flush_interval: Longest time frames wait in memory (seconds, needs a running event loop)
+
+        Raises:
+            OSError: The file cannot be created
+        """
+        self.path = path
+        self.chunk_frames = chunk_frames
+        self.flush_interval = flush_interval
+        self.frames = 0
+        self.files = [path]
+        self._chunk_offsets: List[int] = []
+        self._time_offset = None
+        self._timer = None
+        self._reset_chunk()
+        self._file = open(path, "wb")
+        self._file.write(FILE_HEADER.pack(FILE_MAGIC, FILE_VERSION, chunk_frames, int(time.time() * 1e6)))
+
+    def _reset_chunk(self) -> None:
+        self._ts = array("Q")
+        self._ids = array("I")
+        self._flags = bytearray()
+        self._devs = bytearray()
+        self._data = bytearray()
+        self._keys = set()
+        self._sorted = True
+
+    def __call__(self, frame: CanFrame) -> None:
+        self.write(frame)
+
+    def write(self, frame: CanFrame) -> None:
+        """
+        Add a frame; device time is anchored to the wall clock at the first frame.
+
+        Args:
+            frame: Decoded frame
+        """
+        if self._file is None:
+            return
+        if self._time_offset is None:
+            self._time_offset = int(time.time() * 1e6) - frame.timestamp_us
+        self.append(frame.timestamp_us + self._time_offset, frame.can_id, frame.is_extended, frame.is_remote,
+                    frame.dlc, frame.data, frame.is_tx, frame.dev)
+
+    def append(self, timestamp_us: int, can_id: int, is_extended: bool, is_remote: bool, dlc: int,
+               data: bytes, is_tx: bool = False, dev: int = 0) -> None:
+        """
+        Add a frame with an absolute timestamp (import of existing captures).
+
+        Args:
+            timestamp_us: Wall clock time in microseconds since epoch
+        """
+        ts = self._ts
+        if ts and timestamp_us < ts[-1]:
+            self._sorted = False
+        ts.append(timestamp_us)
+        self._ids.append(can_id)
+        self._flags.append((dlc & FLAG_DLC_MASK) | (FLAG_EXTD if is_extended else 0) |
+                           (FLAG_RTR if is_remote else 0) | (FLAG_TX if is_tx else 0))
+        self._devs.append(dev)
+        self._data += data[:8].ljust(8, b"\0")
+        self._keys.add(can_id | 0x80000000 if is_extended else can_id)
+        self.frames += 1
+        if len(ts) >= self.chunk_frames:
+            self.flush()
+        elif self._timer is None:
+            try:
+                self._timer = asyncio.get_running_loop().call_later(self.flush_interval, self._on_timer)
+            except RuntimeError:
+                pass
+
+    def flush(self) -> None:
+        """ Write the collected frames as a chunk. """
+        if self._file is None or not self._ts:
+            return
+        count = len(self._ts)
+        bitmap = bytearray(BITMAP_BYTES)
+        for key in self._keys:
+            bit = id_bit(key & 0x7FFFFFFF, bool(key & 0x80000000))
+            bitmap[bit >> 3] |= 1 << (bit & 7)
+        ts = self._ts
+        t_min, t_max = (ts[0], ts[-1]) if self._sorted else (min(ts), max(ts))
+        columns = ts.tobytes() + self._ids.tobytes() + self._flags + self._devs + self._data
+        self._chunk_offsets.append(self._file.tell())
+        self._file.write(CHUNK_HEADER.pack(CHUNK_MAGIC, count, t_min, t_max, CHUNK_SORTED if self._sorted else 0, 0) +
+                         bitmap + columns + bytes(_pad8(len(columns))))
+        self._file.flush()
+        self._reset_chunk()
+
+    def close(self) -> None:
+        """ Write the last chunk and the chunk index. """
+        if self._timer is not None:
+            self._timer.cancel()
+            self._timer = None
+        if self._file is None:
+            return
+        self.flush()
+        index_offset = self._file.tell()
+        self._file.write(INDEX_HEADER.pack(INDEX_MAGIC, len(self._chunk_offsets)) +
+                         array("Q", self._chunk_offsets).tobytes() + TRAILER.pack(index_offset, TRAILER_MAGIC))
+        self._file.close()
+        self._file = None
+
+    def _on_timer(self) -> None:
+        self._timer = None
+        try:
+            self.flush()
+        except OSError as e:
+            print(f"Frame store write to {self.path} failed: {e}")
+            self._file.close()
+            self._file = None
+
+
+class FrameStore:
+    """
+    Read-only, memory-mapped view of a .cfs store.
+    Chunks are located through the index, or by walking the file when the
+    index is missing; columns are read as memoryviews into the mapping.
+    """
+
+    def __init__(self, path: str):
+        """
+        Open a store.
+
+        Raises:
+            OSError: The file cannot be read
+            ValueError: Not a frame store
+        """
+        self.path = path
+        self._file = open(path, "rb")
+        size = os.fstat(self._file.fileno()).st_size
+        if size < FILE_HEADER.size:
+            self._file.close()
+            raise ValueError(f"{path}: not a frame store")
+        self._map = mmap.mmap(self._file.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, self.chunk_frames, self.created_us = FILE_HEADER.unpack_from(self._map, 0)
+        if magic != FILE_MAGIC or version != FILE_VERSION:
+            self.close()
+            raise ValueError(f"{path}: not a frame store (version {FILE_VERSION})")
+        self.complete = False
+        self.chunks = self._read_index(size)
+        if self.chunks is None:
+            self.chunks = self._walk_chunks(size)
+        else:
+            self.complete = True
+        self.headers = [CHUNK_HEADER.unpack_from(self._map, offset) for offset in self.chunks]
+
+    def close(self) -> None:
+        self._map.close()
+        self._file.close()
+
+    def __enter__(self) -> 'FrameStore':
+        return self
+
+    def __exit__(self, *exc) -> None:
+        self.close()
+
+    def _read_index(self, size: int) -> Optional[List[int]]:
+        if size < FILE_HEADER.size + INDEX_HEADER.size + TRAILER.size:
+            return None
+        index_offset, magic = TRAILER.unpack_from(self._map, size - TRAILER.size)
+        if magic != TRAILER_MAGIC or index_offset + INDEX_HEADER.size > size:
+            return None
+        magic, count = INDEX_HEADER.unpack_from(self._map, index_offset)
+        start = index_offset + INDEX_HEADER.size
+        if magic != INDEX_MAGIC or start + 8 * count + TRAILER.size != size:
+            return None
+        return list(memoryview(self._map)[start:start + 8 * count].cast("Q"))
+
+    def _walk_chunks(self, size: int) -> List[int]:
+        offsets = []
+        offset = FILE_HEADER.size
+        while offset + CHUNK_HEADER_SIZE <= size:
+            magic, count = CHUNK_HEADER.unpack_from(self._map, offset)[:2]
+            length = CHUNK_HEADER_SIZE + count * FRAME_BYTES
+            length += _pad8(count * FRAME_BYTES)
+            if magic != CHUNK_MAGIC or offset + length > size:
+                break               # torn last chunk of a killed capture
+            offsets.append(offset)
+            offset += length
+        return offsets
+
+    @property
+    def frame_count(self) -> int:
+        return sum(header[1] for header in self.headers)
+
+    @property
+    def time_range(self):
+        """ (first, last) timestamp in microseconds, or None for an empty store. """
+        if not self.headers:
+            return None
+        return min(h[2] for h in self.headers), max(h[3] for h in self.headers)
+
+    def _columns(self, offset: int, count: int):
+        base = offset + CHUNK_HEADER_SIZE
+        view = memoryview(self._map)
+        ts = view[base:base + 8 * count].cast("Q")
+        base += 8 * count
+        ids = view[base:base + 4 * count]
+        base += 4 * count
+        flags = view[base:base + count]
+        base += count
+        devs = view[base:base + count]
+        base += count
+        data = view[base:base + 8 * count]
+        return ts, ids, flags, devs, data
+
+    def query(
+            self,
+            can_id: Optional[int] = None,
+            t_from: Optional[int] = None,
+            t_to: Optional[int] = None,
+            is_extended: Optional[bool] = None
+    ) -> Iterator[CanFrame]:
+        """
+        Frames matching an ID and a time range, in store order.
+
+        Args:
+            can_id: CAN ID (None = all)
+            t_from: First timestamp in microseconds since epoch, inclusive (None = from the start)
+            t_to: Last timestamp in microseconds since epoch, inclusive (None = to the end)
+            is_extended: Only extended (True) or standard (False) frames; None = both
+
+        Yields:
+            CanFrame with timestamp_us in microseconds since epoch
+        """
+        t_lo = 0 if t_from is None else t_from
+        t_hi = (1 << 64) - 1 if t_to is None else t_to
+        bits = []
+        if can_id is not None:
+            if is_extended is not True and can_id <= 0x7FF:
+                bits.append(id_bit(can_id, False))
+            if is_extended is not False:
+                bits.append(id_bit(can_id, True))
+            if not bits:
+                return
+        needle = None if can_id is None else struct.pack("<I", can_id)
+        for offset, (_, count, c_min, c_max, c_flags, _) in zip(self.chunks, self.headers):
+            if c_max < t_lo or c_min > t_hi:
+                continue
+            if bits:
+                bitmap = self._map[offset + CHUNK_HEADER.size:offset + CHUNK_HEADER_SIZE]
+                if not any(bitmap[bit >> 3] & (1 << (bit & 7)) for bit in bits):
+                    continue
+            ts, ids, flags, devs, data = self._columns(offset, count)
+            if c_flags & CHUNK_SORTED:
+                first = bisect.bisect_left(ts, t_lo) if c_min < t_lo else 0
+                last = bisect.bisect_right(ts, t_hi) if c_max > t_hi else count
+            else:
+                first, last = 0, count
+            for i in self._matches(offset + CHUNK_HEADER_SIZE + 8 * count, needle, first, last):
+                t = ts[i]
+                if not t_lo <= t <= t_hi:
+                    continue
+                f = flags[i]
+                if is_extended is not None and bool(f & FLAG_EXTD) != is_extended:
+                    continue
+                rtr = bool(f & FLAG_RTR)
+                dlc = f & FLAG_DLC_MASK
+                yield CanFrame(timestamp_us=t, can_id=int.from_bytes(ids[4 * i:4 * i + 4], "little"),
+                               is_extended=bool(f & FLAG_EXTD), is_remote=rtr, dlc=dlc,
+                               data=b"" if rtr else bytes(data[8 * i:8 * i + min(dlc, 8)]),
+                               is_tx=bool(f & FLAG_TX), dev=devs[i])
+
+    def _matches(self, ids_offset: int, needle: Optional[bytes], first: int, last: int) -> Iterator[int]:
+        """ Frame indexes in [first, last) whose ID is needle; mmap.find() over the ID column. """
+        if needle is None:
+            yield from range(first, last)
+            return
+        start = ids_offset + 4 * first
+        end = ids_offset + 4 * last
+        pos = self._map.find(needle, start, end)
+        while pos >= 0:
+            skew = (pos - ids_offset) % 4
+            if skew == 0:
+                yield (pos - ids_offset) // 4
+                pos += 4
+            else:
+                pos += 4 - skew
+            pos = self._map.find(needle, pos, end)
+
+
+_CANDUMP_LINE = re.compile(r"\((\d+)\.(\d{6})\)\s+\S*?(\d*)\s+([0-9A-Fa-f]+)#(R\d?|[0-9A-Fa-f]*)")
+
+
+def import_candump(writer: FrameStoreWriter, path: str) -> None:
+    """ Appends the frames of a candump log (can-utils or frame_capture) with their timestamps. """
+    with open(path, "r", errors="replace") as f:
+        for line in f:
+            m = _CANDUMP_LINE.match(line)
+            if not m:
+                continue
+            seconds, micros, dev, can_id, payload = m.groups()
+            remote = payload.startswith("R")
+            data = b"" if remote else bytes.fromhex(payload)
+            dlc = (int(payload[1:]) if len(payload) > 1 else 0) if remote else len(data)
+            writer.append(int(seconds) * 1000000 + int(micros), int(can_id, 16), len(can_id) > 3, remote, dlc,
+                          data, dev=int(dev) if dev else 0)
+
+
+def import_stream(writer: FrameStoreWriter, path: str) -> None:
+    """ Appends the frames of a raw frame stream (capture file or serial device). """
+    decoder = FrameStreamDecoder()
+    with open(path, "rb", buffering=0) as f:
+        while True:
+            data = f.read(65536)
+            if not data:
+                break
+            for item in decoder.feed(data):
+                if isinstance(item, CanFrame):
+                    writer.write(item)
+
+
+def _parse_time(value: Optional[str], start_us: int) -> Optional[int]:
+    """ Seconds from the start of the store, or absolute epoch seconds when prefixed with '@'. """
+    if value is None:
+        return None
+    if value.startswith("@"):
+        return int(float(value[1:]) * 1e6)
+    return start_us + int(float(value) * 1e6)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__description__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest='command', required=True)
+    p_import = commands.add_parser('import', help="Build a store from a raw frame stream or a candump .log")
+    p_import.add_argument('source', help="Raw stream (capture file, serial device) or candump log (*.log)")
+    p_import.add_argument('store', help="Store file (.cfs)")
+    p_import.add_argument('--chunk-frames', type=int, default=65536, help="Frames per chunk (default: 65536)")
+    p_info = commands.add_parser('info', help="Frame count, time range and chunks")
+    p_info.add_argument('store', help="Store file (.cfs)")
+    p_query = commands.add_parser('query', help="Print frames by ID and time range")
+    p_query.add_argument('store', help="Store file (.cfs)")
+    p_query.add_argument('--id', type=lambda v: int(v, 0), help="CAN ID (e.g. 0x18FEF100)")
+    p_query.add_argument('--ext', action='store_true', help="Only extended frames")
+    p_query.add_argument('--std', action='store_true', help="Only standard frames")
+    p_query.add_argument('--from', dest='t_from',
+                         help="Start: seconds from the first frame, or @<epoch seconds>")
+    p_query.add_argument('--to', dest='t_to', help="End: seconds from the first frame, or @<epoch seconds>")
+    p_query.add_argument('--count', action='store_true', help="Print only the number of matching frames")
+    args = parser.parse_args()
+
+    if args.command == 'import':
+        started = time.perf_counter()
+        try:
+            writer = FrameStoreWriter(args.store, chunk_frames=args.chunk_frames)
+        except OSError as e:
+            print(f"Cannot create {args.store}: {e}", file=sys.stderr)
+            return 1
+        try:
+            if args.source.endswith('.log'):
+                import_candump(writer, args.source)
+            else:
+                import_stream(writer, args.source)
+        except KeyboardInterrupt:
+            pass
+        finally:
+            writer.close()
+        print(f"{writer.frames} frames stored in {time.perf_counter() - started:.1f} s", file=sys.stderr)
+        return 0
+
+    try:
+        store = FrameStore(args.store)
+    except (OSError, ValueError) as e:
+        print(f"Cannot open store: {e}", file=sys.stderr)
+        return 1
+    with store:
+        time_range = store.time_range
+        if args.command == 'info':
+            print(f"{args.store}: {store.frame_count} frames in {len(store.chunks)} chunks"
+                  f"{'' if store.complete else ' (no index: capture running or interrupted)'}")
+            if time_range:
+                print(f"  from {time.strftime('%Y-%m-%d %H:%M:%S', time.localtime(time_range[0] / 1e6))}"
+                      f" for {(time_range[1] - time_range[0]) / 1e6:.3f} s")
+            return 0
+        start_us = time_range[0] if time_range else 0
+        is_extended = True if args.ext else False if args.std else None
+        started = time.perf_counter()
+        matches = 0
+        for frame in store.query(args.id, _parse_time(args.t_from, start_us), _parse_time(args.t_to, start_us),
+                                 is_extended):
+            matches += 1
+            if not args.count:
+                print(frame.to_text())
+        print(f"{matches} frames in {(time.perf_counter() - started) * 1000:.1f} ms", file=sys.stderr)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,300 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Decoder of the binary CAN frame stream (components/can_dispatch/can_dispatch_stream.h).
+
+The firmware interleaves COBS packets framed by zero bytes with the normal
+console text. FrameStreamDecoder splits a byte stream into text and
+structured CanFrame objects for the GUI and for file capture; packets with a
+bad CRC are passed through as text, so nothing is silently lost.
+Firmware whose console translates LF to CRLF (CONFIG_NEWLIB_STDOUT_LINE_ENDING_CRLF,
+the ESP-IDF default) turns every 0x0A of a packet into 0x0D 0x0A; the
+translation is undone when a packet fails the CRC as received.
+
+Standalone use prints the frames of a capture file or a serial device:
+    python -m py.monitor.frame_stream /dev/ttyACM0
+    python -m py.monitor.frame_stream capture.bin --stats
+'''
+import argparse
+import binascii
+import codecs
+import struct
+import sys
+import time
+from dataclasses import dataclass
+from typing import List, Optional, Union
+
+PKT_FRAME = 0x01
+PKT_DROPPED = 0x02
+FLAG_DLC_MASK = 0x0F
+FLAG_EXTD = 0x10
+FLAG_RTR = 0x20
+FLAG_TX = 0x40
+
+# Longest packet: type, flags, dev, time, 32-bit id, 8 data bytes, crc
+MAX_PACKET = 1 + 1 + 1 + 4 + 4 + 8 + 2
+MAX_ENCODED = MAX_PACKET + 1
+MAX_ENCODED_CRLF = 2 * MAX_ENCODED      # every byte could be a translated 0x0A
+
+
+@dataclass
+class CanFrame:
+    """ One frame logged by the dispatcher. """
+    timestamp_us: int       # device time, unwrapped to 64 bits
+    can_id: int
+    is_extended: bool
+    is_remote: bool
+    dlc: int
+    data: bytes
+    is_tx: bool
+    dev: int = 0
+
+    def to_text(self) -> str:
+        """ One-line human readable form (candump style). """
+        can_id = f"{self.can_id:08X}" if self.is_extended else f"{self.can_id:03X}"
+        payload = 'R' if self.is_remote else self.data.hex(' ').upper()
+        return (f"({self.timestamp_us / 1e6:.6f}) can{self.dev} {'TX' if self.is_tx else 'RX'} "
+                f"{can_id} [{self.dlc}] {payload}")
+
+
+@dataclass
+class DroppedFrames:
+    """ Frames the device could not queue for the stream. """
+    count: int
+
+
+StreamItem = Union[str, CanFrame, DroppedFrames]
+_BAD_PACKET = object()
+
+
+def cobs_decode(data: bytes) -> Optional[bytes]:
+    """ Decodes one COBS block (without delimiters); None if malformed. """
+    out = bytearray()
+    i = 0
+    n = len(data)
+    while i < n:
+        code = data[i]
+        if code == 0:
+            return None
+        end = i + code
+        if end > n:
+            return None
+        out += data[i + 1:end]
+        i = end
+        if code != 0xFF and i < n:
+            out.append(0)
+    return bytes(out)
+
+
+def cobs_encode(data: bytes) -> bytes:
+    """ COBS encoding (without delimiters). """
+    out = bytearray()
+    block = bytearray()
+    for b in data:
+        if b == 0:
+            out.append(len(block) + 1)
+            out += block
+            block.clear()
+        else:
+            block.append(b)
+            if len(block) == 0xFE:
+                out.append(0xFF)
+                out += block
+                block.clear()
+    out.append(len(block) + 1)
+    out += block
+    return bytes(out)
+
+
+def encode_frame(frame: CanFrame) -> bytes:
+    """ Wire form of a frame as the firmware writes it (host tests, fake monitor). """
+    dlc = min(frame.dlc, 8)
+    flags = dlc | (FLAG_EXTD if frame.is_extended else 0) | (FLAG_RTR if frame.is_remote else 0) | \
+        (FLAG_TX if frame.is_tx else 0)
+    pkt = bytearray(struct.pack('<BBBI', PKT_FRAME, flags, frame.dev, frame.timestamp_us & 0xFFFFFFFF))
+    pkt += struct.pack('<I' if frame.is_extended else '<H', frame.can_id)
+    if not frame.is_remote:
+        pkt += frame.data[:dlc]
+    pkt += struct.pack('<H', binascii.crc_hqx(bytes(pkt), 0xFFFF))
+    return b'\x00' + cobs_encode(bytes(pkt)) + b'\x00'
+
+
+class FrameStreamDecoder:
+    """
+    Incremental splitter of console bytes into text and frames.
+
+    Text that follows a packet is held back until the next zero byte or
+    MAX_ENCODED bytes, since it could be the start of the next packet; call
+    flush() when the stream goes idle to release it. Released bytes still
+    count as a packet start, so a packet split by a stall of the sender is
+    decoded when its rest arrives (the first part was shown as text).
+    """
+
+    def __init__(self):
+        self._pending = bytearray()
+        self._released = 0                  # bytes of _pending already emitted by flush()
+        self._after_zero = False
+        self._text = codecs.getincrementaldecoder('utf-8')(errors='replace')
+        self._last_time = None
+        self._time_base = 0
+        self.frames = 0
+        self.dropped = 0
+        self.bad_packets = 0
+        self.crlf_packets = 0               # decoded after undoing LF -> CRLF
+
+    def feed(self, data: bytes) -> List[StreamItem]:
+        """ Consumes a chunk of stream bytes and returns the complete items. """
+        items: List[StreamItem] = []
+        start = 0
+        while True:
+            zero = data.find(0, start)
+            if zero < 0:
+                break
+            released = self._released
+            if self._pending:
+                self._pending += data[start:zero]
+                segment = bytes(self._pending)
+                self._pending.clear()
+                self._released = 0
+            else:
+                segment = data[start:zero]
+            if segment:
+                item = self._decode_packet(segment) if self._after_zero else None
+                if item is None:
+                    self._emit_text(items, segment[released:])
+                else:
+                    items.append(item)
+            self._after_zero = True
+            start = zero + 1
+
+        rest = data[start:]
+        if not self._after_zero:
+            self._emit_text(items, rest)
+        elif rest:
+            self._pending += rest
+            if len(self._pending) > MAX_ENCODED_CRLF:
+                self._emit_text(items, bytes(self._pending[self._released:]))
+                self._pending.clear()
+                self._released = 0
+                self._after_zero = False
+        return items
+
+    @property
+    def holding(self) -> bool:
+        """ True while text after a packet waits for flush() or more data. """
+        return len(self._pending) > self._released
+
+    def flush(self) -> List[StreamItem]:
+        """ Releases text held back after a packet. """
+        items: List[StreamItem] = []
+        if self.holding:
+            self._emit_text(items, bytes(self._pending[self._released:]))
+            self._released = len(self._pending)
+        return items
+
+    def _emit_text(self, items: List[StreamItem], raw: bytes) -> None:
+        if not raw:
+            return
+        text = self._text.decode(raw)
+        if not text:
+            return
+        if items and isinstance(items[-1], str):
+            items[-1] += text
+        else:
+            items.append(text)
+
+    def _unwrap_time(self, time_us: int) -> int:
+        if self._last_time is not None and time_us < self._last_time and self._last_time - time_us > 0x80000000:
+            self._time_base += 1 << 32
+        self._last_time = time_us
+        return self._time_base + time_us
+
+    def _decode_packet(self, segment: bytes) -> Optional[StreamItem]:
+        item = self._decode_segment(segment)
+        if isinstance(item, (CanFrame, DroppedFrames)):
+            return item
+        if b'\r\n' in segment:
+            # Undo the console's LF -> CRLF translation (exact inverse: a sent 0x0D 0x0A arrives as 0x0D 0x0D 0x0A)
+            retry = self._decode_segment(segment.replace(b'\r\n', b'\n'))
+            if isinstance(retry, (CanFrame, DroppedFrames)):
+                self.crlf_packets += 1
+                return retry
+        if item is _BAD_PACKET:
+            self.bad_packets += 1
+        return None
+
+    def _decode_segment(self, segment: bytes) -> object:
+        """ Item, None for a segment that is not a packet, _BAD_PACKET for a packet with a bad CRC or layout. """
+        if len(segment) > MAX_ENCODED:
+            return None
+        pkt = cobs_decode(segment)
+        if pkt is None or len(pkt) < 3:
+            return None
+        body, crc = pkt[:-2], struct.unpack_from('<H', pkt, len(pkt) - 2)[0]
+        if binascii.crc_hqx(body, 0xFFFF) != crc:
+            return _BAD_PACKET
+        if body[0] == PKT_FRAME and len(body) >= 9:
+            flags, dev, time_us = struct.unpack_from('<BBI', body, 1)
+            extd = bool(flags & FLAG_EXTD)
+            rtr = bool(flags & FLAG_RTR)
+            dlc = flags & FLAG_DLC_MASK
+            id_size = 4 if extd else 2
+            data_len = 0 if rtr else min(dlc, 8)
+            if len(body) != 7 + id_size + data_len:
+                return _BAD_PACKET
+            can_id = int.from_bytes(body[7:7 + id_size], 'little')
+            self.frames += 1
+            return CanFrame(timestamp_us=self._unwrap_time(time_us), can_id=can_id, is_extended=extd,
+                            is_remote=rtr, dlc=dlc, data=bytes(body[7 + id_size:]),
+                            is_tx=bool(flags & FLAG_TX), dev=dev)
+        if body[0] == PKT_DROPPED and len(body) == 5:
+            count = struct.unpack_from('<I', body, 1)[0]
+            self.dropped += count
+            return DroppedFrames(count)
+        return _BAD_PACKET
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__description__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('source', help="Capture file or serial device (already configured, e.g. by stty)")
+    parser.add_argument('--stats', action='store_true', help="Print only frame counts and rates")
+    parser.add_argument('--no-text', action='store_true', help="Hide console text between frames")
+    args = parser.parse_args()
+
+    decoder = FrameStreamDecoder()
+    started = time.monotonic()
+    try:
+        with open(args.source, 'rb', buffering=0) as f:
+            while True:
+                data = f.read(65536)
+                if not data:
+                    break
+                for item in decoder.feed(data):
+                    if args.stats:
+                        continue
+                    if isinstance(item, CanFrame):
+                        print(item.to_text())
+                    elif isinstance(item, DroppedFrames):
+                        print(f"*** {item.count} frames dropped by the device ***")
+                    elif not args.no_text:
+                        sys.stdout.write(item)
+    except KeyboardInterrupt:
+        pass
+    for item in decoder.flush():
+        if isinstance(item, str) and not (args.stats or args.no_text):
+            sys.stdout.write(item)
+    elapsed = time.monotonic() - started
+    print(f"\n{decoder.frames} frames, {decoder.dropped} dropped on the device, "
+          f"{decoder.bad_packets} bad packets, {decoder.frames / max(elapsed, 1e-6):.0f} frames/s decoded",
+          file=sys.stderr)
+    if decoder.crlf_packets:
+        print(f"{decoder.crlf_packets} packets had LF translated to CRLF by the console "
+              f"(set CONFIG_NEWLIB_STDOUT_LINE_ENDING_LF=y)", file=sys.stderr)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,270 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Benchmark of the PortMonitorProcess reader against the previous polling one.
+
+Throughput: every monitor reads a high-rate fake source (cat of a file with
+console text and binary frame packets, see frame_stream.py) into a counting
+widget; reported are MB/s, decoded frames/s and widget writes.
+
+Idle: the monitors read sources that print nothing (sleep); reported is the
+CPU time the event loop used per second of wall time. The polling reader
+wakes every read_timeout per monitor, the current one not at all.
+
+Serial (--serial): pseudo-terminals stand in for boards. The same source is
+written to every pty and read either by a stty + cat subprocess per port
+(the former real port command) or by SerialPortMonitor in-process; reported
+CPU includes the child processes.
+
+    python -m py.monitor.monitor_bench
+    python -m py.monitor.monitor_bench --monitors 8 --megabytes 32 --idle-seconds 5
+    python -m py.monitor.monitor_bench --serial --monitors 12 --megabytes 4
+'''
+import argparse
+import asyncio
+import os
+import pty
+import random
+import resource
+import sys
+import tempfile
+import time
+import tty
+
+from py.shell_commands import ShellCommandConfig
+from py.monitor.frame_stream import CanFrame, FrameStreamDecoder, encode_frame
+from py.monitor.monitor_output import items_to_text
+from py.monitor.serial_port_monitor import SerialPortMonitor
+from py.monitor.shell_monitor_logic import PortMonitorProcess
+
+# Writes the source file to every pty master (file descriptors in argv) in turn
+_PTY_WRITER = '''
+import os, sys
+data = open(sys.argv[1], 'rb').read()
+fds = [int(fd) for fd in sys.argv[2:]]
+for pos in range(0, len(data), 4096):
+    for fd in fds:
+        view = memoryview(data)[pos:pos + 4096]
+        while view:
+            view = view[os.write(fd, view):]
+'''
+
+
+class LegacyPortMonitorProcess(PortMonitorProcess):
+    """ The reader before the rewrite: wait_for() polling with a 1 ms timeout. """
+
+    def __init__(self, *args, read_timeout: float = 0.001, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.read_timeout = read_timeout
+
+    def _items_to_text(self, items) -> str:
+        return items_to_text(items, self.frame_sink)
+
+    async def _stream_output(self, stream, prefix: str = ""):
+        try:
+            buffer = ""
+            decoder = FrameStreamDecoder()
+            last_flush = asyncio.get_event_loop().time()
+            while self.running:
+                try:
+                    data = await asyncio.wait_for(stream.read(self.chunk_size), timeout=self.read_timeout)
+                    if not data:
+                        break
+                    chunk = self._items_to_text(decoder.feed(data))
+                    buffer += chunk
+                    current_time = asyncio.get_event_loop().time()
+                    if ('\n' in chunk or len(buffer) >= self.chunk_size or
+                            current_time - last_flush >= self.flush_interval) and buffer:
+                        self._write_to_textarea(f"{prefix}{buffer}")
+                        buffer = ""
+                        last_flush = current_time
+                except asyncio.TimeoutError:
+                    buffer += self._items_to_text(decoder.flush())
+                    if buffer:
+                        current_time = asyncio.get_event_loop().time()
+                        if current_time - last_flush >= self.flush_interval:
+                            self._write_to_textarea(f"{prefix}{buffer}")
+                            buffer = ""
+                            last_flush = current_time
+                    continue
+                except Exception as e:
+                    self._write_to_textarea(f"Stream error: {e}\n")
+                    break
+            buffer += self._items_to_text(decoder.flush())
+            if buffer:
+                self._write_to_textarea(f"{prefix}{buffer}")
+        except Exception as e:
+            self._write_to_textarea(f"Stream error: {e}\n")
+
+
+class CountingWidget:
+    """ Stands in for the log widget. """
+
+    def __init__(self):
+        self.writes = 0
+        self.chars = 0
+
+    def write(self, text: str) -> None:
+        self.writes += 1
+        self.chars += len(text)
+
+
+def make_source(path: str, megabytes: float, frames_per_line: int) -> int:
+    """ Writes console text with binary frames between the lines; returns the frame count. """
+    rng = random.Random(1)
+    frames = 0
+    time_us = 0
+    with open(path, 'wb') as f:
+        size = 0
+        line_no = 0
+        while size < megabytes * 1e6:
+            block = bytearray()
+            for _ in range(256):
+                line_no += 1
+                block += f"I ({line_no}) can_dispatch: rx queue {line_no % 7} load {line_no % 100}%\n".encode()
+                for _ in range(frames_per_line):
+                    time_us += 125
+                    frames += 1
+                    dlc = rng.randint(0, 8)
+                    block += encode_frame(CanFrame(timestamp_us=time_us, can_id=rng.randint(0, 0x7FF),
+                                                   is_extended=False, is_remote=False, dlc=dlc,
+                                                   data=rng.randbytes(dlc), is_tx=False))
+            f.write(block)
+            size += len(block)
+    return frames
+
+
+async def run_monitors(cls, commands, chunk_size: int, flush_interval: float):
+    widgets = [CountingWidget() for _ in commands]
+    frames = [0]
+
+    def sink(frame: CanFrame) -> None:
+        frames[0] += 1
+
+    monitors = [cls(ShellCommandConfig(name=f"bench{i}", command=cmd), widget, chunk_size=chunk_size,
+                    flush_interval=flush_interval, frame_sink=sink)
+                for i, (cmd, widget) in enumerate(zip(commands, widgets))]
+    wall = time.perf_counter()
+    cpu = time.process_time()
+    await asyncio.gather(*(m.start() for m in monitors))
+    return (time.perf_counter() - wall, time.process_time() - cpu, frames[0],
+            sum(w.writes for w in widgets), sum(w.chars for w in widgets))
+
+
+def cpu_time() -> float:
+    """ CPU time of this process and of its waited-for children. """
+    children = resource.getrusage(resource.RUSAGE_CHILDREN)
+    return time.process_time() + children.ru_utime + children.ru_stime
+
+
+async def run_serial(in_process: bool, count: int, source: str, expected: int, args):
+    ptys = []
+    for _ in range(count):
+        master, slave = pty.openpty()
+        tty.setraw(slave)           # no echo back into the master before the reader configures it
+        ptys.append((master, slave, os.ttyname(slave)))
+    widgets = [CountingWidget() for _ in ptys]
+    frames = [0]
+
+    def sink(frame: CanFrame) -> None:
+        frames[0] += 1
+
+    if in_process:
+        monitors = [SerialPortMonitor(path, widget, chunk_size=args.chunk_size, flush_interval=args.flush_interval,
+                                      frame_sink=sink) for (_, _, path), widget in zip(ptys, widgets)]
+    else:
+        monitors = [PortMonitorProcess(ShellCommandConfig(
+            name=path, command=f"stty -F {path} 115200 raw -echo -ixon -ixoff -crtscts && exec cat {path}"),
+            widget, chunk_size=args.chunk_size, flush_interval=args.flush_interval, frame_sink=sink)
+            for (_, _, path), widget in zip(ptys, widgets)]
+    tasks = [asyncio.create_task(m.start()) for m in monitors]
+    await asyncio.sleep(0.5)
+    for _, slave, _ in ptys:
+        os.close(slave)
+
+    wall = time.perf_counter()
+    cpu = cpu_time()
+    if source:
+        masters = [master for master, _, _ in ptys]
+        writer = await asyncio.create_subprocess_exec(sys.executable, '-c', _PTY_WRITER, source,
+                                                      *map(str, masters), pass_fds=masters)
+        await writer.wait()
+        last, stalled = -1, 0
+        while frames[0] < expected * count and stalled < 20:
+            stalled = stalled + 1 if frames[0] == last else 0
+            last = frames[0]
+            await asyncio.sleep(0.05)
+    else:
+        await asyncio.sleep(args.idle_seconds)
+    wall = time.perf_counter() - wall
+    for m in monitors:
+        await m.terminate()
+    await asyncio.gather(*tasks, return_exceptions=True)
+    cpu = cpu_time() - cpu
+    for master, _, _ in ptys:
+        os.close(master)
+    return wall, cpu, frames[0], sum(w.writes for w in widgets)
+
+
+def serial_main(args) -> int:
+    implementations = [("stty + cat process", False), ("in-process", True)]
+    with tempfile.TemporaryDirectory() as tmp:
+        source = os.path.join(tmp, 'source.bin')
+        expected = make_source(source, args.megabytes, args.frames_per_line)
+        size = os.path.getsize(source)
+        print(f"Serial throughput: {args.monitors} ptys x {size / 1e6:.1f} MB, {expected} frames each")
+        for name, in_process in implementations:
+            wall, cpu, frames, writes = asyncio.run(run_serial(in_process, args.monitors, source, expected, args))
+            print(f"  {name:18s} {size * args.monitors / 1e6 / wall:7.1f} MB/s {frames / wall:10.0f} frames/s "
+                  f"{writes:8d} widget writes, cpu {cpu:.2f} s"
+                  f"{'' if frames == expected * args.monitors else '  FRAME COUNT MISMATCH'}")
+    print(f"Serial idle: {args.monitors} ptys, {args.idle_seconds:.1f} s without output")
+    for name, in_process in implementations:
+        wall, cpu, _, _ = asyncio.run(run_serial(in_process, args.monitors, "", 0, args))
+        print(f"  {name:18s} {100.0 * cpu / wall:6.1f} % of one core")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__description__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--monitors', type=int, default=8, help="Monitors running at once (default: 8)")
+    parser.add_argument('--megabytes', type=float, default=16.0, help="Source size per monitor (default: 16)")
+    parser.add_argument('--frames-per-line', type=int, default=4,
+                        help="Binary frames after every text line (default: 4)")
+    parser.add_argument('--idle-seconds', type=float, default=3.0, help="Idle test duration (default: 3)")
+    parser.add_argument('--chunk-size', type=int, default=4096, help="Read size (default: 4096)")
+    parser.add_argument('--flush-interval', type=float, default=0.05, help="Widget flush interval (default: 0.05)")
+    parser.add_argument('--serial', action='store_true',
+                        help="Compare the serial port backends on pseudo-terminals instead")
+    args = parser.parse_args()
+    if args.serial:
+        return serial_main(args)
+
+    implementations = [("polling (old)", LegacyPortMonitorProcess), ("awaited (current)", PortMonitorProcess)]
+    with tempfile.TemporaryDirectory() as tmp:
+        source = os.path.join(tmp, 'source.bin')
+        expected = make_source(source, args.megabytes, args.frames_per_line)
+        size = os.path.getsize(source)
+        print(f"Throughput: {args.monitors} monitors x {size / 1e6:.1f} MB, {expected} frames each")
+        for name, cls in implementations:
+            wall, cpu, frames, writes, chars = asyncio.run(
+                run_monitors(cls, [f"cat {source}"] * args.monitors, args.chunk_size, args.flush_interval))
+            total = size * args.monitors
+            print(f"  {name:18s} {total / 1e6 / wall:7.1f} MB/s {frames / wall:10.0f} frames/s "
+                  f"{writes:8d} widget writes, cpu {cpu:.2f} s"
+                  f"{'' if frames == expected * args.monitors else '  FRAME COUNT MISMATCH'}")
+
+    print(f"Idle: {args.monitors} monitors, {args.idle_seconds:.1f} s without output")
+    for name, cls in implementations:
+        wall, cpu, _, _, _ = asyncio.run(
+            run_monitors(cls, [f"sleep {args.idle_seconds}"] * args.monitors, args.chunk_size,
+                         args.flush_interval))
+        print(f"  {name:18s} {100.0 * cpu / wall:6.1f} % of one core")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
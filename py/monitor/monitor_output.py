@@ -0,0 +1,130 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Output side shared by the monitor backends (subprocess and direct serial).
+Received bytes are buffered, decoded by FrameStreamDecoder and written to
+the log widget at a limited rate.
+'''
+
+import asyncio
+from typing import Callable, Optional
+from py.monitor.frame_stream import CanFrame, DroppedFrames, FrameStreamDecoder
+
+
+class MonitorOutput:
+    """
+    Buffered, rate-limited decoding of one monitored byte stream.
+    Received bytes collect in a bytearray and a flush timer (armed by the
+    first unflushed byte) decodes and writes them once per flush_interval,
+    or at once when chunk_size bytes are waiting; an idle port costs nothing.
+    Must be created while the event loop is running.
+    """
+
+    def __init__(
+            self,
+            port_log_widget,
+            chunk_size: int = 4096,
+            flush_interval: float = 0.05,
+            frame_sink: Optional[Callable[[CanFrame], None]] = None,
+            prefix: str = ""
+    ):
+        """
+        Initialize output buffer.
+
+        Args:
+            port_log_widget: Log widget to write output to
+            chunk_size: Buffered bytes that force an immediate flush
+            flush_interval: Minimum interval between writes to widget (seconds)
+            frame_sink: Called with every decoded binary frame (e.g. file capture)
+            prefix: Prefix string for output (e.g., "STDERR: ")
+        """
+        self.port_log_widget = port_log_widget
+        self.chunk_size = chunk_size
+        self.flush_interval = flush_interval
+        self.frame_sink = frame_sink
+        self.prefix = prefix
+        self.decoder = FrameStreamDecoder()
+        self._loop = asyncio.get_running_loop()
+        self._pending = bytearray()
+        self._timer = None
+        self._last_data = self._loop.time()
+
+    def feed(self, data) -> None:
+        """
+        Buffer received bytes (bytes, bytearray or memoryview; copied).
+
+        Args:
+            data: Bytes read from the port
+        """
+        self._pending += data
+        self._last_data = self._loop.time()
+        if len(self._pending) >= self.chunk_size:
+            self._flush()
+        if self._timer is None and (self._pending or self.decoder.holding):
+            self._timer = self._loop.call_later(self.flush_interval, self._on_timer)
+
+    def close(self) -> None:
+        """ Write everything still buffered; call once the stream has ended. """
+        if self._timer is not None:
+            self._timer.cancel()
+            self._timer = None
+        self._flush(release=True)
+
+    def write_text(self, text: str) -> None:
+        """
+        Write text to log widget.
+        Removes carriage return characters for clean output.
+
+        Args:
+            text: Text to write to widget
+        """
+        text = text.replace('\r', '')
+        try:
+            self.port_log_widget.write(text)
+        except Exception as e:
+            print(f"Error writing to widget: {e}")
+
+    def _flush(self, release: bool = False) -> None:
+        text = ""
+        if self._pending:
+            text = items_to_text(self.decoder.feed(bytes(self._pending)), self.frame_sink)
+            self._pending.clear()
+        if release:
+            text += items_to_text(self.decoder.flush(), self.frame_sink)
+        if text:
+            self.write_text(f"{self.prefix}{text}")
+
+    def _on_timer(self) -> None:
+        self._timer = None
+        # Text the decoder holds back (it could start a packet) is
+        # released once the port has been quiet for a whole interval
+        idle = self._loop.time() - self._last_data >= self.flush_interval
+        self._flush(release=idle)
+        if self.decoder.holding:
+            self._timer = self._loop.call_later(self.flush_interval, self._on_timer)
+
+
+def items_to_text(items, frame_sink: Optional[Callable[[CanFrame], None]] = None) -> str:
+    """
+    Turn decoder output into log text; frames also go to the frame sink.
+
+    Args:
+        items: Text chunks, CanFrame and DroppedFrames items from FrameStreamDecoder
+        frame_sink: Called with every CanFrame
+
+    Returns:
+        Text for the log widget
+    """
+    parts = []
+    for item in items:
+        if isinstance(item, str):
+            parts.append(item)
+        elif isinstance(item, CanFrame):
+            if frame_sink:
+                frame_sink(item)
+            parts.append(item.to_text() + "\n")
+        elif isinstance(item, DroppedFrames):
+            parts.append(f"*** {item.count} frames dropped by the device ***\n")
+    return "".join(parts)
@@ -0,0 +1,162 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+In-process serial port monitor (Linux termios).
+The device (/dev/ttyACM*, /dev/ttyUSB*) is opened directly and read from
+the event loop, so no shell, stty or cat process runs per port.
+A pseudo-terminal works the same way and stands in for a board in tests.
+'''
+
+import asyncio
+import errno
+import os
+import termios
+from typing import Callable, Optional
+from py.monitor.frame_stream import CanFrame
+from py.monitor.monitor_output import MonitorOutput
+
+
+class SerialPortMonitor:
+    """
+    Asynchronous reader of one serial device; same interface as PortMonitorProcess.
+    The device is opened non-blocking and registered with loop.add_reader(),
+    so all monitored ports share the one event loop. Every read goes straight
+    into a preallocated buffer (os.readv), MonitorOutput decodes and flushes.
+    """
+
+    def __init__(
+            self,
+            device: str,
+            port_log_widget,
+            baud_rate: int = 115200,
+            chunk_size: int = 4096,
+            flush_interval: float = 0.05,
+            frame_sink: Optional[Callable[[CanFrame], None]] = None
+    ):
+        """
+        Initialize serial monitor.
+
+        Args:
+            device: Device path (e.g. "/dev/ttyACM0" or a pty "/dev/pts/3")
+            port_log_widget: Log widget to write output to
+            baud_rate: Line speed (ignored by USB CDC and pty devices)
+            chunk_size: Bytes to read per operation (larger = faster)
+            flush_interval: Minimum interval between writes to widget (seconds)
+            frame_sink: Called with every decoded binary frame (e.g. file capture)
+        """
+        self.device = device
+        self.port_log_widget = port_log_widget
+        self.baud_rate = baud_rate
+        self.chunk_size = chunk_size
+        self.flush_interval = flush_interval
+        self.frame_sink = frame_sink
+        self.running = False
+        self._buffer = bytearray(chunk_size)
+        self._view = memoryview(self._buffer)
+        self._fd = -1
+        self._saved_attrs = None
+        self._output = None
+        self._done = None
+
+    async def start(self) -> int:
+        """
+        Open the device and stream its output to log widget until it closes.
+
+        Returns:
+            0 when stopped by terminate() or at end of input, 1 on a read error, -1 if the device cannot be opened
+        """
+        loop = asyncio.get_running_loop()
+        self._output = MonitorOutput(self.port_log_widget, self.chunk_size, self.flush_interval, self.frame_sink)
+        try:
+            self._fd = os.open(self.device, os.O_RDONLY | os.O_NOCTTY | os.O_NONBLOCK)
+            self._saved_attrs = self._configure(self._fd)
+        except (OSError, termios.error, ValueError) as e:
+            self._output.write_text(f"Cannot open {self.device}: {e}\n")
+            self._close()
+            return -1
+
+        self._done = loop.create_future()
+        self.running = True
+        loop.add_reader(self._fd, self._on_readable)
+        try:
+            return await self._done
+        finally:
+            self._close()
+
+    async def run_end_wait(self) -> bool:
+        """
+        Start monitoring and wait for completion.
+
+        Returns:
+            True if monitoring ended without error
+        """
+        return_code = await self.start()
+        return return_code == 0
+
+    async def terminate(self) -> None:
+        """ Stop monitoring; start() returns once the device is closed. """
+        if self.running:
+            self._finish(0)
+            await asyncio.sleep(0)
+
+    def _configure(self, fd: int):
+        """
+        Raw 8N1 mode without flow control or echo (as stty raw -echo -ixon -ixoff -crtscts).
+
+        Returns:
+            Previous attributes, restored on close
+        """
+        speed = getattr(termios, f"B{self.baud_rate}", None)
+        if speed is None:
+            raise ValueError(f"unsupported baud rate {self.baud_rate}")
+        saved = termios.tcgetattr(fd)
+        iflag, oflag, cflag, lflag, _, _, cc = termios.tcgetattr(fd)
+        iflag &= ~(termios.IGNBRK | termios.BRKINT | termios.PARMRK | termios.ISTRIP | termios.INLCR |
+                   termios.IGNCR | termios.ICRNL | termios.IXON | termios.IXOFF | termios.IXANY)
+        oflag &= ~termios.OPOST
+        lflag &= ~(termios.ECHO | termios.ECHONL | termios.ICANON | termios.ISIG | termios.IEXTEN)
+        cflag &= ~(termios.CSIZE | termios.PARENB | getattr(termios, 'CRTSCTS', 0))
+        cflag |= termios.CS8 | termios.CREAD | termios.CLOCAL
+        cc[termios.VMIN] = 0
+        cc[termios.VTIME] = 0
+        termios.tcsetattr(fd, termios.TCSANOW, [iflag, oflag, cflag, lflag, speed, speed, cc])
+        return saved
+
+    def _on_readable(self) -> None:
+        try:
+            n = os.readv(self._fd, [self._buffer])
+        except BlockingIOError:
+            return
+        except OSError as e:
+            # EIO: board unplugged (or pty master closed)
+            reason = "device disconnected" if e.errno == errno.EIO else str(e)
+            self._output.write_text(f"\nSerial port {self.device}: {reason}\n")
+            self._finish(1)
+            return
+        if n == 0:
+            self._finish(0)
+            return
+        self._output.feed(self._view[:n])
+
+    def _finish(self, code: int) -> None:
+        self.running = False
+        if self._fd >= 0:
+            asyncio.get_running_loop().remove_reader(self._fd)
+        if self._done is not None and not self._done.done():
+            self._done.set_result(code)
+
+    def _close(self) -> None:
+        self.running = False
+        if self._fd >= 0:
+            asyncio.get_running_loop().remove_reader(self._fd)
+            if self._saved_attrs is not None:
+                try:
+                    termios.tcsetattr(self._fd, termios.TCSANOW, self._saved_attrs)
+                except termios.error:
+                    pass
+            os.close(self._fd)
+            self._fd = -1
+        if self._output is not None:
+            self._output.close()
@@ -3,15 +3,24 @@
 __author__ = "Ivo Marvan"
 __email__ = "ivo@marvan.cz"
 __description__ = '''
-Shell-based monitor logic using ShellCommandProcess.
-Manages monitor processes for each port with serial port streaming.
-Supports both real serial ports and fake monitoring for testing.
+Monitor logic for the serial ports of the boards.
+Real serial ports are read in-process (SerialPortMonitor); fake ports used
+for testing run the fake monitor script as a subprocess (PortMonitorProcess).
+Binary frame packets of the can_dispatch stream are decoded on the fly and
+can be captured to a file per port (frame_capture.py) or to an indexed
+frame store (frame_store.py).
 '''
 
 import os
 import asyncio
-from typing import Dict
+import time
+from typing import Callable, Dict, Optional, Union
 from py.shell_commands import ShellCommandConfig
+from py.monitor.frame_capture import CAPTURE_FORMATS, FrameCaptureWriter
+from py.monitor.frame_store import STORE_EXTENSION, STORE_FORMAT, FrameStoreWriter
+from py.monitor.frame_stream import CanFrame
+from py.monitor.monitor_output import MonitorOutput
+from py.monitor.serial_port_monitor import SerialPortMonitor
 
 
 class PortMonitorProcess:
@@ -25,9 +34,9 @@ class PortMonitorProcess:
             self,
             config: ShellCommandConfig,
             port_log_widget,
-            read_timeout: float = 0.001,
             chunk_size: int = 4096,
-            flush_interval: float = 0.05
+            flush_interval: float = 0.05,
+            frame_sink: Optional[Callable[[CanFrame], None]] = None
     ):
         """
         Initialize monitor process.
@@ -35,22 +44,19 @@ class PortMonitorProcess:
         Args:
             config: Shell command configuration with monitor command
             port_log_widget: Log widget to write output to
-            read_timeout: Timeout for subprocess read operations (seconds)
             chunk_size: Bytes to read per operation (larger = faster)
             flush_interval: Minimum interval between writes to widget (seconds)
+            frame_sink: Called with every decoded binary frame (e.g. file capture)
         """
         self.config = config
         self.port_log_widget = port_log_widget
         self.process = None
         self.running = False
-        self.read_timeout = read_timeout
         self.chunk_size = chunk_size
         self.flush_interval = flush_interval
-        self.stdout_buffer = ""
-        self.stderr_buffer = ""
         self.stdout_task = None
         self.stderr_task = None
-        self.last_flush_time = 0.0
+        self.frame_sink = frame_sink
         
     async def start(self) -> int:
         """
@@ -81,59 +87,24 @@ class PortMonitorProcess:
     async def _stream_output(self, stream, prefix: str = ""):
         """
         Stream subprocess output to log widget with optimized buffering.
-        Reads larger chunks and flushes periodically for better performance.
+        Reads are plain awaits, so an idle port costs nothing; MonitorOutput
+        buffers, decodes and flushes the data.
         
         Args:
             stream: Asyncio stream to read from (stdout or stderr)
             prefix: Prefix string for output lines (e.g., "STDERR: ")
         """
+        output = MonitorOutput(self.port_log_widget, self.chunk_size, self.flush_interval, self.frame_sink, prefix)
         try:
-            buffer = ""
-            last_flush = asyncio.get_event_loop().time()
-            
             while self.running:
-                try:
-                    data = await asyncio.wait_for(
-                        stream.read(self.chunk_size), 
-                        timeout=self.read_timeout
-                    )
-                    if not data:
-                        break
-                    
-                    chunk = data.decode('utf-8', errors='replace')
-                    buffer += chunk
-                    
-                    current_time = asyncio.get_event_loop().time()
-                    time_since_flush = current_time - last_flush
-                    
-                    should_flush = (
-                        '\n' in chunk or
-                        len(buffer) >= self.chunk_size or
-                        time_since_flush >= self.flush_interval
-                    )
-                    
-                    if should_flush and buffer:
-                        self._write_to_textarea(f"{prefix}{buffer}")
-                        buffer = ""
-                        last_flush = current_time
-                        
-                except asyncio.TimeoutError:
-                    if buffer:
-                        current_time = asyncio.get_event_loop().time()
-                        if current_time - last_flush >= self.flush_interval:
-                            self._write_to_textarea(f"{prefix}{buffer}")
-                            buffer = ""
-                            last_flush = current_time
-                    continue
-                except Exception as e:
-                    self._write_to_textarea(f"Stream error: {e}\n")
+                data = await stream.read(self.chunk_size)
+                if not data:
                     break
-                    
-            if buffer:
-                self._write_to_textarea(f"{prefix}{buffer}")
-                    
+                output.feed(data)
         except Exception as e:
             self._write_to_textarea(f"Stream error: {e}\n")
+        finally:
+            output.close()
     
     def _write_to_textarea(self, text: str) -> None:
         """
@@ -187,41 +158,53 @@ class PortMonitorProcess:
 
 class ShellMonitorLogic:
     """
-    Manager for multiple serial port monitor processes.
-    Handles starting, stopping, and tracking monitor subprocesses.
+    Manager for multiple serial port monitors.
+    Handles starting, stopping, and tracking monitors; all of them run on the GUI event loop.
     Supports both real serial ports (/dev/ttyACM*, /dev/ttyUSB*) and fake ports for testing.
     """
     BAUD_RATE = 115200
-    PORT_PARAMS = 'raw -echo -ixon -ixoff -crtscts'
 
     
     def __init__(
         self, 
         idf_setup_path: str = "~/esp/v5.4.1/esp-idf/export.sh",
-        read_timeout: float = 0.001,
         chunk_size: int = 4096,
-        flush_interval: float = 0.05
+        flush_interval: float = 0.05,
+        capture_dir: Optional[str] = None,
+        capture_format: str = "candump",
+        capture_rotate_mb: float = 0,
+        capture_compress: bool = False,
+        baud_rate: int = BAUD_RATE
     ):
         """
         Initialize monitor logic manager.
         
         Args:
             idf_setup_path: Path to ESP-IDF environment setup script
-            read_timeout: Subprocess read timeout in seconds
             chunk_size: Bytes to read per operation (larger = faster throughput)
             flush_interval: Minimum interval between writes to widget (seconds)
+            capture_dir: Directory for frame captures of every monitored port (None = no capture)
+            capture_format: Capture file format (candump, asc, blf, pcapng) or "store" (indexed .cfs)
+            capture_rotate_mb: Roll over to a new capture file every N MB (0 = one file per session)
+            capture_compress: Compressed capture files (zstd; BLF zlib containers)
+            baud_rate: Line speed of UART consoles (ttyUSB*); must match CONFIG_ESP_CONSOLE_UART_BAUDRATE
         """
         self.idf_setup_path = os.path.expanduser(idf_setup_path)
-        self.read_timeout = read_timeout
         self.chunk_size = chunk_size
         self.flush_interval = flush_interval
-        self.active_monitors: Dict[str, PortMonitorProcess] = {}
+        self.capture_dir = os.path.expanduser(capture_dir) if capture_dir else None
+        self.capture_format = capture_format
+        self.capture_rotate_mb = capture_rotate_mb
+        self.capture_compress = capture_compress
+        self.baud_rate = baud_rate
+        self.active_monitors: Dict[str, Union[PortMonitorProcess, SerialPortMonitor]] = {}
         self.port_loggers: Dict[str, object] = {}
         self.worker_tasks: Dict[str, object] = {}
+        self.captures: Dict[str, Union[FrameCaptureWriter, FrameStoreWriter]] = {}
     
     def start_monitor_for_gui(self, port: str, monitor_log_widget, gui_run_worker_method) -> bool:
         """
-        Start serial port monitoring process.
+        Start serial port monitoring.
         
         Args:
             port: Port identifier (e.g., "ttyACM0" or "Port1" for fake)
@@ -235,21 +218,28 @@ class ShellMonitorLogic:
             return False
             
         self.port_loggers[port] = monitor_log_widget
+        capture = self._create_capture(port, monitor_log_widget)
         if port.startswith("Port"):
-            command = self._create_fake_monitor_command(port)
+            config = ShellCommandConfig(
+                name=f"Monitor {port}",
+                command=self._create_fake_monitor_command(port)
+            )
+            process = PortMonitorProcess(
+                config=config,
+                port_log_widget=monitor_log_widget,
+                chunk_size=self.chunk_size,
+                flush_interval=self.flush_interval,
+                frame_sink=capture
+            )
         else:
-            command = self._create_real_monitor_command(port)
-        config = ShellCommandConfig(
-            name=f"Monitor {port}",
-            command=command
-        )
-        process = PortMonitorProcess(
-            config=config, 
-            port_log_widget=monitor_log_widget,
-            read_timeout=self.read_timeout,
-            chunk_size=self.chunk_size,
-            flush_interval=self.flush_interval
-        )
+            process = SerialPortMonitor(
+                device=f"/dev/{port}",
+                port_log_widget=monitor_log_widget,
+                baud_rate=self.baud_rate,
+                chunk_size=self.chunk_size,
+                flush_interval=self.flush_interval,
+                frame_sink=capture
+            )
         
         self.active_monitors[port] = process
         worker = gui_run_worker_method(
@@ -317,6 +307,7 @@ class ShellMonitorLogic:
     def _create_fake_monitor_command(self, port: str) -> str:
         """
         Create command for fake monitor script.
+        With capture on, the script sends its CAN messages as binary frames.
         
         Args:
             port: Fake port identifier (e.g., "Port1")
@@ -325,21 +316,58 @@ class ShellMonitorLogic:
             Shell command string
         """
         script_path = os.path.join(os.path.dirname(__file__), 'fake_monitor_script.py')
-        return f"python3 {script_path} {port}"
-        
-    def _create_real_monitor_command(self, port: str) -> str:
+        binary = " --binary" if self.capture_dir else ""
+        return f"python3 {script_path} {port}{binary}"
+
+    def _create_capture(self, port: str, port_logger) -> Optional[Union[FrameCaptureWriter, FrameStoreWriter]]:
         """
-        Create command for real serial port monitoring.
-        Uses stty for port configuration and cat for reading.
-        
+        Open the frame capture file of a port (capture_dir/<port>-<date>-<time>.<ext>).
+
         Args:
-            port: Serial port name (e.g., "ttyACM0")
-            
+            port: Port identifier
+            port_logger: Log widget for errors
+
         Returns:
-            Shell command string
+            Capture writer, or None when capture is off or the file cannot be created
+        """
+        if not self.capture_dir:
+            return None
+        store = self.capture_format == STORE_FORMAT
+        extension = STORE_EXTENSION if store else CAPTURE_FORMATS[self.capture_format].extension
+        path = os.path.join(self.capture_dir, f"{port}-{time.strftime('%Y%m%d-%H%M%S')}{extension}")
+        try:
+            os.makedirs(self.capture_dir, exist_ok=True)
+            if store:
+                capture = FrameStoreWriter(path)
+            else:
+                capture = FrameCaptureWriter(path, self.capture_format, flush_interval=1.0,
+                                             rotate_mb=self.capture_rotate_mb, compress=self.capture_compress)
+        except (ValueError, ImportError, OSError) as e:
+            port_logger.write(f"Frame capture of port {port} disabled: {e} ❌\n")
+            return None
+        self.captures[port] = capture
+        return capture
+
+    def _close_capture(self, port: str, port_logger) -> None:
         """
-        return f'stty -F /dev/{port} {self.BAUD_RATE} {self.PORT_PARAMS} && cat /dev/{port}'
+        Close the capture file of a port and report what was written.
 
+        Args:
+            port: Port identifier
+            port_logger: Log widget for the summary (may be None)
+        """
+        capture = self.captures.pop(port, None)
+        if capture is None:
+            return
+        try:
+            capture.close()
+        except OSError as e:
+            if port_logger:
+                port_logger.write(f"Frame capture of port {port} failed: {e} ❌\n")
+            return
+        if port_logger:
+            port_logger.write(f"--- {capture.frames} frames captured to {', '.join(capture.files)} ---\n")
+        
     async def run_monitor_with_cleanup(self, port: str) -> bool:
         """
         Run monitor process with automatic cleanup on completion.
@@ -359,6 +387,8 @@ class ShellMonitorLogic:
         
         try:
             port_logger.write(f"--- Monitor on port {port} starts 🚀 ---\n")
+            if port in self.captures:
+                port_logger.write(f"--- Capturing frames to {self.captures[port].files[0]} ---\n")
             success = await process.run_end_wait()
             if port in self.active_monitors:
                 del self.active_monitors[port]
@@ -382,3 +412,7 @@ class ShellMonitorLogic:
                 del self.port_loggers[port]
                 
             return False
+
+        finally:
+            # Also when the worker is cancelled: the file must get its footer
+            self._close_capture(port, port_logger)
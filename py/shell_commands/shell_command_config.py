@@ -13,13 +13,15 @@ class ShellCommandConfig:
     Configuration container for shell command execution.
     Simple dataclass holding command name and command string.
     """
-    def __init__(self, name: str, command: str):
+    def __init__(self, name: str, command: str, timeout: float = 300):
         """
         Initialize shell command configuration.
         
         Args:
             name: Human-readable command name for logging
             command: Shell command string to execute
+            timeout: Seconds before the process is terminated
         """
         self.name = name or command
         self.command = command
+        self.timeout = timeout
@@ -11,8 +11,11 @@ from typing import Callable, Any
 import asyncio
 import logging
 import re
+from py.log.rich_log_extended import RichLogExtended
 from py.shell_commands.shell_command_config import ShellCommandConfig
 
+_ANSI_PATTERN = re.compile(r'\x1b\[[0-9;]*[mK]')
+
 
 class ShellCommandProcess:
     """
@@ -59,7 +62,7 @@ class ShellCommandProcess:
                     self._read_stream(self.process.stdout, self.stdout_lines),
                     self._read_stream(self.process.stderr, self.stderr_lines)
                 ),
-                timeout=300
+                timeout=self.config.timeout
             )
             
             self.running = False
@@ -67,7 +70,7 @@ class ShellCommandProcess:
             return self.process.returncode or 0
             
         except asyncio.TimeoutError:
-            self.logger.error("Process execution timed out after 5 minutes")
+            self.logger.error(f"Process execution timed out after {self.config.timeout:.0f} s")
             self.terminate()
             return -1
         except Exception as e:
@@ -120,6 +123,8 @@ class ShellCommandProcess:
         """
         Read stream lines asynchronously and log them.
         Respects pause flag and converts ANSI codes to Rich markup.
+        Each line is logged at its own level (ESP-IDF prefix or error words),
+        so the log widget does not have to classify it again.
         
         Args:
             stream: Subprocess output stream (stdout or stderr)
@@ -136,11 +141,12 @@ class ShellCommandProcess:
             decoded_line = line.decode("utf-8").strip()
             output_list.append(decoded_line)
             
+            level = RichLogExtended.classify(_ANSI_PATTERN.sub('', decoded_line))
             rich_line = self._convert_ansi_to_rich_markup(decoded_line)
             try:
-                self.logger.info(rich_line)
+                self.logger.log(level, rich_line)
             except MarkupError as e:
-                self.logger.info(decoded_line)
+                self.logger.log(level, decoded_line)
 
     def pause_output(self) -> None:
         """Pause output streaming (output continues to be captured)."""
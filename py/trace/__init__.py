@@ -0,0 +1,6 @@
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Host tools for the binary event trace of components/can_dispatch/can_dispatch_trace.h.
+'''
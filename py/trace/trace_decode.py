@@ -0,0 +1,276 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+__author__ = "Ivo Marvan"
+__email__ = "ivo@marvan.cz"
+__description__ = '''
+Converts a can_trace_dump() capture to Chrome trace JSON (Perfetto, chrome://tracing).
+
+The input is any serial log containing the "CANTRACE BEGIN" ... "CANTRACE END"
+block printed by the firmware; other lines are ignored and the last complete
+block wins. Each core becomes one thread of the trace: SPI transactions are
+slices, ISR entries and frame events are instants, queue fill levels are
+counters.
+
+Event times are 32-bit cycle counts, which wrap every 2^32 cycles (17.9 s at
+240 MHz). A step back of less than 1 ms is taken as an ISR recording out of
+order, any other step as forward time. Idle gaps spanning whole wraps are
+invisible in the counter; the esp_timer time of SYNC events
+(can_trace_sync(), also recorded by can_trace_start() and can_trace_dump())
+restores them, so sync periodically when traces span long idle periods.
+
+Example:
+    python -m py.trace.trace_decode monitor.log -o can_trace.json
+'''
+import argparse
+import base64
+import json
+import struct
+import sys
+
+_HEADER = struct.Struct('<IBBHII')
+_EVENT = struct.Struct('<IBBHI')
+_MAGIC = 0x43525443
+_VERSION = 1
+_WRAP = 1 << 32
+_REORDER_LIMIT_S = 1e-3     # largest backward step taken as out-of-order recording
+
+# Mirrors can_trace_type_t
+SYNC, ISR, SPI_BEGIN, SPI_END, RX_READ, QUEUE_PUSH, QUEUE_POP, QUEUE_FULL, TX_LOAD, TX_DONE, USER = range(11)
+_INSTANT_NAMES = {
+    ISR: 'ISR',
+    RX_READ: 'RX read',
+    QUEUE_FULL: 'queue full',
+    TX_LOAD: 'TX load',
+    TX_DONE: 'TX done',
+    USER: 'user',
+}
+
+
+def spi_instruction_name(instr):
+    """ Name of an MCP2515 SPI instruction byte. """
+    if instr == 0xC0:
+        return 'RESET'
+    if instr == 0x03:
+        return 'READ'
+    if instr & 0xF9 == 0x90:
+        return 'READ RX%d' % ((instr >> 2) & 1)
+    if instr == 0x02:
+        return 'WRITE'
+    if instr & 0xF8 == 0x40:
+        return 'LOAD TX%d' % ((instr >> 1) & 3)
+    if instr & 0xF8 == 0x80:
+        return 'RTS %d' % (instr & 7)
+    if instr == 0xA0:
+        return 'READ STATUS'
+    if instr == 0xB0:
+        return 'RX STATUS'
+    if instr == 0x05:
+        return 'BIT MODIFY'
+    return '0x%02X' % instr
+
+
+def queue_name(queue):
+    """ Name of a CAN_TRACE_Q_* identifier. """
+    if queue == 0x00:
+        return 'mcp2515 rx fifo'
+    if 0x10 <= queue < 0x20:
+        return 'multi rx dev%d' % (queue - 0x10)
+    if 0x20 <= queue < 0x30:
+        return 'gateway tx port%d' % (queue - 0x20)
+    return 'queue 0x%02X' % queue
+
+
+def frame_id(arg):
+    return ('0x%08X' if arg & 0x80000000 else '0x%03X') % (arg & 0x1FFFFFFF)
+
+
+def extract_dump(lines):
+    """
+    Returns the binary payload of the last complete dump block in lines.
+
+    Raises:
+        ValueError: no complete block or a length mismatch
+    """
+    dump = None
+    chunks = None
+    for line in lines:
+        pos = line.find('CANTRACE ')
+        if pos < 0:
+            continue
+        body = line[pos + len('CANTRACE '):].strip()
+        if body == 'BEGIN':
+            chunks = []
+        elif body.startswith('END'):
+            if chunks is None:
+                continue
+            data = b''.join(chunks)
+            expected = int(body.split()[1])
+            if len(data) != expected:
+                raise ValueError("dump has %d bytes, firmware sent %d (lost lines?)" % (len(data), expected))
+            dump = data
+            chunks = None
+        elif chunks is not None:
+            chunks.append(base64.b64decode(body))
+    if dump is None:
+        raise ValueError("no complete CANTRACE block found")
+    return dump
+
+
+def unwrap_cycles(raw, cpu_hz):
+    """
+    Extends 32-bit cycle stamps of one core (recording order) to a monotonic
+    64-bit time line, except for small steps back caused by ISRs that record
+    between a task's slot reservation and its timestamp.
+
+    Returns:
+        List of 64-bit cycle counts
+    """
+    limit = int(cpu_hz * _REORDER_LIMIT_S)
+    out = []
+    for cycles in raw:
+        if not out:
+            out.append(cycles)
+            continue
+        delta = (cycles - out[-1]) & (_WRAP - 1)
+        out.append(out[-1] + (delta - _WRAP if delta > _WRAP - limit else delta))
+    return out
+
+
+def anchor_wraps(cycles64, events, cpu_hz):
+    """
+    Adds counter wraps the cycle deltas cannot show, using the esp_timer time
+    of consecutive SYNC events. A missing wrap is placed in the longest gap
+    between the two SYNCs, where the core was idle.
+
+    Args:
+        cycles64: unwrap_cycles() result, corrected in place
+        events: Matching (type, arg) pairs
+    """
+    mhz = cpu_hz / 1e6
+    syncs = [k for k, (etype, _) in enumerate(events) if etype == SYNC]
+    for a, b in zip(syncs, syncs[1:]):
+        timer_us = (events[b][1] - events[a][1]) & (_WRAP - 1)
+        wraps = round((timer_us * mhz - (cycles64[b] - cycles64[a])) / _WRAP)
+        if wraps <= 0:
+            continue
+        gap = max(range(a + 1, b + 1), key=lambda k: cycles64[k] - cycles64[k - 1])
+        for k in range(gap, len(cycles64)):
+            cycles64[k] += wraps * _WRAP
+
+
+def parse_dump(data):
+    """
+    Splits a dump into header fields and per-core event lists in recording order.
+
+    Returns:
+        (cpu_hz, [[(cycles64, type, aux, len, arg), ...] per core])
+    """
+    magic, version, cores, event_size, depth, cpu_hz = _HEADER.unpack_from(data, 0)
+    if magic != _MAGIC or version != _VERSION or event_size != _EVENT.size:
+        raise ValueError("not a CANTRACE v%d dump" % _VERSION)
+    off = _HEADER.size
+    per_core = []
+    for _ in range(cores):
+        (head,) = struct.unpack_from('<I', data, off)
+        off += 4
+        ring = data[off:off + depth * event_size]
+        off += depth * event_size
+        count = min(head, depth)
+        raw = [_EVENT.unpack_from(ring, (k % depth) * event_size) for k in range(head - count, head)]
+        cycles64 = unwrap_cycles([r[0] for r in raw], cpu_hz)
+        anchor_wraps(cycles64, [(r[1], r[4]) for r in raw], cpu_hz)
+        per_core.append([(c,) + r[1:] for c, r in zip(cycles64, raw)])
+    return cpu_hz, per_core
+
+
+def core_offsets_us(cpu_hz, per_core):
+    """
+    Offset added to cycles / MHz of each core so that all cores share the
+    esp_timer time base of their first SYNC event. Cores without SYNC borrow
+    the offset of another core (counters assumed aligned).
+    """
+    mhz = cpu_hz / 1e6
+    offsets = [None] * len(per_core)
+    for core, events in enumerate(per_core):
+        for cycles, etype, _, _, arg in events:
+            if etype == SYNC:
+                offsets[core] = arg - cycles / mhz
+                break
+    known = [o for o in offsets if o is not None]
+    fallback = known[0] if known else 0.0
+    return [fallback if o is None else o for o in offsets]
+
+
+def to_chrome(cpu_hz, per_core):
+    """ Builds the Chrome trace event list. """
+    mhz = cpu_hz / 1e6
+    offsets = core_offsets_us(cpu_hz, per_core)
+    start = min((events[0][0] / mhz + offsets[core] for core, events in enumerate(per_core) if events), default=0.0)
+    out = []
+    for core, events in enumerate(per_core):
+        out.append({'ph': 'M', 'pid': 0, 'tid': core, 'name': 'thread_name', 'args': {'name': 'core %d' % core}})
+        spi_open = None
+        for cycles, etype, aux, length, arg in events:
+            ts = cycles / mhz + offsets[core] - start
+            base = {'pid': 0, 'tid': core, 'ts': round(ts, 3)}
+            if etype == SPI_BEGIN:
+                spi_open = (ts, aux, length)
+            elif etype == SPI_END:
+                # A transaction cut off at the ring start has no BEGIN
+                if spi_open is not None and spi_open[1] == aux:
+                    out.append(dict(base, ph='X', ts=round(spi_open[0], 3), dur=round(ts - spi_open[0], 3),
+                                    name='SPI ' + spi_instruction_name(aux),
+                                    args={'bytes': length, 'ok': bool(arg)}))
+                spi_open = None
+            elif etype in (QUEUE_PUSH, QUEUE_POP):
+                name = queue_name(aux)
+                out.append(dict(base, ph='C', name=name, args={'fill': length}))
+                out.append(dict(base, ph='i', s='t', name=('push ' if etype == QUEUE_PUSH else 'pop ') + name,
+                                args={'id': frame_id(arg)}))
+            elif etype == SYNC:
+                out.append(dict(base, ph='i', s='t', name='sync', args={'esp_timer_us': arg}))
+            elif etype == ISR:
+                out.append(dict(base, ph='i', s='t', name='ISR dev%d' % aux))
+            elif etype in _INSTANT_NAMES:
+                args = {'aux': aux, 'len': length}
+                if etype != USER:
+                    args['id'] = frame_id(arg)
+                    if etype == QUEUE_FULL:
+                        args['queue'] = queue_name(aux)
+                else:
+                    args['arg'] = arg
+                out.append(dict(base, ph='i', s='t', name=_INSTANT_NAMES[etype], args=args))
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__description__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('log', nargs='?', help="Captured serial log (default: stdin)")
+    parser.add_argument('-o', '--output', default='can_trace.json', help="Output JSON (default: can_trace.json)")
+    args = parser.parse_args()
+
+    if args.log:
+        with open(args.log, 'r', errors='replace') as f:
+            lines = f.readlines()
+    else:
+        lines = sys.stdin.readlines()
+    try:
+        cpu_hz, per_core = parse_dump(extract_dump(lines))
+    except ValueError as e:
+        print("Error: %s" % e, file=sys.stderr)
+        return 1
+
+    events = to_chrome(cpu_hz, per_core)
+    with open(args.output, 'w') as f:
+        json.dump({'traceEvents': events, 'displayTimeUnit': 'ns'}, f)
+    for core, core_events in enumerate(per_core):
+        if core_events:
+            span_us = (core_events[-1][0] - core_events[0][0]) / (cpu_hz / 1e6)
+            print("core %d: %d events over %.1f us" % (core, len(core_events), span_us))
+    print("Wrote %s (%d trace events, CPU %d MHz)" % (args.output, len(events), cpu_hz // 1000000))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -6,15 +6,23 @@ __description__ = '''
 Test compilation script for all valid Kconfig combinations.
 Tests all meaningful library/example combinations from Kconfig.projbuild
 by creating workspaces, configuring sdkconfig, and compiling with ESP-IDF.
+Combinations build concurrently (each in its own workspace) and share one
+CPU/memory job budget; console lines are prefixed with the combination
+number, the summary keeps the matrix order.
+All workspaces compile through one shared ccache. The base configuration
+(the selection in ./sdkconfig) builds first on its own to warm the cache, the
+summary reports the cache hits of the warm-up and of the matrix.
 Generates comprehensive compilation statistics.
 '''
 
 import argparse
 import asyncio
+import multiprocessing
 import os
 import sys
 import time
 import logging
+import psutil
 from datetime import datetime
 from typing import List, Tuple, Dict
 import traceback
@@ -56,30 +64,41 @@ test_logger = None
 
 
 class SimpleStreamLogger:
-    """Simple logger wrapper for ShellCommandProcess that outputs to console."""
-    def __init__(self, logger):
+    """
+    Simple logger wrapper for ShellCommandProcess that outputs to console.
+    The prefix tells apart the lines of builds running at the same time.
+    """
+    def __init__(self, logger, prefix: str = ""):
         self._logger = logger
+        self._prefix = prefix
         
     def info(self, message):
         """Log info message to console."""
         # Strip Rich markup tags if present
         import re
         clean_msg = re.sub(r'\[/?[a-z\s]+\]', '', message)
-        self._logger.info(clean_msg)
+        self._logger.info(self._prefix + clean_msg)
+        sys.stdout.flush()
+        
+    def warning(self, message):
+        """Log warning message to console."""
+        import re
+        clean_msg = re.sub(r'\[/?[a-z\s]+\]', '', message)
+        self._logger.warning(self._prefix + clean_msg)
         sys.stdout.flush()
         
     def error(self, message):
         """Log error message to console."""
         import re
         clean_msg = re.sub(r'\[/?[a-z\s]+\]', '', message)
-        self._logger.error(clean_msg)
+        self._logger.error(self._prefix + clean_msg)
         sys.stdout.flush()
         
     def debug(self, message):
         """Log debug message to console."""
         import re
         clean_msg = re.sub(r'\[/?[a-z\s]+\]', '', message)
-        self._logger.debug(clean_msg)
+        self._logger.debug(self._prefix + clean_msg)
         sys.stdout.flush()
 
 
@@ -91,7 +110,9 @@ class CompilationResult:
         self.example_id = example_id
         self.example_name = example_name
         self.success = False
+        self.skipped = False
         self.duration = 0.0
+        self.jobs = 0
         self.error_message = ""
         self.workspace_path = ""
         self.log_file = ""
@@ -101,7 +122,10 @@ class CompilationTester:
     """
     Automated compilation tester for all valid Kconfig combinations.
     Manages workspace creation, compilation, and result logging.
+    Up to `parallel` builds run at once, each with its share of the job budget.
     """
+    MIN_JOBS_PER_BUILD = 4          # below this a build spends most of its time in serial steps
+    MEMORY_PER_BUILD_GB = 1.5       # peak of one idf.py build (compiler processes + linker)
 
     def __init__(
             self,
@@ -110,6 +134,10 @@ class CompilationTester:
             sdkconfig_path: str = "./sdkconfig",
             menu_name: str = "*** CAN bus examples  ***",
             fail_fast: bool = False,
+            parallel: int = 0,
+            build_timeout: float = 3600,
+            use_ccache: bool = True,
+            prewarm: bool = True,
     ):
         """
         Initialize compilation tester.
@@ -120,19 +148,32 @@ class CompilationTester:
             sdkconfig_path: Path to sdkconfig file
             menu_name: Menu name in Kconfig to parse
             fail_fast: Stop at first compilation failure
+            parallel: Builds running at once (0 = from the job budget)
+            build_timeout: Seconds one build may take
+            use_ccache: Compile through the compiler cache shared by all workspaces
+            prewarm: Build the base configuration alone before the matrix
         """
         self.idf_setup_path = os.path.expanduser(idf_setup_path)
         self.kconfig_path = kconfig_path
         self.sdkconfig_path = sdkconfig_path
         self.menu_name = menu_name
         self.fail_fast = fail_fast
+        self.parallel = parallel
+        self.build_timeout = build_timeout
+        self.prewarm = prewarm and use_ccache
+        self.wall_time = 0.0
+        self.ccache_warm_stats = None
+        self.ccache_stats = None
+        self.project_inputs = None
+        self._stop = False
         
         # Initialize FlashApp to reuse its logic
         self.flash_app = FlashApp(
             idf_setup_path=idf_setup_path,
             kconfig_path=kconfig_path,
             sdkconfig_path=sdkconfig_path,
-            menu_name=menu_name
+            menu_name=menu_name,
+            use_ccache=use_ccache
         )
         
         self.results: List[CompilationResult] = []
@@ -166,19 +207,70 @@ class CompilationTester:
         
         return valid_combinations
 
+    def find_base_combination(self, combinations: List[Tuple[ConfigOption, ConfigOption]]) -> int:
+        """
+        Index of the combination selected in the base sdkconfig.
+        Must be called before the first workspace switch replaces flash_app.sdkconfig.
+        
+        Args:
+            combinations: Valid combinations
+            
+        Returns:
+            Index into combinations (0 if the base selection is not among them)
+        """
+        def enabled(config_id: str) -> bool:
+            line = self.flash_app.sdkconfig.get_line_by_key(config_id)
+            return line is not None and line.value == 'y'
+        
+        for idx, (lib_option, example_option) in enumerate(combinations):
+            if enabled(lib_option.id) and enabled(example_option.id):
+                return idx
+        return 0
+
+    def plan_parallel_builds(self, count: int) -> Tuple[int, int]:
+        """
+        Split the machine's job budget between concurrent builds.
+        The budget follows FlashApp.get_optimal_jobs() without its per-build cap;
+        concurrency is limited by jobs per build and by available memory.
+        
+        Args:
+            count: Number of combinations to build
+            
+        Returns:
+            Tuple (concurrent builds, jobs per build)
+        """
+        budget = FlashApp.get_optimal_jobs(max_jobs=multiprocessing.cpu_count())
+        if self.parallel > 0:
+            builds = self.parallel
+        else:
+            available_memory = psutil.virtual_memory().available / (1024**3)
+            builds = min(budget // self.MIN_JOBS_PER_BUILD, int(available_memory // self.MEMORY_PER_BUILD_GB))
+        builds = max(1, min(builds, count))
+        # Same number of waves with the builds spread evenly: more jobs each, no half-empty last wave
+        waves = -(-count // builds)
+        builds = -(-count // waves)
+        jobs = max(1, min(budget // builds, 16))
+        return builds, jobs
+
     async def compile_combination(
             self, 
             lib_option: ConfigOption, 
             example_option: ConfigOption,
-            fullclean: bool = False
+            fullclean: bool = False,
+            jobs: int = 0,
+            tag: str = ""
     ) -> CompilationResult:
         """
         Compile single lib/example combination.
+        Workspace and sdkconfig are prepared before the first await, so
+        concurrent calls do not interfere through the shared FlashApp.
         
         Args:
             lib_option: Library configuration option
             example_option: Example configuration option
-            fullclean: Whether to run fullclean before build
+            fullclean: Force fullclean before build (otherwise FlashApp.should_fullclean() decides)
+            jobs: Parallel compile jobs (0 = FlashApp.get_optimal_jobs())
+            tag: Prefix of the console lines of this build
             
         Returns:
             CompilationResult with test outcome
@@ -189,64 +281,63 @@ class CompilationTester:
             example_id=example_option.id,
             example_name=example_option.display_name
         )
+        log = SimpleStreamLogger(test_logger, tag)
         
         start_time = time.time()
         
         try:
-            test_logger.info(f"\n{'='*80}")
-            test_logger.info(f"Testing: {lib_option.display_name} + {example_option.display_name}")
-            test_logger.info(f"{'='*80}\n")
+            log.info(f"{'='*80}")
+            log.info(f"Testing: {lib_option.display_name} + {example_option.display_name}")
+            log.info(f"{'='*80}")
             
             # Step 1: Switch to workspace
-            test_logger.info(f"Step 1: Creating workspace...")
+            log.info(f"Step 1: Creating workspace...")
             success_workspace = self.flash_app._switch_to_workspace(
                 lib_option.id, 
                 example_option.id
             )
             if not success_workspace:
                 result.error_message = "Failed to create workspace"
-                test_logger.error("❌ Failed to create workspace")
+                log.error("❌ Failed to create workspace")
                 return result
             
-            result.workspace_path = self.flash_app._workspace_path
-            test_logger.info(f"✓ Workspace: {result.workspace_path}")
+            workspace_path = self.flash_app._workspace_path
+            result.workspace_path = workspace_path
+            log.info(f"✓ Workspace: {result.workspace_path}")
             
             # Step 2: Update sdkconfig
-            test_logger.info(f"Step 2: Updating sdkconfig...")
+            log.info(f"Step 2: Updating sdkconfig...")
             success_config = self.flash_app._update_sdkconfig(
                 lib_option.id, 
                 example_option.id
             )
             if not success_config:
                 result.error_message = "Failed to update sdkconfig"
-                test_logger.error("❌ Failed to update sdkconfig")
+                log.error("❌ Failed to update sdkconfig")
                 return result
             
-            test_logger.info(f"✓ sdkconfig updated")
+            log.info(f"✓ sdkconfig updated")
             
             # Step 3: Compile
-            test_logger.info(f"Step 3: Compiling (this may take a while)...")
-            jobs = FlashApp.get_optimal_jobs()
-            test_logger.info(f"Using {jobs} parallel jobs")
+            log.info(f"Step 3: Compiling (this may take a while)...")
+            jobs = jobs or FlashApp.get_optimal_jobs()
+            result.jobs = jobs
+            log.info(f"Using {jobs} parallel jobs")
             
-            # Build command
+            # Inputs are taken before the first await, while flash_app.sdkconfig is this workspace's
+            inputs = self.flash_app.build_inputs(self.project_inputs)
             if fullclean:
-                command = (
-                    f"bash -c 'export MAKEFLAGS=-j{jobs} && "
-                    f"source {self.idf_setup_path} && "
-                    f"cd {self.flash_app._workspace_path} && "
-                    f"idf.py fullclean && idf.py build'"
-                )
+                clean_reason = "requested (--fullclean)"
             else:
-                command = (
-                    f"bash -c 'export MAKEFLAGS=-j{jobs} && "
-                    f"source {self.idf_setup_path} && "
-                    f"cd {self.flash_app._workspace_path} && "
-                    f"idf.py build'"
-                )
+                fullclean, clean_reason = self.flash_app.should_fullclean(workspace_path, inputs)
+            if fullclean:
+                log.warning(f"Full clean build: {clean_reason}")
+            else:
+                log.info(f"Incremental build: {clean_reason}")
+            command = self.flash_app.build_command(workspace_path, jobs, fullclean)
             
             # Create log file path
-            log_dir = os.path.join(self.flash_app._workspace_path, "test_logs")
+            log_dir = os.path.join(workspace_path, "test_logs")
             os.makedirs(log_dir, exist_ok=True)
             timestamp = datetime.now().strftime("%Y%m%d_%H%M%S")
             log_file = os.path.join(log_dir, f"build_{timestamp}.log")
@@ -255,19 +346,22 @@ class CompilationTester:
             # Execute compilation
             config = ShellCommandConfig(
                 name=f"Compile {lib_option.display_name} + {example_option.display_name}",
-                command=command
+                command=command,
+                timeout=self.build_timeout
             )
             
             # Use simple logger for process output
-            simple_logger = SimpleStreamLogger(test_logger)
-            process = ShellCommandProcess(config=config, logger=simple_logger)
+            process = ShellCommandProcess(config=config, logger=log)
             success_compile = await process.run_end_wait()
+            if success_compile:
+                self.flash_app.save_build_inputs(workspace_path, inputs)
             
             # Save logs to file
             with open(log_file, 'w') as f:
                 f.write(f"Compilation test: {lib_option.display_name} + {example_option.display_name}\n")
                 f.write(f"Timestamp: {timestamp}\n")
                 f.write(f"Command: {command}\n")
+                f.write(f"{'Full clean' if fullclean else 'Incremental'} build: {clean_reason}\n")
                 f.write(f"{'='*80}\n\n")
                 f.write("=== STDOUT ===\n")
                 for line in process.stdout_lines:
@@ -280,29 +374,30 @@ class CompilationTester:
             
             result.success = success_compile
             if success_compile:
-                test_logger.info(f"✅ Compilation SUCCESSFUL")
+                log.info(f"✅ Compilation SUCCESSFUL")
             else:
                 result.error_message = "Compilation failed (see log file)"
-                test_logger.error(f"❌ Compilation FAILED")
-                test_logger.error(f"   Log file: {log_file}")
+                log.error(f"❌ Compilation FAILED")
+                log.error(f"   Log file: {log_file}")
             
         except Exception as e:
             result.error_message = f"Exception: {str(e)}"
-            test_logger.error(f"❌ Exception during compilation: {e}")
-            test_logger.error(traceback.format_exc())
+            log.error(f"❌ Exception during compilation: {e}")
+            log.error(traceback.format_exc())
         
         finally:
             result.duration = time.time() - start_time
-            test_logger.info(f"Duration: {result.duration:.1f}s")
+            log.info(f"Duration: {result.duration:.1f}s")
         
         return result
 
     async def run_all_tests(self, fullclean: bool = False) -> None:
         """
         Run compilation tests for all valid combinations.
+        Builds run concurrently within the job budget; results keep the matrix order.
         
         Args:
-            fullclean: Whether to run fullclean before each build
+            fullclean: Force fullclean before each build
         """
         test_logger.info("=" * 80)
         test_logger.info("Starting compilation tests for all valid configurations")
@@ -315,26 +410,73 @@ class CompilationTester:
             test_logger.error("No valid combinations found!")
             return
         
+        base = self.find_base_combination(combinations) if self.prewarm and len(combinations) > 1 else None
+        builds, jobs = self.plan_parallel_builds(len(combinations) - (base is not None))
         test_logger.info(f"\nFound {len(combinations)} valid combinations to test")
+        test_logger.info(f"Running {builds} build(s) at once with {jobs} jobs each "
+                         f"({multiprocessing.cpu_count()} CPUs)")
         if self.fail_fast:
             test_logger.info("Fail-fast mode: will stop at first failure\n")
         else:
             test_logger.info("")
         
-        # Test each combination
-        for idx, (lib_option, example_option) in enumerate(combinations, 1):
-            test_logger.info(f"\n[{idx}/{len(combinations)}] Testing combination...")
-            result = await self.compile_combination(lib_option, example_option, fullclean)
-            self.results.append(result)
-            
-            # Check fail-fast mode
-            if self.fail_fast and not result.success:
-                test_logger.warning(f"\n⚠️  Fail-fast mode: stopping at first failure")
-                break
+        slots = asyncio.Semaphore(builds)
+        width = len(str(len(combinations)))
+        warm_result = None
+        
+        async def run_one(idx: int, lib_option: ConfigOption, example_option: ConfigOption) -> CompilationResult:
+            if base is not None and idx == base + 1:
+                return warm_result
+            async with slots:
+                if self._stop:
+                    result = CompilationResult(lib_option.id, lib_option.display_name,
+                                               example_option.id, example_option.display_name)
+                    result.skipped = True
+                    result.error_message = "Skipped (fail-fast)"
+                    return result
+                tag = f"[{idx:{width}d}/{len(combinations)}] "
+                result = await self.compile_combination(lib_option, example_option, fullclean, jobs, tag)
+                if self.fail_fast and not result.success and not self._stop:
+                    self._stop = True
+                    test_logger.warning(f"\n⚠️  Fail-fast mode: no new builds after {tag.strip()}")
+                return result
+        
+        start_time = time.time()
+        # Same for every build of the run; computed once, off the event loop
+        self.project_inputs = await asyncio.to_thread(self.flash_app.project_build_inputs)
+        if self.flash_app.use_ccache and not await self.flash_app.ccache_zero_stats():
+            test_logger.warning("⚠️  ccache not found in the ESP-IDF environment, no cache statistics")
+        if base is not None:
+            lib_option, example_option = combinations[base]
+            test_logger.info(f"Pre-warming compiler cache: {lib_option.display_name} + {example_option.display_name}")
+            tag = f"[{base + 1:{width}d}/{len(combinations)}] "
+            warm_result = await self.compile_combination(lib_option, example_option, fullclean,
+                                                          FlashApp.get_optimal_jobs(), tag)
+            self.ccache_warm_stats = await self.flash_app.ccache_stats()
+            if self.fail_fast and not warm_result.success:
+                self._stop = True
+                test_logger.warning(f"\n⚠️  Fail-fast mode: base configuration failed, no matrix builds")
+        self.results = list(await asyncio.gather(
+            *(run_one(idx, lib_option, example_option)
+              for idx, (lib_option, example_option) in enumerate(combinations, 1))
+        ))
+        self.wall_time = time.time() - start_time
+        self.ccache_stats = await self.flash_app.ccache_stats()
         
         # Print summary
         self.print_summary()
 
+    @staticmethod
+    def format_ccache_stats(stats: Dict[str, int]) -> str:
+        """One line of hit/miss counters from FlashApp.ccache_stats()."""
+        direct = stats.get('direct_cache_hit', 0)
+        preprocessed = stats.get('preprocessed_cache_hit', 0)
+        misses = stats.get('cache_miss', 0)
+        hits = direct + preprocessed
+        rate = hits / (hits + misses) * 100 if hits + misses > 0 else 0
+        return (f"{hits} hits ({direct} direct, {preprocessed} preprocessed), "
+                f"{misses} misses, {rate:.1f}% hit rate")
+
     def print_summary(self) -> None:
         """Print comprehensive test results summary."""
         test_logger.info("\n" + "=" * 80)
@@ -343,7 +485,8 @@ class CompilationTester:
         
         # Count successes and failures
         successes = [r for r in self.results if r.success]
-        failures = [r for r in self.results if not r.success]
+        failures = [r for r in self.results if not r.success and not r.skipped]
+        skipped = [r for r in self.results if r.skipped]
         
         # Print successful builds
         if successes:
@@ -352,7 +495,7 @@ class CompilationTester:
             for result in successes:
                 test_logger.info(
                     f"  ✓ {result.lib_name:30s} + {result.example_name:30s} "
-                    f"({result.duration:.1f}s)"
+                    f"({result.duration:.1f}s, {result.jobs} jobs)"
                 )
             test_logger.info("")
         
@@ -369,11 +512,19 @@ class CompilationTester:
                 test_logger.info(f"    Log file: {result.log_file}")
                 test_logger.info("")
         
+        # Print builds not started after a failure
+        if skipped:
+            test_logger.info(f"⏭️  SKIPPED BUILDS ({len(skipped)}):")
+            test_logger.info("-" * 80)
+            for result in skipped:
+                test_logger.info(f"  - {result.lib_name:30s} + {result.example_name:30s}")
+            test_logger.info("")
+        
         # Print statistics
         test_logger.info("=" * 80)
         test_logger.info("STATISTICS:")
         test_logger.info("-" * 80)
-        total = len(self.results)
+        total = len(self.results) - len(skipped)
         success_count = len(successes)
         failure_count = len(failures)
         success_rate = (success_count / total * 100) if total > 0 else 0
@@ -387,10 +538,20 @@ class CompilationTester:
         if total > 0:
             avg_time = total_time / total
             test_logger.info(f"  Average time per build:    {avg_time:.1f}s")
+        if self.wall_time > 0:
+            test_logger.info(f"  Wall clock time:           {self.wall_time:.1f}s ({self.wall_time/60:.1f} min, "
+                             f"{total_time / self.wall_time:.1f}x overlap)")
+        if self.ccache_stats:
+            if self.ccache_warm_stats:
+                matrix = {key: value - self.ccache_warm_stats.get(key, 0) for key, value in self.ccache_stats.items()}
+                test_logger.info(f"  Compiler cache (warm-up):  {self.format_ccache_stats(self.ccache_warm_stats)}")
+                test_logger.info(f"  Compiler cache (matrix):   {self.format_ccache_stats(matrix)}")
+            else:
+                test_logger.info(f"  Compiler cache:            {self.format_ccache_stats(self.ccache_stats)}")
         test_logger.info("=" * 80)
         
         # Final verdict
-        if failure_count == 0:
+        if failure_count == 0 and not skipped:
             test_logger.info("\n🎉 ALL TESTS PASSED! 🎉\n")
         else:
             test_logger.info(f"\n⚠️  {failure_count} TEST(S) FAILED ⚠️\n")
@@ -421,13 +582,34 @@ async def main():
     parser.add_argument(
         '-f', '--fullclean',
         action='store_true',
-        help="Run fullclean before each build"
+        help="Run fullclean before each build even if the build inputs did not change "
+             "(the shared compiler cache is kept)"
     )
     parser.add_argument(
         '-1', '--fail-fast',
         action='store_true',
         help="Stop at first compilation failure"
     )
+    parser.add_argument(
+        '-j', '--parallel',
+        type=int, default=0,
+        help="Builds running at once (default: 0 = from CPU count and memory)"
+    )
+    parser.add_argument(
+        '-t', '--timeout',
+        type=float, default=3600,
+        help="Timeout of one build in seconds (default: 3600)"
+    )
+    parser.add_argument(
+        '--no-ccache',
+        action='store_true',
+        help="Do not use the compiler cache shared by all workspaces"
+    )
+    parser.add_argument(
+        '--no-prewarm',
+        action='store_true',
+        help="Do not build the base configuration alone before the matrix"
+    )
     parser.add_argument(
         '-v', '--verbose',
         action='store_true',
@@ -450,6 +632,10 @@ async def main():
         kconfig_path=args.kconfig,
         sdkconfig_path=args.sdkconfig,
         fail_fast=args.fail_fast,
+        parallel=args.parallel,
+        build_timeout=args.timeout,
+        use_ccache=not args.no_ccache,
+        prewarm=not args.no_prewarm,
     )
 
     # Run all tests